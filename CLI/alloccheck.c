@@ -0,0 +1,61 @@
+/*
+ * alloccheck.c
+ * ---------------------------------------------
+ * Allocation check wrappers (see alloccheck.h).
+ */
+
+#define ALLOCCHECK_IMPLEMENTATION
+#include "alloccheck.h"
+#include <stdlib.h>
+#include <windows.h>
+
+static volatile LONG armed = 0;
+static volatile LONGLONG violations = 0;
+static const char * volatile firstFile = NULL;
+static volatile LONG firstLine = 0;
+
+/* Counts a call made while armed; the first one keeps its location */
+static void Check( const char *file, int line )
+{
+  if( !armed ) return;
+  if( InterlockedIncrement64( &violations ) == 1 ) {
+    firstLine = line;
+    firstFile = file;
+  }
+}
+
+void AllocCheck_Arm( int arm )
+{
+  InterlockedExchange( &armed, arm ? 1 : 0 );
+}
+
+long long AllocCheck_Violations( const char **file, int *line )
+{
+  *file = firstFile ? firstFile : "";
+  *line = (int)firstLine;
+  return (long long)violations;
+}
+
+void *AllocCheck_Malloc( size_t size, const char *file, int line )
+{
+  Check( file, line );
+  return malloc( size );
+}
+
+void *AllocCheck_Calloc( size_t count, size_t size, const char *file, int line )
+{
+  Check( file, line );
+  return calloc( count, size );
+}
+
+void *AllocCheck_Realloc( void *memory, size_t size, const char *file, int line )
+{
+  Check( file, line );
+  return realloc( memory, size );
+}
+
+void AllocCheck_Free( void *memory, const char *file, int line )
+{
+  if( memory ) Check( file, line );
+  free( memory );
+}
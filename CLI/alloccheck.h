@@ -0,0 +1,52 @@
+/*
+ * alloccheck.h
+ * ---------------------------------------------
+ * Allocation check for the --check-allocations test mode of dsi2lsl.
+ *
+ * The library's sources include this header after the C library headers, so
+ * that their malloc, calloc, realloc and free go through the wrappers below.
+ * The wrappers only forward, except while the check is armed: from the start
+ * of data acquisition until it stops, the sample pipeline is meant to run on
+ * the memory DSI2LSL_Open set up, and every call counts as a violation.
+ * Allocations inside liblsl, the DSI API and the host are not seen.
+ *
+ * eegcodec.c does not include it, so that it stays free of dependencies; its
+ * encoder does not allocate.
+ */
+
+#ifndef ALLOCCHECK_H
+#define ALLOCCHECK_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Arms (1) or disarms (0) the check; the state is process-wide. */
+void AllocCheck_Arm( int armed );
+
+/**
+ * @param file - Receives the source file of the first violation, if any
+ * @param line - Receives its line
+ * @return Number of allocations and frees made while armed
+ */
+long long AllocCheck_Violations( const char **file, int *line );
+
+void *AllocCheck_Malloc( size_t size, const char *file, int line );
+void *AllocCheck_Calloc( size_t count, size_t size, const char *file, int line );
+void *AllocCheck_Realloc( void *memory, size_t size, const char *file, int line );
+void AllocCheck_Free( void *memory, const char *file, int line );
+
+#ifndef ALLOCCHECK_IMPLEMENTATION
+#define malloc( size ) AllocCheck_Malloc( ( size ), __FILE__, __LINE__ )
+#define calloc( count, size ) AllocCheck_Calloc( ( count ), ( size ), __FILE__, __LINE__ )
+#define realloc( memory, size ) AllocCheck_Realloc( ( memory ), ( size ), __FILE__, __LINE__ )
+#define free( memory ) AllocCheck_Free( ( memory ), __FILE__, __LINE__ )
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLOCCHECK_H */
@@ -0,0 +1,576 @@
+/*
+ * asr.c
+ * ---------------------------------------------
+ * Online artifact subspace reconstruction (see asr.h).
+ *
+ * Calibration, with X the high-passed calibration data:
+ *   C0  = geometric median of the covariances of BLOCK_SAMPLES-sample blocks
+ *   V0  = eigenvectors of C0, which are also those of the mixing matrix sqrtm(C0)
+ *   tau = per component of V0' X, median + cutoff * 1.4826 * MAD of its RMS in
+ *         ASR_WINDOW_SECONDS windows overlapping by WINDOW_OVERLAP
+ *
+ * Per chunk, with C the running covariance and V, D its eigenvectors and
+ * eigenvalues (ascending), component j is removed if D(j) exceeds the
+ * threshold energy along it, sum_i (tau(i) * V0(:,i)' V(:,j))^2, unless it
+ * is among the smallest numberOfChannels - maxRemoved components. With Vk the
+ * kept eigenvectors the reconstruction matrix is
+ *
+ *   R = sqrtm(C0) * pinv(diag(keep) * V' * sqrtm(C0)) * V'
+ *     = C0 * Vk * inv(Vk' * C0 * Vk) * Vk'
+ *
+ * and the output blends from the previous chunk's R to this one's with a
+ * raised cosine over the chunk. Matrices are row-major doubles.
+ */
+
+#include "asr.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "alloccheck.h"
+
+#define BLOCK_SAMPLES 10              /* Samples per block covariance during calibration */
+#define WINDOW_OVERLAP 0.66           /* Overlap of the RMS windows during calibration */
+#define MAX_REMOVED_FRACTION 0.66     /* At most this share of the components is removed */
+#define MEDIAN_ITERATIONS 100         /* Weiszfeld iterations for the geometric median */
+#define MEDIAN_TOLERANCE 1e-5
+#define EIGEN_SWEEPS 50
+
+static const double PI = 3.14159265358979323846;
+
+struct AsrFilter {
+  unsigned int numberOfChannels;
+  double samplingRate;
+  double cutoff;
+  int maxRemoved;
+
+  /* One-pole high-pass */
+  double highpass;
+  double *previousInput, *previousOutput;
+  int primed;
+
+  /* Calibration data and scratch; kept, since calibration completes while streaming */
+  float *calibration;
+  size_t calibrationSamples, calibrationCount;
+  float *blockCovariances;            // Upper triangles of the block covariances
+  float *windowRms;
+  int calibrated;
+
+  /* Calibration results */
+  double *c0;                         // Covariance of clean data
+  double *v0;                         // Its eigenvectors, one per column
+  double *tau;                        // Rejection threshold per column of v0
+
+  /* Running state */
+  double *covariance;
+  double *reconstruction, *previousReconstruction;
+  int trivial, previousTrivial;       // Set while the (previous) reconstruction is the identity
+
+  /* Per-chunk scratch */
+  double *chunkCovariance, *work, *eigenvectors, *eigenvalues, *rotation, *product;
+  double *kept, *gram, *solved, *mixedKept;
+  double *sample;
+};
+
+// -----------------------------------------------------------------------------
+// Linear algebra
+// -----------------------------------------------------------------------------
+/**
+ * Eigendecomposition of a symmetric matrix by cyclic Jacobi rotations.
+ *
+ * @param a       - n x n matrix; destroyed
+ * @param vectors - Receives the eigenvectors, one per column, in order of the eigenvalues
+ * @param values  - Receives the eigenvalues in ascending order
+ */
+static void SymmetricEigen( double *a, double *vectors, double *values, unsigned int n )
+{
+  unsigned int p, q, k;
+  int sweep;
+
+  for( p = 0; p < n; p++ )
+    for( q = 0; q < n; q++ ) vectors[ p * n + q ] = p == q ? 1.0 : 0.0;
+
+  for( sweep = 0; sweep < EIGEN_SWEEPS; sweep++ ) {
+    double off = 0.0, diagonal = 0.0;
+    for( p = 0; p < n; p++ ) {
+      diagonal += a[ p * n + p ] * a[ p * n + p ];
+      for( q = p + 1; q < n; q++ ) off += a[ p * n + q ] * a[ p * n + q ];
+    }
+    if( off <= 1e-24 * diagonal || off == 0.0 ) break;
+
+    for( p = 0; p < n; p++ ) {
+      for( q = p + 1; q < n; q++ ) {
+        const double apq = a[ p * n + q ];
+        double theta, t, c, s;
+        if( apq == 0.0 ) continue;
+        theta = ( a[ q * n + q ] - a[ p * n + p ] ) / ( 2.0 * apq );
+        t = ( theta >= 0 ? 1.0 : -1.0 ) / ( fabs( theta ) + sqrt( theta * theta + 1.0 ) );
+        c = 1.0 / sqrt( t * t + 1.0 );
+        s = t * c;
+        for( k = 0; k < n; k++ ) {           /* Columns p and q */
+          const double akp = a[ k * n + p ], akq = a[ k * n + q ];
+          a[ k * n + p ] = c * akp - s * akq;
+          a[ k * n + q ] = s * akp + c * akq;
+        }
+        for( k = 0; k < n; k++ ) {           /* Rows p and q */
+          const double apk = a[ p * n + k ], aqk = a[ q * n + k ];
+          a[ p * n + k ] = c * apk - s * aqk;
+          a[ q * n + k ] = s * apk + c * aqk;
+        }
+        for( k = 0; k < n; k++ ) {
+          const double vkp = vectors[ k * n + p ], vkq = vectors[ k * n + q ];
+          vectors[ k * n + p ] = c * vkp - s * vkq;
+          vectors[ k * n + q ] = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+
+  /* Selection sort by eigenvalue; n is small */
+  for( p = 0; p < n; p++ ) values[ p ] = a[ p * n + p ];
+  for( p = 0; p < n; p++ ) {
+    unsigned int smallest = p;
+    for( q = p + 1; q < n; q++ ) if( values[ q ] < values[ smallest ] ) smallest = q;
+    if( smallest != p ) {
+      double swap = values[ p ]; values[ p ] = values[ smallest ]; values[ smallest ] = swap;
+      for( k = 0; k < n; k++ ) {
+        swap = vectors[ k * n + p ];
+        vectors[ k * n + p ] = vectors[ k * n + smallest ];
+        vectors[ k * n + smallest ] = swap;
+      }
+    }
+  }
+}
+
+/**
+ * Solves a * x = b in place for a symmetric positive definite k x k matrix a
+ * and a k x n right-hand side b, by Cholesky decomposition.
+ * @return 0 on success, non-zero if a is not positive definite
+ */
+static int CholeskySolve( double *a, double *b, unsigned int k, unsigned int n )
+{
+  unsigned int i, j, l, c;
+  for( j = 0; j < k; j++ ) {
+    double d = a[ j * k + j ];
+    for( l = 0; l < j; l++ ) d -= a[ j * k + l ] * a[ j * k + l ];
+    if( !( d > 0.0 ) ) return -1;
+    a[ j * k + j ] = sqrt( d );
+    for( i = j + 1; i < k; i++ ) {
+      double v = a[ i * k + j ];
+      for( l = 0; l < j; l++ ) v -= a[ i * k + l ] * a[ j * k + l ];
+      a[ i * k + j ] = v / a[ j * k + j ];
+    }
+  }
+  for( c = 0; c < n; c++ ) {
+    for( i = 0; i < k; i++ ) {               /* L y = b */
+      double v = b[ i * n + c ];
+      for( l = 0; l < i; l++ ) v -= a[ i * k + l ] * b[ l * n + c ];
+      b[ i * n + c ] = v / a[ i * k + i ];
+    }
+    for( i = k; i-- > 0; ) {                 /* L' x = y */
+      double v = b[ i * n + c ];
+      for( l = i + 1; l < k; l++ ) v -= a[ l * k + i ] * b[ l * n + c ];
+      b[ i * n + c ] = v / a[ i * k + i ];
+    }
+  }
+  return 0;
+}
+
+static int CompareFloats( const void *a, const void *b )
+{
+  const float x = *(const float *)a, y = *(const float *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Median of values; reorders them. */
+static float Median( float *values, size_t count )
+{
+  qsort( values, count, sizeof( float ), CompareFloats );
+  return count % 2 ? values[ count / 2 ] : 0.5f * ( values[ count / 2 - 1 ] + values[ count / 2 ] );
+}
+
+// -----------------------------------------------------------------------------
+// Calibration
+// -----------------------------------------------------------------------------
+/**
+ * Geometric median of the block covariances by Weiszfeld's algorithm, into
+ * c0. Off-diagonal entries count twice in the distances, as in the full
+ * matrices. Being a weighted mean of covariances, the result is positive
+ * semi-definite.
+ */
+static void GeometricMedian( AsrFilter *asr, size_t numberOfBlocks )
+{
+  const unsigned int n = asr->numberOfChannels;
+  const size_t size = (size_t)n * ( n + 1 ) / 2;
+  double *median = asr->work, *sum = asr->gram;       /* Both hold at least n * n values */
+  size_t b, e;
+  unsigned int i, j;
+  int iteration;
+
+  for( e = 0; e < size; e++ ) median[ e ] = 0.0;
+  for( b = 0; b < numberOfBlocks; b++ )
+    for( e = 0; e < size; e++ ) median[ e ] += asr->blockCovariances[ b * size + e ] / (double)numberOfBlocks;
+
+  for( iteration = 0; iteration < MEDIAN_ITERATIONS; iteration++ ) {
+    double weights = 0.0, change = 0.0, norm = 0.0;
+    for( e = 0; e < size; e++ ) sum[ e ] = 0.0;
+    for( b = 0; b < numberOfBlocks; b++ ) {
+      const float *block = asr->blockCovariances + b * size;
+      double distance = 0.0, weight;
+      for( i = 0, e = 0; i < n; i++ )
+        for( j = i; j < n; j++, e++ ) {
+          const double d = block[ e ] - median[ e ];
+          distance += ( i == j ? 1.0 : 2.0 ) * d * d;
+        }
+      weight = 1.0 / ( sqrt( distance ) + 1e-12 );
+      weights += weight;
+      for( e = 0; e < size; e++ ) sum[ e ] += weight * block[ e ];
+    }
+    for( e = 0; e < size; e++ ) {
+      const double next = sum[ e ] / weights;
+      change += ( next - median[ e ] ) * ( next - median[ e ] );
+      norm += next * next;
+      median[ e ] = next;
+    }
+    if( change <= MEDIAN_TOLERANCE * MEDIAN_TOLERANCE * norm ) break;
+  }
+
+  for( i = 0, e = 0; i < n; i++ )
+    for( j = i; j < n; j++, e++ ) asr->c0[ i * n + j ] = asr->c0[ j * n + i ] = median[ e ];
+}
+
+/**
+ * Derives c0, v0 and tau from the calibration data and releases it.
+ * The calibration data is overwritten.
+ */
+static void Calibrate( AsrFilter *asr )
+{
+  const unsigned int n = asr->numberOfChannels;
+  const size_t samples = asr->calibrationSamples;
+  const size_t numberOfBlocks = samples / BLOCK_SAMPLES;
+  const size_t size = (size_t)n * ( n + 1 ) / 2;
+  size_t window = (size_t)( ASR_WINDOW_SECONDS * asr->samplingRate + 0.5 ), step, t, b, e, w, numberOfWindows;
+  unsigned int i, j;
+
+  /* Block covariances and their geometric median */
+  for( b = 0; b < numberOfBlocks; b++ ) {
+    float *block = asr->blockCovariances + b * size;
+    for( i = 0, e = 0; i < n; i++ )
+      for( j = i; j < n; j++, e++ ) {
+        double sum = 0.0;
+        for( t = b * BLOCK_SAMPLES; t < ( b + 1 ) * BLOCK_SAMPLES; t++ )
+          sum += (double)asr->calibration[ t * n + i ] * asr->calibration[ t * n + j ];
+        block[ e ] = (float)( sum / BLOCK_SAMPLES );
+      }
+  }
+  GeometricMedian( asr, numberOfBlocks );
+  memcpy( asr->work, asr->c0, (size_t)n * n * sizeof( double ) );
+  SymmetricEigen( asr->work, asr->v0, asr->eigenvalues, n );
+
+  /* Components of the calibration data, in place */
+  for( t = 0; t < samples; t++ ) {
+    float *x = asr->calibration + t * n;
+    for( i = 0; i < n; i++ ) asr->sample[ i ] = x[ i ];
+    for( j = 0; j < n; j++ ) {
+      double y = 0.0;
+      for( i = 0; i < n; i++ ) y += asr->v0[ i * n + j ] * asr->sample[ i ];
+      x[ j ] = (float)y;
+    }
+  }
+
+  /* Robust statistics of the windowed RMS of each component */
+  if( window < 1 ) window = 1;
+  if( window > samples ) window = samples;
+  step = (size_t)( window * ( 1.0 - WINDOW_OVERLAP ) + 0.5 );
+  if( step < 1 ) step = 1;
+  numberOfWindows = ( samples - window ) / step + 1;
+  for( j = 0; j < n; j++ ) {
+    float median, deviation;
+    for( w = 0; w < numberOfWindows; w++ ) {
+      double sum = 0.0;
+      for( t = w * step; t < w * step + window; t++ ) {
+        const double y = asr->calibration[ t * n + j ];
+        sum += y * y;
+      }
+      asr->windowRms[ w ] = (float)sqrt( sum / window );
+    }
+    median = Median( asr->windowRms, numberOfWindows );
+    for( w = 0; w < numberOfWindows; w++ ) asr->windowRms[ w ] = fabsf( asr->windowRms[ w ] - median );
+    deviation = 1.4826f * Median( asr->windowRms, numberOfWindows );
+    asr->tau[ j ] = median + asr->cutoff * deviation;
+  }
+
+  memcpy( asr->covariance, asr->c0, (size_t)n * n * sizeof( double ) );
+  memcpy( asr->eigenvectors, asr->v0, (size_t)n * n * sizeof( double ) );
+  asr->calibrated = 1;
+}
+
+// -----------------------------------------------------------------------------
+// Processing
+// -----------------------------------------------------------------------------
+/**
+ * Computes the reconstruction matrix for the current covariance.
+ * @return Number of components removed
+ */
+static int UpdateReconstruction( AsrFilter *asr )
+{
+  const unsigned int n = asr->numberOfChannels;
+  unsigned int i, j, l, k = 0;
+  int removed = 0;
+  double trace = 0.0;
+
+  /*
+   * The covariance changes little between chunks, so rotate it into the
+   * previous eigenvectors first: it is then nearly diagonal and the Jacobi
+   * iteration converges in one or two sweeps.
+   */
+  for( i = 0; i < n; i++ )
+    for( j = 0; j < n; j++ ) {
+      double v = 0.0;
+      for( l = 0; l < n; l++ ) v += asr->covariance[ i * n + l ] * asr->eigenvectors[ l * n + j ];
+      asr->product[ i * n + j ] = v;
+    }
+  for( i = 0; i < n; i++ )
+    for( j = i; j < n; j++ ) {
+      double v = 0.0;
+      for( l = 0; l < n; l++ ) v += asr->eigenvectors[ l * n + i ] * asr->product[ l * n + j ];
+      asr->work[ i * n + j ] = asr->work[ j * n + i ] = v;
+    }
+  SymmetricEigen( asr->work, asr->rotation, asr->eigenvalues, n );
+  for( i = 0; i < n; i++ )
+    for( j = 0; j < n; j++ ) {
+      double v = 0.0;
+      for( l = 0; l < n; l++ ) v += asr->eigenvectors[ i * n + l ] * asr->rotation[ l * n + j ];
+      asr->product[ i * n + j ] = v;
+    }
+  memcpy( asr->eigenvectors, asr->product, (size_t)n * n * sizeof( double ) );
+
+  /* Columns of kept, n x k: the eigenvectors to keep */
+  for( j = 0; j < n; j++ ) {
+    double threshold = 0.0;
+    for( i = 0; i < n; i++ ) {
+      double projection = 0.0;
+      for( l = 0; l < n; l++ ) projection += asr->v0[ l * n + i ] * asr->eigenvectors[ l * n + j ];
+      projection *= asr->tau[ i ];
+      threshold += projection * projection;
+    }
+    if( asr->eigenvalues[ j ] < threshold || (int)j < (int)n - asr->maxRemoved ) {
+      for( l = 0; l < n; l++ ) asr->kept[ l * n + k ] = asr->eigenvectors[ l * n + j ];
+      k++;
+    } else {
+      removed++;
+    }
+  }
+  if( removed == 0 ) {
+    asr->trivial = 1;
+    return 0;
+  }
+
+  /* mixedKept = C0 * Vk (n x k); gram = Vk' * C0 * Vk (k x k); solved = Vk' (k x n) */
+  for( i = 0; i < n; i++ )
+    for( j = 0; j < k; j++ ) {
+      double v = 0.0;
+      for( l = 0; l < n; l++ ) v += asr->c0[ i * n + l ] * asr->kept[ l * n + j ];
+      asr->mixedKept[ i * k + j ] = v;
+    }
+  for( i = 0; i < k; i++ )
+    for( j = 0; j < k; j++ ) {
+      double v = 0.0;
+      for( l = 0; l < n; l++ ) v += asr->kept[ l * n + i ] * asr->mixedKept[ l * k + j ];
+      asr->gram[ i * k + j ] = v;
+    }
+  for( i = 0; i < k; i++ ) trace += asr->gram[ i * k + i ];
+  for( i = 0; i < k; i++ ) asr->gram[ i * k + i ] += 1e-9 * trace / k + 1e-30;   /* Flat channels */
+  for( i = 0; i < k; i++ )
+    for( j = 0; j < n; j++ ) asr->solved[ i * n + j ] = asr->kept[ j * n + i ];
+  if( CholeskySolve( asr->gram, asr->solved, k, n ) != 0 ) {
+    /* Keep the previous reconstruction */
+    memcpy( asr->reconstruction, asr->previousReconstruction, (size_t)n * n * sizeof( double ) );
+    asr->trivial = asr->previousTrivial;
+    return 0;
+  }
+
+  /* R = mixedKept * solved */
+  for( i = 0; i < n; i++ )
+    for( j = 0; j < n; j++ ) {
+      double v = 0.0;
+      for( l = 0; l < k; l++ ) v += asr->mixedKept[ i * k + l ] * asr->solved[ l * n + j ];
+      asr->reconstruction[ i * n + j ] = v;
+    }
+  asr->trivial = 0;
+  return removed;
+}
+
+int Asr_Process( AsrFilter *asr, const float *input, float *output, unsigned int numberOfSamples, unsigned int stride )
+{
+  const unsigned int n = asr->numberOfChannels;
+  double * const x = asr->sample;
+  double *swap, weight;
+  unsigned int t, i, j;
+  int removed;
+
+  if( numberOfSamples == 0 ) return 0;
+  if( stride < n ) stride = n;
+  if( !asr->primed ) {
+    for( i = 0; i < n; i++ ) {
+      asr->previousInput[ i ] = input[ i ];
+      asr->previousOutput[ i ] = 0.0;
+    }
+    asr->primed = 1;
+  }
+
+  /* High-pass into output and accumulate the chunk covariance */
+  memset( asr->chunkCovariance, 0, (size_t)n * n * sizeof( double ) );
+  for( t = 0; t < numberOfSamples; t++ ) {
+    for( i = 0; i < n; i++ ) {
+      const double value = input[ (size_t)t * stride + i ];
+      x[ i ] = asr->highpass * ( asr->previousOutput[ i ] + value - asr->previousInput[ i ] );
+      asr->previousInput[ i ] = value;
+      asr->previousOutput[ i ] = x[ i ];
+      output[ (size_t)t * stride + i ] = (float)x[ i ];
+    }
+    for( i = 0; i < n; i++ )
+      for( j = i; j < n; j++ ) asr->chunkCovariance[ i * n + j ] += x[ i ] * x[ j ];
+  }
+
+  if( !asr->calibrated ) {
+    size_t count = asr->calibrationSamples - asr->calibrationCount;
+    if( count > numberOfSamples ) count = numberOfSamples;
+    for( t = 0; t < count; t++ )
+      memcpy( asr->calibration + ( asr->calibrationCount + t ) * n, output + (size_t)t * stride, n * sizeof( float ) );
+    asr->calibrationCount += count;
+    if( asr->calibrationCount < asr->calibrationSamples ) return 0;
+    Calibrate( asr );
+  }
+
+  /* Blocked update of the running covariance over about ASR_WINDOW_SECONDS */
+  weight = numberOfSamples / ( ASR_WINDOW_SECONDS * asr->samplingRate );
+  if( weight > 1.0 ) weight = 1.0;
+  for( i = 0; i < n; i++ )
+    for( j = i; j < n; j++ ) {
+      const double updated = asr->covariance[ i * n + j ]
+                           + weight * ( asr->chunkCovariance[ i * n + j ] / numberOfSamples - asr->covariance[ i * n + j ] );
+      asr->covariance[ i * n + j ] = asr->covariance[ j * n + i ] = updated;
+    }
+
+  removed = UpdateReconstruction( asr );
+
+  /* Blend from the previous reconstruction to the new one over the chunk */
+  if( !asr->trivial || !asr->previousTrivial ) {
+    for( t = 0; t < numberOfSamples; t++ ) {
+      const double blend = 0.5 * ( 1.0 - cos( PI * ( t + 1 ) / numberOfSamples ) );
+      float *y = output + (size_t)t * stride;
+      for( i = 0; i < n; i++ ) x[ i ] = y[ i ];
+      for( i = 0; i < n; i++ ) {
+        double current = x[ i ], previous = x[ i ];
+        if( !asr->trivial ) {
+          current = 0.0;
+          for( j = 0; j < n; j++ ) current += asr->reconstruction[ i * n + j ] * x[ j ];
+        }
+        if( !asr->previousTrivial ) {
+          previous = 0.0;
+          for( j = 0; j < n; j++ ) previous += asr->previousReconstruction[ i * n + j ] * x[ j ];
+        }
+        y[ i ] = (float)( blend * current + ( 1.0 - blend ) * previous );
+      }
+    }
+  }
+
+  swap = asr->previousReconstruction;
+  asr->previousReconstruction = asr->reconstruction;
+  asr->reconstruction = swap;
+  asr->previousTrivial = asr->trivial;
+  return removed;
+}
+
+// -----------------------------------------------------------------------------
+// Life cycle
+// -----------------------------------------------------------------------------
+/* Samples of calibration data: calibrationSeconds, but at least a block and an RMS window */
+static size_t CalibrationSamples( double samplingRate, double calibrationSeconds )
+{
+  size_t samples = (size_t)( calibrationSeconds * samplingRate + 0.5 );
+  size_t window = (size_t)( ASR_WINDOW_SECONDS * samplingRate + 0.5 );
+  if( samples < BLOCK_SAMPLES ) samples = BLOCK_SAMPLES;
+  if( samples < window ) samples = window;
+  return samples;
+}
+
+/* Takes an array of size bytes, aligned for a double; with NULL memory it only adds up the size */
+static void *Take( unsigned char *memory, size_t *used, size_t size )
+{
+  size_t offset = ( *used + sizeof( double ) - 1 ) & ~( sizeof( double ) - 1 );
+  *used = offset + size;
+  return memory ? memory + offset : NULL;
+}
+
+/* Lays out the filter's arrays after the struct; returns the bytes used */
+static size_t Layout( AsrFilter *asr, unsigned char *memory, size_t n, size_t calibrationSamples )
+{
+  const size_t matrix = n * n;
+  size_t used = sizeof( AsrFilter );
+  AsrFilter sizing;
+  if( !asr ) asr = &sizing;
+  asr->calibration = (float *)Take( memory, &used, calibrationSamples * n * sizeof( float ) );
+  asr->blockCovariances = (float *)Take( memory, &used, ( calibrationSamples / BLOCK_SAMPLES ) * ( n * ( n + 1 ) / 2 ) * sizeof( float ) );
+  asr->windowRms = (float *)Take( memory, &used, ( calibrationSamples + 1 ) * sizeof( float ) );
+  asr->previousInput = (double *)Take( memory, &used, n * sizeof( double ) );
+  asr->previousOutput = (double *)Take( memory, &used, n * sizeof( double ) );
+  asr->c0 = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->v0 = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->tau = (double *)Take( memory, &used, n * sizeof( double ) );
+  asr->covariance = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->reconstruction = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->previousReconstruction = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->chunkCovariance = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->work = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->eigenvectors = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->eigenvalues = (double *)Take( memory, &used, n * sizeof( double ) );
+  asr->rotation = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->product = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->kept = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->gram = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->solved = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->mixedKept = (double *)Take( memory, &used, matrix * sizeof( double ) );
+  asr->sample = (double *)Take( memory, &used, n * sizeof( double ) );
+  return used;
+}
+
+size_t Asr_MemorySize( unsigned int numberOfChannels, double samplingRate, double calibrationSeconds )
+{
+  if( numberOfChannels == 0 || !( samplingRate > 0 ) || !( calibrationSeconds > 0 ) ) return 0;
+  return Layout( NULL, NULL, numberOfChannels, CalibrationSamples( samplingRate, calibrationSeconds ) );
+}
+
+AsrFilter *Asr_Create( void *memory, unsigned int numberOfChannels, double samplingRate, double calibrationSeconds, double cutoff )
+{
+  AsrFilter *asr = (AsrFilter *)memory;
+  size_t size = Asr_MemorySize( numberOfChannels, samplingRate, calibrationSeconds );
+
+  if( !asr || size == 0 ) return NULL;
+  memset( asr, 0, size );
+  asr->numberOfChannels = numberOfChannels;
+  asr->samplingRate = samplingRate;
+  asr->cutoff = cutoff > 0 ? cutoff : ASR_DEFAULT_CUTOFF;
+  asr->maxRemoved = (int)( MAX_REMOVED_FRACTION * numberOfChannels + 0.5 );
+  asr->highpass = 1.0 / ( 1.0 + 2.0 * PI * ASR_HIGHPASS_HZ / samplingRate );
+  asr->calibrationSamples = CalibrationSamples( samplingRate, calibrationSeconds );
+  Layout( asr, (unsigned char *)memory, numberOfChannels, asr->calibrationSamples );
+  Asr_Reset( asr );
+  return asr;
+}
+
+void Asr_Reset( AsrFilter *asr )
+{
+  asr->primed = 0;
+  asr->trivial = asr->previousTrivial = 1;
+  if( asr->calibrated ) {
+    memcpy( asr->covariance, asr->c0, (size_t)asr->numberOfChannels * asr->numberOfChannels * sizeof( double ) );
+    memcpy( asr->eigenvectors, asr->v0, (size_t)asr->numberOfChannels * asr->numberOfChannels * sizeof( double ) );
+  } else
+    asr->calibrationCount = 0;
+}
+
+int Asr_IsCalibrated( const AsrFilter *asr )
+{
+  return asr->calibrated;
+}
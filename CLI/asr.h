@@ -0,0 +1,81 @@
+/*
+ * asr.h
+ * ---------------------------------------------
+ * Online artifact subspace reconstruction (ASR) for the "<streamName>-Cleaned"
+ * outlet (see the --asr-outlet option of dsi2lsl).
+ *
+ * The filter first collects calibrationSeconds of data and derives from it
+ * the mixing matrix of clean EEG and a rejection threshold for each of its
+ * components; the statistics are robust (geometric median of short-block
+ * covariances, median and median absolute deviation of windowed RMS), so a
+ * few artifacts in the calibration data are tolerated. Afterwards every
+ * chunk updates a running covariance over about ASR_WINDOW_SECONDS, which is
+ * eigendecomposed; components whose variance exceeds their threshold are
+ * removed and reconstructed from the remaining ones. Chunks are processed as
+ * they arrive, without look-ahead, so the cleaned outlet adds no latency
+ * beyond the processing time.
+ *
+ * The input is high-passed (ASR_HIGHPASS_HZ) to remove electrode offsets;
+ * the output is the high-passed, cleaned signal. Until calibration completes
+ * the high-passed input is passed through unchanged.
+ */
+
+#ifndef ASR_H
+#define ASR_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ASR_WINDOW_SECONDS 0.5
+#define ASR_HIGHPASS_HZ 0.5
+#define ASR_DEFAULT_CUTOFF 20.0
+#define ASR_DEFAULT_CALIBRATION_SECONDS 60.0
+
+typedef struct AsrFilter AsrFilter;
+
+/**
+ * Memory Asr_Create needs for these parameters: the filter, its matrices and
+ * the calibration data. 0 if the parameters are invalid.
+ */
+size_t Asr_MemorySize( unsigned int numberOfChannels, double samplingRate, double calibrationSeconds );
+
+/**
+ * Creates a filter in memory of Asr_MemorySize bytes, which stays the
+ * caller's; the filter does not allocate.
+ * @param memory             - Asr_MemorySize bytes, aligned for a double
+ * @param numberOfChannels   - Channels per sample
+ * @param samplingRate       - Sampling rate in Hz
+ * @param calibrationSeconds - Data to calibrate on, from the first sample processed
+ * @param cutoff             - Rejection threshold in standard deviations of the
+ *                             calibration data's windowed RMS; lower is more aggressive
+ * @return The filter (at memory), or NULL if memory is NULL or the parameters are invalid
+ */
+AsrFilter *Asr_Create( void *memory, unsigned int numberOfChannels, double samplingRate, double calibrationSeconds, double cutoff );
+
+/** Forgets the signal history, e.g. at the start of a new block, but keeps the calibration. */
+void Asr_Reset( AsrFilter *asr );
+
+/** @return Non-zero once calibration has completed. */
+int Asr_IsCalibrated( const AsrFilter *asr );
+
+/**
+ * Cleans one chunk. The chunk that completes the calibration is already
+ * cleaned with it.
+ *
+ * @param input           - numberOfSamples samples of numberOfChannels values, channel-interleaved
+ * @param output          - Receives the cleaned chunk in the same layout; must not overlap input
+ * @param numberOfSamples - Samples in the chunk
+ * @param stride          - Values from one sample to the next in input and output; values
+ *                          past numberOfChannels are left alone
+ * @return Number of components removed in this chunk (0 while calibrating)
+ */
+int Asr_Process( AsrFilter *asr, const float *input, float *output, unsigned int numberOfSamples, unsigned int stride );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASR_H */
@@ -4,9 +4,9 @@
  * Integration between Wearable Sensing DSI C/C++ API and Lab Streaming Layer (LSL).
  *
  * This program acquires data from a DSI headset and streams it over LSL for real-time
- * data acquisition and analysis. It uses Windows threads for parallel processing:
- *   - DSI headset thread: continuously calls DSI_Headset_Idle to process incoming data.
- *   - Impedance thread: checks for impedance activity and prints results.
+ * data acquisition and analysis. The acquisition itself (headset connection, LSL
+ * outlets and worker threads) lives in libdsi2lsl (see libdsi2lsl.h); this file
+ * maps command-line options and console commands onto it.
  *
  * Usage:
  *   - Run the executable and specify options via command line (see GlobalHelp).
@@ -15,11 +15,10 @@
  * For support or feature requests, create a GitHub Issue or contact support@wearablesensing.com.
  */
 
-#include "DSI.h"
-#include "lsl_c.h"
+#include "libdsi2lsl.h"
+#include "ipc.h"
 #include <stdio.h>
 #include <string.h>
-#include <time.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <windows.h>
@@ -28,203 +27,120 @@
 // -----------------------------------------------------------------------------
 // Function Prototypes and Helper Macros
 // -----------------------------------------------------------------------------
-int               StartUp( int argc, const char * argv[], DSI_Headset *headsetOut, int * helpOut );
-int                Finish( DSI_Headset h );
 int            GlobalHelp( int argc, const char * argv[] );
-lsl_outlet        InitLSL( DSI_Headset h, const char * streamName);
-void             OnSample( DSI_Headset h, double packetOffsetTime, void * userData);
-void      getRandomString( char *s, const int len);
 const char * GetStringOpt( int argc, const char * argv[], const char * keyword1, const char * keyword2 );
 int         GetIntegerOpt( int argc, const char * argv[], const char * keyword1, const char * keyword2, int defaultValue );
-int        startAnalogReset( DSI_Headset h );  
-int          CheckImpedance( DSI_Headset h ); 
-void        PrintImpedances( DSI_Headset h, double packetOffsetTime, void * userData );
+double       GetDoubleOpt( int argc, const char * argv[], const char * keyword1, const char * keyword2, double defaultValue );
+int           HandleCommand( uint32_t command, void * context );
+uint32_t      FillTelemetry( IpcTelemetry * telemetry, float * impedances, uint32_t maxImpedances, void * context );
 
-// Global control flags
-static volatile int KeepRunning = 1;      // Main loop control
-static volatile int DSI_Thread_Paused = 0;// Pause DSI thread
+// The acquisition session (see libdsi2lsl.h)
+static DSI2LSL_Session *Session = NULL;
 
 /**
  * Signal handler for graceful shutdown (Ctrl+C)
  */
-void QuitHandler(int a) { KeepRunning = 0; }
-
-// Error checking macros
-#define REPORT(fmt, x)  fprintf(stderr, #x " = " fmt "\n", (x))
-int CheckError(void) {
-  if (DSI_Error()) return fprintf(stderr, "%s\n", DSI_ClearError());
-  else return 0;
-}
-#define CHECK   if (CheckError() != 0) return -1;
+void QuitHandler(int a) { if (Session) DSI2LSL_RequestStop(Session); }
 
 #define MAX_COMMAND_LENGTH 256
-#define BUFFER_SECONDS 2 // Sleep time for thread scheduling (seconds)
-
-// -----------------------------------------------------------------------------
-// Constants
-// -----------------------------------------------------------------------------
-/**
- * CHUNK_SIZE: Number of samples per chunk pushed to LSL.
- * Increasing CHUNK_SIZE beyond 9 increases timestamp difference.
- * Decreasing it increases jitter.
- */
-#define CHUNK_SIZE 9
-
-// -----------------------------------------------------------------------------
-// Thread Parameter Structs
-// -----------------------------------------------------------------------------
-/**
- * ThreadParams: Parameters for impedance thread control.
- */
-typedef struct {
-  DSI_Headset h;           // Headset handle
-  volatile int printFlag;  // Print impedance flag
-  volatile int startFlag;  // Start impedance flag
-  volatile int stopFlag;   // Stop impedance flag
-  lsl_outlet outlet;       // LSL outlet
-} ThreadParams;
-
-/**
- * DSI_Processing_Thread
- * ---------------------
- * Thread function to continuously call DSI_Headset_Idle for data processing.
- * @param lpParam: Pointer to DSI_Headset
- * @return DWORD: 0 on success
- */
-DWORD WINAPI DSI_Processing_Thread(LPVOID lpParam) {
-    DSI_Headset h = (DSI_Headset)lpParam;
-    fprintf(stdout, "DSI processing thread started.\n");
-
-    while (KeepRunning == 1) {
-        /* Only call Idle if the main thread hasn't paused us. */
-        if (!DSI_Thread_Paused) {
-            DSI_Headset_Idle(h, 0.0);
-            if (CheckError() != 0) {
-                fprintf(stderr, "Error in DSI processing thread. Exiting.\n");
-                KeepRunning = 0; /* Signal main thread to exit. */
-            }
-        }
-        /* Sleep for a tiny amount of time to prevent CPU overload. */
-        Sleep(BUFFER_SECONDS);
-    }
-
-    fprintf(stdout, "DSI processing thread finished.\n");
-    return 0;
-}
-
-/**
- * ImpedanceThread
- * ---------------
- * Thread function to check for impedance activity and control impedance driver.
- * @param lpParam: Pointer to ThreadParams
- * @return DWORD: 0 on success
- */
-DWORD WINAPI ImpedanceThread(LPVOID lpParam) {
-    fprintf(stdout, "DSI impedance thread started.\n");
-    ThreadParams *params = (ThreadParams *)lpParam;
-    DSI_Headset h = params->h;
-
-    while(KeepRunning == 1){
-      if(params->startFlag){
-        DSI_Headset_StartImpedanceDriver( h ); CHECK
-        // PrintImpedances( h, 0, "headings"); CHECK 
-        /* Switch OnSample to PrintImpedances to print impedance values instead of raw signals. */
-        DSI_Headset_SetSampleCallback( h, OnSample, params->outlet ); CHECK
-        params->startFlag = 0;
-      }
-      /* Uncomment the following lines to continuously print impedance check. */
-      // while (params->printFlag) {
-      //     DSI_Headset_Receive( h, 0.1, 0 ); CHECK
-      // }
-      if(params->stopFlag){
-        DSI_Headset_StopImpedanceDriver( h ); CHECK
-        DSI_Headset_SetSampleCallback( h, OnSample, params->outlet ); CHECK
-        params->stopFlag = 0;
-      }
-      
-      if (CheckError() != 0) {
-          fprintf(stderr, "Error in DSI processing thread. Exiting.\n");
-          KeepRunning = 0; /* Signal main thread to exit. */
-      }
-    }
-    
-    fprintf(stdout, "DSI impedance thread finished.\n");
-    return 0;
-}
+#define BUFFER_SECONDS 2 // Sleep time for thread scheduling (milliseconds)
 
 /**
  * main
  * ----
- * Entry point. Initializes DSI API, headset, LSL outlet, and starts threads.
+ * Entry point. Opens an acquisition session configured from the command line,
+ * starts it and forwards console commands to it until the input ends.
  */
 int main(int argc, const char *argv[])
 {
-  srand((unsigned int)time(NULL)); // Seed RNG
-  const char *dllname = NULL;
   char command[MAX_COMMAND_LENGTH];
-  HANDLE sThread, iThread;
+  IpcServer *ipcServer = NULL;
+  DSI2LSL_Config config;
+  int error;
 
-  // Load DSI DLL
-  int load_error = Load_DSI_API(dllname);
-  if (load_error < 0) return fprintf(stderr, "failed to load dynamic library \"%s\"\n", DSI_DYLIB_NAME(dllname));
-  if (load_error > 0) return fprintf(stderr, "failed to import %d functions from dynamic library \"%s\"\n", load_error, DSI_DYLIB_NAME(dllname));
-  fprintf(stderr, "DSI API version %s loaded\n", DSI_GetAPIVersion());
-  if (strcmp(DSI_GetAPIVersion(), DSI_API_VERSION) != 0)
-    fprintf(stderr, "WARNING - mismatched versioning: program was compiled with DSI.h version %s but just loaded shared library version %s. You should ensure that you are using matching versions of the API files - contact Wearable Sensing if you are missing a file.\n", DSI_API_VERSION, DSI_GetAPIVersion());
+  if (GetStringOpt(argc, argv, "help", "h")) {
+    GlobalHelp(argc, argv);
+    return 0;
+  }
+
+  /* Read out any configuration options. */
+  DSI2LSL_DefaultConfig(&config);
+  config.port       = GetStringOpt(  argc, argv, "port",      "p" );
+  config.portProbeMs = GetIntegerOpt( argc, argv, "port-probe-ms", NULL, 0 );
+  config.montage    = GetStringOpt(  argc, argv, "montage",   "m" );
+  config.reference  = GetStringOpt(  argc, argv, "reference", "r" );
+  config.verbosity  = GetIntegerOpt( argc, argv, "verbosity", "v", 2 );
+  config.streamName = GetStringOpt(  argc, argv, "lsl-stream-name", "m" );
+
+  // Replay mode feeds a recording through the LSL pipeline; no headset or DSI library is needed
+  config.replayPath = GetStringOpt(argc, argv, "replay", NULL);
+  const char *speedOpt = GetStringOpt(argc, argv, "replay-speed", NULL);
+  config.replaySpeed = (speedOpt && strcmp(speedOpt, "max") == 0) ? 0.0 : GetDoubleOpt(argc, argv, "replay-speed", NULL, 1.0);
+  config.replayRate = GetDoubleOpt(argc, argv, "replay-rate", NULL, 0.0);
+  config.replayLoop = GetStringOpt(argc, argv, "replay-loop", NULL) != NULL;
+  config.standby = GetStringOpt(argc, argv, "standby", NULL) != NULL;
+  config.maxBuffered = GetDoubleOpt(argc, argv, "max-buffered", NULL, 0.0);
+  config.memoryBudgetMB = GetDoubleOpt(argc, argv, "memory-budget-mb", NULL, 0.0);
+  config.compressedOutlet = GetStringOpt(argc, argv, "compressed-outlet", NULL) != NULL;
+  config.compressedResolution = GetDoubleOpt(argc, argv, "compressed-resolution", NULL, 0.0);
+  config.qualityOutlet = GetStringOpt(argc, argv, "quality-outlet", NULL) != NULL;
+  config.sequenceChannel = GetStringOpt(argc, argv, "sequence-channel", NULL) != NULL;
+  config.pace = GetStringOpt(argc, argv, "pace", NULL) != NULL;
+  config.paceMaxDelayMs = GetDoubleOpt(argc, argv, "pace-max-delay", NULL, 0.0);
+  config.tracePath = GetStringOpt(argc, argv, "trace", NULL);
+  config.metricsAddress = GetStringOpt(argc, argv, "metrics", NULL);
+  config.checkAllocations = GetStringOpt(argc, argv, "check-allocations", NULL) != NULL;
+  config.rawOutlet = GetStringOpt(argc, argv, "raw-outlet", NULL) != NULL;
+  config.extraOutlets = GetStringOpt(argc, argv, "extra-outlets", NULL);
+  config.asrOutlet = GetStringOpt(argc, argv, "asr-outlet", NULL) != NULL;
+  config.asrCalibrationSeconds = GetDoubleOpt(argc, argv, "asr-calibration", NULL, 0.0);
+  config.asrCutoff = GetDoubleOpt(argc, argv, "asr-cutoff", NULL, 0.0);
+  config.shutdownTimeoutMs = GetIntegerOpt(argc, argv, "shutdown-timeout-ms", NULL, 0);
+  config.epochMarkers = GetStringOpt(argc, argv, "epoch-markers", NULL);
+  config.epochOutlet = GetStringOpt(argc, argv, "epoch-outlet", NULL) != NULL || config.epochMarkers;
+  config.epochPreMs = GetDoubleOpt(argc, argv, "epoch-pre-ms", NULL, 0.0);
+  config.epochPostMs = GetDoubleOpt(argc, argv, "epoch-post-ms", NULL, 0.0);
+  int replay = config.replayPath && *config.replayPath;
+
+  const char *logLevel = GetStringOpt(argc, argv, "log-level", NULL);
+  DSI2LSL_SetLogOptions(!logLevel || _stricmp(logLevel, "info") == 0 ? DSI2LSL_LOG_INFO
+                        : _stricmp(logLevel, "warning") == 0 ? DSI2LSL_LOG_WARNING : DSI2LSL_LOG_ERROR,
+                        GetStringOpt(argc, argv, "log-timestamps", NULL) != NULL);
 
   // Set up Ctrl+C handler
   signal(SIGINT, QuitHandler);
 
-  // Initialize API and headset
-  DSI_Headset h;
-  int help, error;
-  error = StartUp(argc, argv, &h, &help);
-  if (error || help) {
-    GlobalHelp(argc, argv);
+  // Initialize the headset (or recording) and the LSL outlets
+  error = DSI2LSL_Open(&config, &Session);
+  if (error) {
+    if (!replay) GlobalHelp(argc, argv);
+    return error;
+  }
+  error = DSI2LSL_Start(Session);
+  if (error) {
+    DSI2LSL_Close(Session);
     return error;
   }
 
-  // Initialize LSL outlet
-  const char *streamName = GetStringOpt(argc, argv, "lsl-stream-name", "m");
-  if (!streamName) streamName = "WS-default";
-  fprintf(stdout, "Initializing %s outlet\n", streamName);
-  lsl_outlet outlet = InitLSL(h, streamName); CHECK;
-
-  /* Set the sample callback (forward every data sample received to LSL) */
-  DSI_Headset_SetSampleCallback( h, OnSample, outlet ); CHECK
-
-  /* Start data acquisition */
-  fprintf(stdout, "Starting data acquisition\n");
-  DSI_Headset_StartDataAcquisition( h ); CHECK
-
-  /* Custom struct for impedance flags */
-  ThreadParams zFLag;
-  zFLag.h = h; /* Valid DSI_Headset variable */
-  zFLag.printFlag = 0; /* Used to print impedance continuously */
-  zFLag.startFlag = 0;
-  zFLag.stopFlag = 0;
-  zFLag.outlet = outlet; /* Valid LSL outlet */
-
-  /* Create the impedance thread */
-  iThread = CreateThread(NULL, 0, ImpedanceThread, &zFLag, 0, NULL);
-  if (iThread == NULL) {
-      fprintf(stderr, "Error creating DSI impedance thread.\n");
-      return Finish(h);
+  /* Optional binary control and telemetry channel (used by the GUI) */
+  const char *ipcName = GetStringOpt(argc, argv, "ipc", NULL);
+  if (ipcName && *ipcName) {
+      ipcServer = Ipc_Start(ipcName, GetIntegerOpt(argc, argv, "ipc-telemetry-ms", NULL, IPC_DEFAULT_TELEMETRY_MS),
+                            HandleCommand, FillTelemetry, Session);
   }
-   /* Create and start the DSI processing thread */
-  sThread = CreateThread(NULL, 0, DSI_Processing_Thread, h, 0, NULL);
-  if (sThread == NULL) {
-      fprintf(stderr, "Error creating DSI processing thread.\n");
-      return Finish(h);
+
+  if (replay) {
+    /* Nothing to control in a replay; run until it ends or Ctrl+C */
+    while (DSI2LSL_IsRunning(Session)) Sleep(100);
+  } else {
+    fprintf(stderr, "Wait...\n");
+    Sleep(BUFFER_SECONDS);
+    fprintf(stderr, "Setup Ready\n");
+    /* Start streaming (in standby mode, on the first "start" command) */
+    if (!config.standby) fprintf(stdout, "Streaming...\n");
   }
-  
-  fprintf(stderr, "Wait...\n");
-  Sleep(BUFFER_SECONDS);
-  fprintf(stderr, "Setup Ready\n");
-  /* Start streaming */
-  fprintf(stdout, "Streaming...\n");
-  while( KeepRunning==1 ){
-    
+  while( !replay && DSI2LSL_IsRunning(Session) ){
+
     /* 
      * Read a line of input from stdin (the terminal)
      * fgets reads up to MAX_COMMAND_LENGTH-1 characters or until a newline.
@@ -247,320 +163,68 @@ int main(int argc, const char *argv[])
         continue; /* Go back to the prompt */
     }
 
+    /* Commands are queued to the acquisition thread, so the next line can be read right away. */
     else if (strcmp(command, "checkZOn") == 0) {
-        /* uncomment to print impedance continuously */
-        // zFLag.printFlag = 1; 
-        zFLag.stopFlag = 0;
-        zFLag.startFlag = 1;
-
+        HandleCommand(IPC_CMD_CHECK_Z_ON, Session);
     }else if (strcmp(command, "checkZOff") == 0) {
-        /* Uncomment to print impedance continuously */
-        // zFLag.printFlag = 0;   
-        zFLag.stopFlag = 1;
-        zFLag.startFlag = 0;
+        HandleCommand(IPC_CMD_CHECK_Z_OFF, Session);
     }
     else if (strcmp(command, "resetZ") == 0) {
         /* Reset impedance */
-        startAnalogReset( h ); CHECK
+        HandleCommand(IPC_CMD_RESET_Z, Session);
+    }
+    else if (strcmp(command, "start") == 0) {
+        HandleCommand(IPC_CMD_START_STREAMING, Session);
+    }
+    else if (strcmp(command, "stop") == 0) {
+        /* Ends the block; the headset stays connected */
+        HandleCommand(IPC_CMD_STOP_STREAMING, Session);
+    }
+    else if (strcmp(command, "quit") == 0) {
+        /* Ends the loop; closing the session flushes the last samples */
+        HandleCommand(IPC_CMD_SHUTDOWN, Session);
+    }
+    else {
+        fprintf(stderr, "Unknown command: %s\n", command);
     }
-    Sleep(BUFFER_SECONDS);
-  }
-
-  /* Closing the threads */
-  if (sThread != NULL) {
-      fprintf(stdout, "Waiting for DSI thread to terminate...\n");
-      WaitForSingleObject(sThread, INFINITE);
-      CloseHandle(sThread);
-      fprintf(stdout, "DSI thread has terminated.\n");
-  }
-  if (iThread != NULL) {
-      fprintf(stdout, "Waiting for impedance thread to terminate...\n");
-      WaitForSingleObject(iThread, INFINITE);
-      CloseHandle(iThread);
-      fprintf(stdout, "Impedance thread has terminated.\n");
   }
-  
 
   /* Gracefully exit the program */
+  Ipc_Stop(ipcServer);
   fprintf(stdout, "\n%s will exit now...\n", argv[ 0 ]);
-  lsl_destroy_outlet(outlet);
-  return Finish( h );
+  error = DSI2LSL_Close(Session);
+  Session = NULL;
+  return error;
 }
 
 /**
- * Reset the analog impedance for a DSI headset.
+ * Applies a command received from the console or the IPC channel.
  *
- * @param h - Valid DSI headset handle
- * @return 0 on success
+ * @param command - IPC_CMD_* command code
+ * @param context - Acquisition session
+ * @return IPC_STATUS_* code
  */
-int startAnalogReset(DSI_Headset h) {
-    if (h == NULL) {
-        fprintf(stderr, "Error: Invalid headset handle.\n");
-        return -1;
-    }
-    /* Check initial analog reset mode */
-    fprintf(stdout, "--> Initial analog reset mode: %d\n", DSI_Headset_GetAnalogResetMode(h));
-
-    DSI_Headset_StartAnalogReset(h); CHECK
-    return 0;
-}
-
-/**
- * Starts checking impedance and format it ready for print
- *
- * @param h - Valid DSI headset handle
- * @return 0 on success, non-zero on error.
- */
-
-/**
- * Callback function invoked for each sample received from the DSI headset.
- * Collects samples into a chunk buffer and pushes them to the LSL outlet in batches.
- *
- * @param h - Valid DSI headset handle
- * @param unused_packet_offset_time - Unused packet offset time
- * @param outlet - LSL outlet to push data to
- */
-/* Helper struct for chunk buffer management */
-typedef struct {
-    float* buffer;
-    int sample_index_in_chunk;
-    unsigned int numberOfChannels;
-} ChunkBufferManager;
-
-/* Helper function to initialize or get chunk buffer */
-static ChunkBufferManager* GetChunkBufferManager(DSI_Headset h, ChunkBufferManager **manager_ptr) {
-    if (*manager_ptr == NULL) {
-        *manager_ptr = (ChunkBufferManager*)malloc(sizeof(ChunkBufferManager));
-        if (*manager_ptr == NULL) {
-            fprintf(stderr, "Fatal Error: Could not allocate memory for ChunkBufferManager.\n");
-            return NULL;
-        }
-        (*manager_ptr)->numberOfChannels = DSI_Headset_GetNumberOfChannels(h);
-        (*manager_ptr)->sample_index_in_chunk = 0;
-        if ((*manager_ptr)->numberOfChannels > 0) {
-            (*manager_ptr)->buffer = (float*)malloc(CHUNK_SIZE * (*manager_ptr)->numberOfChannels * sizeof(float));
-            if ((*manager_ptr)->buffer == NULL) {
-                fprintf(stderr, "Fatal Error: Could not allocate memory for chunk buffer.\n");
-                free(*manager_ptr);
-                *manager_ptr = NULL;
-                return NULL;
-            }
-        } else {
-            (*manager_ptr)->buffer = NULL;
-        }
-    }
-    return *manager_ptr;
-}
-
-/* Helper function to free chunk buffer */
-static void FreeChunkBufferManager(ChunkBufferManager **manager_ptr) {
-    if (*manager_ptr) {
-        if ((*manager_ptr)->buffer) free((*manager_ptr)->buffer);
-        free(*manager_ptr);
-        *manager_ptr = NULL;
-    }
-}
-
-static ChunkBufferManager *onSampleManager = NULL;
-
-/**
- * OnSample
- * --------
- * Callback for each sample received from DSI headset.
- * Buffers samples and pushes them to LSL in chunks.
- *
- * @param h: DSI headset handle
- * @param unused_packet_offset_time: Unused
- * @param outlet: LSL outlet
- */
-void OnSample(DSI_Headset h, double unused_packet_offset_time, void *outlet)
+int HandleCommand(uint32_t command, void *context)
 {
-  (void)unused_packet_offset_time;
-  ChunkBufferManager *manager = GetChunkBufferManager(h, &onSampleManager);
-  if (!manager || !manager->buffer) return;
-
-  // Fill buffer with current sample data
-  float* current_sample_ptr = &manager->buffer[manager->sample_index_in_chunk * manager->numberOfChannels];
-  for (unsigned int channelIndex = 0; channelIndex < manager->numberOfChannels; channelIndex++) {
-    current_sample_ptr[channelIndex] = (float)DSI_Channel_GetSignal(DSI_Headset_GetChannelByIndex(h, channelIndex));
-  }
-
-  manager->sample_index_in_chunk++;
-
-  // Push chunk to LSL when buffer is full
-  if (manager->sample_index_in_chunk == CHUNK_SIZE) {
-    lsl_push_chunk_ft(outlet, manager->buffer, (size_t)(CHUNK_SIZE * manager->numberOfChannels), lsl_local_clock());
-    manager->sample_index_in_chunk = 0;
-  }
-}
-
-int Message( const char * msg, int debugLevel ){
-  return fprintf( stderr, "DSI Message (level %d): %s\n", debugLevel, msg );
+    return DSI2LSL_Command((DSI2LSL_Session *)context, command);
 }
 
 /**
- * Initializes and connects to the DSI headset, prepares it for
- * data acquisition.
+ * Fills in a telemetry message for the IPC channel. Called on the IPC thread
+ * only, which keeps the previous message for the sample rate.
  *
- * @param argc - Command-line argument count
- * @param argv - Command-line argument vector
- * @param headsetOut - Output pointer to store initialized headset handle.
- * @param helpOut - Output flag indicating if help was requested.
- *
- * @return 0 on success, non-zero on error.
+ * @param telemetry - Message to fill in
+ * @param impedances - Receives the latest impedance values while the driver is on
+ * @param maxImpedances - Capacity of impedances
+ * @param context - Acquisition session
+ * @return Number of impedance values written
  */
-int StartUp( int argc, const char * argv[], DSI_Headset * headsetOut, int * helpOut )
+uint32_t FillTelemetry(IpcTelemetry *telemetry, float *impedances, uint32_t maxImpedances, void *context)
 {
-  DSI_Headset h;
-
-  /* Read out any configuration options. */
-  int          help       = GetStringOpt(  argc, argv, "help",      "h" ) != NULL;
-  const char * serialPort = GetStringOpt(  argc, argv, "port",      "p" );
-  const char * montage    = GetStringOpt(  argc, argv, "montage",   "m" );
-  const char * reference  = GetStringOpt(  argc, argv, "reference", "r" );
-  int          verbosity  = GetIntegerOpt( argc, argv, "verbosity", "v", 2 );
-  if( headsetOut ) *headsetOut = NULL;
-  if( helpOut ) *helpOut = help;
-  if( help ) return 0;
-
-  /* Passing NULL defers setup of the serial port connection until later... */
-  h = DSI_Headset_New( NULL ); CHECK
-
-  /*
-   * ...which allows us to configure the way we handle any debugging messages
-   * that occur during connection (see our definition of the `DSI_MessageCallback`
-   * function `Message()` above).
-   */
-  DSI_Headset_SetMessageCallback( h, Message ); CHECK
-  DSI_Headset_SetVerbosity( h, verbosity ); CHECK
-
-  /*
-   * Now we establish the serial port connection and initialize the headset.
-   * In this demo program, the string supplied in the --port command-line
-   * option is used as the serial port address (if this string is empty, the
-   * API will automatically look for an environment variable called
-   * DSISerialPort).
-   */
-  DSI_Headset_Connect( h, serialPort ); CHECK
-
-  /*
-   * Sets up the montage according to strings supplied in the --montage and
-   * --reference command-line options, if any.
-   */
-  DSI_Headset_ChooseChannels( h, montage, reference, 1 ); CHECK
-
-  /* Prints an overview of what is known about the headset. */
-  fprintf( stderr, "%s\n", DSI_Headset_GetInfoString( h ) ); CHECK
-
-
-  if( headsetOut ) *headsetOut = h;
-  if( helpOut ) *helpOut = help;
-  return 0;
-}
-
-static ChunkBufferManager *impedanceManager = NULL;
-
-int Finish( DSI_Headset h )
-{
-  /* This stops our application from responding to received samples. */
-  DSI_Headset_SetSampleCallback( h, NULL, NULL ); CHECK
-
-  /* Free the buffer allocated in OnSample and PrintImpedances to prevent memory leak. */
-  FreeChunkBufferManager(&onSampleManager);
-  FreeChunkBufferManager(&impedanceManager);
-
-  /* This send a command to the headset to tell it to stop sending samples. */
-  DSI_Headset_StopDataAcquisition( h ); CHECK
-
-  /*
-   * This allows more than enough time to receive any samples that were
-   * sent before the stop command is carried out, along with the alarm
-   * signal that the headset sends out when it stops.
-   */
-  DSI_Headset_Idle( h, BUFFER_SECONDS ); CHECK
-
-  /*
-   * This is the only really necessary step. Disconnects from the serial
-   * port, frees memory, etc.
-   */
-  DSI_Headset_Delete( h ); CHECK
-
-  return 0;
-}
-
-void getRandomString(char *s, const int len)
-{
-  int i = 0;
-  static const char alphanum[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-  unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)rand();
-  srand(seed); // Reseed for more randomness per call
-  for (i = 0; i < len; ++i) {
-    s[i] = alphanum[rand() % (sizeof(alphanum) - 1)];
-  }
-  s[len] = 0;
-}
-
-lsl_outlet InitLSL(DSI_Headset h, const char * streamName)
-{
-  unsigned int channelIndex;
-  unsigned int numberOfChannels = DSI_Headset_GetNumberOfChannels( h );
-  double samplingRate = DSI_Headset_GetSamplingRate( h );
-
-	/* Out stream declaration object */
-  lsl_streaminfo info;
-	/* Some xml element pointers */
-  lsl_xml_ptr desc, chn, chns, ref; 
-  #define IMAX 16
-  char source_id[IMAX];
-  char *long_label;
-  char *short_label;
-  char *reference;
-	
-	/* Note: an even better choice here may be the serial number of the device. */
-  getRandomString(source_id, IMAX);
-  fprintf(stderr, "Source ID: %s\n", source_id);
-
-  /* Declare a new streaminfo (name: WearableSensing, content type: EEG, number of channels, srate, float values, source id. */
-  info = lsl_create_streaminfo((char*)streamName,"EEG",numberOfChannels,samplingRate,cft_float32,source_id);
-
-  if(!info) {
-      fprintf(stderr, "Failed to create LSL streaminfo.\n");
-      return NULL;
-  }
-  fprintf(stderr, "Stream Name: %s\n", streamName);
-  /* Add some meta-data fields to it (for more standard fields, see https://github.com/sccn/xdf/wiki/Meta-Data). */
-  desc = lsl_get_desc(info);
-  lsl_append_child_value(desc,"manufacturer","WearableSensing");
-
-	/* Describe channel info */
-  chns = lsl_append_child(desc,"channels");
-  for( channelIndex=0; channelIndex < numberOfChannels ; channelIndex++)
-  {
-    chn = lsl_append_child(chns,"channel");
-
-    long_label = (char*) DSI_Channel_GetString( DSI_Headset_GetChannelByIndex( h, channelIndex ) );
-    /* Cut off "negative" part of channel name (e.g., the ref chn) */
-    char label_buffer[256];
-    strncpy_s(label_buffer, sizeof(label_buffer), long_label, _TRUNCATE);
-    label_buffer[sizeof(label_buffer) - 1] = '\0';
-    char *context = NULL;
-    short_label = strtok_s(label_buffer, "-", &context);
-    if(short_label == NULL)
-      short_label = label_buffer;
-    /* Cmit channel info */
-    lsl_append_child_value(chn,"label", short_label);
-    lsl_append_child_value(chn,"unit","microvolts");
-    lsl_append_child_value(chn,"type","EEG");
-  }
-	
-	/* Describe reference used */
-  reference = (char*)DSI_Headset_GetReferenceString(h);
-  ref = lsl_append_child(desc,"reference");
-  lsl_append_child_value(ref,"label", reference);
-  fprintf(stdout, "REF: %s\n", reference);
-
-  /* Make a new outlet (chunking: default, buffering: 360 seconds). */
-  return lsl_create_outlet(info, 0, 360);
+    static IpcTelemetry previous;
+    uint32_t count = DSI2LSL_GetTelemetry((DSI2LSL_Session *)context, &previous, telemetry, impedances, maxImpedances);
+    previous = *telemetry;
+    return count;
 }
 
 
@@ -580,6 +244,12 @@ int GlobalHelp( int argc, const char * argv[] )
             "       Note: if you omit this option, or use an empty string or the string\n"
             "       \"default\", then the API will look for an environment variable called\n"
             "       DSISerialPort and use the content of that, if available.\n"
+            "       --port=auto probes all COM ports at once and connects to the first one\n"
+            "       a DSI headset answers on. The port found is remembered in\n"
+            "       %%LOCALAPPDATA%%\\dsi2lsl-port.txt and tried first next time.\n"
+            "\n"
+            "  --port-probe-ms\n"
+            "       Milliseconds --port=auto waits for a headset to answer (default 8000).\n"
             "\n"
             "  --montage\n"
             "       A list of channel specifications, comma-separated without spaces,\n"
@@ -600,6 +270,185 @@ int GlobalHelp( int argc, const char * argv[] )
             "  --lsl-stream-name\n"
             "       The name of the LSL outlet that will be created to stream the samples\n"
             "       received from the device. If omitted, the stream will be given the name WS-default.\n"
+            "       While impedance checking is on, electrode impedances are also published\n"
+            "       on a stream with the same name followed by -Impedance, and the moment\n"
+            "       each console or --ipc command takes effect is marked on a stream with\n"
+            "       the same name followed by -Markers.\n"
+            "\n"
+            "  --max-buffered\n"
+            "       Seconds of samples liblsl keeps for each consumer that falls behind\n"
+            "       before dropping the oldest (default 360). Every consumer has its own\n"
+            "       queue, so memory use grows with the number of slow consumers.\n"
+            "\n"
+            "  --memory-budget-mb\n"
+            "       Caps the projected backlog memory per consumer of all outlets\n"
+            "       together, including the derived and extra outlets; if they exceed\n"
+            "       it, the backlog of each is shortened by the same factor. The\n"
+            "       projection per outlet and in total, and the actual memory use,\n"
+            "       are printed at start-up.\n"
+            "\n"
+            "  --compressed-outlet\n"
+            "       Also publishes the EEG losslessly compressed on a stream with the same\n"
+            "       name followed by -Compressed, for congested links. Each sample of that\n"
+            "       stream is one chunk encoded as described in eegcodec.h; consumers\n"
+            "       decode it with EegCodec_Decode. The compression ratio and encoding\n"
+            "       cost are printed when streaming stops.\n"
+            "\n"
+            "  --compressed-resolution\n"
+            "       Quantization step of the compressed stream in microvolts (default\n"
+            "       0.01). Set it to the amplifier's step size to lose no information.\n"
+            "\n"
+            "  --quality-outlet\n"
+            "       Also publishes a signal quality index per channel, twice a second, on\n"
+            "       a stream with the same name followed by -Quality. For N channels it\n"
+            "       has 5*N values: N quality indices from 0 (unusable) to 1 (clean),\n"
+            "       then N standard deviations, N shares of 50/60 Hz mains power, N\n"
+            "       shares of samples at the rails and N flatline flags, each over\n"
+            "       about the last second.\n"
+            "\n"
+            "  --sequence-channel\n"
+            "       Appends a channel named Sequence to the EEG stream with the index of\n"
+            "       each sample, counted from the start of the block and derived from\n"
+            "       the headset's packet times, modulo 16777216. A jump in the index is a\n"
+            "       dropped packet; a timestamp gap without one is only jitter. Lost,\n"
+            "       duplicated and late samples are counted either way and printed when\n"
+            "       streaming stops.\n"
+            "\n"
+            "  --pace\n"
+            "       Releases the EEG stream's chunks one chunk period apart from a\n"
+            "       high-resolution timer instead of as Bluetooth bursts complete them,\n"
+            "       for consumers that need a steady cadence. The jitter buffer deepens\n"
+            "       to the recent burst lateness and shrinks again over about 10 s.\n"
+            "       Timestamps are unchanged. The added latency and the chunk interval\n"
+            "       jitter before and after pacing are printed when streaming stops.\n"
+            "\n"
+            "  --pace-max-delay\n"
+            "       Most latency in milliseconds --pace may add (default 250); longer\n"
+            "       bursts go out late instead.\n"
+            "\n"
+            "  --raw-outlet\n"
+            "       Also publishes the signal of each EEG source (electrode) against the\n"
+            "       factory reference, before the montage and reference are applied, on\n"
+            "       a stream with the same name followed by -Raw, so that the data can\n"
+            "       be re-referenced offline. Read in the same pass as the EEG stream and\n"
+            "       chunked alongside it. Not available with --replay.\n"
+            "\n"
+            "  --extra-outlets\n"
+            "       Defines additional outlets fed from the same samples, each with its\n"
+            "       own latency and throughput policy. Definitions are separated by ';'\n"
+            "       and consist of a name, appended to the stream name, optionally\n"
+            "       followed by ':' and comma-separated settings:\n"
+            "         chunk=N          Samples per push (default 9); 1 for lowest latency\n"
+            "         pushthrough=0|1  Send every push at once (1, default) or let LSL\n"
+            "                          batch them for throughput (0)\n"
+            "         format=F         float32 (default), double64, int32 or int16\n"
+            "         resolution=UV    Microvolts per step of int32 and int16 (default 0.1)\n"
+            "         buffer=S         Seconds kept for a consumer that falls behind\n"
+            "         channels=A+B+..  Channel labels to include (default all)\n"
+            "       Example: --extra-outlets=\"Control:chunk=1,channels=C3+C4;\n"
+            "                Record:chunk=150,pushthrough=0,format=int16\"\n"
+            "\n"
+            "  --asr-outlet\n"
+            "       Also publishes the EEG cleaned of large artifacts by artifact subspace\n"
+            "       reconstruction (ASR) on a stream with the same name followed by\n"
+            "       -Cleaned. The signal is high-passed at 0.5 Hz. ASR calibrates on the\n"
+            "       first seconds of data (see --asr-calibration), which should be mostly\n"
+            "       clean; until then the stream carries the high-passed EEG unchanged.\n"
+            "       Each chunk is cleaned as it arrives, so no latency is added beyond the\n"
+            "       processing time, which is printed when streaming stops.\n"
+            "\n"
+            "  --asr-calibration\n"
+            "       Seconds of data ASR calibrates on (default 60).\n"
+            "\n"
+            "  --asr-cutoff\n"
+            "       ASR rejection threshold in standard deviations of the calibration\n"
+            "       data (default 20). Lower values remove more.\n"
+            "\n"
+            "  --epoch-outlet\n"
+            "       Also cuts an epoch around each stimulus and publishes it on a stream\n"
+            "       with the same name followed by -Epochs, and the running average of\n"
+            "       the epochs of its condition (the ERP) on one followed by -ERP. A\n"
+            "       stimulus is a change of the TRG channel to a non-zero value, whose\n"
+            "       value names the condition, or a marker (see --epoch-markers), whose\n"
+            "       string names it. Each epoch is one chunk carrying the samples' own\n"
+            "       timestamps; a Condition channel numbers the conditions in the order\n"
+            "       they first appear, which is announced on the marker stream, and the\n"
+            "       ERP stream adds the number of epochs averaged.\n"
+            "\n"
+            "  --epoch-pre-ms\n"
+            "       Milliseconds of each epoch before the stimulus (default 200).\n"
+            "\n"
+            "  --epoch-post-ms\n"
+            "       Milliseconds of each epoch from the stimulus on (default 800).\n"
+            "\n"
+            "  --epoch-markers\n"
+            "       Name of an LSL marker stream whose markers are stimuli; implies\n"
+            "       --epoch-outlet. Markers may arrive up to a second late.\n"
+            "\n"
+            "  --log-level\n"
+            "       Least severe messages to print: info (default), warning or error.\n"
+            "       Messages are queued and printed by a background thread, so a slow\n"
+            "       console never holds up acquisition.\n"
+            "\n"
+            "  --log-timestamps\n"
+            "       Starts each message with the LSL local clock time it was logged at.\n"
+            "\n"
+            "  --trace\n"
+            "       Records the timing of the pipeline (DSI_Headset_Idle, OnSample, LSL\n"
+            "       pushes, commands, analog resets) per thread and writes it to the given\n"
+            "       file as Chrome trace JSON on exit, e.g. --trace=dsi2lsl.json. Open it\n"
+            "       in https://ui.perfetto.dev or chrome://tracing.\n"
+            "\n"
+            "  --metrics\n"
+            "       Serves Prometheus metrics at http://<ADDRESS>/metrics: samples, sample\n"
+            "       rate, lost, late and dropped samples, histograms of the EEG push and\n"
+            "       DSI_Headset_Idle durations, whether the EEG stream has consumers and\n"
+            "       the electrode impedances while they are checked. ADDRESS is a port,\n"
+            "       bound to 127.0.0.1 (e.g. --metrics=9109), or host:port, e.g.\n"
+            "       --metrics=0.0.0.0:9109 to serve other machines.\n"
+            "\n"
+            "  --check-allocations\n"
+            "       Test mode: exits with an error if the acquisition code allocated or\n"
+            "       freed memory between the start and the end of data acquisition.\n"
+            "       Its buffers are sized and allocated in one block when connecting.\n"
+            "\n"
+            "  --ipc\n"
+            "       Serves a binary control and telemetry channel on the named pipe\n"
+            "       \\\\.\\pipe\\<NAME> (used by the GUI, see ipc_protocol.h).\n"
+            "\n"
+            "  --ipc-telemetry-ms\n"
+            "       Milliseconds between telemetry messages on the --ipc channel (default 100).\n"
+            "\n"
+            "  --replay\n"
+            "       Streams a recording (.xdf or .csv) through the LSL outlet instead of\n"
+            "       connecting to a headset, e.g. for load testing or reproducing issues.\n"
+            "       CSV files need a header row of channel labels, optionally preceded by\n"
+            "       a \"timestamp\" column.\n"
+            "\n"
+            "  --replay-speed\n"
+            "       Replay pace: 1 for real time (default), N for N times real time, or\n"
+            "       \"max\" (or 0) to push as fast as possible and measure throughput.\n"
+            "\n"
+            "  --replay-rate\n"
+            "       Overrides the nominal sampling rate of the replayed stream in Hz.\n"
+            "\n"
+            "  --replay-loop\n"
+            "       Restarts the replay from the beginning when the end is reached.\n"
+            "\n"
+            "  --standby\n"
+            "       Connects to the headset but waits for a \"start\" command (console or\n"
+            "       --ipc) before streaming. \"stop\" ends a block without disconnecting,\n"
+            "       so the next \"start\" streams again within a fraction of a second.\n"
+            "       Without --standby, streaming starts at once and \"stop\"/\"start\" can\n"
+            "       still be used between blocks. The time each startup phase takes is\n"
+            "       logged.\n"
+            "\n"
+            "  --shutdown-timeout-ms\n"
+            "       Most milliseconds ending acquisition may take (default 500). On\n"
+            "       \"quit\", Ctrl+C, the end of input or \"stop\", the headset is stopped,\n"
+            "       the samples it had already sent are still published until it goes\n"
+            "       quiet, and the last partial chunk is pushed with its own timestamps.\n"
+            "       The time this took is logged.\n"
             "\n"
         , argv[ 0 ] );
         return 0;
@@ -652,34 +501,13 @@ int GetIntegerOpt( int argc, const char * argv[], const char * keyword1, const c
     return result;
 }
 
-/**
- * PrintImpedances
- * ---------------
- * Callback function to collect impedance values from the DSI headset and push them to the LSL outlet in chunks.
- *
- * @param h                Valid DSI headset handle.
- * @param packetOffsetTime Unused packet offset time.
- * @param outlet           LSL outlet to push impedance data to.
- *
- * Buffers impedance values for each channel and pushes them to LSL when the buffer is full.
- */
-void PrintImpedances( DSI_Headset h, double packetOffsetTime, void * outlet )
+double GetDoubleOpt( int argc, const char * argv[], const char * keyword1, const char * keyword2, double defaultValue )
 {
-    (void)packetOffsetTime;
-    ChunkBufferManager *manager = GetChunkBufferManager(h, &impedanceManager);
-    if (!manager || !manager->buffer) return;
-
-    float* current_sample_ptr = &manager->buffer[manager->sample_index_in_chunk * manager->numberOfChannels];
-
-    for (unsigned int channelIndex = 0; channelIndex < manager->numberOfChannels; channelIndex++) {
-        current_sample_ptr[channelIndex] = (float) DSI_Source_GetImpedanceEEG(
-            DSI_Headset_GetSourceByIndex(h, channelIndex));
-    }
-
-    manager->sample_index_in_chunk++;
-
-    if (manager->sample_index_in_chunk == CHUNK_SIZE) {
-        lsl_push_chunk_ft(outlet, manager->buffer, (size_t)(CHUNK_SIZE * manager->numberOfChannels), lsl_local_clock());
-        manager->sample_index_in_chunk = 0;
-    }
+    char * end;
+    double result;
+    const char * stringValue = GetStringOpt( argc, argv, keyword1, keyword2 );
+    if( !stringValue || !*stringValue ) return defaultValue;
+    result = strtod( stringValue, &end );
+    if( end == stringValue ) return defaultValue;
+    return result;
 }
@@ -0,0 +1,452 @@
+/*
+ * dsi2lsl_bench.c
+ * ---------------------------------------------
+ * Performance regression benchmarks for the acquisition pipeline.
+ *
+ * Usage: dsi2lsl_bench [--baseline=FILE] [--tolerance=FRACTION] [--output=FILE]
+ *                      [--only=TEXT] [--pipeline]
+ *
+ * Every benchmark is fed synthetic DSI-24 EEG (synthetic.h), the gather kernels
+ * synthetic EEG with their channel count, and each reports the
+ * best of BENCH_RUNS runs in nanoseconds per sample:
+ *
+ *   gather_N       The sample callback's gather kernel (samplekernels.h)
+ *                  specialized for each channel count N, reading a synthetic
+ *                  headset through a function pointer as OnSample reads
+ *                  DSI_Channel_GetSignal; gather_N_generic is the generic loop
+ *                  on the same data, which SampleKernel_Select picks instead
+ *                  where it is faster
+ *   quality_24     Quality_Update per sample, Quality_Get twice a second
+ *   asr_24         Asr_Process per chunk, after calibration
+ *   encode_24      EegCodec_Encode per chunk
+ *   pipeline_*     The whole library in replay mode at maximum speed: chunking,
+ *                  format conversion and pushes on real LSL outlets, with
+ *                  pipeline_eeg     the EEG outlet only,
+ *                  pipeline_int16   an int16 extra outlet in addition and
+ *                  pipeline_all     quality, compressed and cleaned outlets too.
+ *                  The replayed CSV is parsed in the same loop, so these
+ *                  include a constant parsing cost. They need liblsl and run
+ *                  only with --pipeline, until bench_baseline.csv has their
+ *                  numbers from the reference machine.
+ *
+ * The results are printed as a table and, with --output, written as CSV lines
+ * "benchmark,ns_per_sample". With --baseline (CSV in the same format; lines
+ * starting with # are comments), each result is compared with the baseline
+ * and the program exits with 1 if any is slower by more than the tolerance
+ * (default 0.2, i.e. 20%) or has no baseline value, so that a benchmark
+ * cannot go unchecked. Record a new baseline with --output on the reference
+ * machine after a deliberate change in performance or a new benchmark. --only=TEXT runs only the
+ * benchmarks whose name contains TEXT.
+ */
+
+#include "libdsi2lsl.h"
+#include "quality.h"
+#include "asr.h"
+#include "eegcodec.h"
+#include "synthetic.h"
+#include "samplekernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <windows.h>
+
+#define BENCH_SECONDS 60                    /* Synthetic data per benchmark */
+#define BENCH_RUNS 5
+#define BENCH_CHUNK 9                       /* CHUNK_SIZE of the library */
+#define BENCH_DEFAULT_TOLERANCE 0.2
+#define BENCH_MAX_RESULTS 32
+#define BENCH_NAME_LENGTH 64
+#define BENCH_REPLAY_FILE "dsi2lsl_bench_replay.csv"
+#define BENCH_REPLAY_SECONDS 10             /* Looped */
+#define BENCH_PIPELINE_WARMUP 6000          /* Samples; covers the ASR calibration below */
+#define BENCH_PIPELINE_SAMPLES 200000
+#define BENCH_ASR_CALIBRATION_SECONDS 15.0
+
+typedef struct {
+  char name[ BENCH_NAME_LENGTH ];
+  double nsPerSample;
+} BenchResult;
+
+typedef struct {
+  const float *samples;                     /* Channel-interleaved */
+  unsigned int numberOfChannels;
+  size_t numberOfSamples;
+  double rate;
+} Workload;
+
+static double Now( void )
+{
+  struct timespec now;
+  timespec_get( &now, TIME_UTC );
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// -----------------------------------------------------------------------------
+// Synthetic headset
+// -----------------------------------------------------------------------------
+typedef struct SyntheticHeadset SyntheticHeadset;
+
+typedef struct {
+  const SyntheticHeadset *headset;
+  unsigned int index;
+} SyntheticChannel;
+
+struct SyntheticHeadset {
+  const float *sample;                      /* Current sample */
+  SyntheticChannel channels[ SAMPLE_KERNEL_MAX_SIZE ];
+  void *handles[ SAMPLE_KERNEL_MAX_SIZE ];  /* What the kernels get instead of DSI_Channel handles */
+};
+
+/* SampleKernel_Read in place of DSI_Channel_GetSignal */
+static double SyntheticGetSignal( void *channel )
+{
+  const SyntheticChannel *c = (const SyntheticChannel *)channel;
+  return c->headset->sample[ c->index ];
+}
+
+/* Runs a gather kernel as OnSample does, for every sample of w, into a chunk */
+static double BenchGather( const Workload *w, SampleKernel kernel )
+{
+  SyntheticHeadset h;
+  float chunk[ BENCH_CHUNK * SAMPLE_KERNEL_MAX_SIZE ];
+  volatile float sink = 0;
+  double best = 1e300;
+  unsigned int channelIndex;
+  int run, pass, passes = 20;
+
+  for( channelIndex = 0; channelIndex < w->numberOfChannels; channelIndex++ ) {
+    h.channels[ channelIndex ].headset = &h;
+    h.channels[ channelIndex ].index = channelIndex;
+    h.handles[ channelIndex ] = &h.channels[ channelIndex ];
+  }
+  for( run = 0; run < BENCH_RUNS; run++ ) {
+    double start = Now(), elapsed;
+    for( pass = 0; pass < passes; pass++ ) {
+      size_t i;
+      for( i = 0; i < w->numberOfSamples; i++ ) {
+        h.sample = w->samples + i * w->numberOfChannels;
+        kernel( h.handles, w->numberOfChannels, SyntheticGetSignal, chunk + ( i % BENCH_CHUNK ) * w->numberOfChannels );
+      }
+      sink += chunk[ 0 ];
+    }
+    elapsed = Now() - start;
+    if( elapsed < best ) best = elapsed;
+  }
+  return best * 1e9 / ( (double)w->numberOfSamples * passes );
+}
+
+// -----------------------------------------------------------------------------
+// Processing stages
+// -----------------------------------------------------------------------------
+static double BenchQuality( const Workload *w )
+{
+  void *memory = malloc( Quality_MemorySize( w->numberOfChannels ) );
+  SignalQuality *quality = Quality_Create( memory, w->numberOfChannels, w->rate, 100000.0f );
+  float *metrics = (float *)malloc( QUALITY_METRICS * w->numberOfChannels * sizeof( float ) );
+  size_t decimation = (size_t)( w->rate / 2 );
+  double best = 1e300;
+  int run;
+
+  if( !quality || !metrics ) {
+    free( memory );
+    free( metrics );
+    return -1;
+  }
+  for( run = 0; run < BENCH_RUNS; run++ ) {
+    double start = Now(), elapsed;
+    size_t i;
+    Quality_Reset( quality );
+    for( i = 0; i < w->numberOfSamples; i++ ) {
+      Quality_Update( quality, w->samples + i * w->numberOfChannels );
+      if( i % decimation == 0 ) Quality_Get( quality, metrics );
+    }
+    elapsed = Now() - start;
+    if( elapsed < best ) best = elapsed;
+  }
+  free( memory );
+  free( metrics );
+  return best * 1e9 / w->numberOfSamples;
+}
+
+static double BenchAsr( const Workload *w )
+{
+  /* Calibrates on the first third of the data, then times the rest */
+  double calibration = w->numberOfSamples / w->rate / 3;
+  size_t calibrationChunks = (size_t)( calibration * w->rate ) / BENCH_CHUNK + 1;
+  size_t numberOfChunks = w->numberOfSamples / BENCH_CHUNK, timedChunks = numberOfChunks - calibrationChunks, chunk;
+  size_t values = (size_t)BENCH_CHUNK * w->numberOfChannels;
+  float *output = (float *)malloc( values * sizeof( float ) );
+  void *memory = malloc( Asr_MemorySize( w->numberOfChannels, w->rate, calibration ) );
+  double best = 1e300;
+  int run, calibrated;
+
+  if( !output || !memory ) {
+    free( output );
+    free( memory );
+    return -1;
+  }
+  for( run = 0; run < BENCH_RUNS; run++ ) {
+    AsrFilter *asr = Asr_Create( memory, w->numberOfChannels, w->rate, calibration, ASR_DEFAULT_CUTOFF );
+    double start = 0, elapsed;
+    if( !asr ) {
+      free( output );
+      free( memory );
+      return -1;
+    }
+    for( chunk = 0; chunk < numberOfChunks; chunk++ ) {
+      if( chunk == calibrationChunks ) start = Now();
+      Asr_Process( asr, w->samples + chunk * values, output, BENCH_CHUNK, w->numberOfChannels );
+    }
+    elapsed = Now() - start;
+    if( elapsed < best ) best = elapsed;
+    calibrated = Asr_IsCalibrated( asr );
+    if( !calibrated ) {
+      free( output );
+      free( memory );
+      return -1;
+    }
+  }
+  free( output );
+  free( memory );
+  return best * 1e9 / ( (double)timedChunks * BENCH_CHUNK );
+}
+
+static double BenchEncode( const Workload *w )
+{
+  size_t numberOfChunks = w->numberOfSamples / BENCH_CHUNK, chunk;
+  size_t capacity = EegCodec_MaxEncodedSize( w->numberOfChannels, BENCH_CHUNK );
+  size_t values = (size_t)BENCH_CHUNK * w->numberOfChannels;
+  unsigned char *encoded = (unsigned char *)malloc( capacity );
+  double best = 1e300;
+  int run;
+
+  if( !encoded ) return -1;
+  for( run = 0; run < BENCH_RUNS; run++ ) {
+    double start = Now(), elapsed;
+    for( chunk = 0; chunk < numberOfChunks; chunk++ )
+      if( EegCodec_Encode( w->samples + chunk * values, w->numberOfChannels, BENCH_CHUNK, 0.01f, encoded, capacity ) == 0 )
+        return -1;
+    elapsed = Now() - start;
+    if( elapsed < best ) best = elapsed;
+  }
+  free( encoded );
+  return best * 1e9 / ( (double)numberOfChunks * BENCH_CHUNK );
+}
+
+// -----------------------------------------------------------------------------
+// Whole pipeline
+// -----------------------------------------------------------------------------
+typedef struct {
+  DSI2LSL_Session *session;
+  long long samples;
+  double start, end;
+} PipelineRun;
+
+static void CountSample( const float *sample, unsigned int numberOfChannels, double timestamp, void *userData )
+{
+  PipelineRun *run = (PipelineRun *)userData;
+  run->samples++;
+  if( run->samples == BENCH_PIPELINE_WARMUP ) run->start = Now();
+  if( run->samples == BENCH_PIPELINE_WARMUP + BENCH_PIPELINE_SAMPLES ) {
+    run->end = Now();
+    DSI2LSL_RequestStop( run->session );
+  }
+}
+
+/* Writes the replayed recording: a time stamp column, then the channels */
+static int WriteReplayFile( const Workload *w )
+{
+  FILE *f = fopen( BENCH_REPLAY_FILE, "w" );
+  size_t i, numberOfSamples = (size_t)( BENCH_REPLAY_SECONDS * w->rate );
+  unsigned int channel;
+  if( !f ) return -1;
+  fprintf( f, "timestamp" );
+  for( channel = 0; channel < w->numberOfChannels; channel++ ) fprintf( f, ",Ch%u", channel + 1 );
+  fprintf( f, "\n" );
+  for( i = 0; i < numberOfSamples; i++ ) {
+    fprintf( f, "%.6f", i / w->rate );
+    for( channel = 0; channel < w->numberOfChannels; channel++ ) fprintf( f, ",%.3f", w->samples[ i * w->numberOfChannels + channel ] );
+    fprintf( f, "\n" );
+  }
+  return fclose( f ) == 0 ? 0 : -1;
+}
+
+/* Replays BENCH_REPLAY_FILE at maximum speed with the outlets config asks for */
+static double BenchPipeline( DSI2LSL_Config *config )
+{
+  double best = 1e300;
+  int run;
+  config->replayPath = BENCH_REPLAY_FILE;
+  config->replaySpeed = 0;
+  config->replayLoop = 1;
+  config->streamName = "dsi2lsl-bench";
+  for( run = 0; run < BENCH_RUNS; run++ ) {
+    PipelineRun pipeline;
+    memset( &pipeline, 0, sizeof( pipeline ) );
+    if( DSI2LSL_Open( config, &pipeline.session ) != 0 ) return -1;
+    DSI2LSL_SetSampleCallback( pipeline.session, CountSample, &pipeline );
+    if( DSI2LSL_Start( pipeline.session ) == 0 ) {
+      while( DSI2LSL_IsRunning( pipeline.session ) ) Sleep( 10 );
+    }
+    DSI2LSL_Close( pipeline.session );
+    if( pipeline.end <= 0 ) return -1;
+    if( pipeline.end - pipeline.start < best ) best = pipeline.end - pipeline.start;
+  }
+  return best * 1e9 / BENCH_PIPELINE_SAMPLES;
+}
+
+// -----------------------------------------------------------------------------
+// Results
+// -----------------------------------------------------------------------------
+/* Reads "benchmark,ns_per_sample" lines; returns the number read, or -1 if the file cannot be opened */
+static int ReadBaseline( const char *path, BenchResult *baseline, int maxResults )
+{
+  FILE *f = fopen( path, "r" );
+  char line[ 256 ];
+  int count = 0;
+  if( !f ) return -1;
+  while( count < maxResults && fgets( line, sizeof( line ), f ) ) {
+    char *comma = strchr( line, ',' );
+    if( line[ 0 ] == '#' || !comma || comma - line >= BENCH_NAME_LENGTH ) continue;
+    *comma = '\0';
+    strcpy( baseline[ count ].name, line );
+    baseline[ count ].nsPerSample = atof( comma + 1 );
+    count++;
+  }
+  fclose( f );
+  return count;
+}
+
+static const BenchResult *FindResult( const BenchResult *results, int count, const char *name )
+{
+  int i;
+  for( i = 0; i < count; i++ )
+    if( strcmp( results[ i ].name, name ) == 0 ) return &results[ i ];
+  return NULL;
+}
+
+static void AddResult( BenchResult *results, int *count, const char *name, double nsPerSample )
+{
+  if( *count == BENCH_MAX_RESULTS ) return;
+  snprintf( results[ *count ].name, BENCH_NAME_LENGTH, "%s", name );
+  results[ *count ].nsPerSample = nsPerSample;
+  ( *count )++;
+  if( nsPerSample < 0 ) fprintf( stderr, "%s failed.\n", name );
+}
+
+int main( int argc, const char *argv[] )
+{
+  const char *baselinePath = NULL, *outputPath = NULL, *only = "";
+  double tolerance = BENCH_DEFAULT_TOLERANCE;
+  BenchResult results[ BENCH_MAX_RESULTS ], baseline[ BENCH_MAX_RESULTS ];
+  int pipeline = 0, numberOfResults = 0, numberOfBaselines = 0, regressions = 0, missing = 0, failures = 0, i;
+  Workload w;
+  float *samples;
+
+  for( i = 1; i < argc; i++ ) {
+    if( strncmp( argv[ i ], "--baseline=", 11 ) == 0 ) baselinePath = argv[ i ] + 11;
+    else if( strncmp( argv[ i ], "--tolerance=", 12 ) == 0 ) tolerance = atof( argv[ i ] + 12 );
+    else if( strncmp( argv[ i ], "--output=", 9 ) == 0 ) outputPath = argv[ i ] + 9;
+    else if( strncmp( argv[ i ], "--only=", 7 ) == 0 ) only = argv[ i ] + 7;
+    else if( strcmp( argv[ i ], "--pipeline" ) == 0 ) pipeline = 1;
+    else {
+      fprintf( stderr, "Usage: %s [--baseline=FILE] [--tolerance=FRACTION] [--output=FILE] [--only=TEXT] [--pipeline]\n", argv[ 0 ] );
+      return 2;
+    }
+  }
+  if( baselinePath ) {
+    numberOfBaselines = ReadBaseline( baselinePath, baseline, BENCH_MAX_RESULTS );
+    if( numberOfBaselines < 0 ) {
+      fprintf( stderr, "Could not read the baseline %s\n", baselinePath );
+      return 2;
+    }
+  }
+
+  w.numberOfChannels = SYNTHETIC_CHANNELS;
+  w.rate = SYNTHETIC_RATE;
+  w.numberOfSamples = (size_t)( SYNTHETIC_RATE * BENCH_SECONDS );
+  samples = (float *)malloc( w.numberOfSamples * w.numberOfChannels * sizeof( float ) );
+  if( !samples || Synthesize( samples, w.numberOfChannels, w.numberOfSamples, w.rate ) != 0 ) return 2;
+  w.samples = samples;
+
+  {
+    SampleKernel kernel;
+    unsigned int size;
+    for( i = 0; ( size = SampleKernel_Specialized( (unsigned int)i, &kernel ) ) != 0; i++ ) {
+      Workload g = w;
+      float *gatherSamples;
+      char name[ BENCH_NAME_LENGTH ], generic[ BENCH_NAME_LENGTH ];
+      snprintf( name, sizeof( name ), "gather_%u", size );
+      snprintf( generic, sizeof( generic ), "gather_%u_generic", size );
+      if( !strstr( generic, only ) ) continue;
+      gatherSamples = (float *)malloc( w.numberOfSamples * size * sizeof( float ) );
+      if( !gatherSamples || Synthesize( gatherSamples, size, w.numberOfSamples, w.rate ) != 0 ) return 2;
+      g.samples = gatherSamples;
+      g.numberOfChannels = size;
+      if( strstr( name, only ) ) AddResult( results, &numberOfResults, name, BenchGather( &g, kernel ) );
+      AddResult( results, &numberOfResults, generic, BenchGather( &g, SampleKernel_Generic ) );
+      free( gatherSamples );
+    }
+  }
+  if( strstr( "quality_24", only ) ) AddResult( results, &numberOfResults, "quality_24", BenchQuality( &w ) );
+  if( strstr( "asr_24", only ) ) AddResult( results, &numberOfResults, "asr_24", BenchAsr( &w ) );
+  if( strstr( "encode_24", only ) ) AddResult( results, &numberOfResults, "encode_24", BenchEncode( &w ) );
+
+  if( pipeline && strstr( "pipeline_eeg pipeline_int16 pipeline_all", only ) ) {
+    DSI2LSL_Config config;
+    DSI2LSL_SetLogOptions( DSI2LSL_LOG_ERROR, 0 );
+    if( WriteReplayFile( &w ) != 0 ) {
+      fprintf( stderr, "Could not write %s\n", BENCH_REPLAY_FILE );
+      return 2;
+    }
+    DSI2LSL_DefaultConfig( &config );
+    if( strstr( "pipeline_eeg", only ) ) AddResult( results, &numberOfResults, "pipeline_eeg", BenchPipeline( &config ) );
+    config.extraOutlets = "Bench:chunk=9,format=int16";
+    if( strstr( "pipeline_int16", only ) ) AddResult( results, &numberOfResults, "pipeline_int16", BenchPipeline( &config ) );
+    config.qualityOutlet = config.compressedOutlet = config.asrOutlet = 1;
+    config.asrCalibrationSeconds = BENCH_ASR_CALIBRATION_SECONDS;
+    if( strstr( "pipeline_all", only ) ) AddResult( results, &numberOfResults, "pipeline_all", BenchPipeline( &config ) );
+    remove( BENCH_REPLAY_FILE );
+  }
+
+  printf( "%-16s %14s %14s %9s\n", "benchmark", "ns/sample", "baseline", "change" );
+  for( i = 0; i < numberOfResults; i++ ) {
+    const BenchResult *r = &results[ i ], *b = FindResult( baseline, numberOfBaselines, r->name );
+    if( r->nsPerSample < 0 ) {
+      printf( "%-16s %14s\n", r->name, "failed" );
+      failures++;
+    } else if( b && b->nsPerSample > 0 ) {
+      double change = r->nsPerSample / b->nsPerSample - 1.0;
+      int regressed = change > tolerance;
+      printf( "%-16s %14.1f %14.1f %+8.1f%%%s\n", r->name, r->nsPerSample, b->nsPerSample, change * 100.0,
+              regressed ? "  REGRESSION" : "" );
+      regressions += regressed;
+    } else if( baselinePath ) {
+      printf( "%-16s %14.1f %14s\n", r->name, r->nsPerSample, "missing" );
+      missing++;
+    } else {
+      printf( "%-16s %14.1f %14s\n", r->name, r->nsPerSample, "-" );
+    }
+  }
+
+  if( outputPath ) {
+    FILE *f = fopen( outputPath, "w" );
+    if( !f ) {
+      fprintf( stderr, "Could not write %s\n", outputPath );
+      return 2;
+    }
+    fprintf( f, "# dsi2lsl_bench: best of %d runs on synthetic DSI-24 EEG\n", BENCH_RUNS );
+    for( i = 0; i < numberOfResults; i++ )
+      if( results[ i ].nsPerSample >= 0 ) fprintf( f, "%s,%.1f\n", results[ i ].name, results[ i ].nsPerSample );
+    fclose( f );
+  }
+
+  free( samples );
+  if( regressions > 0 )
+    fprintf( stderr, "%d benchmarks are more than %.0f%% slower than the baseline.\n", regressions, tolerance * 100.0 );
+  if( missing > 0 )
+    fprintf( stderr, "%d benchmarks have no baseline in %s; record it with --output on the reference machine.\n",
+             missing, baselinePath );
+  return regressions > 0 || missing > 0 || failures > 0 ? 1 : 0;
+}
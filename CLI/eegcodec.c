@@ -0,0 +1,240 @@
+/*
+ * eegcodec.c
+ * ---------------------------------------------
+ * Lossless EEG chunk codec (see eegcodec.h for the format).
+ *
+ * Bits are written most significant first. A Rice code with parameter k
+ * stores value >> k in unary (that many 1 bits and a 0) followed by the low k
+ * bits. Quotients of ESCAPE_LENGTH or more, which only occur at artifacts or
+ * when the parameter fits the rest of the chunk badly, are written as
+ * ESCAPE_LENGTH 1 bits followed by the raw 32-bit value instead.
+ */
+
+#include "eegcodec.h"
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define ESCAPE_LENGTH 24
+#define RICE_PARAMETER_BITS 5
+#define LENGTH_BITS 5
+#define MAX_RICE_PARAMETER 31
+
+typedef struct {
+  unsigned char *output;
+  size_t capacity;
+  size_t position;
+  uint64_t accumulator;
+  int bits;                          // Bits in accumulator not yet written
+  int overflow;
+} BitWriter;
+
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  size_t position;
+  uint64_t accumulator;
+  int bits;                          // Bits in accumulator not yet read
+} BitReader;
+
+/* Writes the low count bits of value; count is at most 32. */
+static void WriteBits( BitWriter *w, uint32_t value, int count )
+{
+  if( count == 0 ) return;
+  w->accumulator = ( w->accumulator << count ) | ( value & ( 0xFFFFFFFFu >> ( 32 - count ) ) );
+  w->bits += count;
+  while( w->bits >= 8 ) {
+    w->bits -= 8;
+    if( w->position < w->capacity ) w->output[ w->position++ ] = (unsigned char)( w->accumulator >> w->bits );
+    else w->overflow = 1;
+  }
+}
+
+static void FlushBits( BitWriter *w )
+{
+  if( w->bits > 0 ) WriteBits( w, 0, 8 - w->bits );
+}
+
+/* Reads count bits (at most 32). Returns 0 past the end of the data; the caller checks r->position. */
+static uint32_t ReadBits( BitReader *r, int count )
+{
+  uint32_t value;
+  if( count == 0 ) return 0;
+  while( r->bits < count ) {
+    r->accumulator = ( r->accumulator << 8 ) | ( r->position < r->size ? r->data[ r->position ] : 0 );
+    r->position++;
+    r->bits += 8;
+  }
+  r->bits -= count;
+  value = (uint32_t)( r->accumulator >> r->bits );
+  return count == 32 ? value : value & ( ( 1u << count ) - 1 );
+}
+
+static uint32_t ZigZag( int32_t value )
+{
+  return ( (uint32_t)value << 1 ) ^ (uint32_t)( value >> 31 );
+}
+
+static int32_t UnZigZag( uint32_t value )
+{
+  return (int32_t)( ( value >> 1 ) ^ ( 0u - ( value & 1 ) ) );
+}
+
+static int32_t Quantize( float value, double resolution )
+{
+  double steps = value / resolution;
+  if( !( steps == steps ) ) return 0;                 /* NaN */
+  steps = steps >= 0 ? floor( steps + 0.5 ) : ceil( steps - 0.5 );
+  if( steps > 2147483647.0 ) return INT32_MAX;
+  if( steps < -2147483648.0 ) return INT32_MIN;
+  return (int32_t)steps;
+}
+
+/* Number of significant bits in value (at least 1). */
+static int BitLength( uint32_t value )
+{
+  int length = 1;
+  while( length < 32 && ( value >> length ) ) length++;
+  return length;
+}
+
+/* Bits needed to Rice-code values with parameter k. */
+static uint64_t RiceCost( const uint32_t *values, unsigned int count, int k )
+{
+  uint64_t bits = 0;
+  unsigned int i;
+  for( i = 0; i < count; i++ ) {
+    uint32_t quotient = values[ i ] >> k;
+    bits += quotient < ESCAPE_LENGTH ? quotient + 1 + (uint64_t)k : ESCAPE_LENGTH + 32;
+  }
+  return bits;
+}
+
+/* Picks the Rice parameter for values from their mean, refined against its neighbours. */
+static int ChooseRiceParameter( const uint32_t *values, unsigned int count )
+{
+  uint64_t sum = 0, best;
+  unsigned int i;
+  int k = 0, candidate, bestK;
+
+  if( count == 0 ) return 0;
+  for( i = 0; i < count; i++ ) sum += values[ i ];
+  while( k < MAX_RICE_PARAMETER && ( (uint64_t)count << ( k + 1 ) ) <= sum ) k++;
+
+  bestK = k;
+  best = RiceCost( values, count, k );
+  for( candidate = k - 1; candidate <= k + 1; candidate += 2 ) {
+    uint64_t cost;
+    if( candidate < 0 || candidate > MAX_RICE_PARAMETER ) continue;
+    cost = RiceCost( values, count, candidate );
+    if( cost < best ) { best = cost; bestK = candidate; }
+  }
+  return bestK;
+}
+
+size_t EegCodec_MaxEncodedSize( unsigned int numberOfChannels, unsigned int numberOfSamples )
+{
+  size_t bitsPerChannel = LENGTH_BITS + 32 + RICE_PARAMETER_BITS
+                        + ( numberOfSamples > 0 ? numberOfSamples - 1 : 0 ) * (size_t)( ESCAPE_LENGTH + 32 );
+  return EEGCODEC_HEADER_SIZE + ( numberOfChannels * bitsPerChannel + 7 ) / 8;
+}
+
+size_t EegCodec_Encode( const float *samples, unsigned int numberOfChannels, unsigned int numberOfSamples,
+                        float resolution, unsigned char *output, size_t capacity )
+{
+  uint32_t differences[ EEGCODEC_MAX_SAMPLES ];
+  BitWriter w;
+  unsigned int channel, i;
+
+  if( !samples || !output || numberOfChannels == 0 || numberOfChannels > 65535
+      || numberOfSamples == 0 || numberOfSamples > EEGCODEC_MAX_SAMPLES || !( resolution > 0 ) || capacity < EEGCODEC_HEADER_SIZE )
+    return 0;
+
+  output[ 0 ] = EEGCODEC_MAGIC;
+  output[ 1 ] = EEGCODEC_VERSION;
+  output[ 2 ] = (unsigned char)( numberOfChannels & 0xFF );
+  output[ 3 ] = (unsigned char)( numberOfChannels >> 8 );
+  output[ 4 ] = (unsigned char)( numberOfSamples & 0xFF );
+  output[ 5 ] = (unsigned char)( numberOfSamples >> 8 );
+  memcpy( output + 6, &resolution, sizeof( resolution ) );
+
+  memset( &w, 0, sizeof( w ) );
+  w.output = output;
+  w.capacity = capacity;
+  w.position = EEGCODEC_HEADER_SIZE;
+
+  for( channel = 0; channel < numberOfChannels; channel++ ) {
+    int32_t previous = Quantize( samples[ channel ], resolution );
+    uint32_t first;
+    int k, length;
+    for( i = 1; i < numberOfSamples; i++ ) {
+      int32_t current = Quantize( samples[ (size_t)i * numberOfChannels + channel ], resolution );
+      /* Wrapping subtraction: the decoder's wrapping addition restores any pair of values */
+      differences[ i - 1 ] = ZigZag( (int32_t)( (uint32_t)current - (uint32_t)previous ) );
+      previous = current;
+    }
+    k = ChooseRiceParameter( differences, numberOfSamples - 1 );
+
+    /* The first value carries the electrode offset; store only its significant bits */
+    first = ZigZag( Quantize( samples[ channel ], resolution ) );
+    length = BitLength( first );
+    WriteBits( &w, (uint32_t)( length - 1 ), LENGTH_BITS );
+    WriteBits( &w, first, length );
+    WriteBits( &w, (uint32_t)k, RICE_PARAMETER_BITS );
+    for( i = 0; i < numberOfSamples - 1; i++ ) {
+      uint32_t quotient = differences[ i ] >> k;
+      if( quotient < ESCAPE_LENGTH ) {
+        /* quotient 1 bits and a terminating 0, then the low k bits */
+        WriteBits( &w, ( ( 1u << quotient ) - 1 ) << 1, (int)quotient + 1 );
+        if( k > 0 ) WriteBits( &w, differences[ i ], k );
+      } else {
+        WriteBits( &w, ( 1u << ESCAPE_LENGTH ) - 1, ESCAPE_LENGTH );
+        WriteBits( &w, differences[ i ], 32 );
+      }
+    }
+  }
+  FlushBits( &w );
+  return w.overflow ? 0 : w.position;
+}
+
+int EegCodec_ReadHeader( const unsigned char *data, size_t size, unsigned int *numberOfChannels,
+                         unsigned int *numberOfSamples, float *resolution )
+{
+  if( !data || size < EEGCODEC_HEADER_SIZE || data[ 0 ] != EEGCODEC_MAGIC || data[ 1 ] != EEGCODEC_VERSION ) return -1;
+  if( numberOfChannels ) *numberOfChannels = data[ 2 ] | ( (unsigned int)data[ 3 ] << 8 );
+  if( numberOfSamples ) *numberOfSamples = data[ 4 ] | ( (unsigned int)data[ 5 ] << 8 );
+  if( resolution ) memcpy( resolution, data + 6, sizeof( *resolution ) );
+  return 0;
+}
+
+int EegCodec_Decode( const unsigned char *data, size_t size, float *samples, size_t maxValues )
+{
+  unsigned int numberOfChannels, numberOfSamples, channel, i;
+  float resolution;
+  BitReader r;
+
+  if( EegCodec_ReadHeader( data, size, &numberOfChannels, &numberOfSamples, &resolution ) != 0 ) return -1;
+  if( !samples || (size_t)numberOfChannels * numberOfSamples > maxValues ) return -1;
+
+  memset( &r, 0, sizeof( r ) );
+  r.data = data;
+  r.size = size;
+  r.position = EEGCODEC_HEADER_SIZE;
+
+  for( channel = 0; channel < numberOfChannels; channel++ ) {
+    int length = (int)ReadBits( &r, LENGTH_BITS ) + 1;
+    uint32_t value = (uint32_t)UnZigZag( ReadBits( &r, length ) );
+    int k = (int)ReadBits( &r, RICE_PARAMETER_BITS );
+    samples[ channel ] = (float)( (int32_t)value * (double)resolution );
+    for( i = 1; i < numberOfSamples; i++ ) {
+      uint32_t quotient = 0, difference;
+      while( quotient < ESCAPE_LENGTH && ReadBits( &r, 1 ) ) quotient++;
+      if( quotient < ESCAPE_LENGTH ) difference = ( quotient << k ) | ReadBits( &r, k );
+      else difference = ReadBits( &r, 32 );
+      value += (uint32_t)UnZigZag( difference );
+      samples[ (size_t)i * numberOfChannels + channel ] = (float)( (int32_t)value * (double)resolution );
+    }
+    if( r.position > size ) return -1;            /* Ran past the end of the data */
+  }
+  return 0;
+}
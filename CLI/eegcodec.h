@@ -0,0 +1,83 @@
+/*
+ * eegcodec.h
+ * ---------------------------------------------
+ * Lossless compression of EEG chunks for the "<streamName>-Compressed" outlet
+ * (see the --compressed-outlet option of dsi2lsl).
+ *
+ * Each chunk is encoded on its own, so a consumer can start decoding at any
+ * sample of the compressed stream. Values are quantized to a fixed resolution
+ * (in microvolts), delta-encoded across samples and Rice-coded per channel
+ * with a parameter chosen for that channel and chunk. Decoding reproduces the
+ * quantized values exactly; with the resolution set to the amplifier's step
+ * size no information is lost.
+ *
+ * Encoded layout (little-endian):
+ *
+ *   uint8   EEGCODEC_MAGIC
+ *   uint8   EEGCODEC_VERSION
+ *   uint16  numberOfChannels
+ *   uint16  numberOfSamples
+ *   float32 resolution
+ *   bits    for each channel: bit length of the first value minus one (5 bits),
+ *           the zigzag-mapped first value in that many bits, the Rice
+ *           parameter (5 bits), then numberOfSamples - 1 Rice-coded,
+ *           zigzag-mapped differences
+ *
+ * This file and eegcodec.c have no dependencies besides the C library, so
+ * consumers of the compressed stream can build them as a decoder library.
+ */
+
+#ifndef EEGCODEC_H
+#define EEGCODEC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EEGCODEC_MAGIC 0xEEu
+#define EEGCODEC_VERSION 1
+#define EEGCODEC_HEADER_SIZE 10
+#define EEGCODEC_MAX_SAMPLES 1024          /* Samples per chunk the encoder accepts */
+
+/** @return Bytes EegCodec_Encode may need at most for a chunk of this shape. */
+size_t EegCodec_MaxEncodedSize( unsigned int numberOfChannels, unsigned int numberOfSamples );
+
+/**
+ * Encodes one chunk.
+ *
+ * @param samples          - numberOfSamples * numberOfChannels values, channel-interleaved
+ * @param numberOfChannels - Channels per sample (at most 65535)
+ * @param numberOfSamples  - Samples in the chunk (1 to EEGCODEC_MAX_SAMPLES)
+ * @param resolution       - Quantization step in the unit of the samples
+ * @param output           - Receives the encoded chunk
+ * @param capacity         - Size of output; EegCodec_MaxEncodedSize is always enough
+ * @return Encoded size in bytes, or 0 on error
+ */
+size_t EegCodec_Encode( const float *samples, unsigned int numberOfChannels, unsigned int numberOfSamples,
+                        float resolution, unsigned char *output, size_t capacity );
+
+/**
+ * Reads the shape of an encoded chunk without decoding it.
+ * @return 0 on success, non-zero if data is not a chunk this version can decode
+ */
+int EegCodec_ReadHeader( const unsigned char *data, size_t size, unsigned int *numberOfChannels,
+                         unsigned int *numberOfSamples, float *resolution );
+
+/**
+ * Decodes one chunk.
+ *
+ * @param data      - Encoded chunk
+ * @param size      - Size of data
+ * @param samples   - Receives numberOfSamples * numberOfChannels values, channel-interleaved
+ * @param maxValues - Capacity of samples in values
+ * @return 0 on success, non-zero if the chunk is malformed or does not fit
+ */
+int EegCodec_Decode( const unsigned char *data, size_t size, float *samples, size_t maxValues );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EEGCODEC_H */
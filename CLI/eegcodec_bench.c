@@ -0,0 +1,141 @@
+/*
+ * eegcodec_bench.c
+ * ---------------------------------------------
+ * Measures the compression ratio and the encode/decode cost per chunk of the
+ * compressed outlet codec (eegcodec.h), and checks that decoding restores the
+ * quantized values exactly.
+ *
+ * Usage: eegcodec_bench [RECORDING.xdf|.csv] [--resolution=UV] [--chunk=SAMPLES]
+ *
+ * Without a recording, 60 s of synthetic DSI-24-like EEG are used (see
+ * synthetic.h).
+ */
+
+#include "eegcodec.h"
+#include "replay.h"
+#include "synthetic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define SYNTHETIC_SECONDS 60
+#define DEFAULT_RESOLUTION 0.01f
+#define REPEATS 20
+
+/* Reads a whole recording. Returns the number of samples, or 0 on error. */
+static size_t Load( const char *path, float **samples, unsigned int *numberOfChannels, double *rate )
+{
+  ReplaySource *source = Replay_Open( path, 0 );
+  size_t count = 0, capacity = 0;
+  double timestamp;
+  if( !source ) return 0;
+  *numberOfChannels = Replay_GetNumberOfChannels( source );
+  *rate = Replay_GetSamplingRate( source );
+  *samples = NULL;
+  for( ;; ) {
+    if( count == capacity ) {
+      float *grown;
+      capacity = capacity ? capacity * 2 : 65536;
+      grown = (float *)realloc( *samples, capacity * *numberOfChannels * sizeof( float ) );
+      if( !grown ) { count = 0; break; }
+      *samples = grown;
+    }
+    if( Replay_Next( source, *samples + count * *numberOfChannels, &timestamp ) != 1 ) break;
+    count++;
+  }
+  Replay_Close( source );
+  return count;
+}
+
+int main( int argc, const char *argv[] )
+{
+  const char *path = NULL;
+  float resolution = DEFAULT_RESOLUTION;
+  unsigned int chunk = 9, numberOfChannels = SYNTHETIC_CHANNELS;
+  double rate = SYNTHETIC_RATE;
+  float *samples, *decoded;
+  unsigned char *encoded;
+  size_t numberOfSamples, numberOfChunks, capacity, encodedBytes = 0, i;
+  double maxError = 0, encodeSeconds, decodeSeconds;
+  clock_t start;
+  int repeat, mismatches = 0;
+
+  for( i = 1; i < (size_t)argc; i++ ) {
+    if( strncmp( argv[ i ], "--resolution=", 13 ) == 0 ) resolution = (float)atof( argv[ i ] + 13 );
+    else if( strncmp( argv[ i ], "--chunk=", 8 ) == 0 ) chunk = (unsigned int)atoi( argv[ i ] + 8 );
+    else path = argv[ i ];
+  }
+  if( !( resolution > 0 ) || chunk == 0 || chunk > EEGCODEC_MAX_SAMPLES ) {
+    fprintf( stderr, "Usage: %s [RECORDING.xdf|.csv] [--resolution=UV] [--chunk=1..%d]\n", argv[ 0 ], EEGCODEC_MAX_SAMPLES );
+    return 1;
+  }
+
+  if( path ) {
+    numberOfSamples = Load( path, &samples, &numberOfChannels, &rate );
+    if( numberOfSamples == 0 ) { fprintf( stderr, "Could not read %s\n", path ); return 1; }
+  } else {
+    numberOfSamples = (size_t)( SYNTHETIC_RATE * SYNTHETIC_SECONDS );
+    samples = (float *)malloc( numberOfSamples * numberOfChannels * sizeof( float ) );
+    if( !samples || Synthesize( samples, numberOfChannels, numberOfSamples, rate ) != 0 ) return 1;
+  }
+  numberOfChunks = numberOfSamples / chunk;
+  capacity = EegCodec_MaxEncodedSize( numberOfChannels, chunk );
+  encoded = (unsigned char *)malloc( numberOfChunks * capacity );
+  decoded = (float *)malloc( (size_t)chunk * numberOfChannels * sizeof( float ) );
+  if( !encoded || !decoded ) return 1;
+
+  /* Encode */
+  start = clock();
+  for( repeat = 0; repeat < REPEATS; repeat++ ) {
+    encodedBytes = 0;
+    for( i = 0; i < numberOfChunks; i++ ) {
+      size_t size = EegCodec_Encode( samples + i * chunk * numberOfChannels, numberOfChannels, chunk, resolution,
+                                     encoded + i * capacity, capacity );
+      if( size == 0 ) { fprintf( stderr, "Encoding failed at chunk %zu\n", i ); return 1; }
+      encodedBytes += size;
+    }
+  }
+  encodeSeconds = (double)( clock() - start ) / CLOCKS_PER_SEC / REPEATS;
+
+  /* Decode and verify */
+  start = clock();
+  for( repeat = 0; repeat < REPEATS; repeat++ ) {
+    for( i = 0; i < numberOfChunks; i++ ) {
+      if( EegCodec_Decode( encoded + i * capacity, capacity, decoded, (size_t)chunk * numberOfChannels ) != 0 ) {
+        fprintf( stderr, "Decoding failed at chunk %zu\n", i );
+        return 1;
+      }
+      if( repeat == 0 ) {
+        const float *original = samples + i * chunk * numberOfChannels;
+        size_t v;
+        for( v = 0; v < (size_t)chunk * numberOfChannels; v++ ) {
+          double error = fabs( (double)decoded[ v ] - original[ v ] );
+          float quantized = (float)( floor( original[ v ] / (double)resolution + 0.5 ) * (double)resolution );
+          if( error > maxError ) maxError = error;
+          if( decoded[ v ] != quantized && fabs( original[ v ] / (double)resolution - floor( original[ v ] / (double)resolution ) - 0.5 ) > 1e-6 )
+            mismatches++;
+        }
+      }
+    }
+  }
+  decodeSeconds = (double)( clock() - start ) / CLOCKS_PER_SEC / REPEATS;
+
+  printf( "Data:         %s, %u channels at %.0f Hz, %zu chunks of %u samples\n",
+          path ? path : "synthetic EEG", numberOfChannels, rate, numberOfChunks, chunk );
+  printf( "Resolution:   %g uV (max error %.4g uV, %d values differ from the quantized input)\n",
+          resolution, maxError, mismatches );
+  printf( "Size:         %.1f bytes/chunk compressed vs %zu bytes/chunk float32\n",
+          (double)encodedBytes / numberOfChunks, (size_t)chunk * numberOfChannels * sizeof( float ) );
+  printf( "Ratio:        %.2f x (%.2f bits per value)\n",
+          (double)numberOfChunks * chunk * numberOfChannels * sizeof( float ) / encodedBytes,
+          8.0 * encodedBytes / ( (double)numberOfChunks * chunk * numberOfChannels ) );
+  printf( "Encode:       %.2f us/chunk\n", encodeSeconds * 1e6 / numberOfChunks );
+  printf( "Decode:       %.2f us/chunk\n", decodeSeconds * 1e6 / numberOfChunks );
+
+  free( samples );
+  free( encoded );
+  free( decoded );
+  return mismatches ? 1 : 0;
+}
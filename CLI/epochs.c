@@ -0,0 +1,242 @@
+/*
+ * epochs.c
+ * ---------------------------------------------
+ * Event-related epochs and running ERP averages (see epochs.h).
+ *
+ * Samples are numbered from the last reset; sample n lives in slot
+ * n % capacity of the ring, which holds an epoch plus the samples that arrive
+ * within EPOCHS_MAX_MARKER_DELAY_SECONDS, so that a late marker still finds
+ * its pre-stimulus samples. A pending stimulus is due once sample
+ * stimulus + postSamples - 1 has arrived; nextDue keeps the check per sample
+ * to one comparison.
+ *
+ * Averages are updated as mean += (x - mean) / n, which stays accurate over
+ * long sessions where a running sum of microvolts would lose precision.
+ */
+
+#include "epochs.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include "alloccheck.h"
+
+typedef struct {
+  long long stimulus;                 // Number of the stimulus sample
+  int condition;
+} PendingEpoch;
+
+struct EpochExtractor {
+  unsigned int numberOfChannels;
+  double samplingRate;
+  unsigned int preSamples, postSamples, length;
+
+  /* Ring of recent samples */
+  unsigned int capacity;
+  float *samples;                     // capacity * numberOfChannels
+  double *timestamps;                 // capacity
+  long long count;                    // Samples added since the last reset
+
+  PendingEpoch pending[ EPOCHS_MAX_PENDING ];
+  unsigned int numberOfPending;
+  long long nextDue;                  // Sample count at which the first pending epoch is complete
+  long long dropped;
+
+  /* Conditions and their running averages, length * numberOfChannels values each */
+  char names[ EPOCHS_MAX_CONDITIONS ][ EPOCHS_NAME_LENGTH ];
+  int numberOfConditions;
+  float *averages;
+  long long epochs[ EPOCHS_MAX_CONDITIONS ];
+};
+
+/* Samples the ring holds: an epoch plus the samples a late marker may arrive after */
+static unsigned int RingCapacity( double samplingRate, unsigned int length )
+{
+  return length + (unsigned int)ceil( EPOCHS_MAX_MARKER_DELAY_SECONDS * samplingRate );
+}
+
+/*
+ * Lays out the extractor in memory: the struct, the timestamps, the averages
+ * and the samples. With NULL memory it only adds up the size.
+ */
+static size_t Layout( EpochExtractor *e, unsigned char *memory, unsigned int numberOfChannels, double samplingRate,
+                      unsigned int length )
+{
+  const size_t values = (size_t)length * numberOfChannels;
+  const unsigned int capacity = RingCapacity( samplingRate, length );
+  size_t used = ( sizeof( EpochExtractor ) + sizeof( double ) - 1 ) & ~( sizeof( double ) - 1 );
+  if( e ) e->timestamps = (double *)( memory + used );
+  used += capacity * sizeof( double );
+  if( e ) e->averages = (float *)( memory + used );
+  used += EPOCHS_MAX_CONDITIONS * ( values ? values : 1 ) * sizeof( float );
+  if( e ) e->samples = (float *)( memory + used );
+  used += (size_t)capacity * numberOfChannels * sizeof( float );
+  return used;
+}
+
+size_t Epochs_MemorySize( unsigned int numberOfChannels, double samplingRate,
+                          unsigned int preSamples, unsigned int postSamples )
+{
+  return Layout( NULL, NULL, numberOfChannels, samplingRate > 0 ? samplingRate : 300.0,
+                 preSamples + ( postSamples > 0 ? postSamples : 1 ) );
+}
+
+EpochExtractor *Epochs_Create( void *memory, unsigned int numberOfChannels, double samplingRate,
+                               unsigned int preSamples, unsigned int postSamples )
+{
+  EpochExtractor *e = (EpochExtractor *)memory;
+  if( !e ) return NULL;
+  memset( e, 0, Epochs_MemorySize( numberOfChannels, samplingRate, preSamples, postSamples ) );
+  e->numberOfChannels = numberOfChannels;
+  e->samplingRate = samplingRate > 0 ? samplingRate : 300.0;
+  e->preSamples = preSamples;
+  e->postSamples = postSamples > 0 ? postSamples : 1;
+  e->length = e->preSamples + e->postSamples;
+  e->capacity = RingCapacity( e->samplingRate, e->length );
+  Layout( e, (unsigned char *)memory, numberOfChannels, e->samplingRate, e->length );
+  Epochs_Reset( e );
+  return e;
+}
+
+void Epochs_Reset( EpochExtractor *e )
+{
+  e->count = 0;
+  e->dropped += e->numberOfPending;
+  e->numberOfPending = 0;
+  e->nextDue = LLONG_MAX;
+}
+
+unsigned int Epochs_Length( const EpochExtractor *e )
+{
+  return e->length;
+}
+
+int Epochs_Condition( EpochExtractor *e, const char *name, int *isNew )
+{
+  int c;
+  if( isNew ) *isNew = 0;
+  for( c = 0; c < e->numberOfConditions; c++ )
+    if( strncmp( e->names[ c ], name, EPOCHS_NAME_LENGTH - 1 ) == 0 ) return c;
+  if( e->numberOfConditions == EPOCHS_MAX_CONDITIONS ) return -1;
+  strncpy( e->names[ c ], name, EPOCHS_NAME_LENGTH - 1 );
+  e->names[ c ][ EPOCHS_NAME_LENGTH - 1 ] = '\0';
+  e->numberOfConditions++;
+  if( isNew ) *isNew = 1;
+  return c;
+}
+
+void Epochs_Add( EpochExtractor *e, const float *sample, double timestamp )
+{
+  unsigned int slot = (unsigned int)( e->count % e->capacity );
+  memcpy( e->samples + (size_t)slot * e->numberOfChannels, sample, e->numberOfChannels * sizeof( float ) );
+  e->timestamps[ slot ] = timestamp;
+  e->count++;
+}
+
+/* Queues the epoch around stimulus if its first sample is still in the ring */
+static int Schedule( EpochExtractor *e, long long stimulus, int condition )
+{
+  long long oldest = e->count > e->capacity ? e->count - e->capacity : 0;
+  PendingEpoch *p;
+  if( condition < 0 || condition >= e->numberOfConditions || stimulus - (long long)e->preSamples < oldest ||
+      stimulus >= e->count + e->capacity || e->numberOfPending == EPOCHS_MAX_PENDING ) {
+    e->dropped++;
+    return -1;
+  }
+  p = &e->pending[ e->numberOfPending++ ];
+  p->stimulus = stimulus;
+  p->condition = condition;
+  if( stimulus + e->postSamples < e->nextDue ) e->nextDue = stimulus + e->postSamples;
+  return 0;
+}
+
+int Epochs_TriggerNewest( EpochExtractor *e, int condition )
+{
+  return Schedule( e, e->count - 1, condition );
+}
+
+int Epochs_TriggerAt( EpochExtractor *e, double time, int condition )
+{
+  long long newest = e->count - 1, oldest = e->count > e->capacity ? e->count - e->capacity : 0, n;
+  double newestTime;
+  if( e->count == 0 ) {
+    e->dropped++;
+    return -1;
+  }
+  newestTime = e->timestamps[ newest % e->capacity ];
+  if( time >= newestTime )
+    return Schedule( e, newest + (long long)floor( ( time - newestTime ) * e->samplingRate + 0.5 ), condition );
+
+  /* In the past: the sample that arrived nearest to time */
+  for( n = newest; n > oldest && e->timestamps[ ( n - 1 ) % e->capacity ] > time; n-- ) ;
+  if( n > oldest && time - e->timestamps[ ( n - 1 ) % e->capacity ] < e->timestamps[ n % e->capacity ] - time ) n--;
+  if( n == oldest && e->timestamps[ n % e->capacity ] > time + 1.0 / e->samplingRate ) n = oldest - 1;  /* Older than the ring */
+  return Schedule( e, n, condition );
+}
+
+int Epochs_Next( EpochExtractor *e, float *samples, double *timestamps )
+{
+  const unsigned int C = e->numberOfChannels;
+  unsigned int i, j, next = 0;
+  long long first;
+  int condition;
+  float *average;
+  float weight;
+
+  if( e->count < e->nextDue ) return -1;
+  for( i = 0; i < e->numberOfPending; i++ )
+    if( e->pending[ i ].stimulus < e->pending[ next ].stimulus ) next = i;
+  first = e->pending[ next ].stimulus - e->preSamples;
+  condition = e->pending[ next ].condition;
+  e->pending[ next ] = e->pending[ --e->numberOfPending ];
+  e->nextDue = LLONG_MAX;
+  for( i = 0; i < e->numberOfPending; i++ )
+    if( e->pending[ i ].stimulus + e->postSamples < e->nextDue ) e->nextDue = e->pending[ i ].stimulus + e->postSamples;
+
+  e->epochs[ condition ]++;
+  weight = (float)( 1.0 / e->epochs[ condition ] );
+  average = e->averages + (size_t)condition * e->length * C;
+  for( i = 0; i < e->length; i++ ) {
+    unsigned int slot = (unsigned int)( ( first + i ) % e->capacity );
+    const float *sample = e->samples + (size_t)slot * C;
+    float *out = samples + (size_t)i * ( C + 1 ), *mean = average + (size_t)i * C;
+    for( j = 0; j < C; j++ ) {
+      out[ j ] = sample[ j ];
+      mean[ j ] += ( sample[ j ] - mean[ j ] ) * weight;
+    }
+    out[ C ] = (float)condition;
+    timestamps[ i ] = e->timestamps[ slot ];
+  }
+  return condition;
+}
+
+long long Epochs_GetAverage( const EpochExtractor *e, int condition, float *samples )
+{
+  const unsigned int C = e->numberOfChannels;
+  const float *average;
+  unsigned int i;
+  if( condition < 0 || condition >= e->numberOfConditions ) return 0;
+  average = e->averages + (size_t)condition * e->length * C;
+  for( i = 0; i < e->length; i++ ) {
+    float *out = samples + (size_t)i * ( C + 2 );
+    memcpy( out, average + (size_t)i * C, C * sizeof( float ) );
+    out[ C ] = (float)condition;
+    out[ C + 1 ] = (float)e->epochs[ condition ];
+  }
+  return e->epochs[ condition ];
+}
+
+long long Epochs_Count( const EpochExtractor *e, int condition )
+{
+  return condition >= 0 && condition < e->numberOfConditions ? e->epochs[ condition ] : 0;
+}
+
+const char *Epochs_ConditionName( const EpochExtractor *e, int condition )
+{
+  return condition >= 0 && condition < e->numberOfConditions ? e->names[ condition ] : NULL;
+}
+
+long long Epochs_Dropped( const EpochExtractor *e )
+{
+  return e->dropped;
+}
@@ -0,0 +1,109 @@
+/*
+ * epochs.h
+ * ---------------------------------------------
+ * Event-related epochs and running ERP averages for the "<streamName>-Epochs"
+ * and "<streamName>-ERP" outlets (see the --epoch-outlet option of dsi2lsl).
+ *
+ * The extractor keeps the most recent samples, with their timestamps, in a ring
+ * in the memory it is created in. A trigger marks a stimulus, either at the
+ * newest sample (an edge on the TRG channel) or at a time (an LSL marker,
+ * which may arrive up to EPOCHS_MAX_MARKER_DELAY_SECONDS after its stimulus).
+ * Once the samples after the stimulus have arrived, Epochs_Next hands out the
+ * epoch and folds it into the running average of its condition, so that an
+ * average costs one pass over the epoch however many epochs it holds.
+ *
+ * Conditions are named (a TRG value or a marker string) and numbered in the
+ * order they first appear.
+ */
+
+#ifndef EPOCHS_H
+#define EPOCHS_H
+
+#include <stddef.h>
+
+#define EPOCHS_DEFAULT_PRE_MS 200.0
+#define EPOCHS_DEFAULT_POST_MS 800.0
+#define EPOCHS_MAX_MARKER_DELAY_SECONDS 1.0   /* Markers older than this (plus the epoch) are dropped */
+#define EPOCHS_MAX_PENDING 64                 /* Stimuli waiting for their post-stimulus samples */
+#define EPOCHS_MAX_CONDITIONS 32
+#define EPOCHS_NAME_LENGTH 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct EpochExtractor EpochExtractor;
+
+/** Memory Epochs_Create needs for these parameters: the extractor, its ring and the averages. */
+size_t Epochs_MemorySize( unsigned int numberOfChannels, double samplingRate,
+                          unsigned int preSamples, unsigned int postSamples );
+
+/**
+ * Creates an extractor in memory of Epochs_MemorySize bytes, which stays the
+ * caller's; the extractor does not allocate.
+ * @param memory           - Epochs_MemorySize bytes, aligned for a double
+ * @param numberOfChannels - Channels per sample
+ * @param samplingRate     - Sampling rate in Hz
+ * @param preSamples       - Samples before the stimulus in each epoch
+ * @param postSamples      - Samples from the stimulus on (at least 1)
+ * @return The extractor (at memory), or NULL if memory is NULL
+ */
+EpochExtractor *Epochs_Create( void *memory, unsigned int numberOfChannels, double samplingRate,
+                               unsigned int preSamples, unsigned int postSamples );
+
+/** Forgets the buffered samples and pending stimuli, e.g. at the start of a new block; keeps the averages. */
+void Epochs_Reset( EpochExtractor *epochs );
+
+/** @return Samples per epoch, preSamples + postSamples */
+unsigned int Epochs_Length( const EpochExtractor *epochs );
+
+/**
+ * Looks up a condition by name, adding it if it is new.
+ * @param isNew - Set to 1 if the condition was added, otherwise 0; may be NULL
+ * @return Condition number, or -1 if EPOCHS_MAX_CONDITIONS are in use
+ */
+int Epochs_Condition( EpochExtractor *epochs, const char *name, int *isNew );
+
+/** Adds one sample (numberOfChannels values) that arrived at timestamp. */
+void Epochs_Add( EpochExtractor *epochs, const float *sample, double timestamp );
+
+/**
+ * Marks a stimulus at the newest sample, or at the sample nearest to time.
+ * @return 0 if the epoch will be cut, -1 if it was dropped (its samples are gone or too many are pending)
+ */
+int Epochs_TriggerNewest( EpochExtractor *epochs, int condition );
+int Epochs_TriggerAt( EpochExtractor *epochs, double time, int condition );
+
+/**
+ * Takes the next epoch whose samples are all in and adds it to the average
+ * of its condition.
+ * @param samples    - Receives Epochs_Length samples of numberOfChannels + 1
+ *                     values: the channels, then the condition number
+ * @param timestamps - Receives the arrival time of each sample
+ * @return Condition of the epoch, or -1 if none is complete
+ */
+int Epochs_Next( EpochExtractor *epochs, float *samples, double *timestamps );
+
+/**
+ * Copies the running average of a condition.
+ * @param samples - Receives Epochs_Length samples of numberOfChannels + 2
+ *                  values: the channels, the condition number and the number
+ *                  of epochs averaged
+ * @return Number of epochs averaged
+ */
+long long Epochs_GetAverage( const EpochExtractor *epochs, int condition, float *samples );
+
+/** @return Number of epochs averaged for a condition */
+long long Epochs_Count( const EpochExtractor *epochs, int condition );
+
+/** @return Name of a condition, or NULL if there is no such condition */
+const char *Epochs_ConditionName( const EpochExtractor *epochs, int condition );
+
+/** @return Epochs dropped since creation because their samples were gone, cut off by a reset, or too many were pending */
+long long Epochs_Dropped( const EpochExtractor *epochs );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EPOCHS_H */
@@ -0,0 +1,231 @@
+/*
+ * ipc.c
+ * ---------------------------------------------
+ * Named-pipe server for the binary control and telemetry channel (see ipc.h).
+ *
+ * The pipe is opened for overlapped I/O so that a single thread can wait for
+ * incoming commands, the next telemetry deadline and the stop request at once.
+ */
+
+#include "ipc.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <windows.h>
+
+#define IPC_PIPE_BUFFER 65536
+#define IPC_MAX_MESSAGE ( sizeof( IpcHeader ) + sizeof( IpcTelemetry ) + IPC_MAX_IMPEDANCES * sizeof( float ) )
+
+struct IpcServer {
+  char pipeName[ 256 ];
+  int telemetryIntervalMs;
+  IpcCommandHandler onCommand;
+  IpcTelemetrySource fillTelemetry;
+  void *context;
+
+  HANDLE pipe;
+  HANDLE stopEvent;
+  HANDLE readEvent;
+  HANDLE writeEvent;
+  HANDLE thread;
+};
+
+/* Writes one message and waits for it to be accepted by the pipe. Returns 0 on success. */
+static int WriteMessage( IpcServer *server, uint16_t type, uint32_t sequence, const void *payload, uint32_t length )
+{
+  unsigned char message[ IPC_MAX_MESSAGE ];
+  IpcHeader header;
+  OVERLAPPED overlapped;
+  DWORD written = 0;
+
+  if( sizeof( header ) + length > sizeof( message ) ) return -1;
+  header.magic = IPC_MAGIC;
+  header.type = type;
+  header.sequence = sequence;
+  header.length = length;
+  memcpy( message, &header, sizeof( header ) );
+  memcpy( message + sizeof( header ), payload, length );
+
+  memset( &overlapped, 0, sizeof( overlapped ) );
+  overlapped.hEvent = server->writeEvent;
+  if( !WriteFile( server->pipe, message, (DWORD)( sizeof( header ) + length ), NULL, &overlapped )
+      && GetLastError() != ERROR_IO_PENDING ) return -1;
+  if( !GetOverlappedResult( server->pipe, &overlapped, &written, TRUE ) ) return -1;
+  return written == sizeof( header ) + length ? 0 : -1;
+}
+
+static int SendTelemetry( IpcServer *server )
+{
+  unsigned char payload[ sizeof( IpcTelemetry ) + IPC_MAX_IMPEDANCES * sizeof( float ) ];
+  IpcTelemetry telemetry;
+  float impedances[ IPC_MAX_IMPEDANCES ];
+
+  memset( &telemetry, 0, sizeof( telemetry ) );
+  telemetry.numberOfImpedances = server->fillTelemetry( &telemetry, impedances, IPC_MAX_IMPEDANCES, server->context );
+  if( telemetry.numberOfImpedances > IPC_MAX_IMPEDANCES ) telemetry.numberOfImpedances = IPC_MAX_IMPEDANCES;
+  memcpy( payload, &telemetry, sizeof( telemetry ) );
+  memcpy( payload + sizeof( telemetry ), impedances, telemetry.numberOfImpedances * sizeof( float ) );
+  return WriteMessage( server, IPC_MSG_TELEMETRY, 0, payload,
+                      (uint32_t)( sizeof( telemetry ) + telemetry.numberOfImpedances * sizeof( float ) ) );
+}
+
+/*
+ * Handles all complete messages at the start of buffer and moves any partial
+ * message to the front. Returns the number of bytes left, or -1 if the client
+ * sent something that is not this protocol.
+ */
+static int HandleMessages( IpcServer *server, unsigned char *buffer, int size )
+{
+  int offset = 0;
+  while( size - offset >= (int)sizeof( IpcHeader ) ) {
+    IpcHeader header;
+    memcpy( &header, buffer + offset, sizeof( header ) );
+    if( header.magic != IPC_MAGIC || header.length > IPC_MAX_MESSAGE ) return -1;
+    if( size - offset < (int)( sizeof( header ) + header.length ) ) break;
+
+    if( header.type == IPC_MSG_COMMAND && header.length >= sizeof( IpcCommand ) ) {
+      IpcCommand command;
+      IpcAck ack;
+      memcpy( &command, buffer + offset + sizeof( header ), sizeof( command ) );
+      ack.command = command.command;
+      ack.status = server->onCommand( command.command, server->context );
+      if( WriteMessage( server, IPC_MSG_ACK, header.sequence, &ack, sizeof( ack ) ) != 0 ) return -1;
+    }
+    offset += (int)( sizeof( header ) + header.length );
+  }
+  memmove( buffer, buffer + offset, (size_t)( size - offset ) );
+  return size - offset;
+}
+
+/* Serves a connected client until it disconnects or the server is stopped. */
+static void ServeClient( IpcServer *server )
+{
+  unsigned char buffer[ IPC_MAX_MESSAGE * 2 ];
+  int buffered = 0, readPending = 0;
+  OVERLAPPED overlapped;
+  HANDLE events[ 2 ];
+  DWORD nextTelemetry = GetTickCount() + (DWORD)server->telemetryIntervalMs;
+
+  events[ 0 ] = server->stopEvent;
+  events[ 1 ] = server->readEvent;
+  for( ;; ) {
+    if( !readPending ) {
+      memset( &overlapped, 0, sizeof( overlapped ) );
+      overlapped.hEvent = server->readEvent;
+      if( !ReadFile( server->pipe, buffer + buffered, (DWORD)( sizeof( buffer ) - buffered ), NULL, &overlapped )
+          && GetLastError() != ERROR_IO_PENDING ) return;
+      readPending = 1;
+    }
+
+    DWORD now = GetTickCount();
+    DWORD timeout = (LONG)( nextTelemetry - now ) > 0 ? nextTelemetry - now : 0;
+    DWORD result = WaitForMultipleObjects( 2, events, FALSE, timeout );
+    if( result == WAIT_OBJECT_0 ) break;                       /* stop requested */
+
+    if( result == WAIT_OBJECT_0 + 1 ) {
+      DWORD received = 0;
+      readPending = 0;
+      if( !GetOverlappedResult( server->pipe, &overlapped, &received, FALSE ) ) return;
+      buffered = HandleMessages( server, buffer, buffered + (int)received );
+      if( buffered < 0 ) {
+        fprintf( stderr, "IPC: invalid message from client; disconnecting.\n" );
+        return;
+      }
+    } else if( result == WAIT_TIMEOUT ) {
+      nextTelemetry += (DWORD)server->telemetryIntervalMs;
+      if( (LONG)( nextTelemetry - GetTickCount() ) < 0 ) nextTelemetry = GetTickCount() + (DWORD)server->telemetryIntervalMs;
+      if( SendTelemetry( server ) != 0 ) break;
+    } else {
+      break;
+    }
+  }
+  if( readPending ) {
+    DWORD ignored;
+    CancelIo( server->pipe );
+    GetOverlappedResult( server->pipe, &overlapped, &ignored, TRUE );
+  }
+}
+
+/* Accepts clients one after another until the server is stopped. */
+static DWORD WINAPI IpcThread( LPVOID lpParam )
+{
+  IpcServer *server = (IpcServer *)lpParam;
+  HANDLE events[ 2 ];
+  events[ 0 ] = server->stopEvent;
+  events[ 1 ] = server->readEvent;
+
+  while( WaitForSingleObject( server->stopEvent, 0 ) == WAIT_TIMEOUT ) {
+    OVERLAPPED overlapped;
+    memset( &overlapped, 0, sizeof( overlapped ) );
+    overlapped.hEvent = server->readEvent;
+
+    if( !ConnectNamedPipe( server->pipe, &overlapped ) ) {
+      DWORD error = GetLastError();
+      if( error == ERROR_IO_PENDING ) {
+        if( WaitForMultipleObjects( 2, events, FALSE, INFINITE ) != WAIT_OBJECT_0 + 1 ) {
+          DWORD ignored;
+          CancelIo( server->pipe );
+          GetOverlappedResult( server->pipe, &overlapped, &ignored, TRUE );
+          break;
+        }
+      } else if( error != ERROR_PIPE_CONNECTED ) {
+        fprintf( stderr, "IPC: failed to accept client (error %lu).\n", error );
+        Sleep( 100 );
+        continue;
+      }
+    }
+
+    fprintf( stdout, "IPC client connected.\n" );
+    ServeClient( server );
+    DisconnectNamedPipe( server->pipe );
+    fprintf( stdout, "IPC client disconnected.\n" );
+  }
+  return 0;
+}
+
+IpcServer *Ipc_Start( const char *name, int telemetryIntervalMs, IpcCommandHandler onCommand,
+                      IpcTelemetrySource fillTelemetry, void *context )
+{
+  IpcServer *server = (IpcServer *)calloc( 1, sizeof( IpcServer ) );
+  if( !server ) return NULL;
+  snprintf( server->pipeName, sizeof( server->pipeName ), "\\\\.\\pipe\\%s", name );
+  server->telemetryIntervalMs = telemetryIntervalMs > 0 ? telemetryIntervalMs : IPC_DEFAULT_TELEMETRY_MS;
+  server->onCommand = onCommand;
+  server->fillTelemetry = fillTelemetry;
+  server->context = context;
+
+  server->pipe = CreateNamedPipeA( server->pipeName, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+                                   PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1,
+                                   IPC_PIPE_BUFFER, IPC_PIPE_BUFFER, 0, NULL );
+  if( server->pipe == INVALID_HANDLE_VALUE ) {
+    fprintf( stderr, "IPC: could not create pipe %s (error %lu).\n", server->pipeName, GetLastError() );
+    free( server );
+    return NULL;
+  }
+  server->stopEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+  server->readEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+  server->writeEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+  server->thread = CreateThread( NULL, 0, IpcThread, server, 0, NULL );
+  if( !server->stopEvent || !server->readEvent || !server->writeEvent || !server->thread ) {
+    fprintf( stderr, "IPC: could not start server thread.\n" );
+    Ipc_Stop( server );
+    return NULL;
+  }
+  fprintf( stderr, "IPC channel: %s\n", server->pipeName );
+  return server;
+}
+
+void Ipc_Stop( IpcServer *server )
+{
+  if( !server ) return;
+  if( server->stopEvent ) SetEvent( server->stopEvent );
+  if( server->thread ) {
+    WaitForSingleObject( server->thread, INFINITE );
+    CloseHandle( server->thread );
+  }
+  if( server->pipe != INVALID_HANDLE_VALUE ) CloseHandle( server->pipe );
+  if( server->stopEvent ) CloseHandle( server->stopEvent );
+  if( server->readEvent ) CloseHandle( server->readEvent );
+  if( server->writeEvent ) CloseHandle( server->writeEvent );
+  free( server );
+}
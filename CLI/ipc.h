@@ -0,0 +1,47 @@
+/*
+ * ipc.h
+ * ---------------------------------------------
+ * Named-pipe server for the binary control and telemetry channel
+ * (see ipc_protocol.h for the wire format).
+ *
+ * The server runs on its own thread and serves one client at a time. Commands
+ * are passed to a handler and acknowledged as soon as the handler returns;
+ * telemetry is requested from a callback and sent at a fixed interval.
+ */
+
+#ifndef IPC_H
+#define IPC_H
+
+#include "ipc_protocol.h"
+
+/**
+ * Handles one command. Called on the IPC thread.
+ * @return IPC_STATUS_* value sent back in the acknowledgement
+ */
+typedef int (*IpcCommandHandler)( uint32_t command, void *context );
+
+/**
+ * Fills in one telemetry message. Called on the IPC thread.
+ * @return Number of values written to impedances (at most maxImpedances)
+ */
+typedef uint32_t (*IpcTelemetrySource)( IpcTelemetry *telemetry, float *impedances, uint32_t maxImpedances, void *context );
+
+typedef struct IpcServer IpcServer;
+
+/**
+ * Creates the pipe \\.\pipe\<name> and starts serving it.
+ *
+ * @param name                - Pipe name (without the \\.\pipe\ prefix)
+ * @param telemetryIntervalMs - Milliseconds between telemetry messages
+ * @param onCommand           - Command handler
+ * @param fillTelemetry       - Telemetry source
+ * @param context             - Passed to both callbacks
+ * @return Running server, or NULL on error (the reason is printed to stderr)
+ */
+IpcServer *Ipc_Start( const char *name, int telemetryIntervalMs, IpcCommandHandler onCommand,
+                      IpcTelemetrySource fillTelemetry, void *context );
+
+/** Disconnects any client, stops the server thread and frees the server. */
+void Ipc_Stop( IpcServer *server );
+
+#endif /* IPC_H */
@@ -0,0 +1,84 @@
+/*
+ * ipc_protocol.h
+ * ---------------------------------------------
+ * Binary control and telemetry protocol between dsi2lslGUI and dsi2lsl.
+ *
+ * dsi2lsl serves a local named pipe (\\.\pipe\<name>, see the --ipc option).
+ * Every message is an IpcHeader followed by `length` bytes of payload, all
+ * little-endian and unpadded. The client sends IPC_MSG_COMMAND messages and
+ * receives one IPC_MSG_ACK per command (carrying the command's sequence number),
+ * plus an unsolicited IPC_MSG_TELEMETRY message at a fixed interval.
+ *
+ * This header is shared by the C command-line tool and the C++ GUI.
+ */
+
+#ifndef IPC_PROTOCOL_H
+#define IPC_PROTOCOL_H
+
+#include <stdint.h>
+
+#define IPC_MAGIC 0x4C44u           /* "DL" */
+#define IPC_MAX_IMPEDANCES 128
+#define IPC_DEFAULT_TELEMETRY_MS 100
+
+/* Message types */
+enum {
+  IPC_MSG_COMMAND   = 1,            /* client -> dsi2lsl, payload IpcCommand */
+  IPC_MSG_ACK       = 2,            /* dsi2lsl -> client, payload IpcAck; sent once the command is queued */
+  IPC_MSG_TELEMETRY = 3             /* dsi2lsl -> client, payload IpcTelemetry + impedances */
+};
+
+/* Commands */
+enum {
+  IPC_CMD_PING        = 0,          /* No effect; measures the round trip */
+  IPC_CMD_CHECK_Z_ON  = 1,          /* Same as the "checkZOn" console command */
+  IPC_CMD_CHECK_Z_OFF = 2,          /* Same as the "checkZOff" console command */
+  IPC_CMD_RESET_Z     = 3,          /* Same as the "resetZ" console command */
+  IPC_CMD_START_STREAMING = 4,      /* Starts a block on the connected headset ("start") */
+  IPC_CMD_STOP_STREAMING  = 5,      /* Ends the block but keeps the headset connected ("stop") */
+  IPC_CMD_SHUTDOWN        = 6       /* Flushes the last samples and exits ("quit") */
+};
+
+/* Acknowledgement status */
+enum {
+  IPC_STATUS_OK              = 0,
+  IPC_STATUS_FAILED          = -1,
+  IPC_STATUS_UNKNOWN_COMMAND = -2
+};
+
+#pragma pack(push, 1)
+
+typedef struct {
+  uint16_t magic;                   /* IPC_MAGIC */
+  uint16_t type;                    /* IPC_MSG_* */
+  uint32_t sequence;                /* Chosen by the sender; echoed in the acknowledgement */
+  uint32_t length;                  /* Payload bytes that follow */
+} IpcHeader;
+
+typedef struct {
+  uint32_t command;                 /* IPC_CMD_* */
+} IpcCommand;
+
+typedef struct {
+  uint32_t command;                 /* IPC_CMD_* being acknowledged */
+  int32_t  status;                  /* IPC_STATUS_* */
+} IpcAck;
+
+typedef struct {
+  double   timestamp;               /* LSL local clock when the message was sent */
+  double   sampleRate;              /* Samples per second received over the last interval */
+  uint64_t samples;                 /* Samples received since acquisition started */
+  uint64_t samplesLost;             /* Samples missing according to the headset packet times */
+  double   latency;                 /* Arrival delay of the last sample above the earliest arrivals, allowing for clock drift, seconds */
+  uint32_t streaming;               /* 1 while a block is streaming, 0 while standing by */
+  uint32_t maxBuffered;             /* Seconds each LSL consumer may fall behind (max_buffered) */
+  uint32_t hasConsumers;            /* 1 if the EEG outlet had a consumer at its last chunk */
+  uint32_t pullBacklog;             /* Samples waiting in the in-process pull buffer */
+  uint64_t privateMemory;           /* Private bytes of the dsi2lsl process; grows with the LSL backlog */
+  uint32_t impedanceOn;             /* 1 while the impedance driver is on */
+  uint32_t numberOfImpedances;      /* Number of float impedances (megaohms) following this struct */
+} IpcTelemetry;
+
+#pragma pack(pop)
+
+#endif /* IPC_PROTOCOL_H */
@@ -0,0 +1,3061 @@
+/*
+ * libdsi2lsl.c
+ * ---------------------------------------------
+ * Acquisition core shared by the dsi2lsl command-line tool and the GUI (see libdsi2lsl.h).
+ *
+ * A session runs a Windows thread that continuously calls DSI_Headset_Idle to
+ * process incoming data (or paces the samples of a recording in replay mode).
+ * Commands from the host are queued and applied on that same thread between
+ * Idle calls, so they never touch the headset concurrently with acquisition.
+ *
+ * Acquisition runs in blocks: the headset stays connected for the lifetime of
+ * the session, while data acquisition and the LSL outlets are started and
+ * stopped per block (StartStreaming / StopStreaming). Connecting takes
+ * seconds over Bluetooth; starting a block on a warm connection does not.
+ *
+ * Every sample goes through PublishSample, which updates the telemetry
+ * counters, hands the sample to the host (callback and pull buffer) and pushes
+ * it to LSL in chunks.
+ *
+ * For support or feature requests, create a GitHub Issue or contact support@wearablesensing.com.
+ */
+
+#include "libdsi2lsl.h"
+#include "DSI.h"
+#include "lsl_c.h"
+#include "replay.h"
+#include "eegcodec.h"
+#include "quality.h"
+#include "epochs.h"
+#include "asr.h"
+#include "pacer.h"
+#include "trace.h"
+#include "metrics.h"
+#include "portsearch.h"
+#include "samplekernels.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <math.h>
+#include <windows.h>
+#include <psapi.h>
+#include "alloccheck.h"
+
+
+// -----------------------------------------------------------------------------
+// Constants
+// -----------------------------------------------------------------------------
+#define BUFFER_SECONDS 2 // Sleep time for thread scheduling (milliseconds)
+
+/**
+ * CHUNK_SIZE: Number of samples per chunk pushed to LSL.
+ * Increasing CHUNK_SIZE beyond 9 increases timestamp difference.
+ * Decreasing it increases jitter.
+ */
+#define CHUNK_SIZE 9
+
+/**
+ * IMPEDANCE_RATE: Updates per second pushed to the impedance outlet while the
+ * impedance driver is on. Impedances change slowly, so a few Hz is enough.
+ */
+#define IMPEDANCE_RATE 4
+
+/**
+ * QUALITY_RATE: Updates per second pushed to the quality outlet.
+ * QUALITY_RAIL_MICROVOLTS: Samples at or beyond this magnitude count as rail hits.
+ */
+#define QUALITY_RATE 2
+#define QUALITY_RAIL_MICROVOLTS 100000.0f
+
+/**
+ * COMMAND_QUEUE_SIZE: Commands that can wait for the processing thread at once.
+ */
+#define COMMAND_QUEUE_SIZE 16
+
+/**
+ * PORT_CACHE_FILE: Remembers the last port found by --port=auto, in %LOCALAPPDATA%.
+ */
+#define PORT_CACHE_FILE "dsi2lsl-port.txt"
+#define DEFAULT_PORT_PROBE_MS 8000
+
+/**
+ * DEFAULT_MAX_BUFFERED: Seconds of EEG each LSL consumer may fall behind
+ * before liblsl drops its oldest samples (max_buffered of the EEG outlet).
+ * LSL_SAMPLE_OVERHEAD: Approximate bytes liblsl keeps per queued sample in
+ * addition to the channel values, used to project backlog memory.
+ */
+#define DEFAULT_MAX_BUFFERED 360
+#define LSL_SAMPLE_OVERHEAD 48
+
+/**
+ * DEFAULT_COMPRESSED_RESOLUTION: Quantization step of the compressed outlet
+ * in microvolts, well below the amplifier noise of DSI headsets.
+ */
+#define DEFAULT_COMPRESSED_RESOLUTION 0.01
+
+/**
+ * LATE_SAMPLE_SECONDS: A sample counts as late when it arrives this much later
+ * than the earliest arrivals of the block, relative to its headset time, on a
+ * baseline that follows the drift between the clocks (see PublishSample).
+ * SEQUENCE_MODULUS: The sequence channel wraps at this value, the largest
+ * range of integers a float32 channel holds exactly (15.5 h at 300 Hz).
+ */
+#define LATE_SAMPLE_SECONDS 0.1
+#define SEQUENCE_MODULUS 16777216
+
+/**
+ * DEFAULT_SHUTDOWN_MS: Time allowed for ending acquisition (see EndAcquisition);
+ * the headset stops within a few packets of the stop command.
+ * SHUTDOWN_IDLE_SECONDS: Slice of DSI_Headset_Idle while draining.
+ * SHUTDOWN_QUIET_SECONDS: The headset counts as stopped once no sample has
+ * arrived for this long, 15 sample intervals at 300 Hz.
+ * SHUTDOWN_LINGER_MS: Time liblsl gets to send the flushed chunks to connected
+ * consumers before the outlets are destroyed.
+ */
+#define DEFAULT_SHUTDOWN_MS 500
+#define SHUTDOWN_IDLE_SECONDS 0.005
+#define SHUTDOWN_QUIET_SECONDS 0.05
+#define SHUTDOWN_LINGER_MS 20
+
+/**
+ * MAX_EXTRA_OUTLETS: Outlets --extra-outlets may define.
+ * MAX_EXTRA_CHUNK: Largest chunk size of an extra outlet, in samples.
+ * DEFAULT_EXTRA_RESOLUTION: Microvolts per step of integer extra outlets.
+ */
+#define MAX_EXTRA_OUTLETS 8
+#define MAX_EXTRA_CHUNK 32768
+#define DEFAULT_EXTRA_RESOLUTION 0.1
+
+/**
+ * EPOCH_MARKER_QUEUE_SIZE: Markers the marker thread may queue between two samples.
+ * EPOCH_MARKER_POLL_MS: Longest wait of the marker thread for a stream or a
+ * marker, so that it notices the end of the session.
+ * EPOCH_MARKER_BUFFER_SECONDS: Markers liblsl keeps for the marker inlet.
+ */
+#define EPOCH_MARKER_QUEUE_SIZE 64
+#define EPOCH_MARKER_POLL_MS 100
+#define EPOCH_MARKER_BUFFER_SECONDS 60
+
+#define IMAX 16          // Length of the random LSL source IDs
+#define LABEL_LENGTH 256
+
+// -----------------------------------------------------------------------------
+// Messages and error checking
+// -----------------------------------------------------------------------------
+/*
+ * While a session is open, messages are formatted by the thread that logs
+ * them into a slot of a bounded lock-free queue (many producers, one consumer;
+ * each slot's sequence number says whether it is free or filled) and written,
+ * or handed to the host's message callback, by a background thread. A thread
+ * inside DSI_Headset_Idle or the sample callback therefore never waits for a
+ * slow console or pipe reader. When the queue is full the message is dropped
+ * and counted. Outside of a session messages are written directly.
+ */
+#define LOG_QUEUE_SIZE 256               /* Power of two */
+#define LOG_MESSAGE_LENGTH 1024
+
+typedef struct {
+  volatile LONG sequence;                // Position + 1 once filled, position + LOG_QUEUE_SIZE once free again
+  int level;                             // DSI2LSL_LOG_*
+  double timestamp;                      // LSL local clock when logged
+  char text[ LOG_MESSAGE_LENGTH ];
+} LogRecord;
+
+static DSI2LSL_MessageCallback messageCallback = NULL;
+static void *messageUserData = NULL;
+static int logMinimumLevel = DSI2LSL_LOG_INFO;
+static int logTimestamps = 0;
+
+static LogRecord logQueue[ LOG_QUEUE_SIZE ];
+static volatile LONG logHead;            // Next position to fill
+static LONG logTail;                     // Next position to write; writer only
+static volatile LONGLONG logDropped;     // Messages dropped since the writer last reported
+static volatile LONGLONG logDroppedTotal; // Messages dropped since the process started
+static volatile LONG logSessions;        // Open sessions; the writer runs while there are any
+static volatile LONG logQueued;          // Set while the writer runs
+static volatile LONG logStop;
+static HANDLE logThread, logEvent;
+
+/* Writes one message to the host's message callback, or to stdout (INFO) or stderr */
+static void WriteMessage( int level, double timestamp, const char *text )
+{
+  char stamped[ LOG_MESSAGE_LENGTH + 32 ];
+  if( logTimestamps ) {
+    snprintf( stamped, sizeof( stamped ), "[%.3f] %s", timestamp, text );
+    text = stamped;
+  }
+  if( messageCallback ) messageCallback( text, level >= DSI2LSL_LOG_WARNING, messageUserData );
+  else fputs( text, level >= DSI2LSL_LOG_WARNING ? stderr : stdout );
+}
+
+/* Writes the queued messages in order; writer thread (or after it stopped) */
+static void DrainLog( void )
+{
+  LONGLONG dropped;
+  for( ;; ) {
+    LogRecord *record = &logQueue[ logTail & ( LOG_QUEUE_SIZE - 1 ) ];
+    if( record->sequence != logTail + 1 ) break;
+    WriteMessage( record->level, record->timestamp, record->text );
+    InterlockedExchange( &record->sequence, logTail + LOG_QUEUE_SIZE );
+    logTail++;
+  }
+  dropped = InterlockedExchange64( &logDropped, 0 );
+  if( dropped > 0 ) {
+    char text[ 128 ];
+    snprintf( text, sizeof( text ), "%lld log messages were dropped because the log queue was full.\n", (long long)dropped );
+    WriteMessage( DSI2LSL_LOG_WARNING, lsl_local_clock(), text );
+  }
+}
+
+static DWORD WINAPI LogWriterThread( LPVOID lpParam )
+{
+  while( !logStop ) {
+    WaitForSingleObject( logEvent, INFINITE );
+    DrainLog();
+  }
+  DrainLog();
+  return 0;
+}
+
+/* Starts the writer thread with the first open session */
+static void StartLogWriter( void )
+{
+  if( InterlockedIncrement( &logSessions ) != 1 ) return;
+  if( !logEvent ) {
+    LONG position;
+    for( position = 0; position < LOG_QUEUE_SIZE; position++ ) logQueue[ position ].sequence = position;
+    logEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    if( !logEvent ) return;
+  }
+  logStop = 0;
+  logThread = CreateThread( NULL, 0, LogWriterThread, NULL, 0, NULL );
+  if( logThread ) InterlockedExchange( &logQueued, 1 );
+}
+
+/*
+ * Stops the writer thread with the last session, once it has written everything
+ * queued. Messages keep being queued until the writer has exited, so that none
+ * is written directly while it still writes; what arrived after its last pass
+ * is written here.
+ */
+static void StopLogWriter( void )
+{
+  if( InterlockedDecrement( &logSessions ) != 0 ) return;
+  if( logThread ) {
+    logStop = 1;
+    SetEvent( logEvent );
+    WaitForSingleObject( logThread, INFINITE );
+    CloseHandle( logThread );
+    logThread = NULL;
+  }
+  InterlockedExchange( &logQueued, 0 );
+  DrainLog();
+}
+
+/* Queues a message, or writes it directly while no writer runs */
+static void LogMessage( int level, const char *format, va_list args )
+{
+  if( level < logMinimumLevel ) return;
+  if( logQueued ) {
+    LONG position = logHead;
+    for( ;; ) {
+      LogRecord *record = &logQueue[ position & ( LOG_QUEUE_SIZE - 1 ) ];
+      LONG difference = record->sequence - position;
+      if( difference == 0 ) {
+        if( InterlockedCompareExchange( &logHead, position + 1, position ) == position ) {
+          record->level = level;
+          record->timestamp = lsl_local_clock();
+          vsnprintf( record->text, sizeof( record->text ), format, args );
+          InterlockedExchange( &record->sequence, position + 1 );   /* Publishes the record */
+          SetEvent( logEvent );
+          return;
+        }
+      } else if( difference < 0 ) {
+        InterlockedIncrement64( &logDropped );
+        InterlockedIncrement64( &logDroppedTotal );
+        return;
+      }
+      position = logHead;
+    }
+  } else {
+    char message[ LOG_MESSAGE_LENGTH ];
+    vsnprintf( message, sizeof( message ), format, args );
+    WriteMessage( level, lsl_local_clock(), message );
+  }
+}
+
+/* fprintf replacement: stdout is DSI2LSL_LOG_INFO, stderr DSI2LSL_LOG_WARNING */
+static void Log( FILE *stream, const char *format, ... )
+{
+  va_list args;
+  va_start( args, format );
+  LogMessage( stream == stderr ? DSI2LSL_LOG_WARNING : DSI2LSL_LOG_INFO, format, args );
+  va_end( args );
+}
+
+/* Replay_LogFunction: the recording's errors reach the host like the library's own */
+static void LogReplay( const char *format, va_list args )
+{
+  LogMessage( DSI2LSL_LOG_WARNING, format, args );
+}
+
+static void LogError( const char *format, ... )
+{
+  va_list args;
+  va_start( args, format );
+  LogMessage( DSI2LSL_LOG_ERROR, format, args );
+  va_end( args );
+}
+
+static int CheckError( void ) {
+  if( DSI_Error() ) { LogError( "%s\n", DSI_ClearError() ); return 1; }
+  else return 0;
+}
+#define CHECK   if (CheckError() != 0) return -1;
+
+static int Message( const char * msg, int debugLevel ){
+  Log( stderr, "DSI Message (level %d): %s\n", debugLevel, msg );
+  return 1;
+}
+
+// -----------------------------------------------------------------------------
+// Chunk buffer
+// -----------------------------------------------------------------------------
+/* Helper struct for chunk buffer management */
+typedef struct {
+    float* buffer;
+    int sample_index_in_chunk;
+    unsigned int numberOfChannels;
+} ChunkBufferManager;
+
+// -----------------------------------------------------------------------------
+// Arena
+// -----------------------------------------------------------------------------
+/**
+ * Arena: one block holding the buffers of the sample pipeline, sized and
+ * allocated by DSI2LSL_Open so that nothing is allocated once data flows.
+ * ArenaAlloc on an arena without memory only adds up the sizes; AllocatePipeline
+ * runs once like that and once on the real block.
+ */
+typedef struct {
+  unsigned char *base;
+  size_t size;
+  size_t used;
+} Arena;
+
+#define ARENA_ALIGNMENT 64        /* Cache line: buffers written by different threads do not share one */
+
+/* Returns zeroed memory from the arena, or NULL when sizing or out of space */
+static void *ArenaAlloc(Arena *arena, size_t size) {
+    size_t offset = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    arena->used = offset + size;
+    if (!arena->base || arena->used > arena->size) return NULL;
+    return arena->base + offset;
+}
+
+/* Helper function to allocate a chunk buffer for a known number of channels from the arena */
+static ChunkBufferManager* CreateChunkBufferManager(Arena *arena, unsigned int numberOfChannels) {
+    ChunkBufferManager *manager = (ChunkBufferManager*)ArenaAlloc(arena, sizeof(ChunkBufferManager));
+    float *buffer = (float*)ArenaAlloc(arena, CHUNK_SIZE * numberOfChannels * sizeof(float));
+    if (manager == NULL) return NULL;
+    manager->numberOfChannels = numberOfChannels;
+    manager->sample_index_in_chunk = 0;
+    manager->buffer = numberOfChannels > 0 ? buffer : NULL;
+    return manager;
+}
+
+/* Returns the slot in the chunk buffer where the next sample should be written */
+static float* NextSampleSlot(ChunkBufferManager *manager) {
+    return &manager->buffer[manager->sample_index_in_chunk * manager->numberOfChannels];
+}
+
+/*
+ * Commits the sample written to NextSampleSlot and pushes the chunk to LSL
+ * once CHUNK_SIZE samples have accumulated. The chunk is stamped with the
+ * local clock at push time, which LSL treats as the time of its last sample.
+ * With a NULL outlet the chunk is only completed, e.g. for the pacer to push.
+ * The time the push took is recorded in pushSeconds.
+ * Returns 1 if a chunk was completed, 0 otherwise.
+ */
+static int CommitSample(ChunkBufferManager *manager, lsl_outlet outlet, MetricsHistogram *pushSeconds) {
+    manager->sample_index_in_chunk++;
+    if (manager->sample_index_in_chunk < CHUNK_SIZE) return 0;
+
+    if (outlet) {
+        long long start = TRACE_BEGIN();
+        double pushedAt = lsl_local_clock();
+        lsl_push_chunk_ft(outlet, manager->buffer, (size_t)(CHUNK_SIZE * manager->numberOfChannels), pushedAt);
+        Metrics_Observe(pushSeconds, lsl_local_clock() - pushedAt);
+        TRACE_END("lsl_push_chunk_ft", start);
+    }
+    manager->sample_index_in_chunk = 0;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// Pull buffer
+// -----------------------------------------------------------------------------
+/**
+ * PullBuffer: single-producer, single-consumer ring of samples. The acquisition
+ * thread only advances writeCount and the host only advances readCount, so no
+ * lock is needed; the barriers order the sample data against the counters.
+ */
+typedef struct {
+  float *samples;
+  double *timestamps;
+  size_t capacity;                  // In samples
+  volatile LONGLONG writeCount;     // Samples written since the start
+  volatile LONGLONG readCount;      // Samples read since the start
+  LONGLONG dropped;                 // Samples dropped because the buffer was full
+} PullBuffer;
+
+// -----------------------------------------------------------------------------
+// Session
+// -----------------------------------------------------------------------------
+/**
+ * QueuedCommand: A command waiting to be applied by the processing thread.
+ */
+typedef struct {
+  uint32_t command;                 // IPC_CMD_*
+  double queuedAt;                  // LSL local clock when the command was queued
+} QueuedCommand;
+
+/**
+ * EpochMarker: A marker from the --epoch-markers stream waiting for the
+ * acquisition thread.
+ */
+typedef struct {
+  double time;                      // LSL local clock of the stimulus
+  char name[ EPOCHS_NAME_LENGTH ];  // Marker string, the condition's name
+} EpochMarker;
+
+/**
+ * SampleOutlets: LSL outlets and counters fed by the sample callbacks.
+ */
+typedef struct {
+  lsl_outlet eeg;                      // EEG outlet
+  lsl_outlet impedance;                // Impedance outlet (NULL if the headset has no EEG sources)
+  DSI_Source *impedanceSources;        // Sources whose impedance is published
+  char (*impedanceLabels)[ LABEL_LENGTH ]; // Their names, for --metrics
+  float *impedanceValues;              // One impedance sample
+  unsigned int numberOfImpedanceSources;
+  unsigned int impedanceDecimation;    // Samples between impedance updates
+  unsigned int samplesSinceImpedance;
+  volatile int impedanceOn;            // Set while the impedance driver is on
+
+  /* Counters for telemetry; written by the sample callback only */
+  double samplingRate;                 // Nominal sampling rate
+  volatile LONGLONG samples;           // Samples received
+  double firstPacketTime;              // Headset (or recording) time of the first sample
+  double arrivalBaseline;              // Lowest (local clock - headset time), rising with clock drift
+  double lastArrivalDelay;             // (local clock - headset time) of the last sample
+  double lastPacketTime;               // Headset (or recording) time of the last sample
+
+  /* Loss accounting by sample index, i.e. headset time since the first sample times the sampling rate */
+  LONGLONG nextIndex;                  // Index expected next
+  volatile LONGLONG lostSamples;       // Indices skipped
+  LONGLONG gaps;                       // Times indices were skipped
+  LONGLONG duplicatedSamples;          // Samples whose index was already seen
+  LONGLONG lateSamples;                // Samples that arrived LATE_SAMPLE_SECONDS late or more
+  double maxLateness;                  // Highest arrival delay beyond arrivalBaseline
+} SampleOutlets;
+
+/**
+ * ExtraOutlet: An outlet defined with --extra-outlets. It is fed from the same
+ * samples as the EEG outlet but has its own chunk size, pushthrough policy,
+ * sample format and channel subset.
+ */
+typedef struct {
+  char name[ LABEL_LENGTH ];           // Appended to the stream name
+  unsigned int chunkSize;              // Samples per push
+  int pushthrough;                     // Send each push right away instead of letting liblsl batch it
+  lsl_channel_format_t format;         // cft_float32, cft_double64, cft_int32 or cft_int16
+  double resolution;                   // Microvolts per step of the integer formats
+  int maxBuffered;                     // Seconds; 0 for the EEG outlet's until PlanBacklog
+  unsigned int numberOfChannels;
+  unsigned int *channels;              // Indices into the EEG outlet's sample; in the arena once set up
+  void *buffer;                        // chunkSize samples in format
+  unsigned int samplesInChunk;
+  lsl_outlet outlet;
+} ExtraOutlet;
+
+struct DSI2LSL_Session {
+  DSI2LSL_Config config;               // String members are NULL; copies follow
+  char streamName[ LABEL_LENGTH ];
+  char replayPath[ MAX_PATH ];
+  char tracePath[ MAX_PATH ];          // Empty unless tracing
+
+  DSI_Headset h;                       // NULL in replay mode
+  ReplaySource *replay;                // NULL unless in replay mode
+  unsigned int numberOfChannels;
+  unsigned int outletChannels;         // numberOfChannels, plus the sequence channel if enabled
+  char (*labels)[ LABEL_LENGTH ];      // Short channel labels
+  DSI_Channel *channels;               // Handles of the montage's channels, cached for OnSample
+  SampleKernel gather;                 // Reads them into the chunk (see samplekernels.h)
+  SampleKernel_Read readChannel;       // DSI_Channel_GetSignal
+
+  SampleOutlets outlets;
+  Arena arena;                         // Buffers of the sample pipeline (see AllocatePipeline)
+  ChunkBufferManager *chunk;
+  PullBuffer pull;
+  DSI2LSL_SampleCallback onSample;
+  void *onSampleData;
+
+  int maxBuffered;                     // max_buffered of the EEG and derived outlets, seconds (see PlanBacklog)
+
+  /* Streaming blocks */
+  volatile int streaming;              // Data acquisition running and outlets open
+  int blocks;                          // Blocks started so far
+  double openedAt;                     // LSL local clock when DSI2LSL_Open was called
+  double blockRequestedAt;             // When the current block was requested
+  double coldStartMs;                  // From DSI2LSL_Open to the first sample of the first block
+  double lastSampleTime;               // LSL local clock when the last sample was published
+  int shutDown;                        // DSI2LSL_Shutdown has run
+  int shutdownError;                   // and what it returned
+
+  /* Thread control */
+  volatile int keepRunning;            // Cleared to stop the threads
+  volatile int paused;                 // Pauses the processing thread
+  HANDLE processingThread;
+  int started;
+
+  /* Commands queued for the processing thread */
+  CRITICAL_SECTION commandLock;
+  HANDLE commandEvent;                 // Set when a command is queued; wakes the processing thread
+  QueuedCommand commands[ COMMAND_QUEUE_SIZE ];
+  unsigned int firstCommand, numberOfCommands;
+  lsl_outlet markers;                  // "<streamName>-Markers": when each command took effect
+
+  /* "<streamName>-Quality": per-channel signal quality (see quality.h) */
+  SignalQuality *quality;
+  lsl_outlet qualityOutlet;
+  float *qualityValues;
+  int qualityDecimation, samplesSinceQuality;
+
+  /* "<streamName>-Cleaned": the EEG cleaned by artifact subspace reconstruction */
+  AsrFilter *asr;                      // Kept across blocks so that it calibrates once
+  lsl_outlet cleaned;
+  float *cleanedBuffer;                // One chunk
+  int asrCalibrated;
+  long long asrChunks, asrRepairedChunks;
+  double asrSeconds, asrMaxSeconds;
+
+  /* Smooths the EEG outlet's chunk cadence (--pace); NULL if off */
+  Pacer *pacer;
+  void *pacerMemory;                   // Pacer and its ring, in the arena
+
+  /* "<streamName>-Raw": the EEG sources before the montage, read in the same callback as the EEG */
+  DSI_Source *rawSources;              // Cached once the headset is configured; NULL unless --raw-outlet
+  SampleKernel gatherRaw;              // Reads them into the raw chunk
+  SampleKernel_Read readSource;        // DSI_Source_GetSignal
+  unsigned int numberOfRawSources;
+  unsigned int rawChannels;            // numberOfRawSources, plus the sequence channel if enabled
+  char (*rawLabels)[ LABEL_LENGTH ];
+  char rawReference[ LABEL_LENGTH ];   // Name of the factory reference
+  lsl_outlet raw;
+  float *rawBuffer;                    // One chunk, filled in step with the EEG chunk
+
+  /* "<streamName>-<name>" outlets with their own policies (--extra-outlets) */
+  char *extraOutletSpec;               // Until parsed
+  unsigned int *parsedChannels;        // Their channel lists until AllocatePipeline copies them into the arena
+  ExtraOutlet extraOutlets[ MAX_EXTRA_OUTLETS ];
+  int numberOfExtraOutlets;
+
+  /* "<streamName>-Epochs" and "-ERP": epochs around stimuli and the running averages per condition */
+  EpochExtractor *epochs;              // Kept across blocks with its averages; NULL unless --epoch-outlet
+  lsl_outlet epochOutlet, erpOutlet;
+  float *epochBuffer;                  // One epoch, and one average, laid out as in epochs.h
+  float *erpBuffer;
+  double *epochTimestamps;
+  int trgChannel;                      // TRG in the montage, or -1
+  DSI_Source trgSource;                // TRG source of the headset if it is not in the montage; NULL otherwise
+  unsigned int epochPreSamples, epochPostSamples;
+  int trgPrimed;                       // Set once the block's first TRG value was seen
+  float previousTrg;
+  int epochConditionsFull;             // Set once a condition did not fit
+  long long epochsPushed;
+
+  /* Markers from the --epoch-markers stream, queued by the marker thread */
+  char epochMarkers[ LABEL_LENGTH ];   // Empty unless --epoch-markers
+  HANDLE markerThread;
+  CRITICAL_SECTION markerLock;
+  EpochMarker markerQueue[ EPOCH_MARKER_QUEUE_SIZE ];
+  unsigned int firstMarker;
+  volatile unsigned int numberOfMarkers;
+  long long markersDropped;            // markerLock
+
+  /* "<streamName>-Compressed": the EEG chunks encoded with eegcodec */
+  lsl_outlet compressed;
+  unsigned char *compressedBuffer;
+  size_t compressedCapacity;
+  float compressedResolution;
+  long long compressedChunks, compressedBytes;
+  double encodeSeconds;
+
+  /* Throughput statistics */
+  long long replaySamples, chunks;
+
+  /* Prometheus endpoint (--metrics); each metric below has one writer, the server only reads */
+  MetricsServer *metrics;
+  MetricsHistogram pushSeconds;        // lsl_push_chunk_ft on the EEG outlet
+  MetricsHistogram idleSeconds;        // DSI_Headset_Idle
+  volatile int eegConsumers;           // lsl_have_consumers of the EEG outlet at the last chunk
+  LONGLONG metricsPreviousSamples;     // Server thread only
+  double metricsPreviousTime;
+};
+
+static void OnSample( DSI_Headset h, double packetOffsetTime, void * userData );
+static void PrintImpedances( DSI_Headset h, double packetOffsetTime, void * userData );
+static int StartStreaming( DSI2LSL_Session *s, double requestedAt );
+static int StopStreaming( DSI2LSL_Session *s );
+
+/**
+ * Encodes the first samples of the chunk CommitSample has just pushed (all
+ * of it, except when a partial chunk is flushed) and pushes them on the
+ * compressed outlet as a single binary string sample.
+ */
+static void PushCompressedChunk( DSI2LSL_Session *s, double timestamp, unsigned int samples )
+{
+  long long span = TRACE_BEGIN();
+  double start = lsl_local_clock();
+  size_t size = EegCodec_Encode( s->chunk->buffer, s->outletChannels, samples, s->compressedResolution,
+                                 s->compressedBuffer, s->compressedCapacity );
+  char *data = (char *)s->compressedBuffer;
+  unsigned length = (unsigned)size;
+  if (size == 0) return;
+  s->encodeSeconds += lsl_local_clock() - start;
+  s->compressedBytes += (long long)size;
+  s->compressedChunks++;
+  lsl_push_sample_buft( s->compressed, &data, &length, timestamp );
+  TRACE_END( "PushCompressedChunk", span );
+}
+
+/**
+ * Cleans the first samples of the chunk CommitSample has just pushed with
+ * ASR and pushes the result on the cleaned outlet with the same timestamp.
+ */
+static void PushCleanedChunk( DSI2LSL_Session *s, double timestamp, unsigned int samples )
+{
+  long long span = TRACE_BEGIN();
+  double start = lsl_local_clock(), elapsed;
+  int removed = Asr_Process( s->asr, s->chunk->buffer, s->cleanedBuffer, samples, s->outletChannels );
+  elapsed = lsl_local_clock() - start;
+  TRACE_END( "Asr_Process", span );
+  if (s->config.sequenceChannel) {
+    unsigned int i;
+    for (i = 0; i < samples; i++)
+      s->cleanedBuffer[ i * s->outletChannels + s->numberOfChannels ] = s->chunk->buffer[ i * s->outletChannels + s->numberOfChannels ];
+  }
+  if (!s->asrCalibrated) {
+    if (Asr_IsCalibrated( s->asr )) {
+      s->asrCalibrated = 1;
+      Log(stdout, "ASR calibrated in %.0f ms; the cleaned stream is now cleaned.\n", elapsed * 1000.0);
+    }
+  } else {
+    s->asrChunks++;
+    s->asrSeconds += elapsed;
+    if (elapsed > s->asrMaxSeconds) s->asrMaxSeconds = elapsed;
+    if (removed > 0) s->asrRepairedChunks++;
+  }
+  span = TRACE_BEGIN();
+  lsl_push_chunk_ft( s->cleaned, s->cleanedBuffer, (size_t)samples * s->outletChannels, timestamp );
+  TRACE_END( "lsl_push_chunk_ft Cleaned", span );
+}
+
+/** Pacer_ReleaseCallback: pushes a paced chunk on the EEG outlet with its original timestamp. */
+static void PushPacedChunk( const float *chunk, double timestamp, void *userData )
+{
+  DSI2LSL_Session *s = (DSI2LSL_Session *)userData;
+  long long start = TRACE_BEGIN();
+  double pushedAt = lsl_local_clock();
+  lsl_push_chunk_ft( s->outlets.eeg, (float *)chunk, (size_t)CHUNK_SIZE * s->outletChannels, timestamp );
+  Metrics_Observe( &s->pushSeconds, lsl_local_clock() - pushedAt );
+  TRACE_END( "lsl_push_chunk_ft paced", start );
+}
+
+/**
+ * Pushes the first samples of the raw-source chunk filled by OnSample
+ * alongside the EEG chunk CommitSample has just pushed, with the same timestamp.
+ */
+static void PushRawChunk( DSI2LSL_Session *s, double timestamp, unsigned int samples )
+{
+  long long start;
+  if (s->config.sequenceChannel) {
+    unsigned int i;
+    for (i = 0; i < samples; i++)
+      s->rawBuffer[ i * s->rawChannels + s->numberOfRawSources ] = s->chunk->buffer[ i * s->outletChannels + s->numberOfChannels ];
+  }
+  start = TRACE_BEGIN();
+  lsl_push_chunk_ft( s->raw, s->rawBuffer, (size_t)samples * s->rawChannels, timestamp );
+  TRACE_END( "lsl_push_chunk_ft Raw", start );
+}
+
+/** Pushes the first samples of an extra outlet's chunk in its format and pushthrough policy. */
+static void PushExtraChunk( ExtraOutlet *e, unsigned int samples, double timestamp )
+{
+  const unsigned long elements = (unsigned long)samples * e->numberOfChannels;
+  long long start = TRACE_BEGIN();
+  switch (e->format) {
+  case cft_double64: lsl_push_chunk_dtp( e->outlet, (double *)e->buffer, elements, timestamp, e->pushthrough ); break;
+  case cft_int32:    lsl_push_chunk_itp( e->outlet, (int *)e->buffer, elements, timestamp, e->pushthrough ); break;
+  case cft_int16:    lsl_push_chunk_stp( e->outlet, (short *)e->buffer, elements, timestamp, e->pushthrough ); break;
+  default:           lsl_push_chunk_ftp( e->outlet, (float *)e->buffer, elements, timestamp, e->pushthrough ); break;
+  }
+  TRACE_END( "lsl_push_chunk extra", start );
+}
+
+/**
+ * Converts the channels of an extra outlet from one sample into its chunk and
+ * pushes the chunk once it is full.
+ */
+static void FeedExtraOutlet( DSI2LSL_Session *s, ExtraOutlet *e, const float *sample, double timestamp )
+{
+  const size_t offset = (size_t)e->samplesInChunk * e->numberOfChannels;
+  unsigned int c;
+
+  switch (e->format) {
+  case cft_double64:
+    for (c = 0; c < e->numberOfChannels; c++) ((double *)e->buffer)[ offset + c ] = sample[ e->channels[c] ];
+    break;
+  case cft_int32:
+  case cft_int16: {
+    /* The sequence channel is an index, not a voltage: it is not scaled, and wraps at 32768 in int16 */
+    const double limit = e->format == cft_int16 ? 32767.0 : 2147483647.0;
+    for (c = 0; c < e->numberOfChannels; c++) {
+      double value = e->channels[c] < s->numberOfChannels ? sample[ e->channels[c] ] / e->resolution
+                   : e->format == cft_int16 ? fmod( sample[ e->channels[c] ], 32768.0 ) : sample[ e->channels[c] ];
+      value = value > limit ? limit : value < -limit ? -limit : floor(value + 0.5);
+      if (e->format == cft_int16) ((short *)e->buffer)[ offset + c ] = (short)value;
+      else ((int *)e->buffer)[ offset + c ] = (int)value;
+    }
+    break;
+  }
+  default:
+    for (c = 0; c < e->numberOfChannels; c++) ((float *)e->buffer)[ offset + c ] = sample[ e->channels[c] ];
+    break;
+  }
+  if (++e->samplesInChunk < e->chunkSize) return;
+
+  e->samplesInChunk = 0;
+  PushExtraChunk( e, e->chunkSize, timestamp );
+}
+
+/**
+ * Marks a stimulus of the named condition at time, or at the newest sample if
+ * time is negative. A new condition is logged and announced on the markers
+ * outlet as "epoch condition <number>: <name>".
+ */
+static void TriggerEpoch( DSI2LSL_Session *s, const char *name, double time )
+{
+  int isNew, condition = Epochs_Condition( s->epochs, name, &isNew );
+  if (isNew) {
+    char announcement[ EPOCHS_NAME_LENGTH + 32 ], *marker[ 1 ];
+    snprintf( announcement, sizeof(announcement), "epoch condition %d: %s", condition, name );
+    marker[ 0 ] = announcement;
+    if (s->markers) lsl_push_sample_strt( s->markers, marker, lsl_local_clock() );
+    Log( stdout, "Epoch condition %d: %s\n", condition, name );
+  } else if (condition < 0 && !s->epochConditionsFull) {
+    s->epochConditionsFull = 1;
+    Log( stderr, "More than %d epoch conditions; epochs of the others are dropped.\n", EPOCHS_MAX_CONDITIONS );
+  }
+  if (time < 0) Epochs_TriggerNewest( s->epochs, condition );
+  else Epochs_TriggerAt( s->epochs, time, condition );
+}
+
+/**
+ * Adds a sample to the epoch ring, turns a TRG edge to a non-zero value and
+ * the queued markers into stimuli, and pushes each epoch that is complete,
+ * followed by the updated average of its condition.
+ */
+static void FeedEpochs( DSI2LSL_Session *s, const float *sample, double timestamp )
+{
+  const unsigned int length = Epochs_Length( s->epochs );
+  int condition;
+
+  Epochs_Add( s->epochs, sample, timestamp );
+  if (s->trgSource || s->trgChannel >= 0) {
+    float trg = s->trgSource ? (float)DSI_Source_GetSignal( s->trgSource ) : sample[ s->trgChannel ];
+    if (s->trgPrimed && trg != s->previousTrg && trg != 0.0f) {
+      char name[ EPOCHS_NAME_LENGTH ];
+      snprintf( name, sizeof(name), "%d", (int)floor( trg + 0.5f ) );
+      TriggerEpoch( s, name, -1.0 );
+    }
+    s->previousTrg = trg;
+    s->trgPrimed = 1;
+  }
+  if (s->numberOfMarkers > 0) {
+    EnterCriticalSection( &s->markerLock );
+    while (s->numberOfMarkers > 0) {
+      const EpochMarker *m = &s->markerQueue[ s->firstMarker ];
+      TriggerEpoch( s, m->name, m->time );
+      s->firstMarker = ( s->firstMarker + 1 ) % EPOCH_MARKER_QUEUE_SIZE;
+      s->numberOfMarkers--;
+    }
+    LeaveCriticalSection( &s->markerLock );
+  }
+
+  while ((condition = Epochs_Next( s->epochs, s->epochBuffer, s->epochTimestamps )) >= 0) {
+    long long start = TRACE_BEGIN();
+    lsl_push_chunk_ftn( s->epochOutlet, s->epochBuffer, (unsigned long)length * ( s->numberOfChannels + 1 ), s->epochTimestamps );
+    Epochs_GetAverage( s->epochs, condition, s->erpBuffer );
+    lsl_push_chunk_ftn( s->erpOutlet, s->erpBuffer, (unsigned long)length * ( s->numberOfChannels + 2 ), s->epochTimestamps );
+    s->epochsPushed++;
+    TRACE_END( "lsl_push_chunk_ftn Epochs", start );
+  }
+}
+
+/**
+ * Hands a sample written to NextSampleSlot to the host and to LSL.
+ *
+ * @param s - Session
+ * @param packetOffsetTime - Time the sample was sent, on the headset's clock (or on the local
+ *                           clock when replaying), used for telemetry. Its offset from the
+ *                           local clock is unknown and drifts, so lateness is measured against
+ *                           a baseline of the earliest arrivals that may rise with clock drift.
+ * @param sourceTime - Time of the sample on the headset (or recording) clock, from which
+ *                     its index is derived: the headset times its packets by their sequence
+ */
+static void PublishSample( DSI2LSL_Session *s, double packetOffsetTime, double sourceTime )
+{
+  SampleOutlets *o = &s->outlets;
+  float *sample = NextSampleSlot( s->chunk );
+  double now = lsl_local_clock();
+  double arrivalDelay = now - packetOffsetTime;
+  LONGLONG index;
+  int extra;
+  if (o->samples == 0) {
+    o->firstPacketTime = o->lastPacketTime = sourceTime;
+    o->arrivalBaseline = arrivalDelay;
+    o->maxLateness = 0;
+    o->nextIndex = 0;
+    o->lostSamples = o->gaps = o->duplicatedSamples = o->lateSamples = 0;
+    /* Startup instrumentation: how long until data actually flows */
+    if (s->blocks <= 1) {
+      s->coldStartMs = (now - s->openedAt) * 1000.0;
+      Log(stdout, "First sample %.0f ms after start (%.0f ms including connection).\n",
+          (now - s->blockRequestedAt) * 1000.0, s->coldStartMs);
+    } else {
+      Log(stdout, "First sample %.0f ms after start (the first block needed %.0f ms including connection).\n",
+          (now - s->blockRequestedAt) * 1000.0, s->coldStartMs);
+    }
+  }
+  if (arrivalDelay < o->arrivalBaseline) {
+    o->arrivalBaseline = arrivalDelay;
+  } else if (sourceTime > o->lastPacketTime) {
+    /* Follow a headset clock that runs slow, but no faster than clock drift allows (as the pacer does) */
+    double rise = PACER_MAX_DRIFT * (sourceTime - o->lastPacketTime);
+    o->arrivalBaseline += arrivalDelay - o->arrivalBaseline < rise ? arrivalDelay - o->arrivalBaseline : rise;
+  }
+  if (arrivalDelay - o->arrivalBaseline > o->maxLateness) o->maxLateness = arrivalDelay - o->arrivalBaseline;
+  o->lastArrivalDelay = arrivalDelay;
+  o->lastPacketTime = sourceTime;
+
+  /* A skipped index is a dropped packet; jitter only shows in the arrival delay */
+  index = o->samplingRate > 0 ? (LONGLONG)floor((sourceTime - o->firstPacketTime) * o->samplingRate + 0.5) : o->samples;
+  if (index > o->nextIndex) {
+    o->lostSamples += index - o->nextIndex;
+    o->gaps++;
+  } else if (index < o->nextIndex) {
+    o->duplicatedSamples++;
+  }
+  if (index >= o->nextIndex) o->nextIndex = index + 1;
+  if (arrivalDelay - o->arrivalBaseline >= LATE_SAMPLE_SECONDS) o->lateSamples++;
+  if (s->config.sequenceChannel) sample[ s->numberOfChannels ] = (float)(index % SEQUENCE_MODULUS);
+  o->samples++;
+  s->lastSampleTime = now;
+
+  if (s->onSample) s->onSample( sample, s->numberOfChannels, now, s->onSampleData );
+
+  if (s->qualityOutlet) {
+    Quality_Update( s->quality, sample );
+    if (++s->samplesSinceQuality >= s->qualityDecimation) {
+      s->samplesSinceQuality = 0;
+      Quality_Get( s->quality, s->qualityValues );
+      lsl_push_sample_ft( s->qualityOutlet, s->qualityValues, now );
+    }
+  }
+
+  if (s->pull.capacity) {
+    PullBuffer *p = &s->pull;
+    if ((size_t)(p->writeCount - p->readCount) < p->capacity) {
+      size_t slot = (size_t)(p->writeCount % (LONGLONG)p->capacity);
+      memcpy( p->samples + slot * s->numberOfChannels, sample, s->numberOfChannels * sizeof(float) );
+      p->timestamps[slot] = now;
+      MemoryBarrier();
+      p->writeCount++;
+    } else {
+      p->dropped++;
+    }
+  }
+
+  for (extra = 0; extra < s->numberOfExtraOutlets; extra++)
+    if (s->extraOutlets[extra].outlet) FeedExtraOutlet( s, &s->extraOutlets[extra], sample, now );
+
+  if (s->epochOutlet) FeedEpochs( s, sample, now );
+
+  if (CommitSample( s->chunk, s->pacer ? NULL : o->eeg, &s->pushSeconds )) {
+    s->chunks++;
+    s->eegConsumers = lsl_have_consumers( o->eeg );
+    if (s->pacer) Pacer_Submit( s->pacer, s->chunk->buffer, now );
+    if (s->compressed) PushCompressedChunk( s, now, CHUNK_SIZE );
+    if (s->cleaned) PushCleanedChunk( s, now, CHUNK_SIZE );
+    if (s->raw) PushRawChunk( s, now, CHUNK_SIZE );
+  }
+}
+
+/**
+ * Pushes the samples waiting in the chunk being filled, and in the extra
+ * outlets' chunks, when acquisition ends. Like a full chunk they carry the
+ * arrival time of their last sample, so LSL spaces the earlier ones back from
+ * it at the nominal rate instead of stamping them with the time of the flush.
+ * @return Samples flushed from the EEG chunk
+ */
+static unsigned int FlushPartialChunks( DSI2LSL_Session *s )
+{
+  unsigned int samples = (unsigned int)s->chunk->sample_index_in_chunk;
+  int extra;
+
+  /* The chunks the pacer holds are older, so they go out first */
+  if (s->pacer) Pacer_Stop( s->pacer );
+  if (samples > 0 && s->outlets.eeg) {
+    long long start = TRACE_BEGIN();
+    lsl_push_chunk_ft( s->outlets.eeg, s->chunk->buffer, (size_t)samples * s->outletChannels, s->lastSampleTime );
+    TRACE_END( "lsl_push_chunk_ft partial", start );
+    if (s->compressed) PushCompressedChunk( s, s->lastSampleTime, samples );
+    if (s->cleaned) PushCleanedChunk( s, s->lastSampleTime, samples );
+    if (s->raw) PushRawChunk( s, s->lastSampleTime, samples );
+  }
+  s->chunk->sample_index_in_chunk = 0;
+  for (extra = 0; extra < s->numberOfExtraOutlets; extra++) {
+    ExtraOutlet *e = &s->extraOutlets[extra];
+    if (e->outlet && e->samplesInChunk > 0) PushExtraChunk( e, e->samplesInChunk, s->lastSampleTime );
+    e->samplesInChunk = 0;
+  }
+  return samples;
+}
+
+/**
+ * OnSample
+ * --------
+ * Callback for each sample received from DSI headset.
+ * Buffers samples and pushes them to LSL in chunks.
+ *
+ * @param h: DSI headset handle
+ * @param packetOffsetTime: Headset time of the sample, used for telemetry
+ * @param userData: Session
+ */
+static void OnSample(DSI_Headset h, double packetOffsetTime, void *userData)
+{
+  DSI2LSL_Session *s = (DSI2LSL_Session*)userData;
+  ChunkBufferManager *manager = s->chunk;
+  long long start = TRACE_BEGIN();
+  if (!manager || !manager->buffer) return;
+
+  // Fill buffer with current sample data, with the kernel chosen for the montage
+  s->gather((void *const *)s->channels, s->numberOfChannels, s->readChannel, NextSampleSlot(manager));
+
+  // Same pass, before the montage: the cached sources fill the matching slot of the raw chunk
+  if (s->raw)
+    s->gatherRaw((void *const *)s->rawSources, s->numberOfRawSources, s->readSource,
+                 s->rawBuffer + manager->sample_index_in_chunk * s->rawChannels);
+
+  // Push chunk to LSL when buffer is full
+  PublishSample(s, packetOffsetTime, packetOffsetTime);
+  TRACE_END("OnSample", start);
+}
+
+/**
+ * PrintImpedances
+ * ---------------
+ * Sample callback used while the impedance driver is on. Forwards every sample to
+ * OnSample and, IMPEDANCE_RATE times per second, pushes the current impedance of
+ * each EEG source to the impedance outlet.
+ *
+ * @param h                Valid DSI headset handle.
+ * @param packetOffsetTime Packet offset time, forwarded to OnSample.
+ * @param userData         Session.
+ */
+static void PrintImpedances( DSI_Headset h, double packetOffsetTime, void * userData )
+{
+    SampleOutlets *o = &((DSI2LSL_Session*)userData)->outlets;
+    OnSample(h, packetOffsetTime, userData);
+
+    if (!o->impedance || ++o->samplesSinceImpedance < o->impedanceDecimation) return;
+    o->samplesSinceImpedance = 0;
+
+    for (unsigned int sourceIndex = 0; sourceIndex < o->numberOfImpedanceSources; sourceIndex++) {
+        o->impedanceValues[sourceIndex] = (float) DSI_Source_GetImpedanceEEG(o->impedanceSources[sourceIndex]);
+    }
+    lsl_push_sample_ft(o->impedance, o->impedanceValues, lsl_local_clock());
+}
+
+// -----------------------------------------------------------------------------
+// Commands
+// -----------------------------------------------------------------------------
+/* Console name of a command; also the marker pushed when it takes effect */
+static const char *CommandName( uint32_t command )
+{
+  switch( command ) {
+  case IPC_CMD_PING:        return "ping";
+  case IPC_CMD_CHECK_Z_ON:  return "checkZOn";
+  case IPC_CMD_CHECK_Z_OFF: return "checkZOff";
+  case IPC_CMD_RESET_Z:     return "resetZ";
+  case IPC_CMD_START_STREAMING: return "start";
+  case IPC_CMD_STOP_STREAMING:  return "stop";
+  case IPC_CMD_SHUTDOWN:        return "quit";
+  default:                  return "unknown";
+  }
+}
+
+/**
+ * Reset the analog impedance for a DSI headset.
+ *
+ * @param h - Valid DSI headset handle
+ * @return 0 on success
+ */
+static int startAnalogReset(DSI_Headset h) {
+    long long start;
+    if (h == NULL) {
+        Log(stderr, "Error: Invalid headset handle.\n");
+        return -1;
+    }
+    /* Check initial analog reset mode */
+    Log(stdout, "--> Initial analog reset mode: %d\n", DSI_Headset_GetAnalogResetMode(h));
+
+    start = TRACE_BEGIN();
+    DSI_Headset_StartAnalogReset(h);
+    TRACE_END("startAnalogReset", start);
+    CHECK
+    return 0;
+}
+
+/* Turns the impedance driver on and publishes impedances along with the raw signals */
+static int StartImpedance( DSI2LSL_Session *s )
+{
+  DSI_Headset_StartImpedanceDriver( s->h ); CHECK
+  /* Switch OnSample to PrintImpedances to publish impedance values along with the raw signals. */
+  DSI_Headset_SetSampleCallback( s->h, PrintImpedances, s ); CHECK
+  s->outlets.impedanceOn = 1;
+  return 0;
+}
+
+static int StopImpedance( DSI2LSL_Session *s )
+{
+  DSI_Headset_StopImpedanceDriver( s->h ); CHECK
+  DSI_Headset_SetSampleCallback( s->h, OnSample, s ); CHECK
+  s->outlets.impedanceOn = 0;
+  return 0;
+}
+
+/**
+ * Applies one queued command on the processing thread, marks the moment it
+ * took effect on the markers outlet and logs how long it waited in the queue.
+ */
+static void ApplyCommand( DSI2LSL_Session *s, const QueuedCommand *command )
+{
+  int error;
+  double appliedAt;
+  char *marker[ 1 ];
+  long long start = TRACE_BEGIN();
+
+  if( !s->streaming && command->command != IPC_CMD_START_STREAMING && command->command != IPC_CMD_STOP_STREAMING ) {
+    Log( stderr, "Command %s ignored: not streaming.\n", CommandName( command->command ) );
+    return;
+  }
+  switch( command->command ) {
+  case IPC_CMD_START_STREAMING: error = StartStreaming( s, command->queuedAt ); break;
+  case IPC_CMD_STOP_STREAMING:  error = StopStreaming( s ); break;
+  case IPC_CMD_CHECK_Z_ON:  error = StartImpedance( s ); break;
+  case IPC_CMD_CHECK_Z_OFF: error = StopImpedance( s ); break;
+  case IPC_CMD_RESET_Z:     error = startAnalogReset( s->h ); break;
+  default:                  error = 0; break;
+  }
+  appliedAt = lsl_local_clock();
+  TRACE_END( CommandName( command->command ), start );
+  if( error ) {
+    Log( stderr, "Command %s failed.\n", CommandName( command->command ) );
+    return;
+  }
+  marker[ 0 ] = (char *)CommandName( command->command );
+  if( s->markers ) lsl_push_sample_strt( s->markers, marker, appliedAt );
+  Log( stdout, "Command %s applied %.3f ms after it was queued.\n", marker[ 0 ], ( appliedAt - command->queuedAt ) * 1000.0 );
+}
+
+/* Applies every command queued so far, in order. The lock is not held while a command runs. */
+static void ApplyQueuedCommands( DSI2LSL_Session *s )
+{
+  QueuedCommand command;
+  for( ;; ) {
+    EnterCriticalSection( &s->commandLock );
+    if( s->numberOfCommands == 0 ) {
+      LeaveCriticalSection( &s->commandLock );
+      return;
+    }
+    command = s->commands[ s->firstCommand ];
+    s->firstCommand = ( s->firstCommand + 1 ) % COMMAND_QUEUE_SIZE;
+    s->numberOfCommands--;
+    LeaveCriticalSection( &s->commandLock );
+    ApplyCommand( s, &command );
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Threads
+// -----------------------------------------------------------------------------
+/**
+ * DSI_Processing_Thread
+ * ---------------------
+ * Thread function to continuously call DSI_Headset_Idle for data processing.
+ * Queued commands are applied between Idle calls.
+ * @param lpParam: Session
+ * @return DWORD: 0 on success
+ */
+static DWORD WINAPI DSI_Processing_Thread(LPVOID lpParam) {
+    DSI2LSL_Session *s = (DSI2LSL_Session *)lpParam;
+    Log(stdout, "DSI processing thread started.\n");
+    Trace_NameThread("DSI processing");
+
+    while (s->keepRunning == 1) {
+        ApplyQueuedCommands(s);
+        /* Only call Idle if the main thread hasn't paused us. */
+        if (!s->paused) {
+            long long start = TRACE_BEGIN();
+            double idleStart = lsl_local_clock();
+            DSI_Headset_Idle(s->h, 0.0);
+            Metrics_Observe(&s->idleSeconds, lsl_local_clock() - idleStart);
+            TRACE_END("DSI_Headset_Idle", start);
+            if (CheckError() != 0) {
+                Log(stderr, "Error in DSI processing thread. Exiting.\n");
+                s->keepRunning = 0; /* Signal main thread to exit. */
+            }
+        }
+        /* Wait for a tiny amount of time to prevent CPU overload; a new command ends the wait early. */
+        WaitForSingleObject(s->commandEvent, BUFFER_SECONDS);
+    }
+
+    Log(stdout, "DSI processing thread finished.\n");
+    return 0;
+}
+
+/**
+ * ReplayThread
+ * ------------
+ * Replays a recording through the same chunking, time stamping and publishing
+ * code that OnSample uses for live data. Samples are released at the recorded
+ * pace scaled by replaySpeed, and the achieved throughput is reported at the end.
+ * @param lpParam: Session
+ * @return DWORD: 0 on success
+ */
+static DWORD WINAPI ReplayThread(LPVOID lpParam) {
+  DSI2LSL_Session *s = (DSI2LSL_Session *)lpParam;
+  double speed = s->config.replaySpeed;
+  double timestamp, firstTimestamp = 0, lastTimestamp = 0, loopOffset = 0, paceStart = 0, startTime, elapsed;
+  double samplingRate = s->outlets.samplingRate;
+  int status = 0, first = 1;
+
+  Trace_NameThread("Replay");
+  startTime = lsl_local_clock();
+  while (s->keepRunning == 1) {
+    long long span;
+    status = Replay_Next(s->replay, NextSampleSlot(s->chunk), &timestamp);
+    if (status == 0 && s->config.replayLoop && Replay_Rewind(s->replay) == 0) {
+      /* Continue the sample indices across the loop */
+      loopOffset += lastTimestamp - firstTimestamp + (samplingRate > 0 ? 1.0 / samplingRate : 0.0);
+      first = 1;
+      continue;
+    }
+    if (status <= 0) break;
+
+    if (first) {
+      firstTimestamp = timestamp;
+      paceStart = lsl_local_clock();
+      first = 0;
+    }
+    if (speed > 0) {
+      /* Wait until the sample is due at the requested speed. */
+      double wait = paceStart + (timestamp - firstTimestamp) / speed - lsl_local_clock();
+      if (wait > 0.001) Sleep((DWORD)(wait * 1000.0));
+    }
+    span = TRACE_BEGIN();
+    PublishSample(s, paceStart + (timestamp - firstTimestamp) / (speed > 0 ? speed : 1.0), loopOffset + timestamp - firstTimestamp);
+    TRACE_END("PublishSample", span);
+    lastTimestamp = timestamp;
+    s->replaySamples++;
+  }
+  elapsed = lsl_local_clock() - startTime;
+
+  Log(stderr, "Replay finished: %lld samples in %lld chunks over %.3f s (%.1f samples/s, %.2fx real time at %g Hz)\n",
+      s->replaySamples, s->chunks, elapsed, elapsed > 0 ? s->replaySamples / elapsed : 0.0,
+      (elapsed > 0 && samplingRate > 0) ? s->replaySamples / elapsed / samplingRate : 0.0, samplingRate);
+  if (status < 0) Log(stderr, "Replay stopped on a read error.\n");
+  s->keepRunning = 0;
+  return 0;
+}
+
+/**
+ * EpochMarkerThread
+ * -----------------
+ * Reads the --epoch-markers stream once it appears and queues each marker,
+ * with its time on the local clock, for FeedEpochs. liblsl reconnects the
+ * inlet if the stream goes away and comes back.
+ * @param lpParam: Session
+ * @return DWORD: 0 on success
+ */
+static DWORD WINAPI EpochMarkerThread(LPVOID lpParam) {
+  DSI2LSL_Session *s = (DSI2LSL_Session *)lpParam;
+  lsl_continuous_resolver resolver = lsl_create_continuous_resolver_byprop((char *)"name", s->epochMarkers, 5.0);
+  lsl_inlet inlet = NULL;
+
+  Trace_NameThread("Epoch markers");
+  while (resolver && s->keepRunning == 1) {
+    char *marker = NULL;
+    double time;
+    int ec = 0;
+    if (!inlet) {
+      lsl_streaminfo info;
+      if (lsl_resolver_results(resolver, &info, 1) <= 0) {
+        Sleep(EPOCH_MARKER_POLL_MS);
+        continue;
+      }
+      if (lsl_get_channel_count(info) == 1) inlet = lsl_create_inlet(info, EPOCH_MARKER_BUFFER_SECONDS, 0, 1);
+      else Log(stderr, "Epoch markers: %s has %d channels instead of 1; ignored.\n", s->epochMarkers, lsl_get_channel_count(info));
+      lsl_destroy_streaminfo(info);
+      if (!inlet) break;
+      /* Marker times on this machine's clock, comparable with the sample times */
+      lsl_set_postprocessing(inlet, proc_clocksync);
+      Log(stdout, "Epoch markers: reading %s\n", s->epochMarkers);
+    }
+    time = lsl_pull_sample_str(inlet, &marker, 1, EPOCH_MARKER_POLL_MS / 1000.0, &ec);
+    if (time > 0 && marker) {
+      EnterCriticalSection(&s->markerLock);
+      if (s->numberOfMarkers < EPOCH_MARKER_QUEUE_SIZE) {
+        EpochMarker *m = &s->markerQueue[(s->firstMarker + s->numberOfMarkers) % EPOCH_MARKER_QUEUE_SIZE];
+        m->time = time;
+        strncpy_s(m->name, sizeof(m->name), marker, _TRUNCATE);
+        s->numberOfMarkers++;
+      } else {
+        s->markersDropped++;
+      }
+      LeaveCriticalSection(&s->markerLock);
+    }
+    if (marker) lsl_destroy_string(marker);
+  }
+  if (inlet) lsl_destroy_inlet(inlet);
+  if (resolver) lsl_destroy_continuous_resolver(resolver);
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Set-up and tear-down
+// -----------------------------------------------------------------------------
+static void getRandomString(char *s, const int len)
+{
+  int i = 0;
+  static const char alphanum[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)rand();
+  srand(seed); // Reseed for more randomness per call
+  for (i = 0; i < len; ++i) {
+    s[i] = alphanum[rand() % (sizeof(alphanum) - 1)];
+  }
+  s[len] = 0;
+}
+
+/**
+ * Loads the DSI dynamic library once per process.
+ * @return 0 on success
+ */
+static int LoadAPI( void )
+{
+  static int loaded = 0;
+  const char *dllname = NULL;
+  if( loaded ) return 0;
+
+  int load_error = Load_DSI_API(dllname);
+  if (load_error < 0) { Log(stderr, "failed to load dynamic library \"%s\"\n", DSI_DYLIB_NAME(dllname)); return -1; }
+  if (load_error > 0) { Log(stderr, "failed to import %d functions from dynamic library \"%s\"\n", load_error, DSI_DYLIB_NAME(dllname)); return -1; }
+  Log(stderr, "DSI API version %s loaded\n", DSI_GetAPIVersion());
+  if (strcmp(DSI_GetAPIVersion(), DSI_API_VERSION) != 0)
+    Log(stderr, "WARNING - mismatched versioning: program was compiled with DSI.h version %s but just loaded shared library version %s. You should ensure that you are using matching versions of the API files - contact Wearable Sensing if you are missing a file.\n", DSI_API_VERSION, DSI_GetAPIVersion());
+  loaded = 1;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Port discovery (--port=auto)
+// -----------------------------------------------------------------------------
+/*
+ * The search itself is in portsearch.c; the probes here connect DSI headsets.
+ * The DSI API keeps its error state globally, so probes take dsiProbeLock
+ * around every call that sets or clears it and judge a connect by
+ * DSI_Headset_IsConnected rather than by DSI_Error. DSI_Headset_Connect itself
+ * runs outside the lock: it blocks for seconds on a port without a headset,
+ * and the ports are probed concurrently to overlap those waits.
+ */
+static SRWLOCK dsiProbeLock = SRWLOCK_INIT;
+
+static int QuietMessage( const char * msg, int debugLevel ){
+  return 1;
+}
+
+/**
+ * PortProber.probe: checks whether a DSI headset answers on a serial port.
+ *
+ * @param port - Port name, e.g. "COM4"
+ * @param deviceOut - Receives the connected DSI_Headset on success
+ * @return 0 if a headset connected, non-zero otherwise.
+ */
+static int ProbeDsiPort( const char *port, void **deviceOut, void *userData )
+{
+  char device[ PORT_SEARCH_NAME_LENGTH + 8 ];
+  HANDLE serial;
+  DSI_Headset h;
+  int connected;
+  *deviceOut = NULL;
+
+  /* Ports that do not exist or are in use fail here at once, without a connect timeout. */
+  snprintf( device, sizeof( device ), "\\\\.\\%s", port );
+  serial = CreateFileA( device, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL );
+  if( serial == INVALID_HANDLE_VALUE ) return -1;
+  CloseHandle( serial );
+
+  AcquireSRWLockExclusive( &dsiProbeLock );
+  h = DSI_Headset_New( NULL );
+  if( h ) DSI_Headset_SetMessageCallback( h, QuietMessage );
+  DSI_ClearError();
+  ReleaseSRWLockExclusive( &dsiProbeLock );
+  if( !h ) return -1;
+
+  DSI_Headset_Connect( h, port );
+
+  AcquireSRWLockExclusive( &dsiProbeLock );
+  connected = DSI_Headset_IsConnected( h );
+  if( !connected ) DSI_Headset_Delete( h );
+  DSI_ClearError();
+  ReleaseSRWLockExclusive( &dsiProbeLock );
+  if( !connected ) return -1;
+  *deviceOut = h;
+  return 0;
+}
+
+/* PortProber.release: disconnects a headset found after another port won */
+static void ReleaseDsiProbe( void *device, void *userData )
+{
+  AcquireSRWLockExclusive( &dsiProbeLock );
+  DSI_Headset_Delete( (DSI_Headset)device );
+  DSI_ClearError();
+  ReleaseSRWLockExclusive( &dsiProbeLock );
+}
+
+/**
+ * PortProber.list: lists the COM ports known to the system.
+ * @return Number of ports written to ports.
+ */
+static int ListSerialPorts( char (*ports)[ PORT_SEARCH_NAME_LENGTH ], int maxPorts, void *userData )
+{
+  DWORD size = 65536;
+  char *devices = (char *)malloc( size );
+  const char *name;
+  int numberOfPorts = 0;
+
+  if( !devices ) return 0;
+  if( QueryDosDeviceA( NULL, devices, size ) == 0 ) { free( devices ); return 0; }
+  for( name = devices; *name && numberOfPorts < maxPorts; name += strlen( name ) + 1 ) {
+    if( _strnicmp( name, "COM", 3 ) == 0 && name[ 3 ] >= '0' && name[ 3 ] <= '9' && strlen( name ) < PORT_SEARCH_NAME_LENGTH )
+      strcpy_s( ports[ numberOfPorts++ ], PORT_SEARCH_NAME_LENGTH, name );
+  }
+  free( devices );
+  return numberOfPorts;
+}
+
+static void PortCachePath( char *path, size_t size )
+{
+  char directory[ MAX_PATH ];
+  DWORD length = GetEnvironmentVariableA( "LOCALAPPDATA", directory, sizeof( directory ) );
+  if( length == 0 || length >= sizeof( directory ) ) strcpy_s( directory, sizeof( directory ), "." );
+  snprintf( path, size, "%s\\%s", directory, PORT_CACHE_FILE );
+}
+
+/**
+ * Finds the serial port a DSI headset answers on for --port=auto. The port
+ * found last time is tried first; otherwise all COM ports are probed at once.
+ * The result is cached for the next launch.
+ *
+ * @param timeoutMs - Time allowed for each search
+ * @param portOut - Receives the port name (PORT_SEARCH_NAME_LENGTH bytes)
+ * @param headsetOut - Receives the connected headset
+ * @return 0 on success, non-zero if no headset answered.
+ */
+static int FindPort( int timeoutMs, char *portOut, DSI_Headset *headsetOut )
+{
+  PortProber prober = { ProbeDsiPort, ReleaseDsiProbe, ListSerialPorts, NULL };
+  PortSearchResult result;
+  char cachePath[ MAX_PATH + 32 ];
+  double start = lsl_local_clock();
+  int found;
+
+  *headsetOut = NULL;
+  PortCachePath( cachePath, sizeof( cachePath ) );
+  found = PortSearch_Find( &prober, cachePath, timeoutMs, &result ) == 0;
+  if( result.busy > 0 )
+    Log( stderr, "Skipped %d serial ports whose earlier probe has not returned.\n", result.busy );
+  if( !found ) {
+    if( result.numberOfPorts == 0 ) Log( stderr, "No serial ports found.\n" );
+    else Log( stderr, "No DSI headset answered on %d serial ports within %d ms; use --port to choose the port.\n",
+              result.numberOfPorts, timeoutMs );
+    return -1;
+  }
+  if( result.cached )
+    Log( stdout, "Found DSI headset on %s (cached) in %.0f ms\n", result.port, ( lsl_local_clock() - start ) * 1000.0 );
+  else
+    Log( stdout, "Found DSI headset on %s in %.0f ms, probing %d serial ports\n", result.port,
+         ( lsl_local_clock() - start ) * 1000.0, result.numberOfPorts );
+  strncpy_s( portOut, PORT_SEARCH_NAME_LENGTH, result.port, _TRUNCATE );
+  *headsetOut = (DSI_Headset)result.device;
+  return 0;
+}
+
+/**
+ * Initializes and connects to the DSI headset, prepares it for
+ * data acquisition.
+ *
+ * @param config - Session configuration
+ * @param headsetOut - Output pointer to store initialized headset handle.
+ *
+ * @return 0 on success, non-zero on error.
+ */
+static int StartUp( const DSI2LSL_Config *config, DSI_Headset * headsetOut )
+{
+  DSI_Headset h;
+  char foundPort[ PORT_SEARCH_NAME_LENGTH ];
+  int autoPort = config->port && _stricmp( config->port, "auto" ) == 0;
+  double connectStart = lsl_local_clock();
+  *headsetOut = NULL;
+
+  if( autoPort ) {
+    /* The probe that found the headset has already connected it */
+    if( FindPort( config->portProbeMs > 0 ? config->portProbeMs : DEFAULT_PORT_PROBE_MS, foundPort, &h ) != 0 )
+      return -1;
+  } else {
+    /* Passing NULL defers setup of the serial port connection until later... */
+    h = DSI_Headset_New( NULL ); CHECK
+  }
+
+  /*
+   * ...which allows us to configure the way we handle any debugging messages
+   * that occur during connection (see our definition of the `DSI_MessageCallback`
+   * function `Message()` above).
+   */
+  DSI_Headset_SetMessageCallback( h, Message ); CHECK
+  DSI_Headset_SetVerbosity( h, config->verbosity ); CHECK
+
+  /* Hand the headset to the caller now so that it is deleted if a later step fails. */
+  *headsetOut = h;
+
+  /*
+   * Now we establish the serial port connection and initialize the headset.
+   * The string supplied in the --port command-line option is used as the
+   * serial port address (if this string is empty, the API will automatically
+   * look for an environment variable called DSISerialPort).
+   */
+  if( !autoPort ) {
+    connectStart = lsl_local_clock();
+    DSI_Headset_Connect( h, config->port ); CHECK
+  }
+  double connectEnd = lsl_local_clock();
+
+  /*
+   * Sets up the montage according to strings supplied in the --montage and
+   * --reference command-line options, if any.
+   */
+  DSI_Headset_ChooseChannels( h, config->montage, config->reference, 1 ); CHECK
+  Log( stdout, "Startup: connect %.0f ms, choose channels %.0f ms\n",
+       ( connectEnd - connectStart ) * 1000.0, ( lsl_local_clock() - connectEnd ) * 1000.0 );
+
+  /* Prints an overview of what is known about the headset. */
+  Log( stderr, "%s\n", DSI_Headset_GetInfoString( h ) ); CHECK
+
+  return 0;
+}
+
+/** @return Private bytes of this process, or 0 if unknown. */
+static size_t PrivateMemory( void )
+{
+  PROCESS_MEMORY_COUNTERS_EX counters;
+  memset( &counters, 0, sizeof( counters ) );
+  counters.cb = sizeof( counters );
+  if( !GetProcessMemoryInfo( GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&counters, sizeof( counters ) ) ) return 0;
+  return counters.PrivateUsage;
+}
+
+/** Logs the memory the process actually uses at a point during start-up. */
+static void LogMemoryUse( const char *when )
+{
+  size_t bytes = PrivateMemory();
+  if( bytes ) Log( stdout, "Process memory %s: %.1f MB\n", when, bytes / ( 1024.0 * 1024.0 ) );
+}
+
+/**
+ * Creates the EEG outlet and describes its channels and reference.
+ *
+ * @param streamName - Name of the LSL stream
+ * @param numberOfChannels - Number of channels per sample
+ * @param samplingRate - Nominal sampling rate in Hz
+ * @param labels - One label per channel
+ * @param reference - Label of the reference used
+ * @param maxBuffered - Seconds of samples kept for each consumer that falls behind
+ * @param sequenceChannel - Non-zero to append the sample index channel
+ * @return New LSL outlet, or NULL on error
+ */
+static lsl_outlet CreateOutlet(const char * streamName, unsigned int numberOfChannels, double samplingRate,
+                               char (*labels)[ LABEL_LENGTH ], const char * reference, int maxBuffered, int sequenceChannel)
+{
+  unsigned int channelIndex;
+
+	/* Out stream declaration object */
+  lsl_streaminfo info;
+	/* Some xml element pointers */
+  lsl_xml_ptr desc, chn, chns, ref;
+  char source_id[IMAX + 1];
+
+	/* Note: an even better choice here may be the serial number of the device. */
+  getRandomString(source_id, IMAX);
+  Log(stderr, "Source ID: %s\n", source_id);
+
+  /* Declare a new streaminfo (name: WearableSensing, content type: EEG, number of channels, srate, float values, source id. */
+  info = lsl_create_streaminfo((char*)streamName,"EEG",numberOfChannels + (sequenceChannel ? 1 : 0),samplingRate,cft_float32,source_id);
+
+  if(!info) {
+      Log(stderr, "Failed to create LSL streaminfo.\n");
+      return NULL;
+  }
+  Log(stderr, "Stream Name: %s\n", streamName);
+  /* Add some meta-data fields to it (for more standard fields, see https://github.com/sccn/xdf/wiki/Meta-Data). */
+  desc = lsl_get_desc(info);
+  lsl_append_child_value(desc,"manufacturer","WearableSensing");
+
+	/* Describe channel info */
+  chns = lsl_append_child(desc,"channels");
+  for( channelIndex=0; channelIndex < numberOfChannels ; channelIndex++)
+  {
+    chn = lsl_append_child(chns,"channel");
+    /* Cmit channel info */
+    lsl_append_child_value(chn,"label", labels[channelIndex]);
+    lsl_append_child_value(chn,"unit","microvolts");
+    lsl_append_child_value(chn,"type","EEG");
+  }
+  if (sequenceChannel) {
+    /* Index of the sample from the headset's packet times, modulo SEQUENCE_MODULUS: gaps are dropped samples */
+    chn = lsl_append_child(chns,"channel");
+    lsl_append_child_value(chn,"label","Sequence");
+    lsl_append_child_value(chn,"unit","samples");
+    lsl_append_child_value(chn,"type","Sequence");
+  }
+
+	/* Describe reference used */
+  ref = lsl_append_child(desc,"reference");
+  lsl_append_child_value(ref,"label", (char*)reference);
+  Log(stdout, "REF: %s\n", reference);
+
+  /* Make a new outlet (chunking: default, buffering: see PlanBacklog). */
+  return lsl_create_outlet(info, 0, maxBuffered);
+}
+
+/**
+ * Reads the headset's channel labels, cutting off the "negative" part of each
+ * name (e.g. the reference channel).
+ *
+ * @param s - Session with a connected headset
+ * @return 0 on success, non-zero on error.
+ */
+static int ReadChannels(DSI2LSL_Session *s)
+{
+  unsigned int channelIndex;
+  DSI_Headset h = s->h;
+
+  s->numberOfChannels = DSI_Headset_GetNumberOfChannels( h );
+  s->outletChannels = s->numberOfChannels + (s->config.sequenceChannel ? 1 : 0);
+  s->outlets.samplingRate = DSI_Headset_GetSamplingRate( h );
+  s->labels = malloc(s->numberOfChannels * sizeof(*s->labels));
+  s->channels = malloc(s->numberOfChannels * sizeof(*s->channels));
+  if (!s->labels || !s->channels) {
+      Log(stderr, "Failed to allocate channel labels.\n");
+      return -1;
+  }
+
+  for( channelIndex=0; channelIndex < s->numberOfChannels ; channelIndex++)
+  {
+    const char *long_label;
+    s->channels[channelIndex] = DSI_Headset_GetChannelByIndex( h, channelIndex );
+    long_label = DSI_Channel_GetString( s->channels[channelIndex] );
+    /* Cut off "negative" part of channel name (e.g., the ref chn) */
+    strncpy_s(s->labels[channelIndex], sizeof(s->labels[channelIndex]), long_label, _TRUNCATE);
+    s->labels[channelIndex][strcspn(s->labels[channelIndex], "-")] = '\0';
+  }
+
+  /* The montage is fixed from here on: choose the gather kernel once */
+  s->readChannel = (SampleKernel_Read)DSI_Channel_GetSignal;
+  s->gather = SampleKernel_Select( (void *const *)s->channels, s->numberOfChannels, s->readChannel );
+  Log(stdout, "Sample kernel: %s for %u channels\n",
+      s->gather == SampleKernel_Generic ? "generic" : "specialized", s->numberOfChannels);
+  return 0;
+}
+
+/**
+ * Caches the handles and names of the headset's EEG sources (all referential
+ * EEG sources except the factory reference) for the raw-source outlet, so that
+ * OnSample reads them without searching. Source handles stay valid for the
+ * lifetime of the headset.
+ *
+ * @param s - Session with a connected headset
+ * @return 0 on success, non-zero on error.
+ */
+static int ReadSources(DSI2LSL_Session *s)
+{
+  unsigned int sourceIndex, numberOfSources = DSI_Headset_GetNumberOfSources( s->h );
+
+  s->rawSources = malloc(numberOfSources * sizeof(*s->rawSources));
+  s->rawLabels = malloc(numberOfSources * sizeof(*s->rawLabels));
+  if (!s->rawSources || !s->rawLabels) {
+      Log(stderr, "Failed to allocate the raw source table.\n");
+      return -1;
+  }
+  strncpy_s(s->rawReference, sizeof(s->rawReference), "factory", _TRUNCATE);
+  s->numberOfRawSources = 0;
+  for (sourceIndex = 0; sourceIndex < numberOfSources; sourceIndex++) {
+      DSI_Source source = DSI_Headset_GetSourceByIndex( s->h, sourceIndex );
+      if (!DSI_Source_IsReferentialEEG( source )) continue;
+      if (DSI_Source_IsFactoryReference( source )) {
+          strncpy_s(s->rawReference, sizeof(s->rawReference), DSI_Source_GetName( source ), _TRUNCATE);
+          continue;
+      }
+      strncpy_s(s->rawLabels[s->numberOfRawSources], sizeof(s->rawLabels[0]), DSI_Source_GetName( source ), _TRUNCATE);
+      s->rawSources[s->numberOfRawSources++] = source;
+  }
+  s->rawChannels = s->numberOfRawSources + (s->config.sequenceChannel ? 1 : 0);
+  s->readSource = (SampleKernel_Read)DSI_Source_GetSignal;
+  s->gatherRaw = SampleKernel_Select( (void *const *)s->rawSources, s->numberOfRawSources, s->readSource );
+  if (s->numberOfRawSources == 0)
+      Log(stderr, "The headset has no EEG sources; --raw-outlet is ignored.\n");
+  return 0;
+}
+
+/**
+ * Destroys the impedance outlet created by InitImpedanceLSL; its buffers stay in the arena.
+ */
+static void DestroyImpedanceLSL(SampleOutlets * outlets)
+{
+  if (outlets->impedance) lsl_destroy_outlet(outlets->impedance);
+  outlets->impedance = NULL;
+  outlets->numberOfImpedanceSources = 0;
+}
+
+/**
+ * Creates the "<streamName>-Impedance" outlet, with one channel per EEG source
+ * (excluding the factory reference), and fills in the impedance fields of outlets.
+ *
+ * @param h - Valid DSI headset handle
+ * @param streamName - Name of the EEG stream
+ * @param outlets - Receives the impedance outlet and source handles
+ * @return 0 on success, non-zero on error.
+ */
+static int InitImpedanceLSL(DSI_Headset h, const char * streamName, SampleOutlets * outlets)
+{
+  unsigned int sourceIndex, numberOfSources = DSI_Headset_GetNumberOfSources( h );
+  double samplingRate = DSI_Headset_GetSamplingRate( h );
+  char name[256], source_id[IMAX + 1];
+  lsl_streaminfo info;
+  lsl_xml_ptr chns, chn;
+
+  outlets->numberOfImpedanceSources = 0;
+  for (sourceIndex = 0; sourceIndex < numberOfSources; sourceIndex++) {
+      DSI_Source source = DSI_Headset_GetSourceByIndex( h, sourceIndex );
+      if (DSI_Source_IsReferentialEEG( source ) && !DSI_Source_IsFactoryReference( source )) {
+          strncpy_s(outlets->impedanceLabels[outlets->numberOfImpedanceSources], LABEL_LENGTH, DSI_Source_GetName( source ), _TRUNCATE);
+          outlets->impedanceSources[outlets->numberOfImpedanceSources++] = source;
+      }
+  }
+  outlets->impedanceDecimation = (unsigned int)(samplingRate / IMPEDANCE_RATE);
+  if (outlets->impedanceDecimation == 0) outlets->impedanceDecimation = 1;
+  outlets->samplesSinceImpedance = 0;
+  if (outlets->numberOfImpedanceSources == 0) return 0;
+
+  snprintf(name, sizeof(name), "%s-Impedance", streamName);
+  getRandomString(source_id, IMAX);
+  info = lsl_create_streaminfo(name, "Impedance", outlets->numberOfImpedanceSources, IMPEDANCE_RATE, cft_float32, source_id);
+  if (!info) {
+      Log(stderr, "Failed to create LSL impedance streaminfo.\n");
+      return -1;
+  }
+
+  chns = lsl_append_child(lsl_get_desc(info), "channels");
+  for (sourceIndex = 0; sourceIndex < outlets->numberOfImpedanceSources; sourceIndex++) {
+      chn = lsl_append_child(chns, "channel");
+      lsl_append_child_value(chn, "label", (char*)DSI_Source_GetName( outlets->impedanceSources[sourceIndex] ));
+      lsl_append_child_value(chn, "unit", "megaohms");
+      lsl_append_child_value(chn, "type", "Impedance");
+  }
+  Log(stderr, "Impedance Stream Name: %s\n", name);
+  outlets->impedance = lsl_create_outlet(info, 1, 60);
+  return 0;
+}
+
+/**
+ * Creates the "<streamName>-Markers" outlet, on which every command is marked
+ * with the time it took effect.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitMarkerLSL(DSI2LSL_Session *s)
+{
+  char name[256], source_id[IMAX + 1];
+  lsl_streaminfo info;
+
+  snprintf(name, sizeof(name), "%s-Markers", s->streamName);
+  getRandomString(source_id, IMAX);
+  info = lsl_create_streaminfo(name, "Markers", 1, LSL_IRREGULAR_RATE, cft_string, source_id);
+  if (!info) {
+      Log(stderr, "Failed to create LSL marker streaminfo.\n");
+      return -1;
+  }
+  Log(stderr, "Marker Stream Name: %s\n", name);
+  s->markers = lsl_create_outlet(info, 1, 60);
+  return 0;
+}
+
+/**
+ * Creates the "<streamName>-Quality" outlet: QUALITY_METRICS values per EEG
+ * channel, grouped by metric (all quality indices first), QUALITY_RATE times
+ * per second.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitQualityLSL(DSI2LSL_Session *s)
+{
+  char name[256], source_id[IMAX + 1];
+  lsl_streaminfo info;
+  lsl_xml_ptr desc, chns;
+  unsigned int channelIndex;
+  int metric;
+
+  Quality_Reset(s->quality);
+  s->qualityDecimation = (int)(s->outlets.samplingRate / QUALITY_RATE + 0.5);
+  if (s->qualityDecimation < 1) s->qualityDecimation = 1;
+  s->samplesSinceQuality = 0;
+
+  snprintf(name, sizeof(name), "%s-Quality", s->streamName);
+  getRandomString(source_id, IMAX);
+  info = lsl_create_streaminfo(name, "Quality", QUALITY_METRICS * s->numberOfChannels,
+                               s->outlets.samplingRate / s->qualityDecimation, cft_float32, source_id);
+  if (!info) {
+      Log(stderr, "Failed to create LSL quality streaminfo.\n");
+      return -1;
+  }
+  desc = lsl_get_desc(info);
+  lsl_append_child_value(desc, "manufacturer", "WearableSensing");
+  chns = lsl_append_child(desc, "channels");
+  for (metric = 0; metric < QUALITY_METRICS; metric++) {
+      for (channelIndex = 0; channelIndex < s->numberOfChannels; channelIndex++) {
+          lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+          lsl_append_child_value(chn, "label", s->labels[channelIndex]);
+          lsl_append_child_value(chn, "metric", (char*)Quality_MetricName(metric));
+          lsl_append_child_value(chn, "unit", metric == QUALITY_STD ? (char*)"microvolts" : (char*)"normalized");
+      }
+  }
+  Log(stderr, "Quality Stream Name: %s\n", name);
+  s->qualityOutlet = lsl_create_outlet(info, 1, 60);
+  return s->qualityOutlet ? 0 : -1;
+}
+
+/**
+ * Creates the "<streamName>-Cleaned" outlet, laid out like the EEG outlet.
+ * The ASR filter calibrates on the first block only; later blocks reuse it.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitCleanedLSL(DSI2LSL_Session *s, const char *reference)
+{
+  char name[256];
+  double calibrationSeconds = s->config.asrCalibrationSeconds > 0 ? s->config.asrCalibrationSeconds : ASR_DEFAULT_CALIBRATION_SECONDS;
+  double cutoff = s->config.asrCutoff > 0 ? s->config.asrCutoff : ASR_DEFAULT_CUTOFF;
+
+  Asr_Reset(s->asr);
+  if (!Asr_IsCalibrated(s->asr))
+      Log(stderr, "ASR calibrates on the first %g s of data (cutoff %g); keep still and relaxed.\n", calibrationSeconds, cutoff);
+
+  snprintf(name, sizeof(name), "%s-Cleaned", s->streamName);
+  Log(stderr, "Cleaned Stream Name: %s\n", name);
+  s->cleaned = CreateOutlet(name, s->numberOfChannels, s->outlets.samplingRate, s->labels, reference, s->maxBuffered, s->config.sequenceChannel);
+  return s->cleaned ? 0 : -1;
+}
+
+/**
+ * Creates the "<streamName>-Raw" outlet with one channel per source cached by
+ * ReadSources, referenced to the factory reference.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitRawLSL(DSI2LSL_Session *s)
+{
+  char name[256];
+
+  if (!s->rawBuffer) return 0;
+  snprintf(name, sizeof(name), "%s-Raw", s->streamName);
+  Log(stderr, "Raw Stream Name: %s (%u sources)\n", name, s->numberOfRawSources);
+  s->raw = CreateOutlet(name, s->numberOfRawSources, s->outlets.samplingRate, s->rawLabels, s->rawReference, s->maxBuffered, s->config.sequenceChannel);
+  return s->raw ? 0 : -1;
+}
+
+/** Creates an epoch outlet: the EEG channels, the condition and, for averages, the number of epochs. */
+static lsl_outlet CreateEpochOutlet(DSI2LSL_Session *s, const char *suffix, const char *type, const char *reference, int withCount)
+{
+  char name[256], value[32], source_id[IMAX + 1];
+  lsl_streaminfo info;
+  lsl_xml_ptr desc, chns, chn, ref, epoch;
+  unsigned int channelIndex;
+
+  snprintf(name, sizeof(name), "%s-%s", s->streamName, suffix);
+  getRandomString(source_id, IMAX);
+  /* Epochs overlap or leave gaps, so there is no nominal rate; every sample keeps its own timestamp */
+  info = lsl_create_streaminfo(name, (char*)type, s->numberOfChannels + (withCount ? 2 : 1), LSL_IRREGULAR_RATE, cft_float32, source_id);
+  if (!info) {
+      Log(stderr, "Failed to create LSL %s streaminfo.\n", suffix);
+      return NULL;
+  }
+  desc = lsl_get_desc(info);
+  lsl_append_child_value(desc, "manufacturer", "WearableSensing");
+  chns = lsl_append_child(desc, "channels");
+  for (channelIndex = 0; channelIndex < s->numberOfChannels; channelIndex++) {
+      chn = lsl_append_child(chns, "channel");
+      lsl_append_child_value(chn, "label", s->labels[channelIndex]);
+      lsl_append_child_value(chn, "unit", "microvolts");
+      lsl_append_child_value(chn, "type", "EEG");
+  }
+  chn = lsl_append_child(chns, "channel");
+  lsl_append_child_value(chn, "label", "Condition");
+  lsl_append_child_value(chn, "unit", "index");
+  lsl_append_child_value(chn, "type", "Condition");
+  if (withCount) {
+      chn = lsl_append_child(chns, "channel");
+      lsl_append_child_value(chn, "label", "Count");
+      lsl_append_child_value(chn, "unit", "epochs");
+      lsl_append_child_value(chn, "type", "Count");
+  }
+  ref = lsl_append_child(desc, "reference");
+  lsl_append_child_value(ref, "label", (char*)reference);
+  epoch = lsl_append_child(desc, "epoch");
+  snprintf(value, sizeof(value), "%u", s->epochPreSamples);
+  lsl_append_child_value(epoch, "pre_samples", value);
+  snprintf(value, sizeof(value), "%u", s->epochPostSamples);
+  lsl_append_child_value(epoch, "post_samples", value);
+  snprintf(value, sizeof(value), "%g", s->outlets.samplingRate);
+  lsl_append_child_value(epoch, "sampling_rate", value);
+  Log(stderr, "%s Stream Name: %s\n", suffix, name);
+  return lsl_create_outlet(info, 0, s->maxBuffered);
+}
+
+/**
+ * Creates the "<streamName>-Epochs" and "<streamName>-ERP" outlets. Each chunk
+ * on either is one epoch (see epochs.h): a cut of the EEG on the first, the
+ * updated average of its condition on the second, with the same timestamps.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitEpochLSL(DSI2LSL_Session *s, const char *reference)
+{
+  if (!s->epochs) return 0;
+  Epochs_Reset(s->epochs);
+  s->trgPrimed = 0;
+  s->epochsPushed = 0;
+  s->epochOutlet = CreateEpochOutlet(s, "Epochs", "EEG", reference, 0);
+  s->erpOutlet = CreateEpochOutlet(s, "ERP", "ERP", reference, 1);
+  return s->epochOutlet && s->erpOutlet ? 0 : -1;
+}
+
+/** Upper limit of the latency the pacer may add, in seconds (--pace-max-delay). */
+static double PacerMaxDelay(DSI2LSL_Session *s)
+{
+  return s->config.paceMaxDelayMs > 0 ? s->config.paceMaxDelayMs / 1000.0 : PACER_DEFAULT_MAX_DELAY;
+}
+
+/**
+ * Starts the pacer that releases the EEG outlet's chunks at the nominal rate.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitPacer(DSI2LSL_Session *s)
+{
+  double maxDelay = PacerMaxDelay(s);
+  PacerStats stats;
+
+  if (s->outlets.samplingRate <= 0) {
+      Log(stderr, "The stream has no nominal rate; --pace is ignored.\n");
+      return 0;
+  }
+  s->pacer = Pacer_Create(s->pacerMemory, CHUNK_SIZE * s->outletChannels, CHUNK_SIZE / s->outlets.samplingRate, maxDelay, PushPacedChunk, s);
+  if (!s->pacer) {
+      Log(stderr, "Failed to start the pacer.\n");
+      return -1;
+  }
+  Pacer_GetStats(s->pacer, &stats);
+  Log(stdout, "Pacing EEG chunks every %.1f ms, adding at most %.0f ms of latency%s.\n",
+      CHUNK_SIZE * 1000.0 / s->outlets.samplingRate, maxDelay * 1000.0,
+      stats.highResolutionTimer ? "" : " (no high-resolution timer: release times are coarse)");
+  return 0;
+}
+
+/** Label of a channel of the EEG outlet, including the sequence channel. */
+static const char *OutletChannelLabel(DSI2LSL_Session *s, unsigned int channel)
+{
+  return channel < s->numberOfChannels ? s->labels[channel] : "Sequence";
+}
+
+static size_t FormatSize(lsl_channel_format_t format)
+{
+  switch (format) {
+  case cft_double64: return sizeof(double);
+  case cft_int32:    return sizeof(int);
+  case cft_int16:    return sizeof(short);
+  default:           return sizeof(float);
+  }
+}
+
+static const char *FormatName(lsl_channel_format_t format)
+{
+  switch (format) {
+  case cft_double64: return "double64";
+  case cft_int32:    return "int32";
+  case cft_int16:    return "int16";
+  default:           return "float32";
+  }
+}
+
+/**
+ * Applies one key=value setting of an extra outlet definition.
+ * @return 0 on success, non-zero if the setting is invalid.
+ */
+static int ParseExtraSetting(DSI2LSL_Session *s, ExtraOutlet *e, const char *key, char *value)
+{
+  if (strcmp(key, "chunk") == 0) {
+      int chunk = atoi(value);
+      if (chunk < 1 || chunk > MAX_EXTRA_CHUNK) {
+          Log(stderr, "Extra outlet %s: chunk must be 1 to %d samples.\n", e->name, MAX_EXTRA_CHUNK);
+          return -1;
+      }
+      e->chunkSize = (unsigned int)chunk;
+  } else if (strcmp(key, "pushthrough") == 0) {
+      e->pushthrough = atoi(value) != 0;
+  } else if (strcmp(key, "format") == 0) {
+      if (_stricmp(value, "float32") == 0) e->format = cft_float32;
+      else if (_stricmp(value, "double64") == 0) e->format = cft_double64;
+      else if (_stricmp(value, "int32") == 0) e->format = cft_int32;
+      else if (_stricmp(value, "int16") == 0) e->format = cft_int16;
+      else {
+          Log(stderr, "Extra outlet %s: unknown format %s (float32, double64, int32 or int16).\n", e->name, value);
+          return -1;
+      }
+  } else if (strcmp(key, "resolution") == 0) {
+      e->resolution = atof(value);
+      if (!(e->resolution > 0)) {
+          Log(stderr, "Extra outlet %s: resolution must be positive.\n", e->name);
+          return -1;
+      }
+  } else if (strcmp(key, "buffer") == 0) {
+      e->maxBuffered = atoi(value);
+      if (e->maxBuffered < 1) {
+          Log(stderr, "Extra outlet %s: buffer must be at least 1 s.\n", e->name);
+          return -1;
+      }
+  } else if (strcmp(key, "channels") == 0) {
+      char *label, *nextLabel = NULL;
+      unsigned int i;
+      e->numberOfChannels = 0;
+      for (label = strtok_s(value, "+", &nextLabel); label; label = strtok_s(NULL, "+", &nextLabel)) {
+          unsigned int channel;
+          for (channel = 0; channel < s->outletChannels; channel++)
+              if (_stricmp(label, OutletChannelLabel(s, channel)) == 0) break;
+          if (channel == s->outletChannels) {
+              Log(stderr, "Extra outlet %s: no channel named %s.\n", e->name, label);
+              return -1;
+          }
+          /* Each channel at most once, which also keeps the list within outletChannels */
+          for (i = 0; i < e->numberOfChannels; i++)
+              if (e->channels[i] == channel) {
+                  Log(stderr, "Extra outlet %s: channel %s is listed twice.\n", e->name, label);
+                  return -1;
+              }
+          e->channels[e->numberOfChannels++] = channel;
+      }
+      if (e->numberOfChannels == 0) {
+          Log(stderr, "Extra outlet %s: no channels.\n", e->name);
+          return -1;
+      }
+  } else {
+      Log(stderr, "Extra outlet %s: unknown setting %s (chunk, pushthrough, format, resolution, buffer or channels).\n", e->name, key);
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * Parses one extra outlet definition: a name, optionally followed by ':' and
+ * comma-separated key=value settings.
+ * @return 0 on success, non-zero if the definition is invalid.
+ */
+static int ParseExtraOutlet(DSI2LSL_Session *s, ExtraOutlet *e, char *definition)
+{
+  char *settings = strchr(definition, ':'), *setting, *nextSetting = NULL;
+  unsigned int channel;
+
+  if (settings) *settings++ = '\0';
+  if (!*definition) {
+      Log(stderr, "Extra outlet without a name.\n");
+      return -1;
+  }
+  strncpy_s(e->name, sizeof(e->name), definition, _TRUNCATE);
+  e->chunkSize = CHUNK_SIZE;
+  e->pushthrough = 1;
+  e->format = cft_float32;
+  e->resolution = DEFAULT_EXTRA_RESOLUTION;
+  e->channels = s->parsedChannels + (size_t)(e - s->extraOutlets) * s->outletChannels;
+  for (channel = 0; channel < s->outletChannels; channel++) e->channels[channel] = channel;
+  e->numberOfChannels = s->outletChannels;
+
+  for (setting = settings ? strtok_s(settings, ",", &nextSetting) : NULL; setting; setting = strtok_s(NULL, ",", &nextSetting)) {
+      char *value = strchr(setting, '=');
+      if (!value) {
+          Log(stderr, "Extra outlet %s: expected key=value instead of %s.\n", e->name, setting);
+          return -1;
+      }
+      *value++ = '\0';
+      if (ParseExtraSetting(s, e, setting, value) != 0) return -1;
+  }
+
+  Log(stdout, "Extra outlet %s: %u channels as %s, %u samples per chunk, pushthrough %s.\n", e->name,
+      e->numberOfChannels, FormatName(e->format), e->chunkSize, e->pushthrough ? "on" : "off");
+  return 0;
+}
+
+/**
+ * Parses the --extra-outlets definitions, separated by ';'. Needs the channel
+ * labels. The channel lists stay in parsedChannels until SetUpPipeline.
+ * @return 0 on success, non-zero if a definition is invalid.
+ */
+static int ParseExtraOutlets(DSI2LSL_Session *s)
+{
+  char *definition, *nextDefinition = NULL;
+  int error = 0;
+
+  if (!s->extraOutletSpec || !*s->extraOutletSpec) return 0;
+  s->parsedChannels = (unsigned int *)malloc((size_t)MAX_EXTRA_OUTLETS * s->outletChannels * sizeof(unsigned int));
+  if (!s->parsedChannels) return -1;
+  for (definition = strtok_s(s->extraOutletSpec, ";", &nextDefinition); definition && !error; definition = strtok_s(NULL, ";", &nextDefinition)) {
+      if (s->numberOfExtraOutlets == MAX_EXTRA_OUTLETS) {
+          Log(stderr, "At most %d extra outlets can be defined.\n", MAX_EXTRA_OUTLETS);
+          error = -1;
+      } else {
+          error = ParseExtraOutlet(s, &s->extraOutlets[s->numberOfExtraOutlets++], definition);
+      }
+  }
+  free(s->extraOutletSpec);
+  s->extraOutletSpec = NULL;
+  return error;
+}
+
+/* One outlet's share of the LSL backlog, see PlanBacklog */
+typedef struct {
+  const char *name;
+  double bytesPerSecond;               // Queued per consumer that falls behind
+  double seconds;                      // Requested, then planned
+} Backlog;
+
+static int AddBacklog(Backlog *backlog, int count, const char *name, double samplesPerSecond, double bytesPerSample, double seconds)
+{
+  backlog[count].name = name;
+  backlog[count].bytesPerSecond = samplesPerSecond * (bytesPerSample + LSL_SAMPLE_OVERHEAD);
+  backlog[count].seconds = seconds;
+  return count + 1;
+}
+
+/**
+ * Chooses max_buffered for every enabled outlet from --max-buffered, the
+ * buffer= of the extra outlets and the memory budget, and reports the memory
+ * the backlog may take. The budget covers all outlets together: if their
+ * projection exceeds it, every outlet's backlog is shortened by the same
+ * factor, so each keeps a share in proportion to its bytes per second. liblsl
+ * queues samples separately for every consumer, so the projection is per
+ * consumer. Epoch outlets are projected as if the epochs tiled the stream.
+ *
+ * @param s - Session whose channels, sources and extra outlets are known
+ */
+static void PlanBacklog(DSI2LSL_Session *s)
+{
+  Backlog backlog[6 + MAX_EXTRA_OUTLETS];
+  double rate = s->outlets.samplingRate > 0 ? s->outlets.samplingRate : 300;
+  double seconds = s->config.maxBuffered > 0 ? s->config.maxBuffered : DEFAULT_MAX_BUFFERED;
+  double total = 0;
+  int count = 0, extra, i;
+
+  count = AddBacklog(backlog, count, "EEG", rate, s->outletChannels * sizeof(float), seconds);
+  if (s->config.compressedOutlet)
+    count = AddBacklog(backlog, count, "Compressed", rate / CHUNK_SIZE, (double)EegCodec_MaxEncodedSize(s->outletChannels, CHUNK_SIZE), seconds);
+  if (s->config.asrOutlet)
+    count = AddBacklog(backlog, count, "Cleaned", rate, s->outletChannels * sizeof(float), seconds);
+  if (s->config.rawOutlet && s->numberOfRawSources > 0)
+    count = AddBacklog(backlog, count, "Raw", rate, s->rawChannels * sizeof(float), seconds);
+  if (s->config.epochOutlet) {
+    count = AddBacklog(backlog, count, "Epochs", rate, (s->numberOfChannels + 1) * sizeof(float), seconds);
+    count = AddBacklog(backlog, count, "ERP", rate, (s->numberOfChannels + 2) * sizeof(float), seconds);
+  }
+  for (extra = 0; extra < s->numberOfExtraOutlets; extra++) {
+    const ExtraOutlet *e = &s->extraOutlets[extra];
+    count = AddBacklog(backlog, count, e->name, rate, e->numberOfChannels * (double)FormatSize(e->format),
+                       e->maxBuffered > 0 ? e->maxBuffered : seconds);
+  }
+
+  for (i = 0; i < count; i++) total += backlog[i].bytesPerSecond * backlog[i].seconds;
+  if (s->config.memoryBudgetMB > 0 && total > s->config.memoryBudgetMB * 1024.0 * 1024.0) {
+    double scale = s->config.memoryBudgetMB * 1024.0 * 1024.0 / total;
+    int clamped = 0;
+    Log(stdout, "Memory budget of %.1f MB shortens the LSL backlog of every outlet to %.0f%%.\n", s->config.memoryBudgetMB, scale * 100.0);
+    total = 0;
+    for (i = 0; i < count; i++) {
+      backlog[i].seconds = floor(backlog[i].seconds * scale);
+      if (backlog[i].seconds < 1) {
+        backlog[i].seconds = 1;
+        clamped = 1;
+      }
+      total += backlog[i].bytesPerSecond * backlog[i].seconds;
+    }
+    if (clamped)
+      Log(stderr, "WARNING - the memory budget allows less than one second of backlog on some outlets; using 1 s.\n");
+  }
+
+  /* The outlets without a buffer= of their own come after the EEG outlet and share its plan */
+  s->maxBuffered = (int)backlog[0].seconds;
+  for (extra = 0; extra < s->numberOfExtraOutlets; extra++)
+    s->extraOutlets[extra].maxBuffered = (int)backlog[count - s->numberOfExtraOutlets + extra].seconds;
+  for (i = 0; i < count; i++)
+    Log(stdout, "LSL backlog of %s: up to %d s, projected %.1f MB per consumer that falls behind.\n",
+        backlog[i].name, (int)backlog[i].seconds, backlog[i].bytesPerSecond * backlog[i].seconds / (1024.0 * 1024.0));
+  Log(stdout, "LSL backlog: projected %.1f MB per consumer that falls behind on every outlet (%u channels at %.0f Hz).\n",
+      total / (1024.0 * 1024.0), s->outletChannels, rate);
+}
+
+/**
+ * Creates the "<streamName>-<name>" outlets defined with --extra-outlets.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitExtraLSL(DSI2LSL_Session *s, const char *reference)
+{
+  char name[2 * LABEL_LENGTH], source_id[IMAX + 1], value[64];
+  int extra;
+
+  for (extra = 0; extra < s->numberOfExtraOutlets; extra++) {
+      ExtraOutlet *e = &s->extraOutlets[extra];
+      lsl_streaminfo info;
+      lsl_xml_ptr desc, policy, chns, ref;
+      unsigned int c;
+
+      snprintf(name, sizeof(name), "%s-%s", s->streamName, e->name);
+      getRandomString(source_id, IMAX);
+      info = lsl_create_streaminfo(name, "EEG", e->numberOfChannels, s->outlets.samplingRate, e->format, source_id);
+      if (!info) {
+          Log(stderr, "Failed to create LSL streaminfo for %s.\n", name);
+          return -1;
+      }
+      desc = lsl_get_desc(info);
+      lsl_append_child_value(desc, "manufacturer", "WearableSensing");
+      policy = lsl_append_child(desc, "policy");
+      snprintf(value, sizeof(value), "%u", e->chunkSize);
+      lsl_append_child_value(policy, "chunk_size", value);
+      lsl_append_child_value(policy, "pushthrough", e->pushthrough ? "1" : "0");
+      if (e->format == cft_int32 || e->format == cft_int16) {
+          /* Microvolts per step of the EEG channels */
+          snprintf(value, sizeof(value), "%g", e->resolution);
+          lsl_append_child_value(policy, "resolution", value);
+      }
+      chns = lsl_append_child(desc, "channels");
+      for (c = 0; c < e->numberOfChannels; c++) {
+          lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+          int isSequence = e->channels[c] >= s->numberOfChannels;
+          lsl_append_child_value(chn, "label", (char*)OutletChannelLabel(s, e->channels[c]));
+          lsl_append_child_value(chn, "unit", isSequence ? (char*)"samples" : (char*)"microvolts");
+          lsl_append_child_value(chn, "type", isSequence ? (char*)"Sequence" : (char*)"EEG");
+      }
+      ref = lsl_append_child(desc, "reference");
+      lsl_append_child_value(ref, "label", (char*)reference);
+
+      e->samplesInChunk = 0;
+      e->outlet = lsl_create_outlet(info, (int)e->chunkSize, e->maxBuffered);
+      if (!e->outlet) return -1;
+      Log(stderr, "Extra Stream Name: %s\n", name);
+  }
+  return 0;
+}
+
+/**
+ * Creates the "<streamName>-Compressed" outlet. Each sample is one EEG chunk
+ * encoded with eegcodec (see eegcodec.h), stamped like the chunk on the EEG
+ * outlet, i.e. with the time of its last sample.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitCompressedLSL(DSI2LSL_Session *s)
+{
+  char name[256], source_id[IMAX + 1], value[64];
+  lsl_streaminfo info;
+  lsl_xml_ptr desc, encoding, chns;
+  unsigned int channelIndex;
+
+  s->compressedResolution = (float)(s->config.compressedResolution > 0 ? s->config.compressedResolution : DEFAULT_COMPRESSED_RESOLUTION);
+
+  snprintf(name, sizeof(name), "%s-Compressed", s->streamName);
+  getRandomString(source_id, IMAX);
+  info = lsl_create_streaminfo(name, "EEG-Compressed", 1, s->outlets.samplingRate / CHUNK_SIZE, cft_string, source_id);
+  if (!info) {
+      Log(stderr, "Failed to create LSL compressed streaminfo.\n");
+      return -1;
+  }
+  desc = lsl_get_desc(info);
+  lsl_append_child_value(desc, "manufacturer", "WearableSensing");
+  encoding = lsl_append_child(desc, "encoding");
+  lsl_append_child_value(encoding, "codec", "eegcodec");
+  snprintf(value, sizeof(value), "%d", EEGCODEC_VERSION);
+  lsl_append_child_value(encoding, "version", value);
+  snprintf(value, sizeof(value), "%g", s->compressedResolution);
+  lsl_append_child_value(encoding, "resolution", value);
+  snprintf(value, sizeof(value), "%d", CHUNK_SIZE);
+  lsl_append_child_value(encoding, "chunk_size", value);
+  snprintf(value, sizeof(value), "%g", s->outlets.samplingRate);
+  lsl_append_child_value(encoding, "sampling_rate", value);
+  chns = lsl_append_child(desc, "channels");
+  for (channelIndex = 0; channelIndex < s->numberOfChannels; channelIndex++) {
+      lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+      lsl_append_child_value(chn, "label", s->labels[channelIndex]);
+      lsl_append_child_value(chn, "unit", "microvolts");
+  }
+  if (s->config.sequenceChannel) {
+      lsl_xml_ptr chn = lsl_append_child(chns, "channel");
+      lsl_append_child_value(chn, "label", "Sequence");
+      lsl_append_child_value(chn, "unit", "samples");
+  }
+  Log(stderr, "Compressed Stream Name: %s (resolution %g uV)\n", name, s->compressedResolution);
+  s->compressed = lsl_create_outlet(info, 1, s->maxBuffered);
+  return s->compressed ? 0 : -1;
+}
+
+/**
+ * Creates the EEG, impedance and marker outlets of a headset session.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitLSL(DSI2LSL_Session *s)
+{
+  Log(stdout, "Initializing %s outlet\n", s->streamName);
+  s->outlets.eeg = CreateOutlet(s->streamName, s->numberOfChannels, s->outlets.samplingRate, s->labels, DSI_Headset_GetReferenceString(s->h), s->maxBuffered, s->config.sequenceChannel);
+  if (!s->outlets.eeg) return -1;
+  if (s->config.pace && InitPacer(s) != 0) return -1;
+  if (InitImpedanceLSL(s->h, s->streamName, &s->outlets) != 0) return -1;
+  if (s->config.compressedOutlet && InitCompressedLSL(s) != 0) return -1;
+  if (s->config.qualityOutlet && InitQualityLSL(s) != 0) return -1;
+  if (s->config.asrOutlet && InitCleanedLSL(s, DSI_Headset_GetReferenceString(s->h)) != 0) return -1;
+  if (InitExtraLSL(s, DSI_Headset_GetReferenceString(s->h)) != 0) return -1;
+  if (InitRawLSL(s) != 0) return -1;
+  if (InitEpochLSL(s, DSI_Headset_GetReferenceString(s->h)) != 0) return -1;
+  return InitMarkerLSL(s);
+}
+
+/**
+ * Destroys the outlets created by InitLSL.
+ */
+static void DestroyLSL(DSI2LSL_Session *s)
+{
+  int extra;
+
+  /* The pacer flushes what it holds into the EEG outlet, so it goes first */
+  if (s->pacer) {
+      PacerStats stats;
+      Pacer_Stop(s->pacer);
+      Pacer_GetStats(s->pacer, &stats);
+      Pacer_Free(s->pacer);
+      s->pacer = NULL;
+      if (stats.chunks > 0)
+          Log(stdout, "Pacer: %lld chunks, %.1f ms mean and %.1f ms max added latency (final delay %.1f ms); "
+              "chunk interval std %.2f ms in, %.2f ms out; %lld chunks late, %lld dropped.\n",
+              stats.chunks, stats.meanAddedLatency * 1000.0, stats.maxAddedLatency * 1000.0, stats.delay * 1000.0,
+              stats.inputIntervalStd * 1000.0, stats.outputIntervalStd * 1000.0, stats.lateChunks,
+              stats.droppedChunks);
+  }
+  if (s->outlets.eeg) lsl_destroy_outlet(s->outlets.eeg);
+  if (s->markers) lsl_destroy_outlet(s->markers);
+  if (s->compressed) lsl_destroy_outlet(s->compressed);
+  if (s->qualityOutlet) lsl_destroy_outlet(s->qualityOutlet);
+  if (s->cleaned) lsl_destroy_outlet(s->cleaned);
+  if (s->raw) lsl_destroy_outlet(s->raw);
+  s->qualityOutlet = NULL;
+  s->cleaned = NULL;
+  s->raw = NULL;
+  for (extra = 0; extra < s->numberOfExtraOutlets; extra++) {
+      if (s->extraOutlets[extra].outlet) lsl_destroy_outlet(s->extraOutlets[extra].outlet);
+      s->extraOutlets[extra].outlet = NULL;
+  }
+  if (s->epochOutlet) lsl_destroy_outlet(s->epochOutlet);
+  if (s->erpOutlet) lsl_destroy_outlet(s->erpOutlet);
+  s->epochOutlet = s->erpOutlet = NULL;
+  s->outlets.eeg = NULL;
+  s->markers = NULL;
+  s->compressed = NULL;
+  DestroyImpedanceLSL(&s->outlets);
+
+  if (s->epochs && (s->epochsPushed > 0 || Epochs_Dropped(s->epochs) > 0)) {
+      const char *condition;
+      int c;
+      Log(stdout, "Epochs: %lld pushed; %lld dropped so far because their samples were gone or cut off.\n",
+          s->epochsPushed, Epochs_Dropped(s->epochs));
+      for (c = 0; (condition = Epochs_ConditionName(s->epochs, c)) != NULL; c++)
+          Log(stdout, "  Condition %d (%s): %lld epochs averaged\n", c, condition, Epochs_Count(s->epochs, c));
+      s->epochsPushed = 0;
+  }
+
+  if (s->compressedChunks > 0) {
+      Log(stdout, "Compressed outlet: %lld chunks, %.2f x smaller than float32, %.1f us to encode a chunk.\n",
+          s->compressedChunks,
+          (double)s->compressedChunks * CHUNK_SIZE * s->outletChannels * sizeof(float) / s->compressedBytes,
+          s->encodeSeconds * 1e6 / s->compressedChunks);
+      s->compressedChunks = s->compressedBytes = 0;
+      s->encodeSeconds = 0;
+  }
+  if (s->asrChunks > 0) {
+      Log(stdout, "ASR: %lld chunks, %.0f us mean and %.0f us max to clean a chunk of %d samples (%.1f ms of data); "
+          "components removed in %.1f%% of chunks.\n",
+          s->asrChunks, s->asrSeconds * 1e6 / s->asrChunks, s->asrMaxSeconds * 1e6, CHUNK_SIZE,
+          CHUNK_SIZE * 1000.0 / s->outlets.samplingRate, 100.0 * s->asrRepairedChunks / s->asrChunks);
+      s->asrChunks = s->asrRepairedChunks = 0;
+      s->asrSeconds = s->asrMaxSeconds = 0;
+  }
+}
+
+/**
+ * Prints how many samples of the block were lost, duplicated or late, judged
+ * by their indices (see PublishSample).
+ */
+static void LogSampleAccounting( DSI2LSL_Session *s )
+{
+  SampleOutlets *o = &s->outlets;
+  LONGLONG expected = o->nextIndex;
+  if( o->samples == 0 ) return;
+  Log( stdout, "Samples: %lld received of %lld sent; %lld lost in %lld gaps (%.4f%%), %lld duplicated, "
+       "%lld late by %.0f ms or more (max %.0f ms).\n",
+       (long long)o->samples, (long long)expected, (long long)o->lostSamples, (long long)o->gaps,
+       expected > 0 ? 100.0 * o->lostSamples / expected : 0.0, (long long)o->duplicatedSamples,
+       (long long)o->lateSamples, LATE_SAMPLE_SECONDS * 1000.0, o->maxLateness * 1000.0 );
+}
+
+/**
+ * Starts a block: creates the outlets and starts data acquisition on the
+ * already connected headset. Called on the processing thread (or before it
+ * starts).
+ *
+ * @param s - Session
+ * @param requestedAt - LSL local clock when the block was requested
+ * @return 0 on success, non-zero on error.
+ */
+static int StartStreaming( DSI2LSL_Session *s, double requestedAt )
+{
+  SampleOutlets *o = &s->outlets;
+  double outletsAt;
+  if( s->streaming ) return 0;
+
+  if( InitLSL( s ) != 0 ) {
+    DestroyLSL( s );
+    return -1;
+  }
+  outletsAt = lsl_local_clock();
+
+  /* Each block starts with fresh counters and an empty chunk */
+  o->samples = 0;
+  o->samplesSinceImpedance = 0;
+  s->chunk->sample_index_in_chunk = 0;
+  s->blockRequestedAt = requestedAt;
+  s->blocks++;
+
+  /* Set the sample callback (forward every data sample received to LSL) */
+  DSI_Headset_SetSampleCallback( s->h, OnSample, s );
+  if( CheckError() != 0 ) {
+    DestroyLSL( s );
+    return -1;
+  }
+
+  /* Start data acquisition */
+  Log(stdout, "Starting data acquisition\n");
+  DSI_Headset_StartDataAcquisition( s->h );
+  if( CheckError() != 0 ) {
+    DSI_Headset_SetSampleCallback( s->h, NULL, NULL );
+    DestroyLSL( s );
+    return -1;
+  }
+  s->streaming = 1;
+  if( s->config.checkAllocations ) AllocCheck_Arm( 1 );
+  LogMemoryUse( "with outlets open" );
+  Log(stdout, "Block %d: outlets %.1f ms, start acquisition %.1f ms\n", s->blocks,
+      ( outletsAt - requestedAt ) * 1000.0, ( lsl_local_clock() - outletsAt ) * 1000.0);
+  return 0;
+}
+
+/**
+ * Ends data acquisition without losing what the headset has already sent: stops
+ * it, keeps publishing the samples still in flight until none has arrived for
+ * SHUTDOWN_QUIET_SECONDS, removes the sample callback, flushes the partial
+ * chunks and gives liblsl a moment to send them. A replay only needs the flush.
+ * All of it takes at most config.shutdownTimeoutMs (samples arriving later are
+ * discarded), and the time it took is logged.
+ * @return 0 on success, non-zero on error.
+ */
+static int EndAcquisition( DSI2LSL_Session *s )
+{
+  SampleOutlets *o = &s->outlets;
+  const double limit = ( s->config.shutdownTimeoutMs > 0 ? s->config.shutdownTimeoutMs : DEFAULT_SHUTDOWN_MS ) / 1000.0;
+  double start = lsl_local_clock(), now = start, drained, remaining;
+  LONGLONG before = o->samples;
+  unsigned int flushed;
+  int error = 0, timedOut = 0;
+
+  if( s->h ) {
+    LONGLONG received = o->samples;
+    double quietSince = start;
+    DSI_Headset_StopDataAcquisition( s->h );
+    error = CheckError();
+    while( !error && now - quietSince < SHUTDOWN_QUIET_SECONDS ) {
+      if( now - start >= limit ) {
+        timedOut = 1;
+        break;
+      }
+      DSI_Headset_Idle( s->h, SHUTDOWN_IDLE_SECONDS );
+      error = CheckError();
+      now = lsl_local_clock();
+      if( o->samples != received ) {
+        received = o->samples;
+        quietSince = now;
+      }
+    }
+    DSI_Headset_SetSampleCallback( s->h, NULL, NULL );
+    if( CheckError() != 0 ) error = -1;
+  }
+  drained = lsl_local_clock();
+  flushed = FlushPartialChunks( s );
+
+  /* Destroying an outlet drops what it has not sent yet */
+  remaining = limit - ( lsl_local_clock() - start );
+  if( s->eegConsumers && remaining > 0 )
+    Sleep( remaining * 1000.0 < SHUTDOWN_LINGER_MS ? (DWORD)( remaining * 1000.0 ) : SHUTDOWN_LINGER_MS );
+  now = lsl_local_clock();
+
+  Log( stdout, "Acquisition ended in %.1f ms (limit %.0f ms): %lld samples in flight drained in %.1f ms, "
+       "%u flushed from the partial chunk.\n", ( now - start ) * 1000.0, limit * 1000.0,
+       (long long)( o->samples - before ), ( drained - start ) * 1000.0, flushed );
+  if( timedOut )
+    Log( stderr, "The headset was still sending at the shutdown limit; later samples were discarded.\n" );
+  return error;
+}
+
+/**
+ * Ends a block: stops data acquisition and destroys the outlets, but keeps the
+ * headset connected so that the next block starts quickly.
+ * @return 0 on success, non-zero on error.
+ */
+static int StopStreaming( DSI2LSL_Session *s )
+{
+  int error;
+  if( !s->streaming ) return 0;
+  if( s->outlets.impedanceOn && StopImpedance( s ) != 0 ) return -1;
+
+  /* The processing thread keeps the connection serviced between blocks */
+  error = EndAcquisition( s );
+  if( s->config.checkAllocations ) AllocCheck_Arm( 0 );
+  s->streaming = 0;
+  s->eegConsumers = 0;
+  DestroyLSL( s );
+  LogSampleAccounting( s );
+  Log( stdout, "Block %d stopped after %lld samples; the headset stays connected.\n", s->blocks, (long long)s->outlets.samples );
+  return error;
+}
+
+/**
+ * Carves the buffers and filters of the sample pipeline out of the arena and
+ * creates the filters there. With an arena that has no memory it only adds up
+ * their sizes (the pointers stay NULL). Needs the channel counts and the
+ * parsed extra outlets, whose channel lists it moves into the arena.
+ */
+static void AllocatePipeline(DSI2LSL_Session *s, Arena *arena)
+{
+  unsigned int numberOfSources = s->h ? DSI_Headset_GetNumberOfSources( s->h ) : 0;
+  int extra;
+
+  s->chunk = CreateChunkBufferManager(arena, s->outletChannels);
+  if (s->config.pullBufferSeconds > 0) {
+    s->pull.capacity = (size_t)( s->config.pullBufferSeconds * ( s->outlets.samplingRate > 0 ? s->outlets.samplingRate : 300 ) ) + 1;
+    s->pull.samples = (float *)ArenaAlloc(arena, s->pull.capacity * s->numberOfChannels * sizeof(float));
+    s->pull.timestamps = (double *)ArenaAlloc(arena, s->pull.capacity * sizeof(double));
+  }
+  if (s->config.pace && s->outlets.samplingRate > 0)
+    s->pacerMemory = ArenaAlloc(arena, Pacer_MemorySize(CHUNK_SIZE * s->outletChannels, CHUNK_SIZE / s->outlets.samplingRate, PacerMaxDelay(s)));
+  s->outlets.impedanceSources = (DSI_Source *)ArenaAlloc(arena, numberOfSources * sizeof(DSI_Source));
+  s->outlets.impedanceValues = (float *)ArenaAlloc(arena, numberOfSources * sizeof(float));
+  s->outlets.impedanceLabels = (char (*)[ LABEL_LENGTH ])ArenaAlloc(arena, numberOfSources * LABEL_LENGTH);
+  if (s->config.compressedOutlet) {
+    s->compressedCapacity = EegCodec_MaxEncodedSize(s->outletChannels, CHUNK_SIZE);
+    s->compressedBuffer = (unsigned char *)ArenaAlloc(arena, s->compressedCapacity);
+  }
+  if (s->config.qualityOutlet) {
+    s->qualityValues = (float *)ArenaAlloc(arena, QUALITY_METRICS * s->numberOfChannels * sizeof(float));
+    s->quality = Quality_Create(ArenaAlloc(arena, Quality_MemorySize(s->numberOfChannels)),
+                                s->numberOfChannels, s->outlets.samplingRate, QUALITY_RAIL_MICROVOLTS);
+  }
+  if (s->config.asrOutlet) {
+    double calibrationSeconds = s->config.asrCalibrationSeconds > 0 ? s->config.asrCalibrationSeconds : ASR_DEFAULT_CALIBRATION_SECONDS;
+    s->cleanedBuffer = (float *)ArenaAlloc(arena, (size_t)CHUNK_SIZE * s->outletChannels * sizeof(float));
+    s->asr = Asr_Create(ArenaAlloc(arena, Asr_MemorySize(s->numberOfChannels, s->outlets.samplingRate, calibrationSeconds)),
+                        s->numberOfChannels, s->outlets.samplingRate, calibrationSeconds,
+                        s->config.asrCutoff > 0 ? s->config.asrCutoff : ASR_DEFAULT_CUTOFF);
+  }
+  if (s->numberOfRawSources > 0)
+    s->rawBuffer = (float *)ArenaAlloc(arena, (size_t)CHUNK_SIZE * s->rawChannels * sizeof(float));
+  for (extra = 0; extra < s->numberOfExtraOutlets; extra++) {
+    ExtraOutlet *e = &s->extraOutlets[extra];
+    unsigned int *channels = (unsigned int *)ArenaAlloc(arena, e->numberOfChannels * sizeof(unsigned int));
+    if (channels) {
+      memcpy(channels, e->channels, e->numberOfChannels * sizeof(unsigned int));
+      e->channels = channels;
+    }
+    e->buffer = ArenaAlloc(arena, (size_t)e->chunkSize * e->numberOfChannels * FormatSize(e->format));
+  }
+  if (s->config.epochOutlet) {
+    double rate = s->outlets.samplingRate > 0 ? s->outlets.samplingRate : 300.0;
+    size_t length;
+    s->epochPreSamples = (unsigned int)floor((s->config.epochPreMs > 0 ? s->config.epochPreMs : EPOCHS_DEFAULT_PRE_MS) * rate / 1000.0 + 0.5);
+    s->epochPostSamples = (unsigned int)floor((s->config.epochPostMs > 0 ? s->config.epochPostMs : EPOCHS_DEFAULT_POST_MS) * rate / 1000.0 + 0.5);
+    if (s->epochPostSamples == 0) s->epochPostSamples = 1;
+    length = (size_t)s->epochPreSamples + s->epochPostSamples;
+    s->epochBuffer = (float *)ArenaAlloc(arena, length * (s->numberOfChannels + 1) * sizeof(float));
+    s->erpBuffer = (float *)ArenaAlloc(arena, length * (s->numberOfChannels + 2) * sizeof(float));
+    s->epochTimestamps = (double *)ArenaAlloc(arena, length * sizeof(double));
+    s->epochs = Epochs_Create(ArenaAlloc(arena, Epochs_MemorySize(s->numberOfChannels, s->outlets.samplingRate, s->epochPreSamples, s->epochPostSamples)),
+                              s->numberOfChannels, s->outlets.samplingRate, s->epochPreSamples, s->epochPostSamples);
+  }
+}
+
+/**
+ * Finds the TRG channel whose edges start epochs: in the montage, or else
+ * among the headset's sources, so that it need not be streamed.
+ */
+static void FindTrigger(DSI2LSL_Session *s)
+{
+  unsigned int i;
+  s->trgChannel = -1;
+  s->trgSource = NULL;
+  for (i = 0; i < s->numberOfChannels && s->trgChannel < 0; i++)
+    if (_stricmp(s->labels[i], "TRG") == 0) s->trgChannel = (int)i;
+  if (s->trgChannel < 0 && s->h) {
+    unsigned int numberOfSources = DSI_Headset_GetNumberOfSources(s->h);
+    for (i = 0; i < numberOfSources && !s->trgSource; i++) {
+      DSI_Source source = DSI_Headset_GetSourceByIndex(s->h, i);
+      if (_stricmp(DSI_Source_GetName(source), "TRG") == 0) s->trgSource = source;
+    }
+  }
+  if (s->trgChannel >= 0 || s->trgSource)
+    Log(stdout, "Epochs: %u samples before and %u from each stimulus; stimuli are TRG edges%s%s.\n",
+        s->epochPreSamples, s->epochPostSamples, s->epochMarkers[0] ? " and markers from " : "", s->epochMarkers);
+  else if (s->epochMarkers[0])
+    Log(stdout, "Epochs: %u samples before and %u from each stimulus; stimuli are markers from %s.\n",
+        s->epochPreSamples, s->epochPostSamples, s->epochMarkers);
+  else
+    Log(stderr, "Epochs: there is no TRG channel and no --epoch-markers stream; the epoch outlets stay empty.\n");
+}
+
+/**
+ * Allocates the arena for the sample pipeline and creates its filters in it,
+ * once per session: blocks reuse them, and nothing is allocated while streaming.
+ * @return 0 on success, non-zero on error.
+ */
+static int SetUpPipeline(DSI2LSL_Session *s)
+{
+  Arena sizing = { NULL, 0, 0 };
+
+  AllocatePipeline(s, &sizing);
+  s->arena.base = (unsigned char *)malloc(sizing.used);
+  if (!s->arena.base) {
+    Log(stderr, "Failed to allocate %zu bytes for the sample pipeline.\n", sizing.used);
+    return -1;
+  }
+  /* Touch every page now rather than in the first sample callbacks */
+  memset(s->arena.base, 0, sizing.used);
+  s->arena.size = sizing.used;
+  AllocatePipeline(s, &s->arena);
+  if (!s->chunk->buffer) {
+    Log(stderr, "The stream has no channels.\n");
+    return -1;
+  }
+
+  free(s->parsedChannels);
+  s->parsedChannels = NULL;
+
+  if (s->config.qualityOutlet && !s->quality) {
+      Log(stderr, "Failed to create the quality estimator.\n");
+      return -1;
+  }
+  if (s->config.asrOutlet && !s->asr) {
+      Log(stderr, "Failed to create the ASR filter.\n");
+      return -1;
+  }
+  if (s->config.epochOutlet) {
+    if (!s->epochs) {
+      Log(stderr, "Failed to create the epoch ring.\n");
+      return -1;
+    }
+    FindTrigger(s);
+  }
+  Log(stdout, "Sample pipeline: %.1f kB in one block, filters and rings included.\n", s->arena.size / 1024.0);
+  return 0;
+}
+
+/**
+ * Opens the recording given as replayPath and creates the EEG outlet for it.
+ * @return 0 on success, non-zero on error.
+ */
+static int InitReplay(DSI2LSL_Session *s)
+{
+  unsigned int channelIndex;
+  double speed = s->config.replaySpeed;
+
+  Replay_SetLog(LogReplay);
+  s->replay = Replay_Open(s->replayPath, s->config.replayRate);
+  if (!s->replay) return -1;
+  s->numberOfChannels = Replay_GetNumberOfChannels(s->replay);
+  s->outletChannels = s->numberOfChannels + (s->config.sequenceChannel ? 1 : 0);
+  s->outlets.samplingRate = Replay_GetSamplingRate(s->replay);
+  if (speed > 0)
+    Log(stderr, "Replaying %s: %u channels at %g Hz, speed %g\n", s->replayPath, s->numberOfChannels, s->outlets.samplingRate, speed);
+  else
+    Log(stderr, "Replaying %s: %u channels at %g Hz, speed max\n", s->replayPath, s->numberOfChannels, s->outlets.samplingRate);
+
+  s->labels = malloc(s->numberOfChannels * sizeof(*s->labels));
+  if (!s->labels) {
+    Log(stderr, "Failed to allocate channel labels.\n");
+    return -1;
+  }
+  for (channelIndex = 0; channelIndex < s->numberOfChannels; channelIndex++)
+    strncpy_s(s->labels[channelIndex], sizeof(s->labels[channelIndex]), Replay_GetChannelLabel(s->replay, channelIndex), _TRUNCATE);
+
+  if (s->config.rawOutlet)
+    Log(stderr, "A recording has no headset sources; --raw-outlet is ignored.\n");
+  if (ParseExtraOutlets(s) != 0) return -1;
+  PlanBacklog(s);
+  if (SetUpPipeline(s) != 0) return -1;
+  s->outlets.eeg = CreateOutlet(s->streamName, s->numberOfChannels, s->outlets.samplingRate, s->labels, "replay", s->maxBuffered, s->config.sequenceChannel);
+  if (!s->outlets.eeg) return -1;
+  if (s->config.pace && InitPacer(s) != 0) return -1;
+  if (s->config.compressedOutlet && InitCompressedLSL(s) != 0) return -1;
+  if (s->config.qualityOutlet && InitQualityLSL(s) != 0) return -1;
+  if (s->config.asrOutlet && InitCleanedLSL(s, "replay") != 0) return -1;
+  if (InitEpochLSL(s, "replay") != 0) return -1;
+  return InitExtraLSL(s, "replay");
+}
+
+// -----------------------------------------------------------------------------
+// Metrics
+// -----------------------------------------------------------------------------
+/* Appends a counter or gauge with its description and a single value */
+static void WriteMetric( MetricsText *t, const char *name, const char *type, const char *help, double value )
+{
+  Metrics_Describe( t, name, type, help );
+  Metrics_Printf( t, "%s %.17g\n", name, value );
+}
+
+/**
+ * Metrics_RenderCallback for --metrics, on the server's thread. Reads the
+ * counters the acquisition threads keep anyway; the sample counters restart
+ * with each block, which Prometheus treats as a counter reset.
+ */
+static void RenderMetrics( MetricsText *t, void *userData )
+{
+  DSI2LSL_Session *s = (DSI2LSL_Session *)userData;
+  SampleOutlets *o = &s->outlets;
+  double now = lsl_local_clock(), rate = 0.0;
+  LONGLONG samples = o->samples;
+  unsigned int sourceIndex, numberOfImpedances = o->impedanceOn ? o->numberOfImpedanceSources : 0;
+
+  if( s->metricsPreviousTime > 0 && now > s->metricsPreviousTime && samples >= s->metricsPreviousSamples )
+    rate = ( samples - s->metricsPreviousSamples ) / ( now - s->metricsPreviousTime );
+  s->metricsPreviousSamples = samples;
+  s->metricsPreviousTime = now;
+
+  Metrics_Describe( t, "dsi2lsl_info", "gauge", "Name of the EEG stream" );
+  Metrics_Printf( t, "dsi2lsl_info{stream=" );
+  Metrics_LabelValue( t, s->streamName );
+  Metrics_Printf( t, ",mode=\"%s\"} 1\n", s->replay ? "replay" : "headset" );
+  WriteMetric( t, "dsi2lsl_streaming", "gauge", "1 while data acquisition runs and the outlets are open", s->streaming );
+  WriteMetric( t, "dsi2lsl_blocks_total", "counter", "Streaming blocks started", s->blocks );
+  WriteMetric( t, "dsi2lsl_samples_total", "counter", "Samples received in the current block", (double)samples );
+  WriteMetric( t, "dsi2lsl_sample_rate_hz", "gauge", "Samples received per second since the previous scrape", rate );
+  WriteMetric( t, "dsi2lsl_chunks_total", "counter", "EEG chunks completed", (double)s->chunks );
+  WriteMetric( t, "dsi2lsl_samples_lost_total", "counter", "Samples the headset sent that never arrived, in the current block", (double)o->lostSamples );
+  WriteMetric( t, "dsi2lsl_gaps_total", "counter", "Runs of lost samples in the current block", (double)o->gaps );
+  WriteMetric( t, "dsi2lsl_samples_duplicated_total", "counter", "Samples whose index had already been seen, in the current block", (double)o->duplicatedSamples );
+  WriteMetric( t, "dsi2lsl_samples_late_total", "counter", "Samples that arrived 100 ms or more after the earliest arrivals, allowing for clock drift, in the current block", (double)o->lateSamples );
+  WriteMetric( t, "dsi2lsl_arrival_delay_seconds", "gauge", "Arrival delay of the last sample beyond the earliest arrivals, allowing for clock drift", samples > 0 ? o->lastArrivalDelay - o->arrivalBaseline : 0.0 );
+  WriteMetric( t, "dsi2lsl_pull_dropped_total", "counter", "Samples dropped because the pull buffer was full", (double)s->pull.dropped );
+  WriteMetric( t, "dsi2lsl_log_messages_dropped_total", "counter", "Log messages dropped because the log queue was full", (double)logDroppedTotal );
+  if( s->epochs ) WriteMetric( t, "dsi2lsl_epochs_total", "counter", "Epochs pushed on the epoch outlet in the current block", (double)s->epochsPushed );
+  WriteMetric( t, "dsi2lsl_eeg_consumers", "gauge", "1 if the EEG outlet had consumers at the last chunk", s->eegConsumers );
+  WriteMetric( t, "dsi2lsl_private_memory_bytes", "gauge", "Private memory of the process", (double)PrivateMemory() );
+  Metrics_Histogram( t, "dsi2lsl_push_seconds", "Time taken by lsl_push_chunk_ft on the EEG outlet", &s->pushSeconds );
+  Metrics_Histogram( t, "dsi2lsl_idle_seconds", "Time taken by DSI_Headset_Idle", &s->idleSeconds );
+
+  WriteMetric( t, "dsi2lsl_impedance_on", "gauge", "1 while the impedance driver is on", o->impedanceOn );
+  if( numberOfImpedances > 0 ) {
+    float minimum = o->impedanceValues[ 0 ], maximum = minimum;
+    double sum = 0.0;
+    Metrics_Describe( t, "dsi2lsl_impedance_megaohms", "gauge", "Impedance of each electrode" );
+    for( sourceIndex = 0; sourceIndex < numberOfImpedances; sourceIndex++ ) {
+      float value = o->impedanceValues[ sourceIndex ];
+      if( value < minimum ) minimum = value;
+      if( value > maximum ) maximum = value;
+      sum += value;
+      Metrics_Printf( t, "dsi2lsl_impedance_megaohms{electrode=" );
+      Metrics_LabelValue( t, o->impedanceLabels[ sourceIndex ] );
+      Metrics_Printf( t, "} %g\n", value );
+    }
+    WriteMetric( t, "dsi2lsl_impedance_min_megaohms", "gauge", "Lowest electrode impedance", minimum );
+    WriteMetric( t, "dsi2lsl_impedance_mean_megaohms", "gauge", "Mean electrode impedance", sum / numberOfImpedances );
+    WriteMetric( t, "dsi2lsl_impedance_max_megaohms", "gauge", "Highest electrode impedance", maximum );
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Public API
+// -----------------------------------------------------------------------------
+void DSI2LSL_DefaultConfig( DSI2LSL_Config *config )
+{
+  memset( config, 0, sizeof( *config ) );
+  config->verbosity = 2;
+  config->replaySpeed = 1.0;
+}
+
+void DSI2LSL_SetMessageCallback( DSI2LSL_MessageCallback callback, void *userData )
+{
+  messageCallback = callback;
+  messageUserData = userData;
+}
+
+void DSI2LSL_SetLogOptions( int minimumLevel, int timestamps )
+{
+  logMinimumLevel = minimumLevel;
+  logTimestamps = timestamps;
+}
+
+int DSI2LSL_Open( const DSI2LSL_Config *config, DSI2LSL_Session **sessionOut )
+{
+  DSI2LSL_Session *s;
+  int error;
+
+  *sessionOut = NULL;
+  s = (DSI2LSL_Session *)calloc( 1, sizeof( DSI2LSL_Session ) );
+  if( !s ) {
+    Log( stderr, "Failed to allocate session.\n" );
+    return -1;
+  }
+  StartLogWriter();
+  srand( (unsigned int)time( NULL ) ); // Seed RNG for the source IDs
+  s->config = *config;
+  s->config.port = s->config.montage = s->config.reference = NULL;  /* Only valid during the call */
+  s->config.streamName = s->config.replayPath = s->config.extraOutlets = s->config.tracePath = NULL;
+  s->config.metricsAddress = s->config.epochMarkers = NULL;
+  if( config->tracePath && *config->tracePath ) {
+    strncpy_s( s->tracePath, sizeof( s->tracePath ), config->tracePath, _TRUNCATE );
+    if( Trace_Start() == 0 ) Trace_NameThread( "Host" );
+    else Log( stderr, "Failed to start tracing.\n" );
+  }
+  if( config->extraOutlets && *config->extraOutlets ) {
+    size_t length = strlen( config->extraOutlets ) + 1;
+    s->extraOutletSpec = (char *)malloc( length );
+    if( s->extraOutletSpec ) memcpy( s->extraOutletSpec, config->extraOutlets, length );
+  }
+  if( config->epochMarkers && *config->epochMarkers )
+    strncpy_s( s->epochMarkers, sizeof( s->epochMarkers ), config->epochMarkers, _TRUNCATE );
+  strncpy_s( s->streamName, sizeof( s->streamName ), config->streamName ? config->streamName : "WS-default", _TRUNCATE );
+  s->keepRunning = 1;
+  s->openedAt = lsl_local_clock();
+  InitializeCriticalSection( &s->commandLock );
+  InitializeCriticalSection( &s->markerLock );
+  s->commandEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+  if( config->replayPath && *config->replayPath ) {
+    /* Replay mode feeds a recording through the LSL pipeline; no headset or DSI library is needed */
+    strncpy_s( s->replayPath, sizeof( s->replayPath ), config->replayPath, _TRUNCATE );
+    Log( stdout, "Initializing %s outlet\n", s->streamName );
+    error = InitReplay( s );
+  } else {
+    double loadStart = lsl_local_clock();
+    error = LoadAPI();
+    if( !error ) Log( stdout, "Startup: load API %.0f ms\n", ( lsl_local_clock() - loadStart ) * 1000.0 );
+    if( !error ) error = StartUp( config, &s->h );
+    if( !error ) error = ReadChannels( s );
+    if( !error && config->rawOutlet ) error = ReadSources( s );
+    if( !error ) error = ParseExtraOutlets( s );
+    if( !error ) PlanBacklog( s );
+    if( !error ) error = SetUpPipeline( s );
+  }
+
+  if( !error && config->metricsAddress && *config->metricsAddress ) {
+    s->metrics = MetricsServer_Start( config->metricsAddress, RenderMetrics, s );
+    if( s->metrics ) Log( stdout, "Serving metrics at http://%s%s/metrics\n",
+                          strchr( config->metricsAddress, ':' ) ? "" : METRICS_DEFAULT_HOST ":", config->metricsAddress );
+    else {
+      Log( stderr, "Failed to serve metrics at %s.\n", config->metricsAddress );
+      error = -1;
+    }
+  }
+
+  if( error ) {
+    DSI2LSL_Close( s );
+    return error;
+  }
+  LogMemoryUse( "after connecting" );
+  *sessionOut = s;
+  return 0;
+}
+
+void DSI2LSL_SetSampleCallback( DSI2LSL_Session *session, DSI2LSL_SampleCallback callback, void *userData )
+{
+  session->onSample = callback;
+  session->onSampleData = userData;
+}
+
+int DSI2LSL_Start( DSI2LSL_Session *s )
+{
+  if( s->epochs && s->epochMarkers[ 0 ] ) {
+    s->markerThread = CreateThread( NULL, 0, EpochMarkerThread, s, 0, NULL );
+    if( s->markerThread == NULL ) {
+      Log( stderr, "Error creating the epoch marker thread.\n" );
+      return -1;
+    }
+  }
+
+  if( s->replay ) {
+    Log( stdout, "Streaming...\n" );
+    s->blocks = 1;
+    s->blockRequestedAt = lsl_local_clock();
+    s->streaming = 1;
+    if( s->config.checkAllocations ) AllocCheck_Arm( 1 );
+    s->processingThread = CreateThread( NULL, 0, ReplayThread, s, 0, NULL );
+    if( s->processingThread == NULL ) {
+      Log( stderr, "Error creating replay thread.\n" );
+      return -1;
+    }
+    s->started = 1;
+    return 0;
+  }
+
+  if( s->config.standby )
+    Log( stdout, "Standing by with the headset connected; send start to begin streaming.\n" );
+  else if( StartStreaming( s, lsl_local_clock() ) != 0 )
+    return -1;
+  s->started = 1;
+
+   /* Create and start the DSI processing thread */
+  s->processingThread = CreateThread(NULL, 0, DSI_Processing_Thread, s, 0, NULL);
+  if (s->processingThread == NULL) {
+      Log(stderr, "Error creating DSI processing thread.\n");
+      return -1;
+  }
+  return 0;
+}
+
+void DSI2LSL_RequestStop( DSI2LSL_Session *session )
+{
+  session->keepRunning = 0;
+}
+
+int DSI2LSL_IsRunning( const DSI2LSL_Session *session )
+{
+  return session->keepRunning == 1;
+}
+
+int DSI2LSL_Shutdown( DSI2LSL_Session *s )
+{
+  if( s->shutDown ) return s->shutdownError;
+  s->shutDown = 1;
+
+  /* Closing the threads */
+  s->keepRunning = 0;
+  if (s->processingThread != NULL) {
+      Log(stdout, "Waiting for DSI thread to terminate...\n");
+      WaitForSingleObject(s->processingThread, INFINITE);
+      CloseHandle(s->processingThread);
+      s->processingThread = NULL;
+      Log(stdout, "DSI thread has terminated.\n");
+  }
+  if (s->markerThread != NULL) {
+      WaitForSingleObject(s->markerThread, INFINITE);
+      CloseHandle(s->markerThread);
+      s->markerThread = NULL;
+      if (s->markersDropped > 0)
+          Log(stderr, "Epoch markers: %lld dropped because the marker queue was full.\n", (long long)s->markersDropped);
+  }
+  if( s->streaming && EndAcquisition( s ) != 0 ) s->shutdownError = -1;
+
+  if( s->config.checkAllocations ) {
+    const char *file;
+    int line;
+    long long violations;
+    AllocCheck_Arm( 0 );
+    violations = AllocCheck_Violations( &file, &line );
+    if( violations > 0 ) {
+      Log( stderr, "Allocation check failed: %lld allocations or frees while streaming, the first at %s:%d.\n", violations, file, line );
+      s->shutdownError = -1;
+    } else if( s->blocks > 0 ) {
+      Log( stdout, "Allocation check passed: nothing was allocated or freed while streaming.\n" );
+    }
+  }
+  return s->shutdownError;
+}
+
+int DSI2LSL_Close( DSI2LSL_Session *s )
+{
+  int error = 0;
+  if( !s ) return 0;
+
+  MetricsServer_Stop( s->metrics );
+  if( DSI2LSL_Shutdown( s ) != 0 ) error = -1;
+
+  if( s->h ) {
+    /* Disconnects from the serial port and frees the headset */
+    DSI_Headset_Delete( s->h );
+    if( CheckError() != 0 ) error = -1;
+    if( s->streaming ) LogSampleAccounting( s );
+  }
+  if( s->replay ) {
+    Replay_Close( s->replay );
+    LogSampleAccounting( s );
+  }
+  if( s->pull.dropped > 0 )
+    Log( stderr, "%lld samples were dropped because the pull buffer was full.\n", (long long)s->pull.dropped );
+
+  DestroyLSL( s );
+  if( s->commandEvent ) CloseHandle( s->commandEvent );
+  DeleteCriticalSection( &s->commandLock );
+  DeleteCriticalSection( &s->markerLock );
+  free( s->arena.base );
+  free( s->rawSources );
+  free( s->rawLabels );
+  free( s->parsedChannels );
+  free( s->extraOutletSpec );
+  free( s->labels );
+  free( s->channels );
+  if( s->tracePath[ 0 ] ) {
+    long long spans = Trace_Write( s->tracePath );
+    if( spans < 0 ) Log( stderr, "Failed to write the trace to %s.\n", s->tracePath );
+    else Log( stdout, "Wrote %lld spans to %s; open it in https://ui.perfetto.dev or chrome://tracing.\n", spans, s->tracePath );
+  }
+  free( s );
+  StopLogWriter();
+  return error;
+}
+
+unsigned int DSI2LSL_GetNumberOfChannels( const DSI2LSL_Session *session )
+{
+  return session->numberOfChannels;
+}
+
+double DSI2LSL_GetSamplingRate( const DSI2LSL_Session *session )
+{
+  return session->outlets.samplingRate;
+}
+
+const char * DSI2LSL_GetChannelLabel( const DSI2LSL_Session *session, unsigned int channelIndex )
+{
+  return channelIndex < session->numberOfChannels ? session->labels[ channelIndex ] : NULL;
+}
+
+size_t DSI2LSL_Pull( DSI2LSL_Session *s, float *samples, double *timestamps, size_t maxSamples )
+{
+  PullBuffer *p = &s->pull;
+  size_t available, count, slot, first;
+  if( !p->capacity ) return 0;
+
+  available = (size_t)( p->writeCount - p->readCount );
+  MemoryBarrier();
+  count = available < maxSamples ? available : maxSamples;
+  slot = (size_t)( p->readCount % (LONGLONG)p->capacity );
+
+  /* Copy in at most two runs: up to the end of the ring, then from its start */
+  first = count < p->capacity - slot ? count : p->capacity - slot;
+  memcpy( samples, p->samples + slot * s->numberOfChannels, first * s->numberOfChannels * sizeof( float ) );
+  memcpy( samples + first * s->numberOfChannels, p->samples, ( count - first ) * s->numberOfChannels * sizeof( float ) );
+  if( timestamps ) {
+    memcpy( timestamps, p->timestamps + slot, first * sizeof( double ) );
+    memcpy( timestamps + first, p->timestamps, ( count - first ) * sizeof( double ) );
+  }
+  MemoryBarrier();
+  p->readCount += count;
+  return count;
+}
+
+int DSI2LSL_Command( DSI2LSL_Session *s, uint32_t command )
+{
+    if (command == IPC_CMD_PING) return IPC_STATUS_OK;
+    if (command == IPC_CMD_SHUTDOWN) {
+        /* The host sees DSI2LSL_IsRunning turn 0 and closes the session, which ends acquisition gracefully */
+        Log(stdout, "Shutdown requested.\n");
+        DSI2LSL_RequestStop(s);
+        return IPC_STATUS_OK;
+    }
+    if (command != IPC_CMD_CHECK_Z_ON && command != IPC_CMD_CHECK_Z_OFF && command != IPC_CMD_RESET_Z &&
+        command != IPC_CMD_START_STREAMING && command != IPC_CMD_STOP_STREAMING)
+        return IPC_STATUS_UNKNOWN_COMMAND;
+    if (!s->h || !s->started) return IPC_STATUS_FAILED;   /* Nothing to control in a replay */
+
+    EnterCriticalSection(&s->commandLock);
+    if (s->numberOfCommands == COMMAND_QUEUE_SIZE) {
+        LeaveCriticalSection(&s->commandLock);
+        Log(stderr, "Command %s dropped: too many commands waiting.\n", CommandName(command));
+        return IPC_STATUS_FAILED;
+    }
+    QueuedCommand *queued = &s->commands[(s->firstCommand + s->numberOfCommands) % COMMAND_QUEUE_SIZE];
+    queued->command = command;
+    queued->queuedAt = lsl_local_clock();
+    s->numberOfCommands++;
+    LeaveCriticalSection(&s->commandLock);
+    SetEvent(s->commandEvent);
+    return IPC_STATUS_OK;
+}
+
+uint32_t DSI2LSL_GetTelemetry( DSI2LSL_Session *s, const IpcTelemetry *previous, IpcTelemetry *telemetry,
+                               float *impedances, uint32_t maxImpedances )
+{
+    SampleOutlets *o = &s->outlets;
+    double now = lsl_local_clock();
+    LONGLONG samples = o->samples;
+    uint32_t count = 0;
+
+    memset(telemetry, 0, sizeof(*telemetry));
+    telemetry->timestamp = now;
+    telemetry->samples = (uint64_t)samples;
+    /* The sample counter restarts with each block */
+    if (previous && previous->timestamp > 0 && now > previous->timestamp && (uint64_t)samples >= previous->samples)
+        telemetry->sampleRate = ((uint64_t)samples - previous->samples) / (now - previous->timestamp);
+
+    if (samples > 0) {
+        /* Samples the headset sent (judging by its packet times) but that never arrived */
+        telemetry->samplesLost = (uint64_t)o->lostSamples;
+        telemetry->latency = o->lastArrivalDelay - o->arrivalBaseline;
+    }
+
+    telemetry->streaming = (uint32_t)s->streaming;
+    telemetry->maxBuffered = (uint32_t)s->maxBuffered;
+    /* Cached by the acquisition thread, which may destroy the outlet at any time */
+    telemetry->hasConsumers = s->eegConsumers ? 1 : 0;
+    telemetry->pullBacklog = s->pull.capacity ? (uint32_t)(s->pull.writeCount - s->pull.readCount) : 0;
+    telemetry->privateMemory = (uint64_t)PrivateMemory();
+    telemetry->impedanceOn = (uint32_t)o->impedanceOn;
+    if (o->impedanceOn) {
+        count = o->numberOfImpedanceSources < maxImpedances ? o->numberOfImpedanceSources : maxImpedances;
+        memcpy(impedances, o->impedanceValues, count * sizeof(float));
+    }
+    telemetry->numberOfImpedances = count;
+    return count;
+}
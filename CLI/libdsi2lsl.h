@@ -0,0 +1,198 @@
+/*
+ * libdsi2lsl.h
+ * ---------------------------------------------
+ * Acquisition core of dsi2lsl as an embeddable library.
+ *
+ * A session connects to a DSI headset (or replays a recording), publishes the
+ * samples on the LSL outlets described in the dsi2lsl help text and, in
+ * addition, hands every sample to the host application, either through a
+ * callback on the acquisition thread or through a buffer the host pulls from.
+ * The dsi2lsl command-line tool and the GUI (when hosting acquisition
+ * in-process) are both built on this API.
+ *
+ * Typical use:
+ *
+ *   DSI2LSL_Config config;
+ *   DSI2LSL_Session *session;
+ *   DSI2LSL_DefaultConfig( &config );
+ *   config.port = "COM4";
+ *   if( DSI2LSL_Open( &config, &session ) == 0 && DSI2LSL_Start( session ) == 0 ) {
+ *     while( DSI2LSL_IsRunning( session ) ) { ... DSI2LSL_Pull( session, ... ) ... }
+ *   }
+ *   DSI2LSL_Close( session );
+ *
+ * For support or feature requests, create a GitHub Issue or contact support@wearablesensing.com.
+ */
+
+#ifndef LIBDSI2LSL_H
+#define LIBDSI2LSL_H
+
+#include <stddef.h>
+#include "ipc_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct DSI2LSL_Session DSI2LSL_Session;
+
+/**
+ * Session configuration. Strings only need to stay valid until DSI2LSL_Open returns.
+ */
+typedef struct {
+  const char *port;             /* Serial port; NULL or "" uses the DSISerialPort environment variable, "auto" probes all ports */
+  int         portProbeMs;      /* Time allowed for port="auto" to find the headset; 0 for the default */
+  const char *montage;          /* Channel list; NULL for the headset default */
+  const char *reference;        /* Reference; NULL for the headset default */
+  const char *streamName;       /* LSL stream name; NULL for "WS-default" */
+  int         verbosity;        /* Verbosity of headset messages */
+  const char *replayPath;       /* If set, replay this .xdf or .csv file instead of connecting to a headset */
+  double      replaySpeed;      /* 1 = real time, N = N times real time, 0 = as fast as possible */
+  double      replayRate;       /* Overrides the replayed sampling rate in Hz if > 0 */
+  int         replayLoop;       /* Restart the replay when the end is reached */
+  double      pullBufferSeconds;/* Seconds of samples kept for DSI2LSL_Pull; 0 disables pulling */
+  double      maxBuffered;      /* Seconds an LSL consumer may fall behind; 0 for 360 */
+  double      memoryBudgetMB;   /* Caps the projected backlog of all outlets per consumer; 0 for no cap */
+  int         compressedOutlet; /* Also publish the EEG losslessly compressed on "<streamName>-Compressed" */
+  double      compressedResolution; /* Quantization step of the compressed outlet in microvolts; 0 for 0.01 */
+  int         qualityOutlet;    /* Publish per-channel signal quality on "<streamName>-Quality" */
+  int         sequenceChannel;  /* Append a channel with the sample index derived from the headset's packet times */
+  int         asrOutlet;        /* Publish the EEG cleaned by ASR on "<streamName>-Cleaned" */
+  double      asrCalibrationSeconds; /* Data ASR calibrates on; 0 for ASR_DEFAULT_CALIBRATION_SECONDS */
+  double      asrCutoff;        /* ASR rejection threshold in standard deviations; 0 for ASR_DEFAULT_CUTOFF */
+  int         pace;             /* Release the EEG outlet's chunks at the nominal rate instead of as they complete */
+  double      paceMaxDelayMs;   /* Most latency the pacer may add; 0 for PACER_DEFAULT_MAX_DELAY */
+  int         rawOutlet;        /* Publish the headset's source signals, before the montage, on "<streamName>-Raw" */
+  const char *extraOutlets;     /* Additional outlets with their own policies, see --extra-outlets; NULL for none */
+  int         epochOutlet;      /* Publish epochs around TRG edges and markers on "<streamName>-Epochs", their averages on "-ERP" */
+  double      epochPreMs;       /* Epoch length before the stimulus; 0 for EPOCHS_DEFAULT_PRE_MS */
+  double      epochPostMs;      /* Epoch length from the stimulus on; 0 for EPOCHS_DEFAULT_POST_MS */
+  const char *epochMarkers;     /* Name of an LSL marker stream whose markers also start epochs; NULL for TRG only */
+  const char *tracePath;        /* If set, record pipeline spans and write them to this Chrome trace JSON file on close */
+  const char *metricsAddress;   /* If set, serve Prometheus metrics at http://<metricsAddress>/metrics, see metrics.h */
+  int         checkAllocations; /* Test mode: DSI2LSL_Close fails if the library allocated or freed memory while streaming */
+  int         standby;          /* Connect only; streaming starts with IPC_CMD_START_STREAMING */
+  int         shutdownTimeoutMs;/* Most time ending acquisition may take to drain and flush the last samples; 0 for 500 */
+} DSI2LSL_Config;
+
+/** Severity of library messages (see DSI2LSL_SetLogOptions) */
+enum {
+  DSI2LSL_LOG_INFO = 0,         /* Progress and statistics; stdout */
+  DSI2LSL_LOG_WARNING,          /* Notices and recoverable problems; stderr */
+  DSI2LSL_LOG_ERROR             /* Errors reported by the DSI API; stderr */
+};
+
+/**
+ * Receives status messages; isError is set for what the command-line tool
+ * prints to stderr. While a session is open it is called on the library's
+ * log writer thread, in the order the messages were logged.
+ */
+typedef void (*DSI2LSL_MessageCallback)( const char *message, int isError, void *userData );
+
+/**
+ * Receives each sample on the acquisition thread; must return quickly.
+ * @param sample    - One value per channel, in microvolts
+ * @param timestamp - LSL local clock when the sample arrived
+ */
+typedef void (*DSI2LSL_SampleCallback)( const float *sample, unsigned int numberOfChannels, double timestamp, void *userData );
+
+/** Fills in the defaults used by the dsi2lsl command-line tool. */
+void DSI2LSL_DefaultConfig( DSI2LSL_Config *config );
+
+/**
+ * Routes messages to a callback instead of stdout/stderr (process-wide).
+ * Pass NULL to restore the default.
+ */
+void DSI2LSL_SetMessageCallback( DSI2LSL_MessageCallback callback, void *userData );
+
+/**
+ * Sets the least severe DSI2LSL_LOG_* level passed on (default DSI2LSL_LOG_INFO)
+ * and whether messages start with the LSL local clock time they were logged at
+ * (process-wide). Messages are queued without blocking the thread that logs
+ * them; if the queue overflows, a count of the dropped messages follows.
+ */
+void DSI2LSL_SetLogOptions( int minimumLevel, int timestamps );
+
+/**
+ * Loads the DSI API if needed and connects to the headset (or opens the
+ * recording). Blocks while connecting. The LSL outlets are created when
+ * streaming starts.
+ *
+ * @param config     - Session configuration
+ * @param sessionOut - Receives the session, or NULL on error
+ * @return 0 on success, non-zero on error (the reason has been reported as a message)
+ */
+int DSI2LSL_Open( const DSI2LSL_Config *config, DSI2LSL_Session **sessionOut );
+
+/** Sets the per-sample callback. Call before DSI2LSL_Start. */
+void DSI2LSL_SetSampleCallback( DSI2LSL_Session *session, DSI2LSL_SampleCallback callback, void *userData );
+
+/**
+ * Starts the worker threads and, unless config.standby is set, streaming.
+ * While connected, IPC_CMD_STOP_STREAMING and IPC_CMD_START_STREAMING end and
+ * begin blocks without reconnecting; the outlets exist only while streaming.
+ * @return 0 on success
+ */
+int DSI2LSL_Start( DSI2LSL_Session *session );
+
+/** Asks the worker threads to finish; safe to call from a signal handler. */
+void DSI2LSL_RequestStop( DSI2LSL_Session *session );
+
+/** @return 0 once the session has stopped, on request, on error or at the end of a replay */
+int DSI2LSL_IsRunning( const DSI2LSL_Session *session );
+
+/**
+ * Ends acquisition gracefully: joins the threads, stops the headset, publishes
+ * the samples it had already sent and pushes the partial chunks with their own
+ * timestamps, within config.shutdownTimeoutMs. The outlets and the pull buffer
+ * stay available, so that a host can pull the last samples before closing.
+ * DSI2LSL_Close calls it if the host did not.
+ * @return 0 on success
+ */
+int DSI2LSL_Shutdown( DSI2LSL_Session *session );
+
+/** Shuts down (see DSI2LSL_Shutdown), disconnects and frees the session. @return 0 on success */
+int DSI2LSL_Close( DSI2LSL_Session *session );
+
+unsigned int DSI2LSL_GetNumberOfChannels( const DSI2LSL_Session *session );
+double       DSI2LSL_GetSamplingRate( const DSI2LSL_Session *session );
+const char * DSI2LSL_GetChannelLabel( const DSI2LSL_Session *session, unsigned int channelIndex );
+
+/**
+ * Copies the oldest buffered samples (channel-interleaved) out of the pull
+ * buffer. Samples that arrive while the buffer is full are dropped; their
+ * number is reported when the session is closed.
+ *
+ * @param samples    - Receives up to maxSamples * numberOfChannels values
+ * @param timestamps - Receives one LSL local clock time per sample; may be NULL
+ * @param maxSamples - Capacity in samples
+ * @return Number of samples copied
+ */
+size_t DSI2LSL_Pull( DSI2LSL_Session *session, float *samples, double *timestamps, size_t maxSamples );
+
+/**
+ * Queues an IPC_CMD_* command (see ipc_protocol.h). Commands are applied in
+ * order on the acquisition thread between headset updates; when one takes
+ * effect it is marked on the "<streamName>-Markers" outlet and the time it
+ * waited is logged. Returns without waiting for the command to be applied.
+ * IPC_CMD_SHUTDOWN is not queued: it requests the stop, and the host then
+ * closes the session once DSI2LSL_IsRunning returns 0.
+ * @return IPC_STATUS_OK if the command was queued (or is a ping), otherwise an IPC_STATUS_* error
+ */
+int DSI2LSL_Command( DSI2LSL_Session *session, uint32_t command );
+
+/**
+ * Fills in the same telemetry the --ipc channel sends. Safe to call from any
+ * thread while the session is open.
+ * @param previous - The caller's previous telemetry, from which the sample rate
+ *                   is computed; NULL (or zeroed) on the first call
+ * @return Number of impedance values written (at most maxImpedances)
+ */
+uint32_t DSI2LSL_GetTelemetry( DSI2LSL_Session *session, const IpcTelemetry *previous, IpcTelemetry *telemetry,
+                               float *impedances, uint32_t maxImpedances );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBDSI2LSL_H */
@@ -0,0 +1,241 @@
+/*
+ * metrics.c
+ * ---------------------------------------------
+ * Prometheus metrics endpoint (see metrics.h).
+ *
+ * The server handles one connection at a time: Prometheus scrapes every few
+ * seconds, and a request is answered from memory within microseconds. Each
+ * connection gets a few seconds to send its request, so a client that stalls
+ * cannot keep the endpoint busy for long.
+ */
+
+#include "metrics.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include "alloccheck.h"
+
+#define METRICS_REQUEST_SIZE 2048
+#define METRICS_SOCKET_TIMEOUT_MS 2000
+
+const double Metrics_SecondsBuckets[ METRICS_SECONDS_BUCKETS ] = {
+  50e-6, 100e-6, 250e-6, 500e-6, 1e-3, 2.5e-3, 5e-3, 10e-3, 25e-3, 50e-3, 100e-3, 250e-3
+};
+
+void Metrics_Observe( MetricsHistogram *histogram, double seconds )
+{
+  int bucket = 0;
+  while( bucket < METRICS_SECONDS_BUCKETS && seconds > Metrics_SecondsBuckets[ bucket ] ) bucket++;
+  histogram->counts[ bucket ]++;
+  histogram->sum += seconds;
+}
+
+void Metrics_Printf( MetricsText *text, const char *format, ... )
+{
+  va_list args;
+  int written;
+  size_t remaining = text->capacity - text->length;
+  if( remaining <= 1 ) return;
+  va_start( args, format );
+  written = vsnprintf( text->text + text->length, remaining, format, args );
+  va_end( args );
+  if( written < 0 ) return;
+  text->length += (size_t)written < remaining ? (size_t)written : remaining - 1;
+}
+
+void Metrics_Describe( MetricsText *text, const char *name, const char *type, const char *help )
+{
+  Metrics_Printf( text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type );
+}
+
+void Metrics_LabelValue( MetricsText *text, const char *value )
+{
+  Metrics_Printf( text, "\"" );
+  for( ; *value; value++ ) {
+    if( *value == '\\' ) Metrics_Printf( text, "\\\\" );
+    else if( *value == '"' ) Metrics_Printf( text, "\\\"" );
+    else if( *value == '\n' ) Metrics_Printf( text, "\\n" );
+    else Metrics_Printf( text, "%c", *value );
+  }
+  Metrics_Printf( text, "\"" );
+}
+
+void Metrics_Histogram( MetricsText *text, const char *name, const char *help, const MetricsHistogram *histogram )
+{
+  long long cumulative = 0;
+  int bucket;
+  Metrics_Describe( text, name, "histogram", help );
+  for( bucket = 0; bucket < METRICS_SECONDS_BUCKETS; bucket++ ) {
+    cumulative += histogram->counts[ bucket ];
+    Metrics_Printf( text, "%s_bucket{le=\"%g\"} %lld\n", name, Metrics_SecondsBuckets[ bucket ], cumulative );
+  }
+  cumulative += histogram->counts[ METRICS_SECONDS_BUCKETS ];
+  Metrics_Printf( text, "%s_bucket{le=\"+Inf\"} %lld\n", name, cumulative );
+  Metrics_Printf( text, "%s_sum %.9g\n", name, histogram->sum );
+  Metrics_Printf( text, "%s_count %lld\n", name, cumulative );
+}
+
+struct MetricsServer {
+  SOCKET listener;
+  HANDLE thread;
+  volatile LONG stop;
+  Metrics_RenderCallback render;
+  void *userData;
+  char *response;                   // METRICS_RESPONSE_SIZE bytes
+};
+
+static int SendAll( SOCKET client, const char *data, size_t length )
+{
+  while( length > 0 ) {
+    int sent = send( client, data, length > 65536 ? 65536 : (int)length, 0 );
+    if( sent <= 0 ) return -1;
+    data += sent;
+    length -= (size_t)sent;
+  }
+  return 0;
+}
+
+/* Reads one request and answers it; only the request line matters */
+static void Serve( MetricsServer *m, SOCKET client )
+{
+  char request[ METRICS_REQUEST_SIZE ], header[ 256 ];
+  DWORD timeout = METRICS_SOCKET_TIMEOUT_MS;
+  int received = 0, length;
+  MetricsText text;
+
+  setsockopt( client, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof( timeout ) );
+  setsockopt( client, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof( timeout ) );
+  request[ 0 ] = '\0';
+  while( received < (int)sizeof( request ) - 1 && !strstr( request, "\r\n\r\n" ) ) {
+    int n = recv( client, request + received, (int)sizeof( request ) - 1 - received, 0 );
+    if( n <= 0 ) break;
+    received += n;
+    request[ received ] = '\0';
+  }
+  if( !strchr( request, '\n' ) ) return;
+
+  if( strncmp( request, "GET /metrics", 12 ) != 0 || ( request[ 12 ] != ' ' && request[ 12 ] != '?' ) ) {
+    static const char notFound[] = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 21\r\n"
+                                   "Connection: close\r\n\r\nMetrics are /metrics\n";
+    SendAll( client, notFound, sizeof( notFound ) - 1 );
+    return;
+  }
+  text.text = m->response;
+  text.capacity = METRICS_RESPONSE_SIZE;
+  text.length = 0;
+  m->render( &text, m->userData );
+  length = snprintf( header, sizeof( header ),
+                     "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                     "Content-Length: %lu\r\nConnection: close\r\n\r\n", (unsigned long)text.length );
+  if( SendAll( client, header, (size_t)length ) == 0 ) SendAll( client, text.text, text.length );
+}
+
+static DWORD WINAPI MetricsThread( LPVOID lpParam )
+{
+  MetricsServer *m = (MetricsServer *)lpParam;
+  while( !m->stop ) {
+    SOCKET client = accept( m->listener, NULL, NULL );
+    if( client == INVALID_SOCKET ) {
+      if( !m->stop ) Sleep( 100 );    /* E.g. out of resources; try again */
+      continue;
+    }
+    Serve( m, client );
+    shutdown( client, SD_SEND );
+    closesocket( client );
+  }
+  return 0;
+}
+
+/* Splits "host:port", "[v6 host]:port" or "port"; returns 0 on success */
+static int ParseAddress( const char *address, char *host, size_t hostSize, char *port, size_t portSize )
+{
+  const char *colon = strrchr( address, ':' );
+  size_t hostLength;
+  if( !colon ) {
+    strncpy_s( host, hostSize, METRICS_DEFAULT_HOST, _TRUNCATE );
+    strncpy_s( port, portSize, address, _TRUNCATE );
+    return *port ? 0 : -1;
+  }
+  hostLength = (size_t)( colon - address );
+  if( hostLength >= 2 && address[ 0 ] == '[' && address[ hostLength - 1 ] == ']' ) {
+    address++;
+    hostLength -= 2;
+  }
+  if( hostLength == 0 || hostLength >= hostSize ) return -1;
+  memcpy( host, address, hostLength );
+  host[ hostLength ] = '\0';
+  strncpy_s( port, portSize, colon + 1, _TRUNCATE );
+  return *port ? 0 : -1;
+}
+
+/* Creates a socket listening on the first address host and port resolve to */
+static SOCKET Listen( const char *host, const char *port )
+{
+  struct addrinfo hints, *addresses, *a;
+  SOCKET listener = INVALID_SOCKET;
+  memset( &hints, 0, sizeof( hints ) );
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  hints.ai_flags = AI_PASSIVE;
+  if( getaddrinfo( host, port, &hints, &addresses ) != 0 ) return INVALID_SOCKET;
+  for( a = addresses; a && listener == INVALID_SOCKET; a = a->ai_next ) {
+    int exclusive = 1;
+    listener = socket( a->ai_family, a->ai_socktype, a->ai_protocol );
+    if( listener == INVALID_SOCKET ) continue;
+    /* Fail rather than share the port with another dsi2lsl */
+    setsockopt( listener, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char *)&exclusive, sizeof( exclusive ) );
+    if( bind( listener, a->ai_addr, (int)a->ai_addrlen ) != 0 || listen( listener, SOMAXCONN ) != 0 ) {
+      closesocket( listener );
+      listener = INVALID_SOCKET;
+    }
+  }
+  freeaddrinfo( addresses );
+  return listener;
+}
+
+MetricsServer *MetricsServer_Start( const char *address, Metrics_RenderCallback render, void *userData )
+{
+  MetricsServer *m;
+  WSADATA wsa;
+  char host[ 256 ], port[ 32 ];
+
+  if( ParseAddress( address, host, sizeof( host ), port, sizeof( port ) ) != 0 ) return NULL;
+  if( WSAStartup( MAKEWORD( 2, 2 ), &wsa ) != 0 ) return NULL;
+  m = (MetricsServer *)calloc( 1, sizeof( MetricsServer ) );
+  if( !m ) {
+    WSACleanup();
+    return NULL;
+  }
+  m->render = render;
+  m->userData = userData;
+  m->response = (char *)malloc( METRICS_RESPONSE_SIZE );
+  m->listener = Listen( host, port );
+  if( m->response && m->listener != INVALID_SOCKET )
+    m->thread = CreateThread( NULL, 0, MetricsThread, m, 0, NULL );
+  if( !m->thread ) {
+    MetricsServer_Stop( m );
+    return NULL;
+  }
+  /* Scrapes must never compete with acquisition */
+  SetThreadPriority( m->thread, THREAD_PRIORITY_BELOW_NORMAL );
+  return m;
+}
+
+void MetricsServer_Stop( MetricsServer *m )
+{
+  if( !m ) return;
+  InterlockedExchange( &m->stop, 1 );
+  if( m->listener != INVALID_SOCKET ) closesocket( m->listener );   /* Ends a waiting accept */
+  if( m->thread ) {
+    WaitForSingleObject( m->thread, INFINITE );
+    CloseHandle( m->thread );
+  }
+  free( m->response );
+  free( m );
+  WSACleanup();
+}
@@ -0,0 +1,84 @@
+/*
+ * metrics.h
+ * ---------------------------------------------
+ * Prometheus metrics endpoint for the --metrics option of dsi2lsl.
+ *
+ * A small HTTP server on its own thread answers GET /metrics with the
+ * Prometheus text format, which its render callback writes into a buffer
+ * allocated when the server starts. The callback runs on the server's thread
+ * and reads the metrics without taking locks: each counter, gauge and
+ * histogram has a single writer, and aligned 64-bit values are read whole, so
+ * a scrape may see one metric a sample ahead of another but never a torn value.
+ *
+ * Histograms have fixed buckets (METRICS_SECONDS_BUCKETS) so that recording
+ * an observation is a short search and two additions on the writer's thread.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRICS_DEFAULT_HOST "127.0.0.1"
+#define METRICS_RESPONSE_SIZE 65536         /* Bytes; a longer response is cut off */
+#define METRICS_SECONDS_BUCKETS 12
+
+/** Upper bounds of the histogram buckets in seconds, 50 us to 250 ms; the last bucket is +Inf */
+extern const double Metrics_SecondsBuckets[ METRICS_SECONDS_BUCKETS ];
+
+/** Histogram of durations in seconds; written by one thread only. */
+typedef struct {
+  volatile long long counts[ METRICS_SECONDS_BUCKETS + 1 ];  /* Per bucket, not cumulative */
+  volatile double sum;
+} MetricsHistogram;
+
+/** Records one duration; call from the histogram's writer thread only. */
+void Metrics_Observe( MetricsHistogram *histogram, double seconds );
+
+/** Response being written by the render callback. */
+typedef struct {
+  char *text;
+  size_t capacity;
+  size_t length;
+} MetricsText;
+
+/** Appends printf-style text. */
+void Metrics_Printf( MetricsText *text, const char *format, ... );
+
+/** Appends the # HELP and # TYPE lines of a metric; type is "counter", "gauge" or "histogram". */
+void Metrics_Describe( MetricsText *text, const char *name, const char *type, const char *help );
+
+/** Appends value as a quoted label value, escaping backslashes, quotes and line breaks. */
+void Metrics_LabelValue( MetricsText *text, const char *value );
+
+/** Appends a histogram with its description, buckets, sum and count. */
+void Metrics_Histogram( MetricsText *text, const char *name, const char *help, const MetricsHistogram *histogram );
+
+/** Writes the metrics on the server's thread. */
+typedef void (*Metrics_RenderCallback)( MetricsText *text, void *userData );
+
+typedef struct MetricsServer MetricsServer;
+
+/**
+ * Binds the endpoint and starts the server thread.
+ *
+ * @param address  - "port" (bound to METRICS_DEFAULT_HOST) or "host:port", e.g.
+ *                   "0.0.0.0:9109" to serve on every interface
+ * @param render   - Called for each GET /metrics
+ * @param userData - Passed to render
+ * @return New server, or NULL on error
+ */
+MetricsServer *MetricsServer_Start( const char *address, Metrics_RenderCallback render, void *userData );
+
+/** Stops the server thread and frees the server; render is not called afterwards. */
+void MetricsServer_Stop( MetricsServer *server );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H */
@@ -0,0 +1,256 @@
+/*
+ * pacer.c
+ * ---------------------------------------------
+ * Output pacer (see pacer.h).
+ *
+ * The producer computes each chunk's release time when it submits the chunk,
+ * so the schedule state is only touched by one thread; the pacer thread just
+ * waits for the oldest chunk's release time and hands the chunk on. Both sides
+ * share the ring under a critical section that is held for a copy or a release.
+ * The pacer and its ring live in memory the caller provides, so a pacer per
+ * block of streaming costs a thread and a few events, but no allocation.
+ */
+
+#include "pacer.h"
+#include "lsl_c.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+#include "alloccheck.h"
+
+/* Running mean and variance (Welford) */
+typedef struct {
+  long long count;
+  double mean, sumOfSquares, previous;
+} IntervalStats;
+
+static void AddTime( IntervalStats *stats, double time, int first )
+{
+  if( !first ) {
+    double interval = time - stats->previous;
+    double delta = interval - stats->mean;
+    stats->count++;
+    stats->mean += delta / stats->count;
+    stats->sumOfSquares += delta * ( interval - stats->mean );
+  }
+  stats->previous = time;
+}
+
+static double IntervalStd( const IntervalStats *stats )
+{
+  return stats->count > 1 ? sqrt( stats->sumOfSquares / ( stats->count - 1 ) ) : 0.0;
+}
+
+struct Pacer {
+  unsigned int valuesPerChunk;
+  double period, maxDelay;
+  Pacer_ReleaseCallback release;
+  void *userData;
+
+  /* Ring of chunks waiting for release, guarded by lock */
+  CRITICAL_SECTION lock;
+  float *chunks;
+  double *timestamps, *dueTimes;
+  unsigned int capacity, first, count;
+
+  /* Schedule; producer only */
+  long long submitted;
+  double baseline;                  // Arrival time of chunk k minus (k + 1) periods, for the earliest chunks
+  double jitterPeak;                // Decaying peak of (arrival - expected arrival)
+  double delay;
+
+  HANDLE thread, timer, arrived, stop;
+  int highResolutionTimer;
+
+  /* Statistics; lock */
+  long long released, lateChunks, droppedChunks;
+  double addedLatency, maxAddedLatency;
+  IntervalStats input, output;
+};
+
+/* Hands the oldest chunk to the release callback; called with the lock held */
+static void ReleaseFirst( Pacer *p )
+{
+  double now = lsl_local_clock(), latency = now - p->timestamps[ p->first ];
+  p->release( p->chunks + (size_t)p->first * p->valuesPerChunk, p->timestamps[ p->first ], p->userData );
+  p->addedLatency += latency;
+  if( latency > p->maxAddedLatency ) p->maxAddedLatency = latency;
+  AddTime( &p->output, now, p->released == 0 );
+  p->released++;
+  p->first = ( p->first + 1 ) % p->capacity;
+  p->count--;
+}
+
+static DWORD WINAPI PacerThread( LPVOID lpParam )
+{
+  Pacer *p = (Pacer *)lpParam;
+  HANDLE waitForArrival[ 2 ], waitForTimer[ 2 ];
+  waitForArrival[ 0 ] = p->stop; waitForArrival[ 1 ] = p->arrived;
+  waitForTimer[ 0 ] = p->stop;   waitForTimer[ 1 ] = p->timer;
+  Trace_NameThread( "Pacer" );
+
+  for( ;; ) {
+    double wait;
+    EnterCriticalSection( &p->lock );
+    if( p->count == 0 ) {
+      LeaveCriticalSection( &p->lock );
+      if( WaitForMultipleObjects( 2, waitForArrival, FALSE, INFINITE ) == WAIT_OBJECT_0 ) break;
+      continue;
+    }
+    wait = p->dueTimes[ p->first ] - lsl_local_clock();
+    if( wait <= 0 ) {
+      ReleaseFirst( p );
+      LeaveCriticalSection( &p->lock );
+      continue;
+    }
+    LeaveCriticalSection( &p->lock );
+
+    {
+      /* Relative due time in 100 ns units; the loop checks again on wake-up */
+      LARGE_INTEGER dueTime;
+      dueTime.QuadPart = -(LONGLONG)( wait * 1e7 ) - 1;
+      SetWaitableTimer( p->timer, &dueTime, 0, NULL, NULL, FALSE );
+      if( WaitForMultipleObjects( 2, waitForTimer, FALSE, INFINITE ) == WAIT_OBJECT_0 ) break;
+    }
+  }
+
+  /* Stopping: nothing is lost, the rest goes out at once */
+  EnterCriticalSection( &p->lock );
+  while( p->count > 0 ) ReleaseFirst( p );
+  LeaveCriticalSection( &p->lock );
+  Trace_EndThread();
+  return 0;
+}
+
+/* Chunks the ring holds: twice the chunks that can be waiting at the largest delay */
+static unsigned int RingCapacity( double chunkPeriod, double maxDelay )
+{
+  return 2 * (unsigned int)ceil( maxDelay / chunkPeriod ) + 8;
+}
+
+/* The ring follows the pacer: due times, timestamps, then the chunks */
+static size_t RingOffset( void )
+{
+  return ( sizeof( Pacer ) + sizeof( double ) - 1 ) & ~( sizeof( double ) - 1 );
+}
+
+size_t Pacer_MemorySize( unsigned int valuesPerChunk, double chunkPeriod, double maxDelay )
+{
+  size_t capacity = RingCapacity( chunkPeriod, maxDelay );
+  return RingOffset() + capacity * 2 * sizeof( double ) + capacity * valuesPerChunk * sizeof( float );
+}
+
+Pacer *Pacer_Create( void *memory, unsigned int valuesPerChunk, double chunkPeriod, double maxDelay,
+                     Pacer_ReleaseCallback release, void *userData )
+{
+  Pacer *p = (Pacer *)memory;
+  if( !p ) return NULL;
+  memset( p, 0, sizeof( Pacer ) );
+  p->valuesPerChunk = valuesPerChunk;
+  p->period = chunkPeriod;
+  p->maxDelay = maxDelay;
+  p->release = release;
+  p->userData = userData;
+  p->capacity = RingCapacity( chunkPeriod, maxDelay );
+  p->dueTimes = (double *)( (unsigned char *)memory + RingOffset() );
+  p->timestamps = p->dueTimes + p->capacity;
+  p->chunks = (float *)( p->timestamps + p->capacity );
+  InitializeCriticalSection( &p->lock );
+  p->arrived = CreateEvent( NULL, FALSE, FALSE, NULL );
+  p->stop = CreateEvent( NULL, TRUE, FALSE, NULL );
+  p->timer = CreateWaitableTimerEx( NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS );
+  p->highResolutionTimer = p->timer != NULL;
+  if( !p->timer ) p->timer = CreateWaitableTimer( NULL, FALSE, NULL );  /* Before Windows 10 1803 */
+  if( !p->arrived || !p->stop || !p->timer ) {
+    Pacer_Free( p );
+    return NULL;
+  }
+  p->thread = CreateThread( NULL, 0, PacerThread, p, 0, NULL );
+  if( !p->thread ) {
+    Pacer_Free( p );
+    return NULL;
+  }
+  SetThreadPriority( p->thread, THREAD_PRIORITY_TIME_CRITICAL );
+  return p;
+}
+
+void Pacer_Stop( Pacer *p )
+{
+  if( !p->thread ) return;
+  SetEvent( p->stop );
+  WaitForSingleObject( p->thread, INFINITE );
+  CloseHandle( p->thread );
+  p->thread = NULL;
+}
+
+void Pacer_Free( Pacer *p )
+{
+  if( !p ) return;
+  Pacer_Stop( p );
+  if( p->timer ) CloseHandle( p->timer );
+  if( p->arrived ) CloseHandle( p->arrived );
+  if( p->stop ) CloseHandle( p->stop );
+  DeleteCriticalSection( &p->lock );
+}
+
+void Pacer_Submit( Pacer *p, const float *chunk, double timestamp )
+{
+  double expected, offset, jitter, due;
+  unsigned int slot;
+
+  /* Schedule: lateness against the burst-free timeline sets the delay */
+  offset = timestamp - ( p->submitted + 1 ) * p->period;
+  if( p->submitted == 0 ) {
+    p->baseline = offset;
+    p->jitterPeak = 0;
+    p->delay = PACER_MARGIN_SECONDS;
+  } else if( offset < p->baseline ) {
+    p->baseline = offset;
+  } else {
+    /* Follow a headset clock that runs slow, but no faster than clock drift allows */
+    double rise = PACER_MAX_DRIFT * p->period;
+    p->baseline += offset - p->baseline < rise ? offset - p->baseline : rise;
+  }
+  expected = p->baseline + ( p->submitted + 1 ) * p->period;
+  jitter = timestamp - expected;
+  due = expected + p->delay;
+  p->jitterPeak *= 1.0 - p->period / PACER_JITTER_MEMORY_SECONDS;
+  if( jitter > p->jitterPeak ) p->jitterPeak = jitter;
+  p->delay = p->jitterPeak + PACER_MARGIN_SECONDS;
+  if( p->delay > p->maxDelay ) p->delay = p->maxDelay;
+  p->submitted++;
+
+  EnterCriticalSection( &p->lock );
+  if( timestamp > due ) p->lateChunks++;
+  AddTime( &p->input, timestamp, p->submitted == 1 );
+  if( p->count == p->capacity ) {
+    /* Only if the pacer thread is starved; keep the newest data */
+    p->first = ( p->first + 1 ) % p->capacity;
+    p->count--;
+    p->droppedChunks++;
+  }
+  slot = ( p->first + p->count ) % p->capacity;
+  memcpy( p->chunks + (size_t)slot * p->valuesPerChunk, chunk, p->valuesPerChunk * sizeof( float ) );
+  p->timestamps[ slot ] = timestamp;
+  p->dueTimes[ slot ] = expected + p->delay;
+  p->count++;
+  LeaveCriticalSection( &p->lock );
+  SetEvent( p->arrived );
+}
+
+void Pacer_GetStats( Pacer *p, PacerStats *stats )
+{
+  EnterCriticalSection( &p->lock );
+  stats->chunks = p->released;
+  stats->lateChunks = p->lateChunks;
+  stats->droppedChunks = p->droppedChunks;
+  stats->meanAddedLatency = p->released > 0 ? p->addedLatency / p->released : 0.0;
+  stats->maxAddedLatency = p->maxAddedLatency;
+  stats->delay = p->delay;
+  stats->inputIntervalStd = IntervalStd( &p->input );
+  stats->outputIntervalStd = IntervalStd( &p->output );
+  stats->highResolutionTimer = p->highResolutionTimer;
+  LeaveCriticalSection( &p->lock );
+}
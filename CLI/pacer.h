@@ -0,0 +1,96 @@
+/*
+ * pacer.h
+ * ---------------------------------------------
+ * Output pacer for the EEG outlet (see the --pace option of dsi2lsl).
+ *
+ * Bluetooth delivers the headset's samples in bursts, so chunks complete at
+ * irregular times. The pacer holds completed chunks in a small jitter buffer
+ * and releases them from its own thread on a high-resolution timer, one chunk
+ * period apart. Chunk k is released at
+ *
+ *   baseline + (k + 1) * chunkPeriod + delay
+ *
+ * where baseline tracks the earliest arrivals (the burst-free timeline, which
+ * may drift from the local clock by up to PACER_MAX_DRIFT) and delay is the
+ * peak lateness of recent chunks relative to it plus PACER_MARGIN_SECONDS.
+ * The peak decays over PACER_JITTER_MEMORY_SECONDS, so the buffer deepens at
+ * once when bursts get worse and shrinks slowly when they subside. A chunk
+ * later than the current delay is released as soon as it arrives.
+ *
+ * Released chunks keep the timestamp they were submitted with; only the time
+ * they reach consumers changes.
+ */
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACER_DEFAULT_MAX_DELAY 0.25        /* Seconds */
+#define PACER_MARGIN_SECONDS 0.002
+#define PACER_JITTER_MEMORY_SECONDS 10.0
+#define PACER_MAX_DRIFT 1e-4                /* Relative rate difference between headset and local clock */
+
+typedef struct Pacer Pacer;
+
+/** Receives a chunk on the pacer's thread, in submission order. */
+typedef void (*Pacer_ReleaseCallback)( const float *chunk, double timestamp, void *userData );
+
+/** What the pacer cost and achieved; see Pacer_GetStats. */
+typedef struct {
+  long long chunks;              /* Chunks released */
+  long long lateChunks;          /* Chunks that arrived after their release time */
+  long long droppedChunks;       /* Chunks dropped because the buffer was full */
+  double meanAddedLatency;       /* Seconds from submission to release, mean ... */
+  double maxAddedLatency;        /* ... and maximum */
+  double delay;                  /* Current target delay in seconds */
+  double inputIntervalStd;       /* Standard deviation of the time between submissions ... */
+  double outputIntervalStd;      /* ... and between releases, in seconds */
+  int highResolutionTimer;       /* 0 if the system only offers the default timer resolution */
+} PacerStats;
+
+/**
+ * Memory Pacer_Create needs for these parameters: the pacer and its ring of
+ * waiting chunks, so that the caller can set it aside before data flows.
+ */
+size_t Pacer_MemorySize( unsigned int valuesPerChunk, double chunkPeriod, double maxDelay );
+
+/**
+ * Creates a pacer in memory of Pacer_MemorySize bytes and starts its thread.
+ * The pacer does not allocate; the memory may be used again after Pacer_Free.
+ *
+ * @param memory         - Pacer_MemorySize bytes, aligned for a double
+ * @param valuesPerChunk - Floats per chunk
+ * @param chunkPeriod    - Nominal seconds between chunks
+ * @param maxDelay       - Upper limit of the delay the pacer may add, in seconds
+ * @param release        - Called for each chunk when it is due
+ * @param userData       - Passed to release
+ * @return The pacer (at memory), or NULL on error
+ */
+Pacer *Pacer_Create( void *memory, unsigned int valuesPerChunk, double chunkPeriod, double maxDelay,
+                     Pacer_ReleaseCallback release, void *userData );
+
+/** Stops the thread, releasing the chunks still buffered right away. */
+void Pacer_Stop( Pacer *pacer );
+
+/** Stops the pacer if it is running and closes its thread and events; the memory stays the caller's. */
+void Pacer_Free( Pacer *pacer );
+
+/**
+ * Queues a chunk; called by a single producer thread. The chunk is copied.
+ * @param timestamp - LSL local clock of the chunk, handed to the release callback;
+ *                    it is also taken as the chunk's arrival time
+ */
+void Pacer_Submit( Pacer *pacer, const float *chunk, double timestamp );
+
+void Pacer_GetStats( Pacer *pacer, PacerStats *stats );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACER_H */
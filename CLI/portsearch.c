@@ -0,0 +1,194 @@
+/*
+ * portsearch.c
+ * ---------------------------------------------
+ * Serial port discovery for --port=auto (see portsearch.h).
+ *
+ * The search state is reference counted by the caller and the probes it
+ * started, since probes may outlive the search. Ports being probed are kept in
+ * a process-wide list, so that a later search (e.g. of all ports after the
+ * cached port hung) skips a port whose probe has not returned yet.
+ */
+
+#include "portsearch.h"
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "alloccheck.h"
+
+typedef struct PortSearch PortSearch;
+
+typedef struct {
+  PortSearch *search;
+  char port[ PORT_SEARCH_NAME_LENGTH ];
+  void *device;                         // Connected device if this probe succeeded
+} PortProbe;
+
+struct PortSearch {
+  PortProber prober;
+  volatile LONG references;             // Running probes plus the caller
+  volatile LONG remaining;              // Probes that have not finished
+  PortProbe * volatile winner;          // First successful probe, or PROBE_ABANDONED
+  HANDLE doneEvent;                     // Set when a probe wins or all have failed
+  PortProbe probes[ PORT_SEARCH_MAX_PORTS ];
+};
+
+static PortProbe abandonedProbe;
+#define PROBE_ABANDONED ( &abandonedProbe )
+
+/* Ports with a probe running; the names live in the probes */
+static SRWLOCK runningLock = SRWLOCK_INIT;
+static const char *runningPorts[ PORT_SEARCH_MAX_RUNNING ];
+static int numberOfRunning;
+
+/* Registers a probe of port; returns 0 if the port is already being probed */
+static int ClaimPort( const char *port )
+{
+  int i, claimed = 0;
+  AcquireSRWLockExclusive( &runningLock );
+  for( i = 0; i < numberOfRunning && _stricmp( runningPorts[ i ], port ) != 0; i++ ) ;
+  if( i == numberOfRunning && numberOfRunning < PORT_SEARCH_MAX_RUNNING ) {
+    runningPorts[ numberOfRunning++ ] = port;
+    claimed = 1;
+  }
+  ReleaseSRWLockExclusive( &runningLock );
+  return claimed;
+}
+
+static void ReleasePort( const char *port )
+{
+  int i;
+  AcquireSRWLockExclusive( &runningLock );
+  for( i = 0; i < numberOfRunning; i++ ) {
+    if( runningPorts[ i ] == port ) {
+      runningPorts[ i ] = runningPorts[ --numberOfRunning ];
+      break;
+    }
+  }
+  ReleaseSRWLockExclusive( &runningLock );
+}
+
+int PortSearch_Running( void )
+{
+  int running;
+  AcquireSRWLockShared( &runningLock );
+  running = numberOfRunning;
+  ReleaseSRWLockShared( &runningLock );
+  return running;
+}
+
+static void ReleasePortSearch( PortSearch *search )
+{
+  if( InterlockedDecrement( &search->references ) > 0 ) return;
+  CloseHandle( search->doneEvent );
+  free( search );
+}
+
+/* Ends one probe; the last one to end signals the search */
+static void FinishProbe( PortSearch *search )
+{
+  if( InterlockedDecrement( &search->remaining ) == 0 ) SetEvent( search->doneEvent );
+}
+
+static DWORD WINAPI ProbeThread( LPVOID lpParam )
+{
+  PortProbe *probe = (PortProbe *)lpParam;
+  PortSearch *search = probe->search;
+  const PortProber *prober = &search->prober;
+
+  if( prober->probe( probe->port, &probe->device, prober->userData ) == 0 ) {
+    if( InterlockedCompareExchangePointer( (void * volatile *)&search->winner, probe, NULL ) == NULL )
+      SetEvent( search->doneEvent );
+    else
+      prober->release( probe->device, prober->userData );   /* Another port won, or the caller gave up */
+  }
+  ReleasePort( probe->port );
+  FinishProbe( search );
+  ReleasePortSearch( search );
+  return 0;
+}
+
+/**
+ * Probes ports concurrently and returns the first that answers.
+ * @param busy - Receives the number of ports skipped because a probe of them still runs
+ * @return 0 if a device was found, non-zero otherwise.
+ */
+static int Search( const PortProber *prober, char (*ports)[ PORT_SEARCH_NAME_LENGTH ], int numberOfPorts,
+                   int timeoutMs, PortSearchResult *result, int *busy )
+{
+  PortSearch *search;
+  PortProbe *winner;
+  int i;
+
+  *busy = 0;
+  if( numberOfPorts <= 0 ) return -1;
+  if( numberOfPorts > PORT_SEARCH_MAX_PORTS ) numberOfPorts = PORT_SEARCH_MAX_PORTS;
+  search = (PortSearch *)calloc( 1, sizeof( PortSearch ) );
+  if( !search ) return -1;
+  search->doneEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+  if( !search->doneEvent ) {
+    free( search );
+    return -1;
+  }
+  search->prober = *prober;
+  search->references = 1;
+  search->remaining = numberOfPorts;
+
+  for( i = 0; i < numberOfPorts; i++ ) {
+    PortProbe *probe = &search->probes[ i ];
+    HANDLE thread;
+    probe->search = search;
+    strncpy_s( probe->port, sizeof( probe->port ), ports[ i ], _TRUNCATE );
+    if( !ClaimPort( probe->port ) ) {
+      ( *busy )++;
+      FinishProbe( search );
+      continue;
+    }
+    InterlockedIncrement( &search->references );
+    thread = CreateThread( NULL, 0, ProbeThread, probe, 0, NULL );
+    if( thread ) {
+      CloseHandle( thread );
+    } else {
+      ReleasePort( probe->port );
+      InterlockedDecrement( &search->references );
+      FinishProbe( search );
+    }
+  }
+
+  WaitForSingleObject( search->doneEvent, (DWORD)timeoutMs );
+  winner = (PortProbe *)InterlockedCompareExchangePointer( (void * volatile *)&search->winner, PROBE_ABANDONED, NULL );
+  if( winner ) {
+    strncpy_s( result->port, sizeof( result->port ), winner->port, _TRUNCATE );
+    result->device = winner->device;
+  }
+  ReleasePortSearch( search );
+  return winner ? 0 : -1;
+}
+
+int PortSearch_Find( const PortProber *prober, const char *cachePath, int timeoutMs, PortSearchResult *result )
+{
+  char ports[ PORT_SEARCH_MAX_PORTS ][ PORT_SEARCH_NAME_LENGTH ];
+  FILE *cache;
+  int busy;
+
+  memset( result, 0, sizeof( *result ) );
+  if( cachePath && ( cache = fopen( cachePath, "r" ) ) != NULL ) {
+    int ok = fgets( ports[ 0 ], PORT_SEARCH_NAME_LENGTH, cache ) != NULL;
+    fclose( cache );
+    ports[ 0 ][ strcspn( ports[ 0 ], "\r\n" ) ] = '\0';
+    if( ok && ports[ 0 ][ 0 ] && Search( prober, ports, 1, timeoutMs, result, &busy ) == 0 ) {
+      result->cached = 1;
+      return 0;
+    }
+  }
+
+  result->numberOfPorts = prober->list( ports, PORT_SEARCH_MAX_PORTS, prober->userData );
+  if( result->numberOfPorts <= 0 ) return -1;
+  if( Search( prober, ports, result->numberOfPorts, timeoutMs, result, &result->busy ) != 0 ) return -1;
+
+  if( cachePath && ( cache = fopen( cachePath, "w" ) ) != NULL ) {
+    fprintf( cache, "%s\n", result->port );
+    fclose( cache );
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * portsearch.h
+ * ---------------------------------------------
+ * Serial port discovery for --port=auto.
+ *
+ * Every candidate port is probed on its own thread, so a search takes as long
+ * as the slowest answer rather than the sum of all connect timeouts. The first
+ * probe that connects wins and hands its device to the caller. A probe cannot
+ * be interrupted, so probes still running when a search ends clean up after
+ * themselves, and a port is not probed again while an earlier probe of it is
+ * still running: the port is busy, and a second probe would only fail slowly.
+ *
+ * What a probe does is up to the PortProber, so the search can be exercised
+ * with fake ports (see portsearch_test.c).
+ */
+
+#ifndef PORTSEARCH_H
+#define PORTSEARCH_H
+
+#define PORT_SEARCH_MAX_PORTS 64          /* Ports probed at once */
+#define PORT_SEARCH_MAX_RUNNING 128       /* Probes running at once, including abandoned ones */
+#define PORT_SEARCH_NAME_LENGTH 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  /**
+   * Connects to a device on port; runs on its own thread and may block.
+   * @return 0 with *deviceOut set if a device answered, non-zero otherwise
+   */
+  int (*probe)( const char *port, void **deviceOut, void *userData );
+  /** Frees a device connected by a probe that lost, or that answered after the search gave up */
+  void (*release)( void *device, void *userData );
+  /** Lists the candidate ports; returns how many were written */
+  int (*list)( char (*ports)[ PORT_SEARCH_NAME_LENGTH ], int maxPorts, void *userData );
+  void *userData;                         /* Must stay valid while PortSearch_Running() is non-zero */
+} PortProber;
+
+typedef struct {
+  char port[ PORT_SEARCH_NAME_LENGTH ];   /* Port the device answered on */
+  void *device;                           /* Connected device; the caller owns it */
+  int cached;                             /* 1 if found on the port cached from last time */
+  int numberOfPorts;                      /* Ports listed for the search of all ports; 0 if it did not run */
+  int busy;                               /* Listed ports skipped because an earlier probe still runs */
+} PortSearchResult;
+
+/**
+ * Finds the port a device answers on. The port found last time (read from
+ * cachePath) is probed first; otherwise all listed ports are probed at once.
+ * The port found is written to cachePath.
+ *
+ * @param prober    - Probe, release and list functions; copied
+ * @param cachePath - File remembering the last port found; NULL for none
+ * @param timeoutMs - Time allowed for each of the two searches
+ * @param result    - Receives the port and device on success, and the counts either way
+ * @return 0 if a device answered, non-zero otherwise.
+ */
+int PortSearch_Find( const PortProber *prober, const char *cachePath, int timeoutMs, PortSearchResult *result );
+
+/** @return Probes still running, including those of searches that have ended */
+int PortSearch_Running( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PORTSEARCH_H */
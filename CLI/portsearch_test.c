@@ -0,0 +1,207 @@
+/*
+ * portsearch_test.c
+ * ---------------------------------------------
+ * Tests of the --port=auto search (portsearch.h) with fake serial ports:
+ *
+ *   FAIL   fails at once, like a port without a headset that is not in use
+ *   HANG   blocks for HANG_MS, longer than any search waits, then answers
+ *   LATE   answers after LATE_MS
+ *   FAST   answers at once
+ *
+ * Usage: portsearch_test
+ * Exits with 1 if a check fails.
+ */
+
+#include "portsearch.h"
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#define HANG_MS 1500
+#define LATE_MS 200
+#define TIMEOUT_MS 600
+#define SLACK_MS 150                        /* Scheduling allowance for timing checks */
+#define CACHE_FILE "portsearch_test_cache.txt"
+
+typedef struct {
+  const char *ports[ 8 ];
+  volatile LONG probes[ 8 ];                /* Probes started per port */
+  volatile LONG released;                   /* Devices handed back by probes that lost */
+  volatile LONG listed;                     /* Calls of the list function */
+} FakePorts;
+
+static int failures;
+
+#define CHECK( condition ) \
+  do { if( !( condition ) ) { printf( "  FAILED at line %d: %s\n", __LINE__, #condition ); failures++; } } while( 0 )
+
+static int PortIndex( const FakePorts *fake, const char *port )
+{
+  int i;
+  for( i = 0; fake->ports[ i ]; i++ )
+    if( strcmp( fake->ports[ i ], port ) == 0 ) return i;
+  return -1;
+}
+
+/* The device is the port's name, so that checks can tell which port won */
+static int FakeProbe( const char *port, void **deviceOut, void *userData )
+{
+  FakePorts *fake = (FakePorts *)userData;
+  int index = PortIndex( fake, port );
+  *deviceOut = NULL;
+  if( index < 0 ) return -1;
+  InterlockedIncrement( &fake->probes[ index ] );
+  if( strncmp( port, "FAIL", 4 ) == 0 ) return -1;
+  if( strncmp( port, "HANG", 4 ) == 0 ) Sleep( HANG_MS );
+  if( strncmp( port, "LATE", 4 ) == 0 ) Sleep( LATE_MS );
+  *deviceOut = (void *)fake->ports[ index ];
+  return 0;
+}
+
+static void FakeRelease( void *device, void *userData )
+{
+  (void)device;
+  InterlockedIncrement( &( (FakePorts *)userData )->released );
+}
+
+static int FakeList( char (*ports)[ PORT_SEARCH_NAME_LENGTH ], int maxPorts, void *userData )
+{
+  FakePorts *fake = (FakePorts *)userData;
+  int n;
+  InterlockedIncrement( &fake->listed );
+  for( n = 0; fake->ports[ n ] && n < maxPorts; n++ )
+    strcpy_s( ports[ n ], PORT_SEARCH_NAME_LENGTH, fake->ports[ n ] );
+  return n;
+}
+
+/* Runs one search of fake's ports; returns the time it took in ms */
+static double Find( FakePorts *fake, const char *cachePath, int timeoutMs, PortSearchResult *result, int *status )
+{
+  PortProber prober = { FakeProbe, FakeRelease, FakeList, fake };
+  LARGE_INTEGER frequency, start, end;
+  QueryPerformanceFrequency( &frequency );
+  QueryPerformanceCounter( &start );
+  *status = PortSearch_Find( &prober, cachePath, timeoutMs, result );
+  QueryPerformanceCounter( &end );
+  return ( end.QuadPart - start.QuadPart ) * 1000.0 / frequency.QuadPart;
+}
+
+/* Waits for abandoned probes, so that each test starts with no port busy */
+static void WaitForProbes( void )
+{
+  int waited;
+  for( waited = 0; PortSearch_Running() > 0 && waited < 2 * HANG_MS; waited += 10 ) Sleep( 10 );
+  CHECK( PortSearch_Running() == 0 );
+}
+
+static void WriteCache( const char *port )
+{
+  FILE *cache = fopen( CACHE_FILE, "w" );
+  if( cache ) {
+    fprintf( cache, "%s\n", port );
+    fclose( cache );
+  }
+}
+
+static void FirstAnswerWins( void )
+{
+  FakePorts fake = { 0 };
+  PortSearchResult result;
+  int status;
+  double ms;
+  fake.ports[ 0 ] = "FAIL1";
+  fake.ports[ 1 ] = "HANG1";
+  fake.ports[ 2 ] = "LATE1";
+  printf( "First answer wins without waiting for a hanging port\n" );
+  ms = Find( &fake, NULL, TIMEOUT_MS, &result, &status );
+  CHECK( status == 0 );
+  CHECK( strcmp( result.port, "LATE1" ) == 0 && result.device == fake.ports[ 2 ] );
+  CHECK( !result.cached && result.numberOfPorts == 3 && result.busy == 0 );
+  CHECK( ms >= LATE_MS - 1 && ms < LATE_MS + SLACK_MS );
+  WaitForProbes();
+  CHECK( fake.released == 1 );              /* The hanging port answered after the search */
+}
+
+static void TimesOut( void )
+{
+  FakePorts fake = { 0 };
+  PortSearchResult result;
+  int status;
+  double ms;
+  fake.ports[ 0 ] = "FAIL2";
+  fake.ports[ 1 ] = "HANG2";
+  printf( "Gives up after the timeout\n" );
+  ms = Find( &fake, NULL, TIMEOUT_MS, &result, &status );
+  CHECK( status != 0 && result.device == NULL );
+  CHECK( ms >= TIMEOUT_MS - 1 && ms < TIMEOUT_MS + SLACK_MS );
+  WaitForProbes();
+  CHECK( fake.released == 1 );
+}
+
+static void FailsFast( void )
+{
+  FakePorts fake = { 0 };
+  PortSearchResult result;
+  int status;
+  double ms;
+  fake.ports[ 0 ] = "FAIL3";
+  fake.ports[ 1 ] = "FAIL4";
+  printf( "Ends as soon as every port has failed\n" );
+  ms = Find( &fake, NULL, TIMEOUT_MS, &result, &status );
+  CHECK( status != 0 && result.numberOfPorts == 2 );
+  CHECK( ms < SLACK_MS );
+}
+
+static void UsesCachedPort( void )
+{
+  FakePorts fake = { 0 };
+  PortSearchResult result;
+  int status;
+  fake.ports[ 0 ] = "FAST1";
+  fake.ports[ 1 ] = "LATE2";
+  printf( "Tries the cached port first and caches the port found\n" );
+  WriteCache( "LATE2" );
+  Find( &fake, CACHE_FILE, TIMEOUT_MS, &result, &status );
+  CHECK( status == 0 && result.cached && strcmp( result.port, "LATE2" ) == 0 );
+  CHECK( fake.listed == 0 && fake.probes[ 0 ] == 0 );
+
+  WriteCache( "GONE" );                     /* No longer listed: probed, fails, then all ports */
+  Find( &fake, CACHE_FILE, TIMEOUT_MS, &result, &status );
+  CHECK( status == 0 && !result.cached && strcmp( result.port, "FAST1" ) == 0 );
+  CHECK( fake.listed == 1 );
+  Find( &fake, CACHE_FILE, TIMEOUT_MS, &result, &status );
+  CHECK( status == 0 && result.cached && strcmp( result.port, "FAST1" ) == 0 );
+  WaitForProbes();
+}
+
+static void SkipsHangingCachedPort( void )
+{
+  FakePorts fake = { 0 };
+  PortSearchResult result;
+  int status;
+  double ms;
+  fake.ports[ 0 ] = "HANG3";
+  fake.ports[ 1 ] = "LATE3";
+  printf( "Does not probe a hanging cached port again while its probe runs\n" );
+  WriteCache( "HANG3" );
+  ms = Find( &fake, CACHE_FILE, TIMEOUT_MS, &result, &status );
+  CHECK( status == 0 && !result.cached && strcmp( result.port, "LATE3" ) == 0 );
+  CHECK( result.numberOfPorts == 2 && result.busy == 1 );
+  CHECK( fake.probes[ 0 ] == 1 );
+  CHECK( ms < TIMEOUT_MS + LATE_MS + SLACK_MS );
+  WaitForProbes();
+  CHECK( fake.released == 1 );
+}
+
+int main( void )
+{
+  FirstAnswerWins();
+  TimesOut();
+  FailsFast();
+  UsesCachedPort();
+  SkipsHangingCachedPort();
+  remove( CACHE_FILE );
+  if( failures ) printf( "%d checks failed\n", failures );
+  else printf( "All checks passed\n" );
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * quality.c
+ * ---------------------------------------------
+ * Per-channel signal quality estimator (see quality.h).
+ *
+ * All statistics are first-order exponential averages with the same weight,
+ * so that they describe the same stretch of signal. Mains power is measured
+ * by mixing the signal (minus its running mean) with a 50 Hz and a 60 Hz
+ * oscillator and averaging the products: for a sinusoid of amplitude A at the
+ * oscillator frequency, the averaged in-phase and quadrature products have a
+ * squared magnitude of A^2 / 4, while its power is A^2 / 2.
+ */
+
+#include "quality.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "alloccheck.h"
+
+/* Quality index thresholds */
+#define FLATLINE_MICROVOLTS 0.01f     /* Mean absolute change below which a channel is flat */
+#define STD_GOOD_MICROVOLTS 50.0f     /* Index starts to drop above this standard deviation ... */
+#define STD_BAD_MICROVOLTS 200.0f     /* ... and is 0 from this one on */
+#define LINE_RATIO_GOOD 0.5f          /* Index starts to drop when mains is this share of the variance */
+#define RAIL_FRACTION_BAD 0.1f        /* Index is 0 once this share of samples hits the rails */
+
+#define NUMBER_OF_LINE_FREQUENCIES 2
+static const double LINE_FREQUENCIES[ NUMBER_OF_LINE_FREQUENCIES ] = { 50.0, 60.0 };
+
+struct SignalQuality {
+  unsigned int numberOfChannels;
+  float weight;                       // Weight of a new sample in the averages
+  float rail;
+  int primed;                         // Set once the first sample after a reset was seen
+
+  /* Oscillators at the line frequencies, advanced once per sample */
+  double cosine[ NUMBER_OF_LINE_FREQUENCIES ], sine[ NUMBER_OF_LINE_FREQUENCIES ];
+  double stepCosine[ NUMBER_OF_LINE_FREQUENCIES ], stepSine[ NUMBER_OF_LINE_FREQUENCIES ];
+
+  /* One array per statistic, numberOfChannels entries each */
+  float *mean, *variance, *absoluteChange, *previous, *railHits;
+  float *inPhase[ NUMBER_OF_LINE_FREQUENCIES ], *quadrature[ NUMBER_OF_LINE_FREQUENCIES ];
+  float *storage;
+};
+
+#define QUALITY_ARRAYS ( 5 + 2 * NUMBER_OF_LINE_FREQUENCIES )
+
+/* Bytes of the estimator followed by its arrays */
+static size_t StorageOffset( void )
+{
+  return ( sizeof( SignalQuality ) + sizeof( double ) - 1 ) & ~( sizeof( double ) - 1 );
+}
+
+size_t Quality_MemorySize( unsigned int numberOfChannels )
+{
+  return StorageOffset() + (size_t)QUALITY_ARRAYS * ( numberOfChannels ? numberOfChannels : 1 ) * sizeof( float );
+}
+
+SignalQuality *Quality_Create( void *memory, unsigned int numberOfChannels, double samplingRate, float railMicrovolts )
+{
+  SignalQuality *q = (SignalQuality *)memory;
+  float *next;
+  int f;
+  if( !q ) return NULL;
+  memset( q, 0, Quality_MemorySize( numberOfChannels ) );
+  q->storage = (float *)( (unsigned char *)memory + StorageOffset() );
+
+  q->numberOfChannels = numberOfChannels;
+  q->weight = (float)( 1.0 / ( QUALITY_WINDOW_SECONDS * ( samplingRate > 0 ? samplingRate : 300.0 ) ) );
+  q->rail = railMicrovolts;
+  next = q->storage;
+  q->mean = next;           next += numberOfChannels;
+  q->variance = next;       next += numberOfChannels;
+  q->absoluteChange = next; next += numberOfChannels;
+  q->previous = next;       next += numberOfChannels;
+  q->railHits = next;       next += numberOfChannels;
+  for( f = 0; f < NUMBER_OF_LINE_FREQUENCIES; f++ ) {
+    double step = 2.0 * 3.14159265358979323846 * LINE_FREQUENCIES[ f ] / ( samplingRate > 0 ? samplingRate : 300.0 );
+    q->inPhase[ f ] = next;    next += numberOfChannels;
+    q->quadrature[ f ] = next; next += numberOfChannels;
+    q->stepCosine[ f ] = cos( step );
+    q->stepSine[ f ] = sin( step );
+  }
+  Quality_Reset( q );
+  return q;
+}
+
+void Quality_Reset( SignalQuality *q )
+{
+  int f;
+  memset( q->storage, 0, (size_t)QUALITY_ARRAYS * q->numberOfChannels * sizeof( float ) );
+  for( f = 0; f < NUMBER_OF_LINE_FREQUENCIES; f++ ) {
+    q->cosine[ f ] = 1.0;
+    q->sine[ f ] = 0.0;
+  }
+  q->primed = 0;
+}
+
+void Quality_Update( SignalQuality *q, const float *sample )
+{
+  const unsigned int n = q->numberOfChannels;
+  const float a = q->weight, rail = q->rail;
+  float * const mean = q->mean, * const variance = q->variance;
+  float * const absoluteChange = q->absoluteChange, * const previous = q->previous, * const railHits = q->railHits;
+  unsigned int c;
+  int f;
+
+  /* Start the averages at the first sample so that electrode offsets do not show up as variance */
+  if( !q->primed ) {
+    memcpy( mean, sample, n * sizeof( float ) );
+    memcpy( previous, sample, n * sizeof( float ) );
+    q->primed = 1;
+  }
+
+  /*
+   * Branch-free loops over channels so that the compiler can vectorize them;
+   * each touches few arrays to keep the compiler's aliasing checks cheap.
+   */
+  for( c = 0; c < n; c++ ) {
+    const float d = sample[ c ] - mean[ c ];
+    mean[ c ] += a * d;
+    variance[ c ] = ( 1.0f - a ) * ( variance[ c ] + a * d * d );
+  }
+  for( c = 0; c < n; c++ ) {
+    absoluteChange[ c ] += a * ( fabsf( sample[ c ] - previous[ c ] ) - absoluteChange[ c ] );
+    previous[ c ] = sample[ c ];
+  }
+  for( c = 0; c < n; c++ )
+    railHits[ c ] += a * ( ( fabsf( sample[ c ] ) >= rail ? 1.0f : 0.0f ) - railHits[ c ] );
+
+  for( f = 0; f < NUMBER_OF_LINE_FREQUENCIES; f++ ) {
+    const float cosine = (float)q->cosine[ f ], sine = (float)q->sine[ f ];
+    float * const inPhase = q->inPhase[ f ], * const quadrature = q->quadrature[ f ];
+    double nextCosine, nextSine, norm;
+    for( c = 0; c < n; c++ ) {
+      const float x = sample[ c ] - mean[ c ];
+      inPhase[ c ] += a * ( x * cosine - inPhase[ c ] );
+      quadrature[ c ] += a * ( x * sine - quadrature[ c ] );
+    }
+    /* Advance the oscillator, correcting the rounding drift of its amplitude */
+    nextCosine = q->cosine[ f ] * q->stepCosine[ f ] - q->sine[ f ] * q->stepSine[ f ];
+    nextSine = q->sine[ f ] * q->stepCosine[ f ] + q->cosine[ f ] * q->stepSine[ f ];
+    norm = ( 3.0 - ( nextCosine * nextCosine + nextSine * nextSine ) ) * 0.5;
+    q->cosine[ f ] = nextCosine * norm;
+    q->sine[ f ] = nextSine * norm;
+  }
+}
+
+/* 1 at or below good, 0 at or above bad, linear in between */
+static float Ramp( float value, float good, float bad )
+{
+  if( value <= good ) return 1.0f;
+  if( value >= bad ) return 0.0f;
+  return ( bad - value ) / ( bad - good );
+}
+
+void Quality_Get( const SignalQuality *q, float *metrics )
+{
+  const unsigned int n = q->numberOfChannels;
+  unsigned int c;
+  int f;
+  for( c = 0; c < n; c++ ) {
+    float std = sqrtf( q->variance[ c ] );
+    float lineRatio = 0.0f;
+    int flat = q->absoluteChange[ c ] < FLATLINE_MICROVOLTS;
+    for( f = 0; f < NUMBER_OF_LINE_FREQUENCIES; f++ ) {
+      float power = 2.0f * ( q->inPhase[ f ][ c ] * q->inPhase[ f ][ c ] + q->quadrature[ f ][ c ] * q->quadrature[ f ][ c ] );
+      float ratio = q->variance[ c ] > 0 ? power / q->variance[ c ] : 0.0f;
+      if( ratio > lineRatio ) lineRatio = ratio;
+    }
+    if( lineRatio > 1.0f ) lineRatio = 1.0f;
+
+    metrics[ QUALITY_INDEX * n + c ] = flat ? 0.0f
+        : Ramp( std, STD_GOOD_MICROVOLTS, STD_BAD_MICROVOLTS )
+        * Ramp( lineRatio, LINE_RATIO_GOOD, 1.0f )
+        * Ramp( q->railHits[ c ], 0.0f, RAIL_FRACTION_BAD );
+    metrics[ QUALITY_STD * n + c ] = std;
+    metrics[ QUALITY_LINE_RATIO * n + c ] = lineRatio;
+    metrics[ QUALITY_RAIL_FRACTION * n + c ] = q->railHits[ c ];
+    metrics[ QUALITY_FLATLINE * n + c ] = flat ? 1.0f : 0.0f;
+  }
+}
+
+const char *Quality_MetricName( int metric )
+{
+  switch( metric ) {
+  case QUALITY_INDEX:         return "index";
+  case QUALITY_STD:           return "std";
+  case QUALITY_LINE_RATIO:    return "line_ratio";
+  case QUALITY_RAIL_FRACTION: return "rail_fraction";
+  case QUALITY_FLATLINE:      return "flatline";
+  default:                    return "unknown";
+  }
+}
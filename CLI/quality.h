@@ -0,0 +1,72 @@
+/*
+ * quality.h
+ * ---------------------------------------------
+ * Per-channel signal quality estimator for the "<streamName>-Quality" outlet
+ * (see the --quality-outlet option of dsi2lsl).
+ *
+ * Every sample updates, for each channel, exponentially weighted estimates
+ * over about QUALITY_WINDOW_SECONDS: mean and variance, mains (50 and 60 Hz)
+ * power by complex demodulation, mean absolute sample-to-sample change (for
+ * flatlines) and the fraction of samples at the rails. Each update is O(1)
+ * per channel; the state is kept as one array per statistic so the per-sample
+ * loop runs across channels and vectorizes.
+ */
+
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <stddef.h>
+
+#define QUALITY_WINDOW_SECONDS 1.0
+
+/* Metrics reported per channel, in this order (see Quality_Get) */
+enum {
+  QUALITY_INDEX = 0,        /* 0 (unusable) to 1 (clean), combining the metrics below */
+  QUALITY_STD,              /* Standard deviation in microvolts */
+  QUALITY_LINE_RATIO,       /* Share of the variance at 50 or 60 Hz, 0 to 1 */
+  QUALITY_RAIL_FRACTION,    /* Share of samples at the rails, 0 to 1 */
+  QUALITY_FLATLINE,         /* 1 while the signal does not change */
+  QUALITY_METRICS
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SignalQuality SignalQuality;
+
+/** Memory Quality_Create needs: the estimator and its per-channel arrays. */
+size_t Quality_MemorySize( unsigned int numberOfChannels );
+
+/**
+ * Creates an estimator in memory of Quality_MemorySize bytes, which stays the
+ * caller's; the estimator does not allocate.
+ * @param memory           - Quality_MemorySize bytes, aligned for a double
+ * @param numberOfChannels - Channels per sample
+ * @param samplingRate     - Sampling rate in Hz
+ * @param railMicrovolts   - Absolute value at which a sample counts as a rail hit
+ * @return The estimator (at memory), or NULL if memory is NULL
+ */
+SignalQuality *Quality_Create( void *memory, unsigned int numberOfChannels, double samplingRate, float railMicrovolts );
+
+/** Forgets all history, e.g. at the start of a new block. */
+void Quality_Reset( SignalQuality *quality );
+
+/** Adds one sample (numberOfChannels values in microvolts). */
+void Quality_Update( SignalQuality *quality, const float *sample );
+
+/**
+ * Computes the current metrics.
+ * @param metrics - Receives QUALITY_METRICS * numberOfChannels values, grouped
+ *                  by metric: all indices first, then all standard deviations, ...
+ */
+void Quality_Get( const SignalQuality *quality, float *metrics );
+
+/** Short name of a QUALITY_* metric, e.g. "index". */
+const char *Quality_MetricName( int metric );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUALITY_H */
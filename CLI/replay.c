@@ -0,0 +1,418 @@
+/*
+ * replay.c
+ * ---------------------------------------------
+ * Recorded-data source for the dsi2lsl --replay mode (see replay.h).
+ *
+ * XDF files are parsed chunk by chunk as described in the XDF specification
+ * (https://github.com/sccn/xdf/wiki/Specifications); only numeric channel
+ * formats are supported. CSV files are read line by line. Neither format is
+ * loaded into memory as a whole, so long recordings can be replayed.
+ */
+
+#include "replay.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include "alloccheck.h"
+
+#define REPLAY_LABEL_LENGTH 64
+#define REPLAY_CSV_LINE_LENGTH 65536
+#define REPLAY_MAX_CSV_COLUMNS 1024
+#define REPLAY_DEFAULT_RATE 300.0 /* DSI-24 sampling rate, used when a CSV carries no timing */
+
+/* XDF chunk tags */
+#define XDF_TAG_STREAM_HEADER 2
+#define XDF_TAG_SAMPLES       3
+
+typedef enum { REPLAY_XDF, REPLAY_CSV } ReplayFormat;
+
+struct ReplaySource {
+    FILE *file;
+    ReplayFormat format;
+    unsigned int numberOfChannels;
+    double samplingRate;
+    char (*labels)[REPLAY_LABEL_LENGTH];
+    double lastTimestamp;
+    long long sampleCount;
+
+    /* XDF state */
+    unsigned int streamId;
+    int valueBytes;          /* Size of one channel value in bytes */
+    int valueIsFloat;        /* 1 for float32/double64, 0 for integer formats */
+    unsigned char *valueBuffer;
+    unsigned long long samplesLeftInChunk;
+
+    /* CSV state */
+    long dataStart;          /* File offset of the first data row */
+    int hasTimestampColumn;
+    char *line;
+};
+
+static Replay_LogFunction replayLog;
+
+void Replay_SetLog( Replay_LogFunction log )
+{
+    replayLog = log;
+}
+
+// -----------------------------------------------------------------------------
+// Small helpers
+// -----------------------------------------------------------------------------
+
+/* Reports an error through the Replay_SetLog function, or to stderr. Returns -1. */
+static int ReplayError( const char *format, ... )
+{
+    va_list args;
+    va_start( args, format );
+    if( replayLog ) replayLog( format, args );
+    else vfprintf( stderr, format, args );
+    va_end( args );
+    return -1;
+}
+
+static int EndsWith( const char *s, const char *suffix )
+{
+    size_t n = strlen( s ), m = strlen( suffix );
+    if( m > n ) return 0;
+    for( size_t i = 0; i < m; i++ )
+        if( tolower( (unsigned char)s[ n - m + i ] ) != tolower( (unsigned char)suffix[ i ] ) ) return 0;
+    return 1;
+}
+
+static int AllocateChannels( ReplaySource *src, unsigned int numberOfChannels )
+{
+    src->numberOfChannels = numberOfChannels;
+    src->labels = calloc( numberOfChannels, sizeof( *src->labels ) );
+    if( !src->labels ) return ReplayError( "Replay: could not allocate %u channel labels.\n", numberOfChannels );
+    for( unsigned int i = 0; i < numberOfChannels; i++ ) snprintf( src->labels[ i ], REPLAY_LABEL_LENGTH, "Ch%u", i + 1 );
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// XDF
+// -----------------------------------------------------------------------------
+
+/* Reads a little-endian unsigned integer of the given width. Returns 0 on success. */
+static int ReadLE( FILE *f, int bytes, unsigned long long *value )
+{
+    unsigned char b[ 8 ];
+    if( bytes < 1 || bytes > 8 || fread( b, 1, (size_t)bytes, f ) != (size_t)bytes ) return -1;
+    *value = 0;
+    for( int i = bytes - 1; i >= 0; i-- ) *value = ( *value << 8 ) | b[ i ];
+    return 0;
+}
+
+/* Reads an XDF variable-length integer (a 1, 4 or 8 byte width prefix followed by the value). */
+static int ReadVarLen( FILE *f, unsigned long long *value )
+{
+    int width = fgetc( f );
+    if( width != 1 && width != 4 && width != 8 ) return -1;
+    return ReadLE( f, width, value );
+}
+
+/*
+ * Copies the text content of the first <tag>...</tag> element found at or after
+ * `from` into `out`. Returns a pointer just past the closing tag, or NULL.
+ */
+static const char *XmlValue( const char *from, const char *tag, char *out, size_t outSize )
+{
+    char open[ 64 ], close[ 64 ];
+    snprintf( open, sizeof( open ), "<%s>", tag );
+    snprintf( close, sizeof( close ), "</%s>", tag );
+    const char *start = strstr( from, open );
+    if( !start ) return NULL;
+    start += strlen( open );
+    const char *end = strstr( start, close );
+    if( !end ) return NULL;
+    size_t length = (size_t)( end - start );
+    if( length >= outSize ) length = outSize - 1;
+    memcpy( out, start, length );
+    out[ length ] = '\0';
+    return end + strlen( close );
+}
+
+/* Maps an LSL channel_format name to a value size. Returns 0 for unsupported formats. */
+static int XdfValueBytes( const char *format, int *isFloat )
+{
+    *isFloat = 0;
+    if( strcmp( format, "float32" ) == 0 ) { *isFloat = 1; return 4; }
+    if( strcmp( format, "double64" ) == 0 ) { *isFloat = 1; return 8; }
+    if( strcmp( format, "int8" ) == 0 ) return 1;
+    if( strcmp( format, "int16" ) == 0 ) return 2;
+    if( strcmp( format, "int32" ) == 0 ) return 4;
+    if( strcmp( format, "int64" ) == 0 ) return 8;
+    return 0;
+}
+
+/*
+ * Scans the stream headers of an XDF file and selects the stream to replay:
+ * the first EEG stream, otherwise the first stream with a numeric format.
+ */
+static int OpenXdf( ReplaySource *src )
+{
+    char magic[ 4 ];
+    char *chosenXml = NULL;
+    int chosenIsEEG = 0;
+
+    if( fread( magic, 1, 4, src->file ) != 4 || memcmp( magic, "XDF:", 4 ) != 0 )
+        return ReplayError( "Replay: not an XDF file (bad magic code).\n" );
+
+    for( ;; ) {
+        unsigned long long length, tag;
+        if( ReadVarLen( src->file, &length ) != 0 ) break;              /* end of file */
+        if( length < 2 || ReadLE( src->file, 2, &tag ) != 0 ) break;
+        length -= 2;
+
+        if( tag == XDF_TAG_SAMPLES ) break; /* headers precede the data they describe */
+        if( tag != XDF_TAG_STREAM_HEADER || length < 4 || chosenIsEEG ) {
+            if( fseek( src->file, (long)length, SEEK_CUR ) != 0 ) break;
+            continue;
+        }
+
+        unsigned long long streamId;
+        if( ReadLE( src->file, 4, &streamId ) != 0 ) break;           /* truncated file */
+        char *xml = malloc( (size_t)length - 4 + 1 );
+        if( !xml || fread( xml, 1, (size_t)length - 4, src->file ) != (size_t)length - 4 ) {
+            free( xml );
+            break;
+        }
+        xml[ length - 4 ] = '\0';
+
+        char type[ 64 ] = "", format[ 32 ] = "";
+        int isFloat;
+        XmlValue( xml, "type", type, sizeof( type ) );
+        XmlValue( xml, "channel_format", format, sizeof( format ) );
+        if( XdfValueBytes( format, &isFloat ) == 0 || ( chosenXml && strcmp( type, "EEG" ) != 0 ) ) {
+            free( xml );
+            continue;
+        }
+        free( chosenXml );
+        chosenXml = xml;
+        chosenIsEEG = strcmp( type, "EEG" ) == 0;
+        src->streamId = (unsigned int)streamId;
+    }
+
+    if( !chosenXml ) return ReplayError( "Replay: no numeric stream found in XDF file.\n" );
+
+    char value[ 64 ] = "";
+    XmlValue( chosenXml, "channel_count", value, sizeof( value ) );
+    int numberOfChannels = atoi( value );
+    XmlValue( chosenXml, "nominal_srate", value, sizeof( value ) );
+    src->samplingRate = atof( value );
+    XmlValue( chosenXml, "channel_format", value, sizeof( value ) );
+    src->valueBytes = XdfValueBytes( value, &src->valueIsFloat );
+
+    if( numberOfChannels <= 0 || AllocateChannels( src, (unsigned int)numberOfChannels ) != 0 ) {
+        free( chosenXml );
+        return ReplayError( "Replay: invalid channel count in XDF stream header.\n" );
+    }
+
+    /* Channel labels from <desc><channels><channel><label>, when present. */
+    const char *cursor = strstr( chosenXml, "<channels>" );
+    for( unsigned int i = 0; cursor && i < src->numberOfChannels; i++ ) {
+        char channel[ 1024 ];
+        cursor = XmlValue( cursor, "channel", channel, sizeof( channel ) );
+        if( cursor ) XmlValue( channel, "label", src->labels[ i ], REPLAY_LABEL_LENGTH );
+    }
+    free( chosenXml );
+
+    src->valueBuffer = malloc( (size_t)src->valueBytes * src->numberOfChannels );
+    if( !src->valueBuffer ) return ReplayError( "Replay: could not allocate sample buffer.\n" );
+    return Replay_Rewind( src );
+}
+
+static double XdfValue( const ReplaySource *src, const unsigned char *p )
+{
+    switch( src->valueBytes ) {
+        case 1: return (double)*(const signed char *)p;
+        case 2: { short v; memcpy( &v, p, 2 ); return v; }
+        case 4: if( src->valueIsFloat ) { float v; memcpy( &v, p, 4 ); return v; }
+                else { int v; memcpy( &v, p, 4 ); return v; }
+        default: if( src->valueIsFloat ) { double v; memcpy( &v, p, 8 ); return v; }
+                 else { long long v; memcpy( &v, p, 8 ); return (double)v; }
+    }
+}
+
+static int NextXdf( ReplaySource *src, float *sample, double *timestamp )
+{
+    /* Advance to the next Samples chunk of the replayed stream. */
+    while( src->samplesLeftInChunk == 0 ) {
+        unsigned long long length, tag, streamId, numberOfSamples;
+        if( ReadVarLen( src->file, &length ) != 0 ) return 0;
+        if( length < 2 || ReadLE( src->file, 2, &tag ) != 0 ) return 0;
+        length -= 2;
+        if( tag == XDF_TAG_SAMPLES && length >= 4 ) {
+            if( ReadLE( src->file, 4, &streamId ) != 0 ) return 0;     /* truncated file */
+            if( streamId == src->streamId ) {
+                if( ReadVarLen( src->file, &numberOfSamples ) != 0 ) return 0;
+                src->samplesLeftInChunk = numberOfSamples;
+                continue;
+            }
+            length -= 4;
+        }
+        if( fseek( src->file, (long)length, SEEK_CUR ) != 0 ) return -1;
+    }
+
+    /* A recording cut off mid-sample (e.g. by a crash of the recorder) ends there */
+    int timestampBytes = fgetc( src->file );
+    if( timestampBytes == EOF ) return 0;
+    if( timestampBytes == 8 ) {
+        if( fread( timestamp, sizeof( double ), 1, src->file ) != 1 ) return 0;
+    } else if( timestampBytes == 0 ) {
+        *timestamp = src->lastTimestamp + ( src->samplingRate > 0 ? 1.0 / src->samplingRate : 0.0 );
+    } else {
+        return ReplayError( "Replay: corrupt XDF sample (timestamp size %d).\n", timestampBytes );
+    }
+
+    size_t sampleBytes = (size_t)src->valueBytes * src->numberOfChannels;
+    if( fread( src->valueBuffer, 1, sampleBytes, src->file ) != sampleBytes ) return 0;
+    for( unsigned int i = 0; i < src->numberOfChannels; i++ )
+        sample[ i ] = (float)XdfValue( src, src->valueBuffer + (size_t)i * src->valueBytes );
+
+    src->samplesLeftInChunk--;
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// CSV
+// -----------------------------------------------------------------------------
+
+/* Splits a CSV line in place and returns the number of fields stored in `fields`. */
+static unsigned int SplitCsv( char *line, char **fields, unsigned int maxFields )
+{
+    unsigned int n = 0;
+    line[ strcspn( line, "\r\n" ) ] = '\0';
+    for( char *p = line; n < maxFields; ) {
+        while( *p == ' ' || *p == '\t' ) p++;
+        fields[ n++ ] = p;
+        p = strchr( p, ',' );
+        if( !p ) break;
+        *p++ = '\0';
+    }
+    return n;
+}
+
+static int OpenCsv( ReplaySource *src, double rateOverride )
+{
+    char *fields[ REPLAY_MAX_CSV_COLUMNS ];
+    src->line = malloc( REPLAY_CSV_LINE_LENGTH );
+    if( !src->line ) return ReplayError( "Replay: could not allocate line buffer.\n" );
+    if( !fgets( src->line, REPLAY_CSV_LINE_LENGTH, src->file ) ) return ReplayError( "Replay: CSV file is empty.\n" );
+
+    unsigned int n = SplitCsv( src->line, fields, REPLAY_MAX_CSV_COLUMNS );
+    src->hasTimestampColumn = _stricmp( fields[ 0 ], "timestamp" ) == 0 || _stricmp( fields[ 0 ], "time" ) == 0;
+    if( n <= (unsigned int)src->hasTimestampColumn ) return ReplayError( "Replay: CSV header has no channel columns.\n" );
+    if( AllocateChannels( src, n - src->hasTimestampColumn ) != 0 ) return -1;
+    for( unsigned int i = 0; i < src->numberOfChannels; i++ )
+        snprintf( src->labels[ i ], REPLAY_LABEL_LENGTH, "%s", fields[ i + src->hasTimestampColumn ] );
+    src->dataStart = ftell( src->file );
+
+    /* Estimate the nominal rate from the first rows when the file carries time stamps. */
+    src->samplingRate = REPLAY_DEFAULT_RATE;
+    if( src->hasTimestampColumn ) {
+        double first = 0, last = 0;
+        int rows = 0;
+        while( rows < 256 && fgets( src->line, REPLAY_CSV_LINE_LENGTH, src->file ) ) {
+            double t = strtod( src->line, NULL );
+            if( rows++ == 0 ) first = t;
+            last = t;
+        }
+        if( rows > 1 && last > first ) src->samplingRate = ( rows - 1 ) / ( last - first );
+    }
+    if( rateOverride > 0 ) src->samplingRate = rateOverride;
+    return Replay_Rewind( src );
+}
+
+static int NextCsv( ReplaySource *src, float *sample, double *timestamp )
+{
+    char *p, *end;
+    do {
+        if( !fgets( src->line, REPLAY_CSV_LINE_LENGTH, src->file ) ) return 0;
+        p = src->line + strspn( src->line, " \t" );
+    } while( *p == '\r' || *p == '\n' || *p == '\0' );
+
+    if( src->hasTimestampColumn ) {
+        *timestamp = strtod( p, &end );
+        if( end == p ) return ReplayError( "Replay: bad time stamp in CSV row %lld.\n", src->sampleCount + 1 );
+        p = end + strspn( end, " \t," );
+    } else {
+        *timestamp = src->sampleCount / src->samplingRate;
+    }
+    for( unsigned int i = 0; i < src->numberOfChannels; i++ ) {
+        sample[ i ] = strtof( p, &end );
+        if( end == p ) return ReplayError( "Replay: missing value in CSV row %lld.\n", src->sampleCount + 1 );
+        p = end + strspn( end, " \t," );
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+// Public interface
+// -----------------------------------------------------------------------------
+
+ReplaySource *Replay_Open( const char *path, double rateOverride )
+{
+    ReplaySource *src = calloc( 1, sizeof( ReplaySource ) );
+    if( !src ) return NULL;
+
+    if( EndsWith( path, ".xdf" ) ) src->format = REPLAY_XDF;
+    else if( EndsWith( path, ".csv" ) ) src->format = REPLAY_CSV;
+    else {
+        ReplayError( "Replay: unsupported file type \"%s\" (expected .xdf or .csv).\n", path );
+        free( src );
+        return NULL;
+    }
+
+    src->file = fopen( path, "rb" );
+    if( !src->file ) {
+        ReplayError( "Replay: could not open \"%s\".\n", path );
+        free( src );
+        return NULL;
+    }
+
+    int error = src->format == REPLAY_XDF ? OpenXdf( src ) : OpenCsv( src, rateOverride );
+    if( error != 0 ) {
+        Replay_Close( src );
+        return NULL;
+    }
+    if( rateOverride > 0 ) src->samplingRate = rateOverride;
+    return src;
+}
+
+void Replay_Close( ReplaySource *src )
+{
+    if( !src ) return;
+    if( src->file ) fclose( src->file );
+    free( src->labels );
+    free( src->valueBuffer );
+    free( src->line );
+    free( src );
+}
+
+unsigned int Replay_GetNumberOfChannels( const ReplaySource *src ) { return src->numberOfChannels; }
+double       Replay_GetSamplingRate( const ReplaySource *src )     { return src->samplingRate; }
+
+const char *Replay_GetChannelLabel( const ReplaySource *src, unsigned int channelIndex )
+{
+    return channelIndex < src->numberOfChannels ? src->labels[ channelIndex ] : "";
+}
+
+int Replay_Next( ReplaySource *src, float *sample, double *timestamp )
+{
+    int status = src->format == REPLAY_XDF ? NextXdf( src, sample, timestamp ) : NextCsv( src, sample, timestamp );
+    if( status == 1 ) {
+        src->lastTimestamp = *timestamp;
+        src->sampleCount++;
+    }
+    return status;
+}
+
+int Replay_Rewind( ReplaySource *src )
+{
+    src->samplesLeftInChunk = 0;
+    src->lastTimestamp = 0;
+    src->sampleCount = 0;
+    return fseek( src->file, src->format == REPLAY_XDF ? 4L : src->dataStart, SEEK_SET );
+}
@@ -0,0 +1,67 @@
+/*
+ * replay.h
+ * ---------------------------------------------
+ * Recorded-data source for the dsi2lsl --replay mode.
+ *
+ * A ReplaySource reads EEG samples back from an XDF recording (for example one
+ * written by LabRecorder) or from a CSV file, one sample at a time. dsi2lsl feeds
+ * these samples through the same chunking and LSL publishing code used by the
+ * DSI sample callback, so the publish path can be exercised without a headset.
+ *
+ * CSV files must start with a header row of channel labels. If the first column
+ * is named "timestamp" (or "time"), its values are used as sample timestamps in
+ * seconds; otherwise samples are assumed to be evenly spaced at the nominal rate.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdarg.h>
+
+typedef struct ReplaySource ReplaySource;
+
+/** Receives the replay functions' error messages, printf-style. */
+typedef void (*Replay_LogFunction)( const char *format, va_list args );
+
+/** Routes error messages to log instead of stderr; NULL restores stderr. */
+void Replay_SetLog( Replay_LogFunction log );
+
+/**
+ * Opens a recording for replay. The format is chosen by file extension
+ * (.xdf or .csv). For XDF files the first stream of type EEG is replayed, or
+ * the first numeric stream if there is no EEG stream.
+ *
+ * @param path         - Path to the .xdf or .csv file
+ * @param rateOverride - Nominal sampling rate to use instead of the one in the
+ *                       file (or estimated from it); pass 0 to keep the file's
+ * @return New replay source, or NULL on error (the reason is reported, see Replay_SetLog)
+ */
+ReplaySource *Replay_Open( const char *path, double rateOverride );
+
+/** Closes the file and frees the replay source. */
+void Replay_Close( ReplaySource *src );
+
+/** Number of channels in each replayed sample. */
+unsigned int Replay_GetNumberOfChannels( const ReplaySource *src );
+
+/** Nominal sampling rate of the replayed stream in Hz. */
+double Replay_GetSamplingRate( const ReplaySource *src );
+
+/** Label of the given channel (never NULL). */
+const char *Replay_GetChannelLabel( const ReplaySource *src, unsigned int channelIndex );
+
+/**
+ * Reads the next sample.
+ *
+ * @param src       - Replay source
+ * @param sample    - Receives Replay_GetNumberOfChannels() values
+ * @param timestamp - Receives the recorded time stamp of the sample in seconds
+ * @return 1 if a sample was read, 0 at the end of the recording (or where a
+ *         truncated file is cut off), -1 on error
+ */
+int Replay_Next( ReplaySource *src, float *sample, double *timestamp );
+
+/** Restarts the replay from the first sample. Returns 0 on success. */
+int Replay_Rewind( ReplaySource *src );
+
+#endif /* REPLAY_H */
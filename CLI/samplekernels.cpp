@@ -0,0 +1,101 @@
+/*
+ * samplekernels.cpp
+ * ---------------------------------------------
+ * Gather kernels specialized on the channel count (see samplekernels.h).
+ *
+ * The reads go to the DSI API through a function pointer and cannot be
+ * vectorized, so a kernel first makes all of them, unrolled at compile time
+ * into straight-line code, into a local array, and then converts the array to
+ * float in a loop of constant length, which the compiler turns into packed
+ * conversions and stores.
+ *
+ * Whether that beats the generic loop depends on the count and the machine
+ * (for 7 channels the unrolled reads measured slower), so the selection times
+ * both, interleaved, and keeps the best of CALIBRATION_ROUNDS batches of each.
+ */
+
+#include "samplekernels.h"
+#include <windows.h>
+
+namespace {
+
+/* Reads channels I..N-1 into values */
+template< unsigned int I, unsigned int N >
+struct Reads {
+  static inline void Run( void *const *channels, SampleKernel_Read read, double *values )
+  {
+    values[ I ] = read( channels[ I ] );
+    Reads< I + 1, N >::Run( channels, read, values );
+  }
+};
+
+template< unsigned int N >
+struct Reads< N, N > {
+  static inline void Run( void *const *, SampleKernel_Read, double * ) {}
+};
+
+const int CALIBRATION_ROUNDS = 32;
+const int CALIBRATION_BATCH = 64;            /* Calls per timed batch */
+
+template< unsigned int N >
+void Gather( void *const *channels, unsigned int, SampleKernel_Read read, float *out )
+{
+  static_assert( N <= SAMPLE_KERNEL_MAX_SIZE, "SAMPLE_KERNEL_MAX_SIZE is too small" );
+  double values[ N ];
+  Reads< 0, N >::Run( channels, read, values );
+  for( unsigned int i = 0; i < N; i++ ) out[ i ] = (float)values[ i ];
+}
+
+struct Specialization {
+  unsigned int numberOfChannels;
+  SampleKernel kernel;
+};
+
+const Specialization specializations[] = {
+  { 7, Gather< 7 > },
+  { 24, Gather< 24 > },
+  { 32, Gather< 32 > }
+};
+
+/* Ticks of one batch of calls of kernel */
+LONGLONG TimeBatch( SampleKernel kernel, void *const *channels, unsigned int numberOfChannels, SampleKernel_Read read,
+                    float *out )
+{
+  LARGE_INTEGER start, end;
+  QueryPerformanceCounter( &start );
+  for( int call = 0; call < CALIBRATION_BATCH; call++ ) kernel( channels, numberOfChannels, read, out );
+  QueryPerformanceCounter( &end );
+  return end.QuadPart - start.QuadPart;
+}
+
+}
+
+extern "C" void SampleKernel_Generic( void *const *channels, unsigned int numberOfChannels, SampleKernel_Read read, float *out )
+{
+  for( unsigned int i = 0; i < numberOfChannels; i++ ) out[ i ] = (float)read( channels[ i ] );
+}
+
+extern "C" SampleKernel SampleKernel_Select( void *const *channels, unsigned int numberOfChannels, SampleKernel_Read read )
+{
+  SampleKernel specialized = NULL;
+  for( unsigned int i = 0; i < sizeof( specializations ) / sizeof( specializations[ 0 ] ); i++ )
+    if( specializations[ i ].numberOfChannels == numberOfChannels ) specialized = specializations[ i ].kernel;
+  if( !specialized ) return SampleKernel_Generic;
+
+  float out[ SAMPLE_KERNEL_MAX_SIZE ];
+  LONGLONG bestSpecialized = 0, bestGeneric = 0;
+  for( int round = 0; round < CALIBRATION_ROUNDS; round++ ) {
+    LONGLONG ticks = TimeBatch( specialized, channels, numberOfChannels, read, out );
+    if( round == 0 || ticks < bestSpecialized ) bestSpecialized = ticks;
+    ticks = TimeBatch( SampleKernel_Generic, channels, numberOfChannels, read, out );
+    if( round == 0 || ticks < bestGeneric ) bestGeneric = ticks;
+  }
+  return bestSpecialized < bestGeneric ? specialized : SampleKernel_Generic;
+}
+
+extern "C" unsigned int SampleKernel_Specialized( unsigned int index, SampleKernel *kernel )
+{
+  if( index >= sizeof( specializations ) / sizeof( specializations[ 0 ] ) ) return 0;
+  if( kernel ) *kernel = specializations[ index ].kernel;
+  return specializations[ index ].numberOfChannels;
+}
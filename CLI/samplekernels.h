@@ -0,0 +1,66 @@
+/*
+ * samplekernels.h
+ * ---------------------------------------------
+ * Gather kernels of the sample callback: each reads the current value of a
+ * fixed list of headset channels (or sources) and stores it as float into the
+ * chunk.
+ *
+ * A loop over a channel count known only at run time leaves the compiler
+ * nothing to unroll or vectorize. samplekernels.cpp compiles kernels for the
+ * channel counts of common montages (see SampleKernel_Specialized), which
+ * issue the reads as one unrolled sequence and convert and store the values
+ * with vector instructions. That does not pay off for every count, so
+ * SampleKernel_Select, called once the montage is chosen, times the
+ * specialized kernel against the generic loop on the actual channels and
+ * returns the faster one.
+ *
+ * The kernels are C++ templates (samplekernels.cpp) behind this C interface;
+ * they use no C++ runtime, so C programs link them as they are.
+ */
+
+#ifndef SAMPLEKERNELS_H
+#define SAMPLEKERNELS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SAMPLE_KERNEL_MAX_SIZE 32             /* Largest channel count with a specialized kernel */
+
+/**
+ * Reads one channel's current value, e.g. DSI_Channel_GetSignal or
+ * DSI_Source_GetSignal cast to this type: DSI handles are pointers.
+ */
+typedef double (*SampleKernel_Read)( void *channel );
+
+/**
+ * Stores (float)read( channels[ i ] ) in out[ i ] for each channel.
+ * Specialized kernels ignore numberOfChannels.
+ */
+typedef void (*SampleKernel)( void *const *channels, unsigned int numberOfChannels, SampleKernel_Read read, float *out );
+
+/**
+ * Chooses the kernel for channels: the one specialized for numberOfChannels
+ * if it measures faster than the generic loop, which it is timed against on
+ * these channels, and the generic loop otherwise. Reads every channel a few
+ * thousand times.
+ * @return The kernel; never NULL
+ */
+SampleKernel SampleKernel_Select( void *const *channels, unsigned int numberOfChannels, SampleKernel_Read read );
+
+/**
+ * Lists the specialized kernels, e.g. for benchmarks.
+ * @param index  - 0 for the first
+ * @param kernel - Receives the kernel; may be NULL
+ * @return Its channel count, or 0 after the last
+ */
+unsigned int SampleKernel_Specialized( unsigned int index, SampleKernel *kernel );
+
+/** The generic loop, for any number of channels. */
+void SampleKernel_Generic( void *const *channels, unsigned int numberOfChannels, SampleKernel_Read read, float *out );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLEKERNELS_H */
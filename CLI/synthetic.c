@@ -0,0 +1,53 @@
+/*
+ * synthetic.c
+ * ---------------------------------------------
+ * Synthetic EEG (see synthetic.h).
+ */
+
+#include "synthetic.h"
+#include <stdlib.h>
+#include <math.h>
+
+static const double PI = 3.14159265358979323846;
+
+static double Uniform( void )
+{
+  return ( rand() + 1.0 ) / ( RAND_MAX + 2.0 );
+}
+
+static double Gaussian( void )
+{
+  return sqrt( -2.0 * log( Uniform() ) ) * cos( 2 * PI * Uniform() );
+}
+
+int Synthesize( float *samples, unsigned int numberOfChannels, size_t numberOfSamples, double rate )
+{
+  /* Sum of first-order low-pass noise sources approximates a 1/f spectrum */
+  static const double poles[] = { 0.99, 0.95, 0.8, 0.5 };
+  double (*state)[ 4 ] = (double (*)[ 4 ])calloc( numberOfChannels, sizeof( *state ) );
+  unsigned int channel;
+  size_t i;
+
+  if( !state ) return -1;
+  srand( 1 );
+  for( i = 0; i < numberOfSamples; i++ ) {
+    double t = i / rate;
+    /* A blink every 4 s, lasting 0.3 s */
+    double blinkPhase = fmod( t, 4.0 );
+    double blink = blinkPhase < 0.3 ? 150.0 * sin( PI * blinkPhase / 0.3 ) : 0.0;
+    for( channel = 0; channel < numberOfChannels; channel++ ) {
+      double value = 200.0 * ( (int)channel - 12 );                    /* Electrode offset */
+      int p;
+      for( p = 0; p < 4; p++ ) {
+        state[ channel ][ p ] = poles[ p ] * state[ channel ][ p ] + Gaussian();
+        value += state[ channel ][ p ] * ( 1.0 - poles[ p ] ) * 40.0;
+      }
+      if( channel >= numberOfChannels * 2 / 3 ) value += 15.0 * sin( 2 * PI * 10.0 * t + channel );   /* Alpha */
+      if( channel < 3 ) value += blink;
+      value += 3.0 * sin( 2 * PI * 60.0 * t );
+      samples[ i * numberOfChannels + channel ] = (float)value;
+    }
+  }
+  free( state );
+  return 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * synthetic.h
+ * ---------------------------------------------
+ * Synthetic DSI-like EEG for the benchmark programs, so that they run without
+ * a headset or a recording.
+ */
+
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYNTHETIC_CHANNELS 24               /* DSI-24 */
+#define SYNTHETIC_RATE 300.0
+
+/**
+ * Fills samples (channel-interleaved) with synthetic EEG in microvolts: 1/f
+ * background activity, posterior alpha, mains interference, electrode offsets
+ * and blink artifacts on the frontal channels. The same arguments always give
+ * the same data.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int Synthesize( float *samples, unsigned int numberOfChannels, size_t numberOfSamples, double rate );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SYNTHETIC_H */
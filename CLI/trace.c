@@ -0,0 +1,163 @@
+/*
+ * trace.c
+ * ---------------------------------------------
+ * Span tracing (see trace.h).
+ *
+ * Trace_Start allocates TRACE_MAX_THREADS rings up front, so that tracing
+ * does not allocate once acquisition runs. A thread takes the next free ring
+ * on its first span and finds it again through a thread-local slot; threads
+ * beyond TRACE_MAX_THREADS are not traced. A thread started for every block,
+ * like the pacer's, hands its ring back with Trace_EndThread, so that the
+ * next one continues its track instead of taking a new ring. Ticks come from
+ * QueryPerformanceCounter and are written relative to Trace_Start.
+ */
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+#include "alloccheck.h"
+
+typedef struct {
+  const char *name;
+  long long start, end;
+} TraceEvent;
+
+typedef struct {
+  DWORD threadId;
+  const char *name;
+  volatile LONG released;               // 1 once the thread ended; the next new thread continues the track
+  unsigned long long count;             // Spans recorded; the ring keeps the last TRACE_EVENTS_PER_THREAD
+  TraceEvent events[ TRACE_EVENTS_PER_THREAD ];
+} TraceThread;
+
+volatile int traceEnabled = 0;
+
+static DWORD traceSlot = TLS_OUT_OF_INDEXES;
+static TraceThread *traceThreads = NULL;   // TRACE_MAX_THREADS rings
+static volatile LONG traceThreadsUsed = 0;
+static LARGE_INTEGER traceOrigin, traceFrequency;
+
+/* The calling thread's ring, taken on first use; NULL once all are taken */
+static TraceThread *CurrentThread( void )
+{
+  TraceThread *thread = (TraceThread *)TlsGetValue( traceSlot );
+  LONG used, index;
+  if( thread ) return thread;
+  used = traceThreadsUsed < TRACE_MAX_THREADS ? traceThreadsUsed : TRACE_MAX_THREADS;
+  for( index = 0; index < used && !thread; index++ )
+    if( InterlockedCompareExchange( &traceThreads[ index ].released, 0, 1 ) == 1 ) thread = &traceThreads[ index ];
+  if( !thread ) {
+    index = InterlockedIncrement( &traceThreadsUsed ) - 1;
+    if( index >= TRACE_MAX_THREADS ) return NULL;
+    thread = &traceThreads[ index ];
+    thread->threadId = GetCurrentThreadId();
+  }
+  TlsSetValue( traceSlot, thread );
+  return thread;
+}
+
+int Trace_Start( void )
+{
+  if( traceEnabled ) return 0;
+  traceThreads = (TraceThread *)calloc( TRACE_MAX_THREADS, sizeof( TraceThread ) );
+  if( !traceThreads ) return -1;
+  traceThreadsUsed = 0;
+  traceSlot = TlsAlloc();
+  if( traceSlot == TLS_OUT_OF_INDEXES ) {
+    free( traceThreads );
+    traceThreads = NULL;
+    return -1;
+  }
+  QueryPerformanceFrequency( &traceFrequency );
+  QueryPerformanceCounter( &traceOrigin );
+  traceEnabled = 1;
+  return 0;
+}
+
+long long Trace_Now( void )
+{
+  LARGE_INTEGER now;
+  QueryPerformanceCounter( &now );
+  return now.QuadPart;
+}
+
+void Trace_Span( const char *name, long long start )
+{
+  TraceThread *thread;
+  TraceEvent *event;
+  if( !traceEnabled || !( thread = CurrentThread() ) ) return;
+  event = &thread->events[ thread->count & ( TRACE_EVENTS_PER_THREAD - 1 ) ];
+  event->name = name;
+  event->start = start;
+  event->end = Trace_Now();
+  thread->count++;
+}
+
+void Trace_NameThread( const char *name )
+{
+  TraceThread *thread;
+  if( traceEnabled && ( thread = CurrentThread() ) ) thread->name = name;
+}
+
+void Trace_EndThread( void )
+{
+  TraceThread *thread;
+  if( traceEnabled && ( thread = (TraceThread *)TlsGetValue( traceSlot ) ) != NULL ) {
+    TlsSetValue( traceSlot, NULL );
+    InterlockedExchange( &thread->released, 1 );
+  }
+}
+
+/* Microseconds since Trace_Start */
+static double Microseconds( long long ticks )
+{
+  return ( ticks - traceOrigin.QuadPart ) * 1e6 / (double)traceFrequency.QuadPart;
+}
+
+long long Trace_Write( const char *path )
+{
+  FILE *file;
+  TraceThread *thread;
+  LONG used = traceThreadsUsed < TRACE_MAX_THREADS ? traceThreadsUsed : TRACE_MAX_THREADS, i;
+  DWORD processId = GetCurrentProcessId();
+  long long written = 0, dropped = 0;
+  const char *separator = "";
+
+  if( !traceEnabled ) return 0;
+  traceEnabled = 0;
+  file = fopen( path, "w" );
+  if( file ) {
+    fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+    for( i = 0; i < used; i++ ) {
+      unsigned long long first, index;
+      thread = &traceThreads[ i ];
+      first = thread->count > TRACE_EVENTS_PER_THREAD ? thread->count - TRACE_EVENTS_PER_THREAD : 0;
+      if( thread->name ) {
+        fprintf( file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+                 separator, (unsigned long)processId, (unsigned long)thread->threadId, thread->name );
+        separator = ",";
+      }
+      for( index = first; index < thread->count; index++ ) {
+        const TraceEvent *event = &thread->events[ index & ( TRACE_EVENTS_PER_THREAD - 1 ) ];
+        fprintf( file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+                 separator, event->name, (unsigned long)processId, (unsigned long)thread->threadId,
+                 Microseconds( event->start ), Microseconds( event->end ) - Microseconds( event->start ) );
+        separator = ",";
+        written++;
+      }
+      dropped += (long long)first;
+    }
+    fprintf( file, "\n],\"otherData\":{\"droppedSpans\":\"%lld\"}}\n", dropped );
+    if( fclose( file ) != 0 ) written = -1;
+  } else {
+    written = -1;
+  }
+
+  /* Threads still alive keep a pointer in the old slot, which is not used again */
+  free( traceThreads );
+  traceThreads = NULL;
+  TlsFree( traceSlot );
+  traceSlot = TLS_OUT_OF_INDEXES;
+  return written;
+}
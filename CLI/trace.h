@@ -0,0 +1,64 @@
+/*
+ * trace.h
+ * ---------------------------------------------
+ * Span tracing of the acquisition pipeline for the --trace option of dsi2lsl.
+ *
+ * Each thread records complete spans (name, begin and end tick) into its own
+ * ring of TRACE_EVENTS_PER_THREAD events, so recording takes no lock; once a
+ * ring is full the oldest spans are overwritten. The rings of the first
+ * TRACE_MAX_THREADS threads are allocated by Trace_Start. Trace_Write saves the spans
+ * as Chrome trace JSON, which chrome://tracing and https://ui.perfetto.dev
+ * open as a timeline with one track per thread.
+ *
+ * Instrumented code brackets a span with TRACE_BEGIN and TRACE_END; while
+ * tracing is off, that is one test of a global flag:
+ *
+ *   long long start = TRACE_BEGIN();
+ *   DSI_Headset_Idle( h, 0.0 );
+ *   TRACE_END( "DSI_Headset_Idle", start );
+ *
+ * Names must be string literals or otherwise outlive the trace.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_EVENTS_PER_THREAD 65536       /* Power of two */
+#define TRACE_MAX_THREADS 8                 /* Threads traced; later ones are not */
+
+extern volatile int traceEnabled;
+
+/** Starts recording (process-wide) and allocates the rings. @return 0 on success */
+int Trace_Start( void );
+
+/** Current tick; use TRACE_BEGIN. */
+long long Trace_Now( void );
+
+/** Records a span from start to now on the calling thread's ring; use TRACE_END. */
+void Trace_Span( const char *name, long long start );
+
+/** Names the calling thread's track, e.g. "DSI processing". No-op while not tracing. */
+void Trace_NameThread( const char *name );
+
+/** Hands the calling thread's ring to the next thread that starts tracing; call before a thread that is started again ends. */
+void Trace_EndThread( void );
+
+/**
+ * Stops recording, writes all spans to path as Chrome trace JSON and frees
+ * the rings. Call once the traced threads have finished.
+ * @return Number of spans written, or -1 if the file could not be written
+ */
+long long Trace_Write( const char *path );
+
+#define TRACE_BEGIN() ( traceEnabled ? Trace_Now() : 0 )
+#define TRACE_END( name, start ) do { if( start ) Trace_Span( ( name ), ( start ) ); } while( 0 )
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
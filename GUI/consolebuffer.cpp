@@ -0,0 +1,79 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#include "consolebuffer.h"
+#include <QPlainTextEdit>
+
+/* liblsl log lines that are hidden from the console */
+const QString CONSOLE_FILTER = "netinterfaces\\.cpp|udp_server\\.cpp|common\\.cpp|api_config\\.cpp";
+
+
+/**
+ * Constructor for ConsoleBuffer
+ * @param console - The widget the lines are appended to.
+ * @param parent - The parent object.
+ */
+ConsoleBuffer::ConsoleBuffer(QPlainTextEdit *console, QObject *parent) :
+    QObject(parent),
+    console(console),
+    filter(CONSOLE_FILTER),
+    droppedLines(0)
+{
+    this->timer = new QTimer(this);
+    this->timer->setInterval(1000 / REFRESH_HZ);
+    connect(this->timer, &QTimer::timeout, this, &ConsoleBuffer::flush);
+    this->timer->start();
+}
+
+/**
+ * Queues text for the console. Text is shown on the next flush.
+ * @param text - The text to show; may contain several lines.
+ */
+void ConsoleBuffer::append(const QString &text)
+{
+    this->pendingLines.append(text);
+    if (this->pendingLines.size() > MAX_PENDING_LINES) {
+        this->pendingLines.removeFirst();
+        this->droppedLines++;
+    }
+}
+
+/**
+ * Splits process output into lines and queues them, hiding liblsl network chatter.
+ * @param output - Everything read from the process since the last call.
+ */
+void ConsoleBuffer::appendOutput(const QByteArray &output)
+{
+    QByteArray data = this->partialLine + output;
+    int lineStart = 0;
+    int lineEnd;
+    while ((lineEnd = data.indexOf('\n', lineStart)) >= 0) {
+        QString line = QString::fromLocal8Bit(data.constData() + lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        if (line.endsWith('\r'))
+            line.chop(1);
+        if (!this->filter.match(line).hasMatch())
+            this->append(line);
+    }
+    this->partialLine = data.mid(lineStart);
+}
+
+/**
+ * Appends all queued console lines in a single update.
+ * Called by the timer at REFRESH_HZ.
+ */
+void ConsoleBuffer::flush()
+{
+    if (this->pendingLines.isEmpty())
+        return;
+    if (this->droppedLines > 0) {
+        this->pendingLines.prepend(QString("... %1 lines skipped ...").arg(this->droppedLines));
+        this->droppedLines = 0;
+    }
+    this->console->appendPlainText(this->pendingLines.join('\n'));
+    this->pendingLines.clear();
+}
@@ -0,0 +1,55 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#ifndef CONSOLEBUFFER_H
+#define CONSOLEBUFFER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QByteArray>
+#include <QStringList>
+#include <QRegularExpression>
+
+class QPlainTextEdit;
+
+/*
+ * Rate-limited feed of a console widget.
+ *
+ * Lines are queued as they arrive and appended to the console in one update
+ * at most REFRESH_HZ times per second, so that a streamer printing thousands
+ * of lines per second cannot saturate the UI thread. At most MAX_PENDING_LINES
+ * are queued between updates; older ones are dropped and counted, since the
+ * console only keeps its last maximumBlockCount lines anyway.
+ */
+class ConsoleBuffer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum { REFRESH_HZ = 30, MAX_PENDING_LINES = 5000 };
+
+    explicit ConsoleBuffer(QPlainTextEdit *console, QObject *parent = 0);
+
+    /* Queues text; it may contain several lines */
+    void append(const QString &text);
+    /* Queues raw process output; an incomplete last line is kept until the rest arrives */
+    void appendOutput(const QByteArray &output);
+
+public slots:
+    /* Appends all queued lines in a single update */
+    void flush();
+
+private:
+    QPlainTextEdit *console;
+    QTimer *timer;
+    QStringList pendingLines;
+    QByteArray partialLine;
+    QRegularExpression filter;
+    int droppedLines;
+};
+
+#endif /* CONSOLEBUFFER_H */
@@ -0,0 +1,117 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+/*
+ * Stress test of the console batching (ConsoleBuffer).
+ *
+ * A producer timer feeds FLOOD_LINES_PER_SECOND lines of process output
+ * while a heartbeat timer measures how long the event loop goes without
+ * serving it. The UI counts as responsive if no gap exceeds MAX_STALL_MS,
+ * the producer keeps its rate, and the console ends on the latest line.
+ *
+ * Run with QT_QPA_PLATFORM=offscreen where there is no display (ctest does).
+ */
+
+#include "consolebuffer.h"
+#include <QtTest>
+#include <QPlainTextEdit>
+#include <QTextBlock>
+#include <QElapsedTimer>
+#include <QEventLoop>
+
+const int FLOOD_LINES_PER_SECOND = 10000;
+const int FLOOD_SECONDS = 3;
+const int HEARTBEAT_MS = 10;
+const int MAX_STALL_MS = 100;           /* Longer than this feels frozen */
+const int CONSOLE_BLOCKS = 5000;        /* maximumBlockCount of the console, see mainwindow.ui */
+
+class ConsoleBufferTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void floodStaysResponsive();
+    void keepsLatestLines();
+};
+
+/* A typical verbose line of the streamer */
+static QByteArray OutputLine(int number)
+{
+    return QByteArray("[12345.678] Sample ") + QByteArray::number(number) +
+           " arrived 0.4 ms late; pacer queue depth 3, chunk 9 of 9\r\n";
+}
+
+void ConsoleBufferTest::floodStaysResponsive()
+{
+    QPlainTextEdit console;
+    console.setReadOnly(true);
+    console.setMaximumBlockCount(CONSOLE_BLOCKS);
+    console.resize(800, 400);
+    console.show();
+    ConsoleBuffer buffer(&console);
+
+    QElapsedTimer clock;
+    qint64 produced = 0, lastBeat = 0, maxStall = 0;
+    QTimer producer, heartbeat;
+    producer.setTimerType(Qt::PreciseTimer);
+    producer.setInterval(1);
+    connect(&producer, &QTimer::timeout, [&]() {
+        /* Catch up to the target rate, in one read as a burst of output would arrive */
+        qint64 due = clock.elapsed() * FLOOD_LINES_PER_SECOND / 1000;
+        QByteArray output;
+        for (; produced < due; produced++)
+            output += OutputLine((int)produced);
+        if (!output.isEmpty())
+            buffer.appendOutput(output);
+    });
+    heartbeat.setTimerType(Qt::PreciseTimer);
+    heartbeat.setInterval(HEARTBEAT_MS);
+    connect(&heartbeat, &QTimer::timeout, [&]() {
+        qint64 now = clock.elapsed();
+        maxStall = qMax(maxStall, now - lastBeat);
+        lastBeat = now;
+    });
+
+    QEventLoop loop;
+    QTimer::singleShot(FLOOD_SECONDS * 1000, &loop, &QEventLoop::quit);
+    clock.start();
+    producer.start();
+    heartbeat.start();
+    loop.exec();
+    producer.stop();
+    heartbeat.stop();
+    buffer.flush();
+
+    qDebug("%lld lines in %lld ms; longest event loop stall %lld ms",
+           (long long)produced, (long long)clock.elapsed(), (long long)maxStall);
+    QVERIFY2(maxStall <= MAX_STALL_MS, qPrintable(QString("The event loop stalled for %1 ms").arg(maxStall)));
+    QVERIFY2(produced >= (qint64)FLOOD_LINES_PER_SECOND * FLOOD_SECONDS * 9 / 10,
+             qPrintable(QString("Only %1 lines were fed").arg(produced)));
+    QVERIFY(console.document()->blockCount() <= CONSOLE_BLOCKS);
+    QCOMPARE(console.document()->lastBlock().text(),
+             QString::fromLatin1(OutputLine((int)produced - 1)).trimmed());
+}
+
+void ConsoleBufferTest::keepsLatestLines()
+{
+    QPlainTextEdit console;
+    ConsoleBuffer buffer(&console);
+    const int maxPending = ConsoleBuffer::MAX_PENDING_LINES;
+    const int lines = 3 * maxPending;
+
+    for (int i = 0; i < lines; i++)
+        buffer.append(QString("line %1").arg(i));
+    buffer.flush();
+
+    QCOMPARE(console.document()->blockCount(), maxPending + 1);
+    QCOMPARE(console.document()->firstBlock().text(), QString("... %1 lines skipped ...").arg(lines - maxPending));
+    QCOMPARE(console.document()->firstBlock().next().text(), QString("line %1").arg(lines - maxPending));
+    QCOMPARE(console.document()->lastBlock().text(), QString("line %1").arg(lines - 1));
+}
+
+QTEST_MAIN(ConsoleBufferTest)
+#include "consolebuffer_test.moc"
@@ -0,0 +1,142 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#include "controlchannel.h"
+#include <cstring>
+
+const int RETRY_MS = 250;
+
+
+/**
+ * Constructor for ControlChannel
+ * @param parent - The parent object.
+ */
+ControlChannel::ControlChannel(QObject *parent) :
+    QObject(parent),
+    nextSequence(1)
+{
+    this->socket = new QLocalSocket(this);
+    connect(this->socket, &QLocalSocket::readyRead, this, &ControlChannel::readMessages);
+    connect(this->socket, &QLocalSocket::connected, this, &ControlChannel::connected);
+    this->retryTimer = new QTimer(this);
+    this->retryTimer->setInterval(RETRY_MS);
+    connect(this->retryTimer, &QTimer::timeout, this, &ControlChannel::tryConnect);
+    connect(this->socket, &QLocalSocket::connected, this->retryTimer, &QTimer::stop);
+}
+
+ControlChannel::~ControlChannel()
+{
+}
+
+/**
+ * Starts connecting to the pipe served by a streamer started with --ipc=<name>.
+ * @param name - Pipe name.
+ */
+void ControlChannel::open(const QString &name)
+{
+    this->close();
+    this->name = name;
+    this->retryTimer->start();
+}
+
+/**
+ * Disconnects and forgets any command still waiting for its acknowledgement.
+ */
+void ControlChannel::close()
+{
+    this->retryTimer->stop();
+    this->socket->abort();
+    this->buffer.clear();
+    this->pending.clear();
+}
+
+bool ControlChannel::isConnected() const
+{
+    return this->socket->state() == QLocalSocket::ConnectedState;
+}
+
+/**
+ * Called by the retry timer until the streamer's pipe accepts the connection.
+ */
+void ControlChannel::tryConnect()
+{
+    if (this->isConnected()) {
+        this->retryTimer->stop();
+        return;
+    }
+    if (this->socket->state() == QLocalSocket::UnconnectedState)
+        this->socket->connectToServer(this->name);
+}
+
+/**
+ * Sends a command. The acknowledgement is reported by commandAcknowledged.
+ * @param command - IPC_CMD_* command code.
+ * @return false if the channel is not connected.
+ */
+bool ControlChannel::sendCommand(quint32 command)
+{
+    if (!this->isConnected())
+        return false;
+
+    IpcHeader header;
+    IpcCommand payload;
+    header.magic = IPC_MAGIC;
+    header.type = IPC_MSG_COMMAND;
+    header.sequence = this->nextSequence++;
+    header.length = sizeof(payload);
+    payload.command = command;
+
+    QByteArray message(sizeof(header) + sizeof(payload), Qt::Uninitialized);
+    std::memcpy(message.data(), &header, sizeof(header));
+    std::memcpy(message.data() + sizeof(header), &payload, sizeof(payload));
+    this->pending[header.sequence].start();
+    this->socket->write(message);
+    this->socket->flush();
+    return true;
+}
+
+/**
+ * Parses all complete messages received so far.
+ */
+void ControlChannel::readMessages()
+{
+    this->buffer += this->socket->readAll();
+    int offset = 0;
+    while (this->buffer.size() - offset >= (int)sizeof(IpcHeader)) {
+        IpcHeader header;
+        std::memcpy(&header, this->buffer.constData() + offset, sizeof(header));
+        if (header.magic != IPC_MAGIC) {
+            /* Not our protocol; drop the connection rather than guess */
+            this->close();
+            return;
+        }
+        if (this->buffer.size() - offset < (int)(sizeof(header) + header.length))
+            break;
+        const char *payload = this->buffer.constData() + offset + sizeof(header);
+
+        if (header.type == IPC_MSG_ACK && header.length >= sizeof(IpcAck)) {
+            IpcAck ack;
+            std::memcpy(&ack, payload, sizeof(ack));
+            double roundTripMs = -1;
+            auto sent = this->pending.find(header.sequence);
+            if (sent != this->pending.end()) {
+                roundTripMs = sent->nsecsElapsed() / 1e6;
+                this->pending.erase(sent);
+            }
+            emit commandAcknowledged(ack.command, ack.status, roundTripMs);
+        } else if (header.type == IPC_MSG_TELEMETRY && header.length >= sizeof(IpcTelemetry)) {
+            IpcTelemetry telemetry;
+            std::memcpy(&telemetry, payload, sizeof(telemetry));
+            const quint32 available = (header.length - sizeof(telemetry)) / sizeof(float);
+            QVector<float> impedances(qMin(telemetry.numberOfImpedances, available));
+            std::memcpy(impedances.data(), payload + sizeof(telemetry), impedances.size() * sizeof(float));
+            emit telemetryReceived(telemetry, impedances);
+        }
+        offset += sizeof(header) + header.length;
+    }
+    this->buffer.remove(0, offset);
+}
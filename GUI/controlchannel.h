@@ -0,0 +1,62 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#ifndef CONTROLCHANNEL_H
+#define CONTROLCHANNEL_H
+
+#include <QObject>
+#include <QLocalSocket>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTimer>
+#include <QVector>
+#include "ipc_protocol.h"
+
+/*
+ * Client side of the binary control and telemetry channel served by dsi2lsl
+ * (--ipc=<name>, see ipc_protocol.h).
+ *
+ * Keeps trying to connect until the streamer has created its pipe, then sends
+ * commands and reports acknowledgements (with their round-trip time) and
+ * telemetry as they arrive.
+ */
+class ControlChannel : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ControlChannel(QObject *parent = 0);
+    ~ControlChannel();
+
+    /* Connects to the named pipe, retrying until it exists */
+    void open(const QString &name);
+    /* Disconnects and stops retrying */
+    void close();
+    bool isConnected() const;
+
+    /* Sends an IPC_CMD_* command; returns false if not connected */
+    bool sendCommand(quint32 command);
+
+signals:
+    void connected();
+    void commandAcknowledged(quint32 command, qint32 status, double roundTripMs);
+    void telemetryReceived(const IpcTelemetry &telemetry, const QVector<float> &impedances);
+
+private slots:
+    void tryConnect();
+    void readMessages();
+
+private:
+    QLocalSocket *socket;
+    QTimer *retryTimer;
+    QString name;
+    QByteArray buffer;
+    quint32 nextSequence;
+    QHash<quint32, QElapsedTimer> pending;   /* Sent commands by sequence number */
+};
+
+#endif /* CONTROLCHANNEL_H */
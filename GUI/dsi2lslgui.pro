@@ -6,16 +6,64 @@
 
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets network
+
+# The DSI API that libdsi2lsl loads at run time, and liblsl. Set the liblsl
+# paths here or on the command line: qmake LSL_INC=... LSL_LIB=...
+DSI_API = ../DSI_API_v1.18.2_04102023
+isEmpty(LSL_INC): LSL_INC = YOUR_PATH_TO_LIBLSL_INCLUDE
+isEmpty(LSL_LIB): LSL_LIB = YOUR_PATH_TO_LIBLSL_LIB
+
+INCLUDEPATH += ../CLI $$DSI_API $$LSL_INC
 
 TARGET = dsi2lslgui
 TEMPLATE = app
 
 
 SOURCES += main.cpp\
-        mainwindow.cpp
+        mainwindow.cpp\
+        consolebuffer.cpp\
+        signalview.cpp\
+        impedanceview.cpp\
+        controlchannel.cpp\
+        inprocessstreamer.cpp\
+        ../CLI/libdsi2lsl.c\
+        ../CLI/replay.c\
+        ../CLI/eegcodec.c\
+        ../CLI/quality.c\
+        ../CLI/epochs.c\
+        ../CLI/asr.c\
+        ../CLI/pacer.c\
+        ../CLI/alloccheck.c\
+        ../CLI/trace.c\
+        ../CLI/metrics.c\
+        ../CLI/portsearch.c\
+        ../CLI/samplekernels.cpp\
+        $$DSI_API/DSI_API_Loader.c
 
-HEADERS  += mainwindow.h
+HEADERS  += mainwindow.h\
+        consolebuffer.h\
+        signalview.h\
+        impedanceview.h\
+        controlchannel.h\
+        inprocessstreamer.h\
+        ../CLI/libdsi2lsl.h\
+        ../CLI/replay.h\
+        ../CLI/eegcodec.h\
+        ../CLI/quality.h\
+        ../CLI/epochs.h\
+        ../CLI/asr.h\
+        ../CLI/pacer.h\
+        ../CLI/alloccheck.h\
+        ../CLI/trace.h\
+        ../CLI/metrics.h\
+        ../CLI/portsearch.h\
+        ../CLI/samplekernels.h\
+        ../CLI/ipc_protocol.h\
+        $$DSI_API/DSI.h
 
 FORMS    += mainwindow.ui
 
+LIBS += -L$$LSL_LIB -llsl
+win32: LIBS += -lpsapi -lws2_32
+
@@ -0,0 +1,213 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#include "impedanceview.h"
+#include "../CLI/quality.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <lsl_cpp.h>
+#include <algorithm>
+#include <cmath>
+
+const int POLL_HZ = 4;
+const int CELL_WIDTH = 80;
+const int CELL_HEIGHT = 40;
+
+/* Color thresholds in megaohms */
+const float IMPEDANCE_GOOD = 1.0f;
+const float IMPEDANCE_FAIR = 10.0f;
+
+/* Color thresholds for the quality index */
+const float QUALITY_GOOD = 0.8f;
+const float QUALITY_FAIR = 0.5f;
+
+
+/**
+ * Constructor for ImpedanceView
+ * @param parent - The parent widget.
+ * @param kind - Whether to show impedances or signal quality.
+ */
+ImpedanceView::ImpedanceView(QWidget *parent, Kind kind) :
+    QWidget(parent),
+    kind(kind),
+    valuesPerElectrode(kind == Quality ? QUALITY_METRICS : 1),
+    labelsKnown(false)
+{
+    if (kind == Quality)
+        this->setToolTip(QString("Signal quality over the last second: green from %1%, yellow from %2%, red below. "
+                                 "High amplitude, mains noise, flatlines and clipping lower it.")
+                         .arg(QUALITY_GOOD * 100).arg(QUALITY_FAIR * 100));
+    else
+        this->setToolTip(QString("Electrode impedance in megaohms: green below %1, yellow below %2, red above.")
+                         .arg(IMPEDANCE_GOOD).arg(IMPEDANCE_FAIR));
+    this->timer = new QTimer(this);
+    this->timer->setInterval(1000 / POLL_HZ);
+    connect(this->timer, &QTimer::timeout, this, &ImpedanceView::poll);
+}
+
+ImpedanceView::~ImpedanceView()
+{
+}
+
+/**
+ * Starts looking for "<streamName>-Impedance" (or "-Quality"); values are shown as soon as it appears.
+ * @param streamName - Name of the EEG stream.
+ */
+void ImpedanceView::setStream(const QString &streamName)
+{
+    this->stop();
+    this->resolver.reset(new lsl::continuous_resolver("name", (streamName + (this->kind == Quality ? "-Quality" : "-Impedance")).toStdString()));
+    this->timer->start();
+}
+
+/**
+ * Stops polling; the last values stay on screen.
+ */
+void ImpedanceView::stop()
+{
+    this->timer->stop();
+    this->inlet.reset();
+    this->resolver.reset();
+}
+
+/**
+ * Defines the electrodes and clears all values.
+ * @param labels - One label per electrode.
+ */
+void ImpedanceView::setElectrodes(const QStringList &labels)
+{
+    this->labels = labels;
+    this->shown.assign(labels.size(), -1);
+    this->updateGeometry();
+    this->update();
+}
+
+/**
+ * Updates the shown values, repainting only the cells that changed.
+ * @param values - Impedances in megaohms, or quality indices from 0 to 1.
+ * @param count - Number of values.
+ */
+void ImpedanceView::setValues(const float *values, int count)
+{
+    const float scale = this->kind == Quality ? 100.0f : 10.0f;
+    count = std::min(count, (int)this->shown.size());
+    for (int i = 0; i < count; i++) {
+        int steps = std::isfinite(values[i]) ? (int)std::lround(std::max(0.0f, values[i]) * scale) : -1;
+        if (steps != this->shown[i]) {
+            this->shown[i] = steps;
+            this->update(this->cellRect(i));
+        }
+    }
+}
+
+int ImpedanceView::columns() const
+{
+    return std::max(1, this->width() / CELL_WIDTH);
+}
+
+QRect ImpedanceView::cellRect(int index) const
+{
+    const int cols = this->columns();
+    const int width = this->width() / cols;
+    return QRect((index % cols) * width, (index / cols) * CELL_HEIGHT, width, CELL_HEIGHT);
+}
+
+QSize ImpedanceView::sizeHint() const
+{
+    const int cols = this->columns();
+    const int rows = std::max(1, (this->labels.size() + cols - 1) / cols);
+    return QSize(cols * CELL_WIDTH, rows * CELL_HEIGHT);
+}
+
+/**
+ * Pulls the latest impedance or quality sample. Called by the poll timer.
+ */
+void ImpedanceView::poll()
+{
+    try {
+        if (!this->inlet) {
+            std::vector<lsl::stream_info> results = this->resolver->results();
+            if (results.empty())
+                return;
+            const lsl::stream_info *newest = &results[0];
+            for (const lsl::stream_info &info : results)
+                if (info.created_at() > newest->created_at())
+                    newest = &info;
+            this->inlet.reset(new lsl::stream_inlet(*newest, 1));
+            this->labelsKnown = false;
+            QStringList names;
+            for (int c = 0; c < newest->channel_count() / this->valuesPerElectrode; c++)
+                names << QString::number(c + 1);
+            this->setElectrodes(names);
+            this->pullBuffer.resize((size_t)newest->channel_count() * POLL_HZ * 4);
+        }
+
+        /* Only the most recent sample matters; quality samples start with the indices */
+        const std::size_t C = this->shown.size(), stride = C * this->valuesPerElectrode;
+        std::size_t elements, latest = 0;
+        while ((elements = this->inlet->pull_chunk_multiplexed(this->pullBuffer.data(), (double *)0,
+                                                                this->pullBuffer.size(), 0, 0.0)) > 0)
+            latest = elements;
+        if (latest < stride || C == 0)
+            return;
+
+        if (!this->labelsKnown) {
+            QStringList names;
+            lsl::xml_element channel = this->inlet->info(0.5).desc().child("channels").child("channel");
+            for (std::size_t c = 0; c < C && !channel.empty(); c++, channel = channel.next_sibling())
+                names << QString::fromUtf8(channel.child_value("label"));
+            if ((std::size_t)names.size() == C)
+                this->setElectrodes(names);
+            this->labelsKnown = true;
+        }
+        this->setValues(this->pullBuffer.data() + latest - stride, (int)C);
+    } catch (std::exception &) {
+        /* Stream lost or description not available yet; try again on the next tick */
+    }
+}
+
+/**
+ * Paints the cells that intersect the update region.
+ */
+void ImpedanceView::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(this);
+    painter.fillRect(event->rect(), this->palette().window());
+    for (int i = 0; i < this->labels.size(); i++) {
+        const QRect cell = this->cellRect(i);
+        if (!cell.intersects(event->rect()))
+            continue;
+
+        const int steps = this->shown[i];
+        QColor color;
+        QString text;
+        if (this->kind == Quality) {
+            const float value = steps / 100.0f;
+            color = steps < 0 ? QColor(Qt::lightGray)
+                  : value >= QUALITY_GOOD ? QColor(120, 200, 120)
+                  : value >= QUALITY_FAIR ? QColor(240, 210, 90)
+                  : QColor(230, 110, 100);
+            text = steps < 0 ? QString("--") : QString("%1%").arg(steps);
+        } else {
+            const float value = steps / 10.0f;
+            color = steps < 0 ? QColor(Qt::lightGray)
+                  : value < IMPEDANCE_GOOD ? QColor(120, 200, 120)
+                  : value < IMPEDANCE_FAIR ? QColor(240, 210, 90)
+                  : QColor(230, 110, 100);
+            text = steps < 0 ? QString("--") : QString::number(value, 'f', 1);
+        }
+        painter.fillRect(cell.adjusted(1, 1, -1, -1), color);
+        painter.setPen(Qt::black);
+        painter.drawText(cell, Qt::AlignCenter, this->labels[i] + "\n" + text);
+    }
+}
+
+void ImpedanceView::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    this->updateGeometry();
+}
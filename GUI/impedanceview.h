@@ -0,0 +1,76 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#ifndef IMPEDANCEVIEW_H
+#define IMPEDANCEVIEW_H
+
+#include <QWidget>
+#include <QTimer>
+#include <QStringList>
+#include <memory>
+#include <vector>
+
+namespace lsl {
+class continuous_resolver;
+class stream_inlet;
+}
+
+/*
+ * Per-electrode impedance or signal quality panel.
+ *
+ * Shows one colored cell per electrode, fed by the "<stream>-Impedance" outlet
+ * that dsi2lsl publishes while the impedance driver is on, or by the quality
+ * indices of the "<stream>-Quality" outlet (--quality-outlet). Values are
+ * polled a few times per second and only cells whose shown value or color
+ * changed are repainted.
+ */
+class ImpedanceView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    enum Kind { Impedance, Quality };
+
+    explicit ImpedanceView(QWidget *parent = 0, Kind kind = Impedance);
+    ~ImpedanceView();
+
+    /* Resolves the impedance (or quality) stream belonging to the named EEG stream */
+    void setStream(const QString &streamName);
+    /* Stops polling and releases the inlet */
+    void stop();
+
+    /* Defines the electrodes; all cells show "no data" until values arrive */
+    void setElectrodes(const QStringList &labels);
+    /* Updates the shown impedances (megaohms) or quality indices (0 to 1), one value per electrode */
+    void setValues(const float *values, int count);
+
+    QSize sizeHint() const;
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+
+private slots:
+    void poll();
+
+private:
+    QRect cellRect(int index) const;
+    int columns() const;
+
+    const Kind kind;
+    int valuesPerElectrode;    /* Channels of the stream per electrode; only the first block is shown */
+    std::unique_ptr<lsl::continuous_resolver> resolver;
+    std::unique_ptr<lsl::stream_inlet> inlet;
+    std::vector<float> pullBuffer;
+    bool labelsKnown;
+    QTimer *timer;
+
+    QStringList labels;
+    std::vector<int> shown;    /* Shown value in tenths of a megaohm or percent quality, or -1 for no data */
+};
+
+#endif /* IMPEDANCEVIEW_H */
@@ -0,0 +1,170 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#include "inprocessstreamer.h"
+#include <cstring>
+
+const int PULL_HZ = 60;
+const double PULL_BUFFER_SECONDS = 2.0;   /* Older samples are dropped if the GUI stalls */
+
+
+/**
+ * Constructor for InProcessStreamer
+ * @param parent - The parent object.
+ */
+InProcessStreamer::InProcessStreamer(QObject *parent) :
+    QObject(parent),
+    session(NULL),
+    openThread(NULL),
+    starting(false)
+{
+    memset(&this->previousTelemetry, 0, sizeof(this->previousTelemetry));
+    this->pullTimer = new QTimer(this);
+    this->pullTimer->setInterval(1000 / PULL_HZ);
+    connect(this->pullTimer, &QTimer::timeout, this, &InProcessStreamer::pull);
+}
+
+InProcessStreamer::~InProcessStreamer()
+{
+    this->stop();
+    DSI2LSL_SetMessageCallback(NULL, NULL);
+}
+
+/**
+ * Library messages arrive on whichever thread produced them; the signal is
+ * queued to the GUI thread by Qt.
+ */
+void InProcessStreamer::onMessage(const char *message, int, void *userData)
+{
+    QString text = QString::fromLocal8Bit(message);
+    for (const QString &line : text.split('\n', QString::SkipEmptyParts))
+        emit static_cast<InProcessStreamer *>(userData)->message(line);
+}
+
+/**
+ * Opens a session on a worker thread.
+ * @param port - Serial port, or empty for the DSISerialPort environment variable.
+ * @param streamName - LSL stream name.
+ * @param montage - Channel list, or empty for the default.
+ * @param reference - Reference, or empty for the default.
+ */
+void InProcessStreamer::start(const QString &port, const QString &streamName, const QString &montage, const QString &reference)
+{
+    this->stop();
+    DSI2LSL_SetMessageCallback(&InProcessStreamer::onMessage, this);
+    this->starting = true;
+
+    const QByteArray portBytes = port.toLocal8Bit(), nameBytes = streamName.toLocal8Bit();
+    const QByteArray montageBytes = montage.toLocal8Bit(), referenceBytes = reference.toLocal8Bit();
+    this->openThread = QThread::create([this, portBytes, nameBytes, montageBytes, referenceBytes]() {
+        DSI2LSL_Config config;
+        DSI2LSL_DefaultConfig(&config);
+        config.port = portBytes.constData();
+        config.streamName = nameBytes.constData();
+        config.montage = montageBytes.isEmpty() ? NULL : montageBytes.constData();
+        config.reference = referenceBytes.isEmpty() ? NULL : referenceBytes.constData();
+        config.pullBufferSeconds = PULL_BUFFER_SECONDS;
+        config.qualityOutlet = 1;
+        DSI2LSL_Session *opened = NULL;
+        if (DSI2LSL_Open(&config, &opened) == 0 && DSI2LSL_Start(opened) != 0) {
+            DSI2LSL_Close(opened);
+            opened = NULL;
+        }
+        this->session = opened;
+    });
+    connect(this->openThread, &QThread::finished, this, &InProcessStreamer::onOpened);
+    this->openThread->start();
+}
+
+/**
+ * Called on the GUI thread once the worker has tried to open the session.
+ */
+void InProcessStreamer::onOpened()
+{
+    if (this->openThread) {
+        this->openThread->deleteLater();
+        this->openThread = NULL;
+    }
+    this->starting = false;
+    if (this->session) {
+        this->pullBuffer.resize((size_t)this->channelCount() * (size_t)(this->samplingRate() / PULL_HZ + 64));
+        this->pullTimer->start();
+    }
+    emit opened(this->session != NULL);
+}
+
+/**
+ * Closes the session. Waits for a session that is still connecting. The last
+ * samples, flushed when acquisition ends, are still handed out.
+ */
+void InProcessStreamer::stop()
+{
+    if (this->openThread) {
+        this->openThread->wait();
+        this->onOpened();
+    }
+    this->pullTimer->stop();
+    if (this->session) {
+        DSI2LSL_Shutdown(this->session);
+        this->pull();
+        DSI2LSL_Close(this->session);
+        this->session = NULL;
+    }
+}
+
+bool InProcessStreamer::isRunning() const
+{
+    return this->starting || (this->session && DSI2LSL_IsRunning(this->session));
+}
+
+int InProcessStreamer::sendCommand(quint32 command)
+{
+    return this->session ? DSI2LSL_Command(this->session, command) : IPC_STATUS_FAILED;
+}
+
+bool InProcessStreamer::telemetry(IpcTelemetry &telemetry, QVector<float> &impedances)
+{
+    if (!this->session)
+        return false;
+    float values[IPC_MAX_IMPEDANCES];
+    uint32_t count = DSI2LSL_GetTelemetry(this->session, &this->previousTelemetry, &telemetry, values, IPC_MAX_IMPEDANCES);
+    this->previousTelemetry = telemetry;
+    impedances = QVector<float>(values, values + count);
+    return true;
+}
+
+int InProcessStreamer::channelCount() const
+{
+    return this->session ? (int)DSI2LSL_GetNumberOfChannels(this->session) : 0;
+}
+
+double InProcessStreamer::samplingRate() const
+{
+    return this->session ? DSI2LSL_GetSamplingRate(this->session) : 0.0;
+}
+
+QStringList InProcessStreamer::channelLabels() const
+{
+    QStringList labels;
+    for (int c = 0; c < this->channelCount(); c++)
+        labels << QString::fromUtf8(DSI2LSL_GetChannelLabel(this->session, (unsigned int)c));
+    return labels;
+}
+
+/**
+ * Hands everything buffered since the last call to samplesAvailable.
+ * Called by the pull timer.
+ */
+void InProcessStreamer::pull()
+{
+    const int C = this->channelCount();
+    if (C == 0)
+        return;
+    size_t pulled;
+    while ((pulled = DSI2LSL_Pull(this->session, this->pullBuffer.data(), NULL, this->pullBuffer.size() / C)) > 0)
+        emit samplesAvailable(this->pullBuffer.data(), (int)pulled);
+}
@@ -0,0 +1,73 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#ifndef INPROCESSSTREAMER_H
+#define INPROCESSSTREAMER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QThread>
+#include <QVector>
+#include <vector>
+#include "libdsi2lsl.h"
+
+/*
+ * Hosts a libdsi2lsl acquisition session inside the GUI process, as an
+ * alternative to running dsi2lsl as a subprocess.
+ *
+ * Connecting and disconnecting block for seconds, so they run on a worker
+ * thread. While the session runs, samples are pulled from its shared buffer on
+ * a timer and handed out through samplesAvailable, without going through LSL.
+ */
+class InProcessStreamer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit InProcessStreamer(QObject *parent = 0);
+    ~InProcessStreamer();
+
+    /* Connects with the given options (see DSI2LSL_Config); reports the outcome via opened */
+    void start(const QString &port, const QString &streamName, const QString &montage, const QString &reference);
+    /* Stops the session, if any; returns once it is closed */
+    void stop();
+
+    /* True from start until the session stops or fails to open */
+    bool isRunning() const;
+    /* IPC_CMD_* command; returns an IPC_STATUS_* code */
+    int sendCommand(quint32 command);
+    /* Telemetry as sent over the dsi2lsl --ipc channel; false if no session is open */
+    bool telemetry(IpcTelemetry &telemetry, QVector<float> &impedances);
+
+    int channelCount() const;
+    double samplingRate() const;
+    QStringList channelLabels() const;
+
+signals:
+    void opened(bool ok);
+    void message(const QString &line);
+    /* Channel-interleaved samples; only valid during the call */
+    void samplesAvailable(const float *samples, int numberOfSamples);
+
+private slots:
+    void onOpened();
+    void pull();
+
+private:
+    static void onMessage(const char *message, int isError, void *userData);
+
+    DSI2LSL_Session *session;
+    QThread *openThread;
+    bool starting;
+    QTimer *pullTimer;
+    std::vector<float> pullBuffer;
+    IpcTelemetry previousTelemetry;   /* Last telemetry, for the sample rate */
+};
+
+#endif /* INPROCESSSTREAMER_H */
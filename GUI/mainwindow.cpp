@@ -13,6 +13,7 @@
 #include <QCheckBox>
 #include <QByteArray>
 #include <iostream>
+#include <algorithm>
 
 #ifndef WIN32
 #include <unistd.h>
@@ -33,8 +34,18 @@ const QString port = "--port=";
 const QString lslStream = "--lsl-stream-name=";
 const QString montage = "--montage=";
 const QString reference = "--reference=";
+const QString ipc = "--ipc=";
+const QString qualityOutlet = "--quality-outlet";
 const QString defaultValule = "(use default)";
 
+/*
+ * On Stop the streamer is asked to exit (IPC_CMD_SHUTDOWN, or "quit" before
+ * the control channel connects) so that it flushes its last samples; it is
+ * only killed if it has not exited after SHUTDOWN_WAIT_MS. The UI does not
+ * wait for it, except when the window closes.
+ */
+const int SHUTDOWN_WAIT_MS = 5000;
+
 
 /**
  * Constructor for MainWindow
@@ -46,7 +57,9 @@ MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
     counter(0),
-    zCheckState(false)
+    zCheckState(false),
+    inProcessMode(false),
+    standingBy(false)
 {
     ui->setupUi(this);
 
@@ -66,8 +79,36 @@ MainWindow::MainWindow(QWidget *parent) :
     this->progressBar = new QProgressBar(this);
     ui->statusBar->addPermanentWidget(this->progressBar, 1);
     this->progressBar->setTextVisible(false);
-    this->streamer = new QProcess(this);
-    this->streamer->setProcessChannelMode(QProcess::MergedChannels);
+    /* Live view of the stream published by the streamer */
+    this->signalView = new SignalView(this);
+    ui->gridLayout->addWidget(this->signalView, 6, 1, 1, 2);
+    ui->gridLayout->setRowStretch(6, 1);
+    /* Electrode impedances, shown while streaming with impedance checking on */
+    this->impedanceView = new ImpedanceView(this);
+    ui->gridLayout->addWidget(this->impedanceView, 7, 1, 1, 2);
+    this->impedanceView->setVisible(false);
+    /* Per-channel signal quality, shown in the same place while impedance checking is off */
+    this->qualityView = new ImpedanceView(this, ImpedanceView::Quality);
+    ui->gridLayout->addWidget(this->qualityView, 7, 1, 1, 2);
+    this->qualityView->setVisible(false);
+    /* Commands and status go over a binary channel once the streamer is up */
+    this->control = new ControlChannel(this);
+    connect(this->control, &ControlChannel::commandAcknowledged, this, &MainWindow::onCommandAcknowledged);
+    connect(this->control, &ControlChannel::telemetryReceived, this, &MainWindow::onTelemetryReceived);
+    /* Optionally run the acquisition inside the GUI process */
+    this->inProcess = new InProcessStreamer(this);
+    connect(this->inProcess, &InProcessStreamer::message, this, &MainWindow::appendToConsole);
+    connect(this->inProcess, &InProcessStreamer::opened, this, &MainWindow::onInProcessOpened);
+    connect(this->inProcess, &InProcessStreamer::samplesAvailable, this->signalView, &SignalView::appendSamples);
+    this->inProcessCheckBox = new QCheckBox("Run acquisition in the GUI process", this);
+    this->inProcessCheckBox->setToolTip("Acquire without starting dsi2lsl; the plot reads samples directly instead of through LSL.");
+    ui->gridLayout->addWidget(this->inProcessCheckBox, 9, 1, 1, 2);
+    this->keepConnectedCheckBox = new QCheckBox("Keep headset connected between runs", this);
+    this->keepConnectedCheckBox->setToolTip("Stop ends the block without disconnecting, so the next Start streams within a fraction of a second.");
+    ui->gridLayout->addWidget(this->keepConnectedCheckBox, 10, 1, 1, 2);
+    this->createStreamer();
+    /* Batch console updates so that verbose output cannot saturate the UI thread */
+    this->console = new ConsoleBuffer(ui->console, this);
     /* Connecting Impedance button */
     connect(ui->ZCheckBox, &QCheckBox::toggled, this, &MainWindow::onZCheckBoxToggled);
     connect(ui->ResetZButton, &QPushButton::clicked, this, &MainWindow::onResetZButtonClicked);
@@ -81,10 +122,50 @@ MainWindow::MainWindow(QWidget *parent) :
  */
 MainWindow::~MainWindow()
 {
-    this->on_buttonBox_rejected();
+    this->stopStreaming(false, true);
+    /* Streamers stopped earlier get the rest of their time to exit */
+    const QList<QProcess *> exiting = this->exitingStreamers;
+    for (QProcess *process : exiting)
+        if (!process->waitForFinished(SHUTDOWN_WAIT_MS))
+            process->kill();
     delete ui;
 }
 
+/**
+ * Creates the process that runs dsi2lsl; its output goes to the console.
+ * @return void
+ */
+void MainWindow::createStreamer()
+{
+    this->streamer = new QProcess(this);
+    this->streamer->setProcessChannelMode(QProcess::MergedChannels);
+    connect(this->streamer, SIGNAL(readyReadStandardOutput()), this, SLOT(writeToConsole()));
+}
+
+/**
+ * Lets the streamer, already asked to exit, finish in the background: its
+ * output still reaches the console, it is killed if it has not exited after
+ * SHUTDOWN_WAIT_MS, and a new process takes its place for the next Start.
+ * @return void
+ */
+void MainWindow::releaseStreamer()
+{
+    QProcess *exiting = this->streamer;
+    this->exitingStreamers.append(exiting);
+    connect(exiting, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, exiting]() {
+        this->exitingStreamers.removeOne(exiting);
+        exiting->deleteLater();
+    });
+    QTimer::singleShot(SHUTDOWN_WAIT_MS, exiting, [this, exiting]() {
+        if (exiting->state() != QProcess::NotRunning) {
+            this->appendToConsole("Streamer did not exit in time; stopping it.");
+            exiting->kill();
+        }
+    });
+    this->createStreamer();
+}
+
 /**
  * This function is called when the user clicks the "Z" button.
  * It toggles the state of the Z button and sends a command to the streamer process
@@ -97,16 +178,39 @@ void MainWindow::onZCheckBoxToggled(bool checked){
     this->zCheckState = checked;
 }
 void MainWindow::handleZCheckBoxToggled(){
-    QByteArray command;
         if(this->zCheckState){
-            command = "checkZOn\n";
-            this->ui->console->append("\n---------- Impedance Driver On -----------\n");
+            this->sendCommand(IPC_CMD_CHECK_Z_ON, "checkZOn\n");
+            this->appendToConsole("\n---------- Impedance Driver On -----------\n");
         }else{
-            command = "checkZOff\n";
-            this->ui->console->append("\n---------- Impedance Driver Off ----------\n");
+            this->sendCommand(IPC_CMD_CHECK_Z_OFF, "checkZOff\n");
+            this->appendToConsole("\n---------- Impedance Driver Off ----------\n");
         }
-        // Write the command to the process's standard input
-        this->streamer->write(command);
+}
+
+/**
+ * Sends a command to the streamer over the control channel, or writes the
+ * equivalent console command to its standard input while the channel is not
+ * connected yet.
+ * @param command - IPC_CMD_* command code.
+ * @param consoleCommand - The same command as text, including the newline.
+ * @return void
+ */
+void MainWindow::sendCommand(quint32 command, const QByteArray &consoleCommand){
+    if (this->inProcessMode) {
+        if (this->inProcess->sendCommand(command) != IPC_STATUS_OK)
+            this->appendToConsole(QString("Command %1 failed.").arg(command));
+    } else if (!this->control->sendCommand(command)) {
+        this->streamer->write(consoleCommand);
+    }
+}
+
+/**
+ * @return true while the streamer subprocess or the in-process session runs.
+ */
+bool MainWindow::isStreaming() const{
+    if (this->inProcessMode)
+        return this->inProcess->isRunning();
+    return this->streamer && this->streamer->state() == QProcess::Running;
 }
 
 /**
@@ -115,18 +219,13 @@ void MainWindow::handleZCheckBoxToggled(){
  * @return void
  */
 void MainWindow::onResetZButtonClicked(){
-    if (this->streamer && this->streamer->state() == QProcess::Running) {
-        /* The command to send, including the newline character to simulate 'Enter'. */
-        QByteArray command;
-
-        command = "resetZ\n";
-
-        /* Write the command to the process's standard input. */
-        this->streamer->write(command);
-        this->ui->console->append("---------- Reset ----------\n");
+    if (this->isStreaming()) {
+        /* The console command includes the newline character to simulate 'Enter'. */
+        this->sendCommand(IPC_CMD_RESET_Z, "resetZ\n");
+        this->appendToConsole("---------- Reset ----------\n");
 
     } else {
-        this->ui->console->append("Streamer is not running. Cannot send command.");
+        this->appendToConsole("Streamer is not running. Cannot send command.");
     }
 }
 
@@ -135,22 +234,78 @@ void MainWindow::onResetZButtonClicked(){
  * It checks if the streamer is already running, and if so, it stops it.
  * Then it sets up the input arguments for the streamer and starts it.
  * It also connects the output of the streamer to a slot that writes to the console.
+ * If the headset was kept connected after the last Stop and the settings are
+ * unchanged, only a new block is started on the running streamer.
  * 
  * @return void
  */
 void MainWindow::on_buttonBox_accepted()
 {
-    if (this->streamer && this->streamer->state() == QProcess::Running) {
-        this->on_buttonBox_rejected();
+    QStringList settings = this->parseArguments();
+    if (this->inProcessCheckBox->isChecked())
+        settings << "in-process";
+    const bool warmStart = this->standingBy && this->isStreaming() && settings == this->connectedSettings;
+    if (warmStart) {
+        /* Warm start: the headset is still connected, only the block starts */
+        this->sendCommand(IPC_CMD_START_STREAMING, "start\n");
+        if (this->inProcessMode)
+            this->onInProcessOpened(true);
+        else {
+            this->signalView->setStream(this->ui->nameLineEdit->text().simplified());
+            handleZCheckBoxToggled(); /* Handle the Z checkbox state */
+        }
+    } else if (this->isStreaming()) {
+        this->stopStreaming(false);
     }
-    /* Set input arguments to the streamer */
-    QStringList arguments = this->parseArguments();
-    this->streamer->start(program, arguments);
-    connect(this->streamer, SIGNAL(readyReadStandardOutput()), this, SLOT(writeToConsole()));
-    handleZCheckBoxToggled(); /* Handle the Z checkbox state */
+    this->connectedSettings = settings;
+    this->inProcessMode = this->inProcessCheckBox->isChecked();
+    this->standingBy = false;
+    if (warmStart) {
+        /* Streamer already up */
+    } else if (this->inProcessMode) {
+        /* The session reports back through onInProcessOpened once connected */
+        QString montageText = this->ui->montageLineEdit->text().simplified();
+        QString referenceText = this->ui->referenceLineEdit->text().simplified();
+        this->inProcess->start(this->ui->portLineEdit->text().simplified(),
+                               this->ui->nameLineEdit->text().simplified(),
+                               montageText.compare(defaultValule) ? montageText : QString(),
+                               referenceText.compare(defaultValule) ? referenceText : QString());
+    } else {
+        /* Set input arguments to the streamer */
+        QStringList arguments = this->parseArguments();
+        const QString pipeName = QString("dsi2lsl-%1").arg(QCoreApplication::applicationPid());
+        arguments << ipc + pipeName;
+        this->streamer->start(program, arguments);
+        this->control->open(pipeName);
+        this->signalView->setStream(this->ui->nameLineEdit->text().simplified());
+        handleZCheckBoxToggled(); /* Handle the Z checkbox state */
+    }
+    this->impedanceView->setVisible(this->zCheckState);
+    this->qualityView->setVisible(!this->zCheckState);
+    if (this->zCheckState)
+        this->impedanceView->setStream(this->ui->nameLineEdit->text().simplified());
+    else
+        this->qualityView->setStream(this->ui->nameLineEdit->text().simplified());
     this->counter = 0;
     this->timerId = this->startTimer(1000);
     this->ui->ZCheckBox->setEnabled(false); /* Enable the ZCheckBox */
+    this->inProcessCheckBox->setEnabled(false);
+}
+
+/**
+ * Called once the in-process session has connected, or failed to.
+ * @param ok - true if the session is running.
+ * @return void
+ */
+void MainWindow::onInProcessOpened(bool ok)
+{
+    if (!ok) {
+        this->appendToConsole("Could not start acquisition.");
+        return;
+    }
+    this->signalView->setExternalSource(this->inProcess->channelCount(), this->inProcess->samplingRate(),
+                                        this->inProcess->channelLabels());
+    handleZCheckBoxToggled(); /* Handle the Z checkbox state */
 }
 
 /** 
@@ -162,9 +317,9 @@ void MainWindow::on_buttonBox_accepted()
  */
 void MainWindow::timerEvent(QTimerEvent *event)
 {
-    if(this->streamer->state()==QProcess::NotRunning)
+    if(!this->isStreaming())
     {
-        this->on_buttonBox_rejected();
+        this->stopStreaming(false);
         return;
     }
     if(!this->ui->statusBar->isVisible())
@@ -173,39 +328,130 @@ void MainWindow::timerEvent(QTimerEvent *event)
     if(this->counter > 100)
         this->counter = 0;
     this->progressBar->setValue(this->counter);
-    this->ui->statusBar->showMessage("Streaming...");
+    IpcTelemetry telemetry;
+    QVector<float> impedances;
+    if (this->inProcessMode && this->inProcess->telemetry(telemetry, impedances))
+        this->onTelemetryReceived(telemetry, impedances);
+    else if (!this->control->isConnected())
+        this->ui->statusBar->showMessage("Streaming...");
+}
+
+/**
+ * Logs the streamer's answer to a command sent over the control channel.
+ * @param command - IPC_CMD_* command code.
+ * @param status - IPC_STATUS_* result.
+ * @param roundTripMs - Time from sending the command to receiving the answer.
+ * @return void
+ */
+void MainWindow::onCommandAcknowledged(quint32 command, qint32 status, double roundTripMs)
+{
+    if (status != IPC_STATUS_OK)
+        this->appendToConsole(QString("Command %1 failed (status %2).").arg(command).arg(status));
+    else
+        this->appendToConsole(QString("Command %1 acknowledged in %2 ms.").arg(command).arg(roundTripMs, 0, 'f', 3));
+}
+
+/**
+ * Shows the streamer's periodic status in the status bar.
+ * @param telemetry - Rates and counters reported by the streamer.
+ * @param impedances - Latest impedances while the impedance driver is on.
+ * @return void
+ */
+void MainWindow::onTelemetryReceived(const IpcTelemetry &telemetry, const QVector<float> &impedances)
+{
+    if (!telemetry.streaming) {
+        this->ui->statusBar->showMessage("Connected, standing by");
+        return;
+    }
+    QString message = QString("Streaming: %1 Hz, %2 samples, %3 lost, latency %4 ms")
+            .arg(telemetry.sampleRate, 0, 'f', 1)
+            .arg(telemetry.samples)
+            .arg(telemetry.samplesLost)
+            .arg(telemetry.latency * 1000, 0, 'f', 1);
+    if (telemetry.privateMemory)
+        message += QString(", %1 MB").arg(telemetry.privateMemory / (1024.0 * 1024.0), 0, 'f', 1);
+    if (telemetry.impedanceOn && !impedances.isEmpty())
+        message += QString(", max impedance %1 MOhm").arg(*std::max_element(impedances.begin(), impedances.end()), 0, 'f', 1);
+    this->ui->statusBar->showMessage(message);
 }
 
 /** 
- * This function reads the output from the streamer process and appends it to the console.
+ * This function reads the output from the streamer process and queues it for the console.
  * It is called whenever there is new data available from the streamer.
  * @return void
  */
 void MainWindow::writeToConsole()
 {
-    while(this->streamer->canReadLine()){
-        QString line = this->streamer->readLine(); /* Read the line into a string */
-        if (!line.contains("netinterfaces.cpp") && !line.contains("udp_server.cpp") && !line.contains("common.cpp") && !line.contains("api_config.cpp")) { /* Check if the line contains "netinterfaces.cpp" */
-            this->ui->console->append(line); /* If it doesn't, add it to the console */
-        }
-    }
+    QProcess *process = qobject_cast<QProcess *>(this->sender());
+    if (process)
+        this->console->appendOutput(process->readAll());
+}
+
+/**
+ * Queues text for the console (see ConsoleBuffer).
+ * @param text - The text to show; may contain several lines.
+ * @return void
+ */
+void MainWindow::appendToConsole(const QString &text)
+{
+    this->console->append(text);
 }
 
 
 /** 
  * This function is called when the user clicks the "Stop" button.
- * It stops the streamer process and resets the UI elements.
+ * It stops the streamer, or only the current block if the headset is kept connected.
  * @return void
  */
 void MainWindow::on_buttonBox_rejected()
 {
+    this->stopStreaming(this->keepConnectedCheckBox->isChecked() && this->isStreaming());
+}
+
+/**
+ * Stops streaming and resets the UI elements.
+ * @param keepConnected - Only end the block; the streamer stays up with the
+ *                        headset connected until the next Start.
+ * @param waitForExit - Block until the streamer has exited (or is killed);
+ *                      otherwise it exits in the background.
+ * @return void
+ */
+void MainWindow::stopStreaming(bool keepConnected, bool waitForExit)
+{
+    if (keepConnected) {
+        if (!this->standingBy) {
+            this->sendCommand(IPC_CMD_STOP_STREAMING, "stop\n");
+            this->appendToConsole("---------- Stopped, headset stays connected ----------\n");
+        }
+        this->standingBy = true;
+    } else {
+        this->standingBy = false;
+    }
     if(this->streamer != NULL){
-        this->streamer->close();
-        this->ui->console->append("Streamer will exit now. Good bye!");
+        if (!keepConnected) {
+            if (this->streamer->state() == QProcess::Running) {
+                if (!this->control->sendCommand(IPC_CMD_SHUTDOWN))
+                    this->streamer->write("quit\n");
+                /* The end of input also ends its console loop */
+                this->streamer->closeWriteChannel();
+                if (!waitForExit)
+                    this->releaseStreamer();
+                else if (!this->streamer->waitForFinished(SHUTDOWN_WAIT_MS))
+                    this->appendToConsole("Streamer did not exit in time; stopping it.");
+            }
+            this->control->close();
+            this->streamer->close();
+            this->inProcess->stop();
+            this->appendToConsole("Streamer will exit now. Good bye!");
+        }
+        this->signalView->stop();
+        this->impedanceView->stop();
+        this->qualityView->stop();
         this->killTimer(this->timerId);
         this->counter = 0;
         this->ui->statusBar->setVisible(false);
         this->ui->ZCheckBox->setEnabled(true); /* Enable the ZCheckBox */
+        this->inProcessCheckBox->setEnabled(true);
     }
 
 }
@@ -228,5 +474,7 @@ QStringList MainWindow::parseArguments()
     if(ui->referenceLineEdit->text().simplified().compare(defaultValule))
         arguments << (reference+this->ui->referenceLineEdit->text().simplified()).toStdString().c_str();
 
+    arguments << qualityOutlet;
+
     return arguments;
 }
\ No newline at end of file
@@ -15,6 +15,12 @@
 #include <QCheckBox>
 #include <QProgressBar>
 #include <QProcess>
+#include <QStringList>
+#include "signalview.h"
+#include "impedanceview.h"
+#include "controlchannel.h"
+#include "inprocessstreamer.h"
+#include "consolebuffer.h"
 
 
 namespace Ui {
@@ -44,12 +50,44 @@ private slots:
     /* For resetting impedance */
     void onResetZButtonClicked();
 
+    /* Control channel to the streamer */
+    void onCommandAcknowledged(quint32 command, qint32 status, double roundTripMs);
+    void onTelemetryReceived(const IpcTelemetry &telemetry, const QVector<float> &impedances);
+
+    /* In-process acquisition */
+    void onInProcessOpened(bool ok);
+
 private:
+    void appendToConsole(const QString &text);
+    void sendCommand(quint32 command, const QByteArray &consoleCommand);
+    bool isStreaming() const;
+    void stopStreaming(bool keepConnected, bool waitForExit = false);
+    void createStreamer();
+    void releaseStreamer();
+
     Ui::MainWindow *ui;
     QProcess *streamer;
+    QList<QProcess *> exitingStreamers; /* Stopped streamers that have not exited yet */
+
+    /* Console lines are queued here and appended in batches */
+    ConsoleBuffer *console;
     int timerId;
     int counter;
     QProgressBar *progressBar;
+    SignalView *signalView;
+    ImpedanceView *impedanceView;
+    ImpedanceView *qualityView;
+    ControlChannel *control;
+
+    /* Acquisition hosted in the GUI process instead of the dsi2lsl subprocess */
+    InProcessStreamer *inProcess;
+    QCheckBox *inProcessCheckBox;
+    bool inProcessMode;
+
+    /* Warm standby: Stop ends the block but leaves the headset connected */
+    QCheckBox *keepConnectedCheckBox;
+    bool standingBy;
+    QStringList connectedSettings; /* Settings of the connected session; Start reconnects if they change */
 
     /* For checking impedance */
     QCheckBox *ZCheckBox;
@@ -0,0 +1,294 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#include "signalview.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QWheelEvent>
+#include <lsl_cpp.h>
+#include <algorithm>
+
+const int REFRESH_HZ = 60;
+const double DEFAULT_WINDOW_SECONDS = 10.0;
+const float DEFAULT_RANGE_UV = 100.0f;
+const int INLET_BUFFER_SECONDS = 2;     /* Older data is dropped if the GUI stalls */
+const float OFFSET_TIME_CONSTANT = 1.0f; /* Seconds; removes electrode DC offsets from the plot */
+
+
+/**
+ * Constructor for SignalView
+ * @param parent - The parent widget.
+ */
+SignalView::SignalView(QWidget *parent) :
+    QWidget(parent),
+    labelsKnown(false),
+    channelCount(0),
+    samplingRate(0),
+    windowSeconds(DEFAULT_WINDOW_SECONDS),
+    range(DEFAULT_RANGE_UV),
+    columnCount(0),
+    head(0),
+    samplesPerColumn(1),
+    columnFill(0),
+    dirty(false)
+{
+    this->setAttribute(Qt::WA_OpaquePaintEvent);
+    this->setMinimumHeight(200);
+    this->setToolTip("Live signal. Scroll to change the vertical scale.");
+    this->timer = new QTimer(this);
+    this->timer->setInterval(1000 / REFRESH_HZ);
+    connect(this->timer, &QTimer::timeout, this, &SignalView::poll);
+}
+
+SignalView::~SignalView()
+{
+}
+
+/**
+ * Starts looking for the named stream; it is plotted as soon as it appears.
+ * @param streamName - Name of the LSL stream to plot.
+ */
+void SignalView::setStream(const QString &streamName)
+{
+    this->stop();
+    this->resolver.reset(new lsl::continuous_resolver("name", streamName.toStdString()));
+    this->timer->start();
+}
+
+/**
+ * Starts plotting samples handed to appendSamples, e.g. by an in-process
+ * acquisition session; the refresh timer only repaints.
+ * @param channelCount - Number of channels per sample.
+ * @param samplingRate - Nominal sampling rate in Hz.
+ * @param labels - Channel labels; may be empty.
+ */
+void SignalView::setExternalSource(int channelCount, double samplingRate, const QStringList &labels)
+{
+    this->stop();
+    this->setChannelLayout(channelCount, samplingRate, labels);
+    this->labelsKnown = true;
+    this->timer->start();
+}
+
+/**
+ * Stops plotting and releases the inlet; the last data stays on screen.
+ */
+void SignalView::stop()
+{
+    this->timer->stop();
+    this->inlet.reset();
+    this->resolver.reset();
+}
+
+/**
+ * Defines the plotted channels and clears the plot.
+ * @param channelCount - Number of channels per sample.
+ * @param samplingRate - Nominal sampling rate in Hz.
+ * @param labels - Channel labels; may be empty.
+ */
+void SignalView::setChannelLayout(int channelCount, double samplingRate, const QStringList &labels)
+{
+    this->channelCount = channelCount;
+    this->samplingRate = samplingRate > 0 ? samplingRate : 300;
+    this->labels = labels;
+    this->lastValue.assign(channelCount, 0.0f);
+    this->offset.assign(channelCount, 0.0f);
+    this->resetColumns();
+}
+
+/**
+ * Sizes the column cache for the current width and clears it.
+ * Each pixel column covers at least one sample.
+ */
+void SignalView::resetColumns()
+{
+    double windowSamples = this->samplingRate * this->windowSeconds;
+    this->columnCount = std::max(1, std::min(this->width(), (int)windowSamples));
+    this->samplesPerColumn = windowSamples / this->columnCount;
+    this->head = 0;
+    this->columnFill = 0;
+    size_t cells = (size_t)this->columnCount * this->channelCount;
+    this->columnMin.assign(cells, 0.0f);
+    this->columnMax.assign(cells, 0.0f);
+    this->currentMin.assign(this->channelCount, 0.0f);
+    this->currentMax.assign(this->channelCount, 0.0f);
+    this->vertices.resize((int)cells);
+    this->rebuildVertices();
+}
+
+/**
+ * Appends samples to the plot. Each sample widens the min/max range of the
+ * current column; when a column is complete its lines are written to the
+ * vertex buffer in place.
+ * @param samples - numberOfSamples * channelCount channel-interleaved values.
+ * @param numberOfSamples - Number of samples.
+ */
+void SignalView::appendSamples(const float *samples, int numberOfSamples)
+{
+    const int C = this->channelCount;
+    const float alpha = 1.0f / (float)(OFFSET_TIME_CONSTANT * this->samplingRate);
+    if (C == 0 || this->columnCount == 0)
+        return;
+
+    for (int s = 0; s < numberOfSamples; s++, samples += C) {
+        bool newColumn = this->columnFill == 0;
+        for (int c = 0; c < C; c++) {
+            this->offset[c] += alpha * (samples[c] - this->offset[c]);
+            float v = samples[c] - this->offset[c];
+            /* Start each column at the previous value so consecutive columns connect */
+            if (newColumn) {
+                this->currentMin[c] = std::min(this->lastValue[c], v);
+                this->currentMax[c] = std::max(this->lastValue[c], v);
+            } else {
+                this->currentMin[c] = std::min(this->currentMin[c], v);
+                this->currentMax[c] = std::max(this->currentMax[c], v);
+            }
+            this->lastValue[c] = v;
+        }
+        this->columnFill += 1;
+        if (this->columnFill >= this->samplesPerColumn) {
+            std::copy(this->currentMin.begin(), this->currentMin.end(), this->columnMin.begin() + (size_t)this->head * C);
+            std::copy(this->currentMax.begin(), this->currentMax.end(), this->columnMax.begin() + (size_t)this->head * C);
+            this->updateColumnVertices(this->head);
+            this->head = (this->head + 1) % this->columnCount;
+            this->columnFill -= this->samplesPerColumn;
+            if (this->columnFill < 1)
+                this->columnFill = 0;
+            this->dirty = true;
+        }
+    }
+}
+
+/**
+ * Writes the lines of one column into the vertex buffer. Lines are stored at
+ * x = column index; paintEvent shifts the two halves of the ring into place.
+ * @param column - The column to update.
+ */
+void SignalView::updateColumnVertices(int column)
+{
+    const int C = this->channelCount;
+    const float band = (float)this->height() / C;
+    const float scale = band / 2 / this->range;
+    const qreal x = column + 0.5;
+    for (int c = 0; c < C; c++) {
+        const size_t i = (size_t)column * C + c;
+        const float baseline = band * (c + 0.5f);
+        const float top = std::max(baseline - this->columnMax[i] * scale, baseline - band);
+        const float bottom = std::min(baseline - this->columnMin[i] * scale, baseline + band);
+        /* Make flat columns at least one pixel tall so they remain visible */
+        this->vertices[(int)i] = QLineF(x, top, x, std::max(bottom, top + 1.0f));
+    }
+}
+
+/**
+ * Recomputes every line, e.g. after a resize or a scale change.
+ */
+void SignalView::rebuildVertices()
+{
+    for (int column = 0; column < this->columnCount && this->channelCount > 0; column++)
+        this->updateColumnVertices(column);
+    this->update();
+}
+
+/**
+ * Pulls everything available from the inlet, if any. Called by the refresh
+ * timer; repaints only if a column was completed.
+ */
+void SignalView::poll()
+{
+    if (this->resolver) try {
+        if (!this->inlet) {
+            std::vector<lsl::stream_info> results = this->resolver->results();
+            if (results.empty())
+                return;
+            /* Prefer the newest stream in case an old one is still being forgotten */
+            const lsl::stream_info *newest = &results[0];
+            for (const lsl::stream_info &info : results)
+                if (info.created_at() > newest->created_at())
+                    newest = &info;
+            this->inlet.reset(new lsl::stream_inlet(*newest, INLET_BUFFER_SECONDS));
+            this->labelsKnown = false;
+            this->setChannelLayout(newest->channel_count(), newest->nominal_srate(), QStringList());
+            this->pullBuffer.resize((size_t)this->channelCount * (size_t)std::max(1.0, this->samplingRate));
+        }
+
+        std::size_t elements;
+        while ((elements = this->inlet->pull_chunk_multiplexed(this->pullBuffer.data(), (double *)0,
+                                                                this->pullBuffer.size(), 0, 0.0)) > 0) {
+            this->appendSamples(this->pullBuffer.data(), (int)(elements / this->channelCount));
+            if (!this->labelsKnown) {
+                /* The connection is up now, so the full stream description arrives quickly */
+                QStringList names;
+                lsl::xml_element channel = this->inlet->info(0.5).desc().child("channels").child("channel");
+                for (int c = 0; c < this->channelCount && !channel.empty(); c++, channel = channel.next_sibling())
+                    names << QString::fromUtf8(channel.child_value("label"));
+                this->labels = names;
+                this->labelsKnown = true;
+            }
+        }
+    } catch (std::exception &) {
+        /* Stream lost or description not available yet; try again on the next tick */
+    }
+
+    if (this->dirty) {
+        this->dirty = false;
+        this->update();
+    }
+}
+
+/**
+ * Draws the channel lines, oldest column at the left.
+ */
+void SignalView::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(this->rect(), Qt::white);
+    if (this->channelCount == 0 || this->vertices.isEmpty()) {
+        painter.drawText(this->rect(), Qt::AlignCenter, "No signal");
+        return;
+    }
+
+    const int C = this->channelCount;
+    const qreal xScale = (qreal)this->width() / this->columnCount;
+    painter.setPen(QPen(Qt::darkBlue, 0));
+
+    painter.save();
+    painter.scale(xScale, 1);
+    painter.translate(-this->head, 0);
+    painter.drawLines(this->vertices.constData() + (size_t)this->head * C, (this->columnCount - this->head) * C);
+    painter.restore();
+
+    painter.save();
+    painter.scale(xScale, 1);
+    painter.translate(this->columnCount - this->head, 0);
+    painter.drawLines(this->vertices.constData(), this->head * C);
+    painter.restore();
+
+    painter.setPen(Qt::black);
+    const qreal band = (qreal)this->height() / C;
+    for (int c = 0; c < this->labels.size() && c < C; c++)
+        painter.drawText(QPointF(4, band * (c + 0.5) + 4), this->labels[c]);
+    painter.drawText(this->rect().adjusted(0, 0, -4, -2), Qt::AlignRight | Qt::AlignBottom,
+                     QString("%1 uV / %2 s").arg(this->range).arg(this->windowSeconds));
+}
+
+void SignalView::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    if (this->channelCount > 0)
+        this->resetColumns();
+}
+
+/**
+ * Mouse wheel zooms the vertical scale.
+ */
+void SignalView::wheelEvent(QWheelEvent *event)
+{
+    this->range *= event->angleDelta().y() > 0 ? 0.8f : 1.25f;
+    this->range = std::max(1.0f, std::min(this->range, 100000.0f));
+    this->rebuildVertices();
+}
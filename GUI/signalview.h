@@ -0,0 +1,90 @@
+/*
+ * Wearable Sensing LSL GUI
+ *
+ * Please create a GitHub Issue or contact support@wearablesensing.com if you
+ * encounter any issues or would like to request new features.
+ */
+
+#ifndef SIGNALVIEW_H
+#define SIGNALVIEW_H
+
+#include <QWidget>
+#include <QTimer>
+#include <QVector>
+#include <QLineF>
+#include <QStringList>
+#include <memory>
+#include <vector>
+
+namespace lsl {
+class continuous_resolver;
+class stream_inlet;
+}
+
+/*
+ * Scrolling multichannel EEG plot.
+ *
+ * Samples are reduced to one vertical min/max line per pixel column as they
+ * arrive. The lines are kept in a persistent, ring-ordered vertex buffer, so a
+ * repaint only rewrites the columns completed since the last frame and draws
+ * the buffer in two calls, independent of the sampling rate.
+ */
+class SignalView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit SignalView(QWidget *parent = 0);
+    ~SignalView();
+
+    /* Resolves the named LSL stream and starts plotting it */
+    void setStream(const QString &streamName);
+    /* Plots samples passed to appendSamples instead of an LSL stream */
+    void setExternalSource(int channelCount, double samplingRate, const QStringList &labels);
+    /* Stops plotting and releases the inlet */
+    void stop();
+
+    /* Defines the plotted channels; clears the plot */
+    void setChannelLayout(int channelCount, double samplingRate, const QStringList &labels);
+    /* Appends channel-interleaved samples, e.g. from an in-process source */
+    void appendSamples(const float *samples, int numberOfSamples);
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+    void wheelEvent(QWheelEvent *event);
+
+private slots:
+    void poll();
+
+private:
+    void resetColumns();
+    void updateColumnVertices(int column);
+    void rebuildVertices();
+
+    std::unique_ptr<lsl::continuous_resolver> resolver;
+    std::unique_ptr<lsl::stream_inlet> inlet;
+    std::vector<float> pullBuffer;
+    bool labelsKnown;
+    QTimer *timer;
+
+    int channelCount;
+    double samplingRate;
+    QStringList labels;
+    double windowSeconds;      /* Time span shown across the plot */
+    float range;               /* Microvolts from a channel's baseline to the edge of its band */
+
+    /* Column cache, column-major: entry [column * channelCount + channel] */
+    int columnCount;
+    int head;                  /* Next column to complete; also the oldest column on screen */
+    double samplesPerColumn;
+    double columnFill;         /* Samples accumulated in the current column */
+    std::vector<float> columnMin, columnMax;
+    std::vector<float> currentMin, currentMax, lastValue, offset;
+    bool dirty;
+
+    /* One line per column and channel, same layout as the column cache */
+    QVector<QLineF> vertices;
+};
+
+#endif /* SIGNALVIEW_H */
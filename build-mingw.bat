@@ -21,13 +21,38 @@ set QT_BIN="YOUR_PATH_TO_QT5_MINGW64_BIN"
 :: Add Qt bin to PATH for tools
 set PATH=%QT_BIN%;%PATH%
 
+:: Build libdsi2lsl (acquisition core shared by dsi2lsl and the GUI)
+echo Building libdsi2lsl...
+if not exist %OUT%\obj mkdir %OUT%\obj
+gcc -c CLI\libdsi2lsl.c -I DSI_API_v1.18.2_04102023 -I %LSL_INC% -o %OUT%\obj\libdsi2lsl.o && ^
+gcc -c CLI\replay.c -o %OUT%\obj\replay.o && ^
+gcc -c CLI\eegcodec.c -o %OUT%\obj\eegcodec.o && ^
+gcc -c CLI\quality.c -o %OUT%\obj\quality.o && ^
+gcc -c CLI\epochs.c -o %OUT%\obj\epochs.o && ^
+gcc -c CLI\asr.c -o %OUT%\obj\asr.o && ^
+gcc -c CLI\pacer.c -I %LSL_INC% -o %OUT%\obj\pacer.o && ^
+gcc -c CLI\alloccheck.c -o %OUT%\obj\alloccheck.o && ^
+gcc -c CLI\trace.c -o %OUT%\obj\trace.o && ^
+gcc -c CLI\metrics.c -o %OUT%\obj\metrics.o && ^
+gcc -c CLI\portsearch.c -o %OUT%\obj\portsearch.o && ^
+g++ -c CLI\samplekernels.cpp -O2 -fno-exceptions -fno-rtti -o %OUT%\obj\samplekernels.o && ^
+gcc -c DSI_API_v1.18.2_04102023\DSI_API_Loader.c -I DSI_API_v1.18.2_04102023 -o %OUT%\obj\DSI_API_Loader.o && ^
+ar rcs %OUT%\libdsi2lsl.a %OUT%\obj\libdsi2lsl.o %OUT%\obj\replay.o %OUT%\obj\eegcodec.o %OUT%\obj\quality.o %OUT%\obj\epochs.o %OUT%\obj\asr.o %OUT%\obj\pacer.o %OUT%\obj\alloccheck.o %OUT%\obj\trace.o %OUT%\obj\metrics.o %OUT%\obj\portsearch.o %OUT%\obj\samplekernels.o %OUT%\obj\DSI_API_Loader.o
+
+if %ERRORLEVEL% neq 0 (
+    echo Failed to build libdsi2lsl!
+    pause
+    exit /b 1
+)
+
 :: Build dsi2lsl (console app)
 echo Building dsi2lsl...
 gcc CLI\dsi2lsl.c ^
-    DSI_API_v1.18.2_04102023\DSI_API_Loader.c ^
-    -I DSI_API_v1.18.2_04102023 ^
+    CLI\ipc.c ^
     -I %LSL_INC% ^
+    -L %OUT% -ldsi2lsl ^
     -L %LSL_LIB% -llsl ^
+    -lpsapi -lws2_32 ^
     -o %OUT%\dsi2lsl.exe
 
 if %ERRORLEVEL% neq 0 (
@@ -53,7 +78,37 @@ if %ERRORLEVEL% neq 0 (
 :: Generate Qt MOC files
 echo Generating Qt MOC files...
 moc.exe GUI\mainwindow.h -o %OUT%\moc\moc_mainwindow.cpp
+if %ERRORLEVEL% neq 0 (
+    echo MOC failed! Check if Qt tools are in PATH.
+    pause
+    exit /b 1
+)
+moc.exe GUI\signalview.h -o %OUT%\moc\moc_signalview.cpp
+if %ERRORLEVEL% neq 0 (
+    echo MOC failed! Check if Qt tools are in PATH.
+    pause
+    exit /b 1
+)
+moc.exe GUI\impedanceview.h -o %OUT%\moc\moc_impedanceview.cpp
+if %ERRORLEVEL% neq 0 (
+    echo MOC failed! Check if Qt tools are in PATH.
+    pause
+    exit /b 1
+)
+moc.exe GUI\controlchannel.h -o %OUT%\moc\moc_controlchannel.cpp
+if %ERRORLEVEL% neq 0 (
+    echo MOC failed! Check if Qt tools are in PATH.
+    pause
+    exit /b 1
+)
+moc.exe GUI\inprocessstreamer.h -o %OUT%\moc\moc_inprocessstreamer.cpp
 
+if %ERRORLEVEL% neq 0 (
+    echo MOC failed! Check if Qt tools are in PATH.
+    pause
+    exit /b 1
+)
+moc.exe GUI\consolebuffer.h -o %OUT%\moc\moc_consolebuffer.cpp
 if %ERRORLEVEL% neq 0 (
     echo MOC failed! Check if Qt tools are in PATH.
     pause
@@ -62,11 +117,16 @@ if %ERRORLEVEL% neq 0 (
 
 :: Build GUI app
 echo Building GUI...
-g++ GUI\main.cpp GUI\mainwindow.cpp %OUT%\moc\moc_mainwindow.cpp ^
-    -I GUI -I %OUT%\ui -I %LSL_INC% ^
-    -I %QT_INC% -I %QT_INC%\QtCore -I %QT_INC%\QtGui -I %QT_INC%\QtWidgets ^
+g++ GUI\main.cpp GUI\mainwindow.cpp GUI\signalview.cpp GUI\impedanceview.cpp GUI\controlchannel.cpp ^
+    GUI\inprocessstreamer.cpp GUI\consolebuffer.cpp ^
+    %OUT%\moc\moc_mainwindow.cpp %OUT%\moc\moc_signalview.cpp %OUT%\moc\moc_impedanceview.cpp ^
+    %OUT%\moc\moc_controlchannel.cpp %OUT%\moc\moc_inprocessstreamer.cpp %OUT%\moc\moc_consolebuffer.cpp ^
+    -I GUI -I CLI -I %OUT%\ui -I %LSL_INC% ^
+    -I %QT_INC% -I %QT_INC%\QtCore -I %QT_INC%\QtGui -I %QT_INC%\QtWidgets -I %QT_INC%\QtNetwork ^
+    -L %OUT% -ldsi2lsl ^
     -L %LSL_LIB% -llsl ^
-    -L %QT_LIB% -lQt5Core -lQt5Gui -lQt5Widgets ^
+    -L %QT_LIB% -lQt5Core -lQt5Gui -lQt5Widgets -lQt5Network ^
+    -lpsapi -lws2_32 ^
     -mwindows ^
     -o %OUT%\dsi2lslGUI.exe
 
@@ -87,6 +147,7 @@ echo Copying required DLLs...
 copy "%QT_BIN%\Qt5Core.dll" "%OUT%\" >nul
 copy "%QT_BIN%\Qt5Gui.dll" "%OUT%\" >nul
 copy "%QT_BIN%\Qt5Widgets.dll" "%OUT%\" >nul
+copy "%QT_BIN%\Qt5Network.dll" "%OUT%\" >nul
 copy "YOUR_PATH_TO_LIBLSL__BIN_LSL.DLL" "%OUT%\" >nul 
 copy "YOUR_PATH_TO_LIBDSI.DLL" "%OUT%\" >nul 
 